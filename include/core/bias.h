@@ -19,7 +19,21 @@ extern "C" {
 #include "deca_regs.h"
 #include "deca_device_api.h"
 
+/* Defines -------------------------------------------------------------------*/
+/* Points of a range bias table */
+#define BIAS_TABLE_MAX_POINTS (64)
+
 /* Typedef -------------------------------------------------------------------*/
+/* Range bias of one link against the first path power of the received frame,
+ * as points every fpp_step dB from fpp_start, interpolated linearly in
+ * between and held outside. One per radio profile, since the bias depends on
+ * the PRF. */
+typedef struct {
+    float fpp_start;                       // [dBm] First path power of bias_mm[0]
+    float fpp_step;                        // [dB] Spacing of the points, > 0
+    uint8_t num_points;                    // 0 for no correction
+    int16_t bias_mm[BIAS_TABLE_MAX_POINTS]; // [mm] Added to the true distance
+} BiasTable;
 
 /* Function Prototypes -------------------------------------------------------*/
 
@@ -33,16 +47,47 @@ extern "C" {
  * @param fpp (float*) A pointer to where the fpp will be stored.
  * 
  * NOTE: This function and the corresponding notation is primarily based on Section 4.7
- *       in the DW1000 User Manual.
+ *       in the DW1000 User Manual. The logarithm is taken with a table, see
+ *       fastDb() in bias.c, rather than with log10().
  * 
  * @return (int) 1.
  */
 int retrievePower(float*);
 int retrieveSkew(float*);
 
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: biasConfigure()
+ *
+ * @brief Replace the range bias table of a radio profile. Takes effect with
+ *        the next range computed.
+ *
+ * @param profile (uint8_t) RADIO_PROFILE_, see dwt_general.h.
+ * @param table (BiasTable*) The new table, with no points to stop correcting.
+ *
+ * @return (int) 1 if the table was accepted.
+ */
+int biasConfigure(uint8_t profile, const BiasTable *table);
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: biasCorrectRange()
+ *
+ * @brief Remove the range bias from a TWR distance, with the table of the
+ *        radio profile in use. Each reception adds the bias of its first path
+ *        power to its time-stamp, and half of it to the time of flight, so
+ *        the bias of the poll (fpp1, at the target) and of the response
+ *        (fpp2, at the initiator) are averaged.
+ *
+ * @param distance (float*) [m] The distance to correct, in place.
+ * @param fpp1 (float) [dBm] First path power of the poll.
+ * @param fpp2 (float) [dBm] First path power of the response.
+ *
+ * @return (bool) Whether a correction was applied, i.e. the profile has a table.
+ */
+bool biasCorrectRange(float *distance, float fpp1, float fpp2);
+
 
 #ifdef __cplusplus
 }
 #endif
 
-#endif /* __BIAS_H__ */
\ No newline at end of file
+#endif /* __BIAS_H__ */
@@ -1,6 +1,41 @@
+/**
+  ******************************************************************************
+  * @file    cir.h
+  * @brief   This file contains all the function prototypes for
+  *          the cir.c file
+  ******************************************************************************
+  */
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __CIR_H__
+#define __CIR_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
 #include "common.h"
 #include "deca_regs.h"
 #include "deca_device_api.h"
+#include <stdbool.h>
+
+/* Defines -------------------------------------------------------------------*/
+/* Taps of the longest accumulator, at 64 MHz PRF. The length in use is
+ * cir_taps of the radio profile. */
+#define NUM_CIR_POINTS (1016)
 
+/* Largest window around the first path with complex taps, so that the record
+ * fits in RECORD_CIR_MAX_IQ_TAPS (see records.h) */
+#define CIR_MAX_IQ_HALF_WINDOW (255)
+
+/* Function Prototypes -------------------------------------------------------*/
+int cirConfigure(uint16_t half_window, bool iq);
 int read_cir(uint8_t initiator_id, uint8_t target_id);
-void output_cir(uint8_t initiator_id, uint8_t target_id, uint16_t first_path_idx);
\ No newline at end of file
+bool cirOutputPending(void);
+void cirOutputStep(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CIR_H__ */
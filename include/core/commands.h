@@ -16,57 +16,149 @@ extern "C" {
 /* Includes ------------------------------------------------------------------*/
 #include <stdint.h>
 #include <stdbool.h>
-#include "uthash.h"
 #include "main.h"
+/* Defines -------------------------------------------------------------------*/
+#define COMMAND_MAX_STR_LEN   (200)  // Including the string terminator
+#define COMMAND_MAX_BYTES_LEN (1024)
+
 /* Typedefs -----------------------------------------------------------*/   
 
-// hash table implementation to store integer parameters
-typedef struct IntParams {
-    char key[10];      /* field used as the key */
-    int value;     /* field used to store integers */
-    UT_hash_handle hh; /* makes this structure hashable */
-} IntParams;
-
-// hash table implementation to store float parameters
-typedef struct FloatParams {
-    char key[10];      /* field used as the key */
-    float value;       /* field used to store integers */
-    UT_hash_handle hh; /* makes this structure hashable */
-} FloatParams;
-
-// hash table implementation to store boolean parameters
-typedef struct BoolParams {
-    char key[10];      /* field used as the key */
-    bool value;     /* field used to store booleans*/
-    UT_hash_handle hh; /* makes this structure hashable */
-} BoolParams;
-
-// hash table implementation to store string parameters
-typedef struct StrParams {
-    char key[10];      /* field used as the key */
-    char value[200];      /* field used to store string messages */
-    UT_hash_handle hh; /* makes this structure hashable */
-}StrParams;     
-
-// hash table implementation to store string parameters
-typedef struct ByteParams {
-    char key[10];      /* field used as the key */
-    uint8_t value[USB_BUFFER_SIZE];      /* pointer to first element of byte array */
-    uint16_t len;        /* length of the byte array */
-    UT_hash_handle hh; /* makes this structure hashable */
-}ByteParams; 
+/* Arbitrary bytes field. The length is sent along with the data. */
+typedef struct {
+    uint16_t len;                          /* length of the byte array */
+    uint8_t value[COMMAND_MAX_BYTES_LEN];  /* the byte array */
+} BytesField;
+
+/* Decoded fields of each command that has any. The field order of the USB
+message is given by the schemas in usb_interface.c, not by these structs. */
+typedef struct {
+    int test_int;
+    char test_str[COMMAND_MAX_STR_LEN];
+    bool test_bool;
+    float test_flt;
+    BytesField test_byte;
+} C03Params;
+
+typedef struct {
+    bool toggle;
+} C04Params;
+
+typedef struct {
+    int target;
+    bool targ_meas;
+    int ds_twr;
+    bool get_cir;
+} C05Params;
+
+typedef struct {
+    BytesField data;
+} C06Params;
+
+typedef struct {
+    int delay;
+} C08Params;
+
+typedef struct {
+    int mode;
+} C10Params;
+
+typedef struct {
+    BytesField targets;
+    bool targ_meas;
+} C11Params;
+
+typedef struct {
+    int slot_len;
+    BytesField slots;
+} C12Params;
+
+typedef struct {
+    int half_window;
+    bool iq;
+} C13Params;
+
+typedef struct {
+    int mode;
+} C14Params;
+
+typedef struct {
+    int mode;
+} C15Params;
+
+typedef struct {
+    int profile;
+} C16Params;
+
+typedef struct {
+    int report;
+} C17Params;
+
+typedef struct {
+    int reset;
+} C18Params;
+
+typedef struct {
+    int profile;
+    float fpp_start;
+    float fpp_step;
+    BytesField bias;
+} C19Params;
+
+typedef struct {
+    int profile;
+    int tx;
+    int rx;
+} C20Params;
+
+typedef struct {
+    int benchmark;
+} C21Params;
+
+/* Only one command is ever decoded at a time, so all of them share the same
+static storage. */
+typedef union {
+    C03Params c03;
+    C04Params c04;
+    C05Params c05;
+    C06Params c06;
+    C08Params c08;
+    C10Params c10;
+    C11Params c11;
+    C12Params c12;
+    C13Params c13;
+    C14Params c14;
+    C15Params c15;
+    C16Params c16;
+    C17Params c17;
+    C18Params c18;
+    C19Params c19;
+    C20Params c20;
+    C21Params c21;
+} CommandParams;
 
 /* Function Prototypes -------------------------------------------------------*/
-int c00_set_idle(IntParams*, FloatParams*, BoolParams*, StrParams*, ByteParams*);
-int c01_get_id(IntParams*, FloatParams*, BoolParams*, StrParams*, ByteParams*);
-int c02_reset(IntParams*, FloatParams*, BoolParams*, StrParams*, ByteParams*);
-int c03_do_tests(IntParams*, FloatParams*, BoolParams*, StrParams*, ByteParams*);
-int c04_toggle_passive(IntParams*, FloatParams*, BoolParams*, StrParams*, ByteParams*);
-int c05_initiate_twr(IntParams*, FloatParams*, BoolParams*, StrParams*, ByteParams*);
-int c06_broadcast(IntParams*, FloatParams*, BoolParams*, StrParams*, ByteParams*);
-int c07_get_max_frame_len(IntParams*, FloatParams*, BoolParams*, StrParams*, ByteParams*);
-int c08_set_response_delay(IntParams*, FloatParams*, BoolParams*, StrParams*, ByteParams*);
-int c09_jump_to_bootloader(IntParams*, FloatParams*, BoolParams*, StrParams*, ByteParams*);
+int c00_set_idle(const CommandParams*);
+int c01_get_id(const CommandParams*);
+int c02_reset(const CommandParams*);
+int c03_do_tests(const CommandParams*);
+int c04_toggle_passive(const CommandParams*);
+int c05_initiate_twr(const CommandParams*);
+int c06_broadcast(const CommandParams*);
+int c07_get_max_frame_len(const CommandParams*);
+int c08_set_response_delay(const CommandParams*);
+int c09_jump_to_bootloader(const CommandParams*);
+int c10_set_output_mode(const CommandParams*);
+int c11_initiate_burst(const CommandParams*);
+int c12_set_schedule(const CommandParams*);
+int c13_set_cir_window(const CommandParams*);
+int c14_set_passive_output(const CommandParams*);
+int c15_set_rx_buffering(const CommandParams*);
+int c16_set_radio_profile(const CommandParams*);
+int c17_get_trace(const CommandParams*);
+int c18_get_rtos_stats(const CommandParams*);
+int c19_set_bias_table(const CommandParams*);
+int c20_set_antenna_delay(const CommandParams*);
+int c21_run_benchmark(const CommandParams*);
 void jump_to_bootloader(void);
 
 
@@ -32,7 +32,7 @@ extern "C" {
 #endif
 
 int broadcast(uint8*, uint16_t);
-int dataReceiveCallback(uint8*);
+int dataReceiveCallback(uint8*, uint16_t);
 
 
 #endif /* __MESSAGING_H__ */
\ No newline at end of file
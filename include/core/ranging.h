@@ -28,28 +28,72 @@ extern "C" {
 #include "common.h"
 #include "dwt_general.h"
 #include "dwt_iqr.h"
+#include "tdma.h"
 
 /* Typedef -------------------------------------------------------------------*/
 typedef signed long long int64;
 typedef unsigned long long uint64;
 
+/* Counters of the RX path since startup. A frame is lost whenever the UWB
+ * task falls behind by more than the depth of its queue. */
+typedef struct {
+    uint32_t frames;         // Good frames handed over to the UWB task
+    uint32_t dropped;        // Good frames lost, no free message block
+    uint32_t events_dropped; // Other events lost, no free message block
+    uint32_t oversized;      // Frames longer than MAX_FRAME_LEN
+    uint32_t overruns;       // Receiver overruns reported by the DW1000
+    uint32_t buffer_frames[2]; // Good frames read from each RX buffer, double buffering only
+    uint32_t back_to_back;   // Frames already waiting in the other buffer as one was read
+} UwbRxStats;
+
 /* Function Prototypes -------------------------------------------------------*/
 void ranging_init(void);
 void uwbFrameHandler(void);
 int twrInitiateInstance(uint8_t, bool, uint8_t, bool);
-int twrReceiveCallback(void);
-int txTimestampsSS(uint64_t, uint64_t, float*, float*, bool);
-int txTimestampsDS(uint64_t, uint64_t, uint64_t, float*, float*, bool);
-int rxTimestampsSS(uint64_t, uint8_t, float*, float*, bool, bool);
-int rxTimestampsDS(uint64_t, uint64_t, uint8_t, float*, float*, bool, bool);
-int passivelyListenSS(uint32_t, bool, bool);
-int passivelyListenDS(uint32_t, bool, bool);
-bool checkReceivedFrame(uint8_t, uint8_t, uint8_t, uint8_t, uint8_t);
+int twrBurstInstance(const uint8_t*, uint8_t, bool);
+int twrScheduleInstance(const TdmaSlot*, const TdmaTiming*);
+void ensureRxEnabled(void);
+int txTimestampsSS(uint64, uint64, float, float, uint8_t, uint32);
+int txTimestampsDS(uint64, uint64, uint64, float, float, uint8_t);
 void setPassiveToggle(bool);
-void setResponseDelay(uint16);
+void setPassiveOutput(uint8_t);
+void setResponseDelay(uint32);
+void setRxBuffering(uint8_t);
+void setRadioProfile(uint8_t);
+void setAntennaDelay(uint8_t, uint16_t, uint16_t);
+void uwbRxStats(UwbRxStats *stats);
+osMailQId uwbMailQId(void);
+void uwbRxConfigUpdate(void);
 
 #define UUS_TO_DWT_TIME 65536
-#define MAX_FRAME_LEN 100
+#define MAX_FRAME_LEN 127 // Longest frame of the standard PHY, including the CRC
+#define BURST_MAX_TARGETS 6 // Limited by the length of the burst final message
+#define MAX_RESPONSE_DELAY_UUS 1000000 // Well within the 8.6 s a transmission can be delayed by
+
+/* IEEE 802.15.4 addressing of the UWB frames. All boards share one PAN, and
+ * the short address of a board is its ID, so the DW1000 can reject the frames
+ * addressed to other boards without waking the MCU. */
+#define UWB_PAN_ID (0xDECA)
+#define UWB_BROADCAST_ADDR (0xFFFF)
+
+/* Data frame header: frame control (data, PAN ID compression, short
+ * addresses), sequence number, PAN ID, destination and source addresses,
+ * then the message type of this firmware. The addresses are filled in later. */
+#define UWB_FRAME_HEADER(type) 0x41, 0x88, 0, (UWB_PAN_ID & 0xFF), (UWB_PAN_ID >> 8), 0, 0, 0, 0, (type)
+#define UWB_FRAME_HEADER_LEN (10)
+
+/* Ranging modes, the ds_twr parameter of an exchange */
+#define TWR_MODE_SS (0)           // Single-sided, 2 frames
+#define TWR_MODE_DS (1)           // Double-sided, 3 frames
+#define TWR_MODE_SS_CORRECTED (2) // Single-sided corrected for the clock offset, 2 frames
+
+/* Receive buffering, see setRxBuffering() */
+#define RX_BUFFER_SINGLE (0) // Receiver re-enabled by the UWB task after each frame
+#define RX_BUFFER_DOUBLE (1) // Double buffer, receiver re-enabled by the DW1000
+
+/* Output of the passive listeners */
+#define PASSIVE_OUTPUT_RAW  (0) // All the timestamps overheard, S01
+#define PASSIVE_OUTPUT_TDOA (1) // Pseudo-range computed on board, S14
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,44 @@
+/**
+  ******************************************************************************
+  * @file    ranging_math.h
+  * @brief   This file contains all the function prototypes for
+  *          the ranging_math.c file
+  ******************************************************************************
+  */
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __RANGING_MATH_H__
+#define __RANGING_MATH_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Defines -------------------------------------------------------------------*/
+/* Speed of light in air, in metres per second. */
+#define SPEED_OF_LIGHT 299702547
+
+/* The DW1000 time-stamps are 40 bits long, and wrap around every 17.2 s. */
+#define DWT_TS_MASK (0xFFFFFFFFFFULL)
+
+/* Times of flight are returned in DW1000 time units of 1/(128*499.2 MHz), as
+ * fixed point numbers with this many fractional bits. */
+#define TOF_FRAC_BITS (6)
+
+/* Function Prototypes -------------------------------------------------------*/
+uint64_t tsDiff(uint64_t later, uint64_t earlier);
+int32_t tofSS(uint64_t Ra, uint64_t Db);
+int32_t tofSSSkew(uint64_t Ra, uint64_t Db, float skew);
+int32_t tofDS(uint64_t Ra1, uint64_t Ra2, uint64_t Db1, uint64_t Db2);
+int32_t tofDSAsym(uint64_t Ra1, uint64_t Ra2, uint64_t Db1, uint64_t Db2);
+int32_t tdoaSS(uint64_t Rp, uint64_t Db, float skew);
+int32_t tdoaDS(uint64_t Rp1, uint64_t Rp2, uint64_t Db1, uint64_t Db2);
+float tofToDistance(int32_t tof);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RANGING_MATH_H__ */
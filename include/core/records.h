@@ -0,0 +1,198 @@
+/**
+  ******************************************************************************
+  * @file    records.h
+  * @brief   This file contains all the function prototypes for
+  *          the records.c file
+  ******************************************************************************
+  */
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __RECORDS_H__
+#define __RECORDS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Defines -------------------------------------------------------------------*/
+/* Binary frame layout, all fields little-endian:
+ *
+ *   | sync | version | type | seq | len (2) | payload (len) | crc (2) |
+ *
+ * The sync byte is outside of the ASCII range, so the host can tell binary
+ * frames apart from the ASCII command responses sharing the same stream.
+ * The CRC is CRC-16/CCITT-FALSE computed over version, type, seq, len and
+ * the payload. Version 2 widened the time-stamps to the full 40 bits of the
+ * DW1000 clock, and version 3 sends each of them as 5 bytes. */
+#define RECORD_SYNC_BYTE (0xA5)
+#define RECORD_VERSION (3)
+#define RECORD_HEADER_LEN (6)
+#define RECORD_CRC_LEN (2)
+
+/* Payload lengths of the range and passive records, with their time-stamps
+ * packed into RECORD_TS_LEN bytes each. A DS-TWR range frame is 60 bytes on
+ * the wire, and a passive one 96. */
+#define RECORD_TS_LEN (5)
+#define RECORD_RANGE_LEN (2 + 4 + 6*RECORD_TS_LEN + 4*4)
+#define RECORD_PASSIVE_LEN (3 + 9*RECORD_TS_LEN + 10*4)
+
+/* Record types. Numbered after their ASCII counterparts. */
+#define RECORD_TYPE_PASSIVE (0x01) // S01
+#define RECORD_TYPE_RANGE   (0x05) // R05 and S05
+#define RECORD_TYPE_CIR     (0x10) // S10
+#define RECORD_TYPE_BURST   (0x11) // R11
+#define RECORD_TYPE_CIR_WINDOW (0x13) // S13
+#define RECORD_TYPE_TDOA    (0x14) // S14
+#define RECORD_TYPE_RTOS    (0x18) // C18, sent in ASCII mode as well
+
+/* Record flags */
+#define RECORD_FLAG_INITIATOR  (0x01) // R05 if set, S05 otherwise
+#define RECORD_FLAG_DS_TWR     (0x02) // Double-sided exchange, third signal valid
+#define RECORD_FLAG_INCOMPLETE (0x04) // Exchange was only partially overheard
+#define RECORD_FLAG_SKEW_CORR  (0x08) // Single-sided exchange corrected for the clock offset
+#define RECORD_FLAG_HAS_RANGE  (0x10) // S14: the initiator's timestamps were overheard
+#define RECORD_FLAG_BIAS_CORR  (0x20) // Distance corrected for the range bias, see bias.c
+
+/* Ranges in an R11 record, at most BURST_MAX_TARGETS (see ranging.h) */
+#define RECORD_BURST_MAX_RANGES (6)
+
+/* CIR record flags */
+#define RECORD_CIR_FLAG_IQ (0x01) // Raw complex taps instead of magnitudes
+
+/* Complex taps in an S13 record, so that it fits in the USB transmit ring */
+#define RECORD_CIR_MAX_IQ_TAPS (512)
+
+/* Length of the task and queue names of an RTOS record. Names that long are
+ * not terminated. */
+#define RECORD_RTOS_NAME_LEN (12)
+
+/* Typedefs ------------------------------------------------------------------*/
+typedef enum {OUTPUT_ASCII=0, OUTPUT_BINARY=1} OutputMode;
+
+/* Result of a TWR exchange at one of the two ranging boards. Time-stamps are
+ * the 40-bit DW1000 time, here and in the passive records. The payload has
+ * the same fields in the same order, but only the low 5 bytes of each
+ * time-stamp, see outputRangeRecord(). */
+typedef struct __attribute__((packed)) {
+    uint8_t neighbour_id;
+    uint8_t flags;
+    float distance;
+    uint64_t tx1, rx1;
+    uint64_t tx2, rx2;
+    uint64_t tx3, rx3;
+    float fpp1, fpp2;
+    float skew1, skew2;
+} RangeRecord;
+
+/* Timestamps and signal information overheard by a passive listener. The
+ * "_n" fields are the neighbours' values embedded in the overheard frames. */
+typedef struct __attribute__((packed)) {
+    uint8_t initiator_id;
+    uint8_t target_id;
+    uint8_t flags;
+    uint64_t rx1, rx2, rx3;
+    uint64_t tx1_n, rx1_n;
+    uint64_t tx2_n, rx2_n;
+    uint64_t tx3_n, rx3_n;
+    float fpp1, fpp2, fpp3;
+    float skew1, skew2, skew3;
+    float fpp1_n, fpp2_n;
+    float skew1_n, skew2_n;
+} PassiveRecord;
+
+/* Result of an exchange overheard by a passive listener L, computed on board
+ * from the same timestamps as a PassiveRecord. tdoa is d(T,L) - d(I,L) for
+ * initiator I and target T. The I-T range is only known with
+ * RECORD_FLAG_HAS_RANGE, i.e. if the initiator sent its own final message;
+ * otherwise range is 0 and tdoa still includes d(I,T). */
+typedef struct __attribute__((packed)) {
+    uint8_t initiator_id;
+    uint8_t target_id;
+    uint8_t flags;
+    float tdoa;
+    float range;
+    float fpp1, fpp2;       // Poll and target's response, at the listener
+} TdoaRecord;
+
+/* Header of a CIR record. Followed by num_taps uint16 magnitudes. */
+typedef struct __attribute__((packed)) {
+    uint8_t initiator_id;
+    uint8_t target_id;
+    uint16_t first_path_idx; // Raw RX_TIME_FP_INDEX, 10.6 fixed point.
+    uint16_t num_taps;
+} CirRecordHeader;
+
+/* Header of a windowed CIR record. Followed by num_taps uint16 magnitudes, or
+ * by num_taps int16 (real, imaginary) pairs with RECORD_CIR_FLAG_IQ. */
+typedef struct __attribute__((packed)) {
+    uint8_t initiator_id;
+    uint8_t target_id;
+    uint16_t first_path_idx; // Raw RX_TIME_FP_INDEX, 10.6 fixed point.
+    uint16_t first_tap;      // Accumulator index of the first tap sent.
+    uint16_t num_taps;
+    uint8_t flags;
+} CirWindowHeader;
+
+/* Header of an RTOS record. Followed by num_tasks RtosTaskRecord,
+ * num_queues RtosQueueRecord and a RtosUsbRecord. Run times are in units of 1/run_time_hz s and
+ * wrap around, so that the host works with the differences between records. */
+typedef struct __attribute__((packed)) {
+    uint32_t tick;          // osKernelSysTick(), in ms
+    uint32_t run_time;      // Total run time, all tasks
+    uint32_t run_time_hz;
+    uint16_t cpu_load;      // Permille, over the last second
+    uint8_t num_tasks;
+    uint8_t num_queues;
+} RtosStatsHeader;
+
+typedef struct __attribute__((packed)) {
+    char name[RECORD_RTOS_NAME_LEN];
+    uint8_t priority;       // FreeRTOS priority, 0 for the idle task
+    uint8_t state;          // eTaskState
+    uint16_t stack_free;    // Least free stack since startup, in words
+    uint32_t run_time;
+} RtosTaskRecord;
+
+typedef struct __attribute__((packed)) {
+    char name[RECORD_RTOS_NAME_LEN];
+    uint8_t size;           // Messages the queue holds
+    uint8_t used;           // Messages waiting
+    uint8_t peak;           // Most messages waiting, sampled at every tick
+} RtosQueueRecord;
+
+/* Transmit ring buffer of the USB link, see CdcTxStats. Counts since startup,
+ * which wrap around like the run times. */
+typedef struct __attribute__((packed)) {
+    uint32_t queued_bytes;
+    uint32_t sent_bytes;
+    uint32_t dropped_msgs;  // Output lost because the ring was full
+    uint32_t dropped_bytes;
+    uint16_t high_water;    // Most bytes waiting in the ring
+    uint16_t pending;       // Bytes waiting, this record excluded
+} RtosUsbRecord;
+
+/* Function Prototypes -------------------------------------------------------*/
+void recordsInit(void);
+void setOutputMode(OutputMode mode);
+OutputMode getOutputMode(void);
+uint16_t recordsCrc16(const uint8_t *data, uint16_t len);
+int sendRecord(uint8_t type, const void *payload, uint16_t len);
+void outputRangeRecord(const RangeRecord *rec);
+void outputPassiveRecord(const PassiveRecord *rec);
+void outputTdoaRecord(const TdoaRecord *rec);
+void outputBurstRecord(const RangeRecord *recs, uint8_t count);
+uint16_t outputCirRecord(uint8_t initiator_id, uint8_t target_id,
+                         uint16_t first_path_idx,
+                         const uint32_t *taps, uint16_t num_taps,
+                         uint16_t from);
+uint16_t outputCirWindowRecord(const CirWindowHeader *header,
+                               const void *taps, uint16_t from);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RECORDS_H__ */
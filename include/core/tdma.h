@@ -0,0 +1,65 @@
+/**
+  ******************************************************************************
+  * @file    tdma.h
+  * @brief   This file contains all the function prototypes for
+  *          the tdma.c file
+  ******************************************************************************
+  */
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __TDMA_H__
+#define __TDMA_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "cmsis_os.h"
+
+/* Defines -------------------------------------------------------------------*/
+#define TDMA_MAX_SLOTS (32)
+#define TDMA_SLOT_LEN (4)        // Bytes per slot in the C12 command
+#define UUS_PER_MS (975)         // One UUS is 512/499.2 us
+
+/* Slot index of the polls sent outside of a schedule */
+#define TDMA_NO_SLOT (0xFF)
+
+/* Slot flags */
+#define TDMA_FLAG_TARG_MEAS (0x01) // The target computes the range as well
+#define TDMA_FLAG_GET_CIR   (0x02) // The CIR of the exchange is output
+
+/* Typedefs ------------------------------------------------------------------*/
+/* One exchange of the schedule. Every board is given the same table, and
+ * initiates the exchanges of the slots it is the initiator of. */
+typedef struct {
+    uint8_t initiator;
+    uint8_t target;
+    uint8_t ds_twr;
+    uint8_t flags;
+} TdmaSlot;
+
+/* Timing of a scheduled poll, in DW1000 system time units of 256/(128*499.2
+ * MHz), i.e. the high 32 bits of the 40-bit clock. */
+typedef struct {
+    uint8_t slot;
+    bool ref_valid;        // If not, the schedule starts at this poll.
+    uint32_t frame_start;  // Start of a recent frame
+    uint32_t frame_len;
+    uint32_t slot_len;
+} TdmaTiming;
+
+/* Function Prototypes -------------------------------------------------------*/
+void tdma_init(void);
+int tdmaConfigure(const TdmaSlot *slots, uint8_t num_slots, uint32_t slot_uus);
+void tdmaTask(void const *argument);
+void tdmaPollTimestamp(uint8_t initiator_id, uint8_t slot, uint32_t ts_hi32, uint32_t tick);
+bool tdmaActive(void);
+osMailQId tdmaMailQId(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TDMA_H__ */
@@ -16,13 +16,6 @@
   *                             www.st.com/SLA0044
   *
   ******************************************************************************
-  * @attention
-  *
-  * This script uses the hash table implementation extracted from
-  * Copyright (c) 2005-2021, Troy D. Hanson http://troydhanson.github.io/uthash/
-  * All rights reserved.
-  * 
-  ******************************************************************************
   */
 /* USER CODE END Header */
 
@@ -78,6 +71,15 @@ uint8_t get_board_id(void);
 #define USB_BUFFER_SIZE USB_MSG_BUFFER_SIZE*USB_QUEUE_SIZE // Size of total USB buffer, in bytes.
 #define MAX_COMMAND_RETRIES (5)
 
+/* RTOS objects, all statically allocated. Stack sizes are in 32-bit words. */
+#define BLINK_STACK_SIZE (64)
+#define USB_RECEIVE_STACK_SIZE (768)
+#define UWB_STACK_SIZE (576)
+#define TDMA_STACK_SIZE (256)
+#define UWB_QUEUE_SIZE (16)        // Events of the UWB task, frames included.
+#define TWR_RESULT_QUEUE_SIZE (2)  // Results of the TWR requests of the USB task.
+#define TDMA_QUEUE_SIZE (4)
+
 /* USER CODE BEGIN Private defines */
 #define DW_RESET_Pin GPIO_PIN_11
 #define DW_RESET_GPIO_Port GPIOC
@@ -56,6 +56,8 @@ void DebugMon_Handler(void);
 void TIM2_IRQHandler(void);
 void OTG_FS_IRQHandler(void);
 void EXTI9_5_IRQHandler(void);
+void DMA2_Stream0_IRQHandler(void);
+void DMA2_Stream3_IRQHandler(void);
 /* USER CODE BEGIN EFP */
 
 /* USER CODE END EFP */
@@ -25,6 +25,7 @@ typedef struct{
 } element_R3;
 
 void usb_print(char*);
+int usb_write(uint8_t*, uint16_t);
 void convert_float_to_string(char* stringbuff,float data);
 void convert_elementR3_to_string(char* str, element_R3 data);
 ITStatus EXTI_GetITEnStatus(uint32_t x);
@@ -18,13 +18,48 @@ extern "C" {
 #include "deca_device_api.h"
 
 /* Type defines --------------------------------------------------------------*/
+/* A radio configuration, together with the constants that depend on it. All
+ * boards must use the same profile to hear each other. Durations are in UUS
+ * (512/499.2 us) unless noted otherwise. */
+typedef struct {
+    const char *name;
+    dwt_config_t config;
+    float a_constant;             // First path power constant, depends on the PRF
+    int16_t rxpacc_adjustment;    // Correction of the preamble count for the SFD
+    float skew_ppm_per_ci;        // Carrier integrator to clock skew, depends on
+                                  // the channel and the data rate
+    uint16_t pre_timeout;         // Preamble detection timeout, in PACs
+    uint16_t rx_after_tx_uus;     // Wait for response delay
+    uint8_t frame_wait_ms;        // Time allowed for each frame of an exchange
+    uint32_t ss_reply_uus;        // Reply delays of the target, see ranging.c
+    uint32_t ss_fast_reply_uus;
+    uint32_t ds_reply_uus;        // Default second-response delay in DS-TWR
+    uint32_t burst_first_slot_uus;
+    uint32_t burst_slot_uus;
+    uint32_t min_slot_uus;        // Shortest TDMA slot, for DS-TWR with a final message
+    uint32_t tx_lead_uus;         // Earliest start of a scheduled poll, covers its preamble
+    uint16_t cir_taps;            // Length of the accumulator, depends on the PRF
+} RadioProfile;
 
 
 /* Defines -------------------------------------------------------------------*/
-/* Default antenna delay values for 64 MHz PRF. */
+/* Default antenna delay values for 64 MHz PRF, until set per board with
+ * antennaDelaySet(). */
 #define TX_ANT_DLY 16436
 #define RX_ANT_DLY 16436
 
+/* Same for 16 MHz PRF. Not measured: the delays of the two PRFs differ by a
+ * few units, i.e. a few cm, so the profiles at 16 MHz must be calibrated
+ * (python/uwb/calibrate.py --profile) before their ranges are used. */
+#define TX_ANT_DLY_16M TX_ANT_DLY
+#define RX_ANT_DLY_16M RX_ANT_DLY
+
+/* Radio profiles, see radio_profiles in dwt_general.c */
+#define RADIO_PROFILE_DEFAULT    (0) // Channel 2, 64 MHz PRF, 128 symbols, 6.8 Mbps
+#define RADIO_PROFILE_FAST       (1) // Same with 64 symbols, for the shortest exchanges
+#define RADIO_PROFILE_LONG_RANGE (2) // Channel 2, 16 MHz PRF, 1024 symbols, 110 kbps
+#define NUM_RADIO_PROFILES       (3)
+
 /* Variable Declarations -----------------------------------------------------*/
 
 /* Function Prototypes -------------------------------------------------------*/
@@ -35,12 +70,20 @@ uint32_t getInterval(uint32_t* previous_ticks_buff);
 
 void uwb_init(void);
 void reset_DW1000(void);
+void radioProfileConfigure(uint8_t id);
+const RadioProfile *radioProfile(void);
+const RadioProfile *radioProfileById(uint8_t id);
+uint8_t radioProfileId(void);
+void antennaDelaySet(uint8_t profile, uint16_t tx, uint16_t rx);
+void antennaDelayGet(uint8_t profile, uint16_t *tx, uint16_t *rx);
+void antennaDelayConfigure(void);
+uint16_t txAntennaDelay(void);
 
 typedef unsigned long long uint64;
 uint64 get_tx_timestamp_u64(void);
 uint64 get_rx_timestamp_u64(void);
 void final_msg_set_ts(uint8 *ts_field, uint64 ts);
-void final_msg_get_ts(const uint8 *ts_field, uint32 *ts);
+void final_msg_get_ts(const uint8 *ts_field, uint64 *ts);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,89 @@
+/**
+  ******************************************************************************
+  * @file    rtos_static.h
+  * @brief   This file contains all the function prototypes for
+  *          the rtos_static.c file
+  ******************************************************************************
+  */
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __RTOS_STATIC_H__
+#define __RTOS_STATIC_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include "cmsis_os.h"
+
+/* Defines -------------------------------------------------------------------*/
+#ifdef UWB_SIM
+/* The simulator implements the mail queues itself, see sim_os.c. */
+#define osMailQStaticDef(name, queue_sz, type) static osMailQDef(name, queue_sz, type)
+#define osMailQStatic(name) NULL
+#define osMailCreateStatic(queue_def, storage) osMailCreate(queue_def, NULL)
+
+#else
+/* Words of a block of the pool of a mail queue, which cmsis_os.c rounds up
+ * to 4 bytes. */
+#define MAIL_ITEM_WORDS(type) ((sizeof(type) + 3)/4)
+
+/*! ----------------------------------------------------------------------------
+ * Macro: osMailQStaticDef()
+ *
+ * @brief Same as osMailQDef(), along with the storage of the queue, for
+ * osMailCreateStatic(). The CMSIS-RTOS layer only creates mail queues from
+ * the FreeRTOS heap.
+ */
+#define osMailQStaticDef(name, queue_sz, type)                                   \
+static MailQueueCb os_mailQ_qcb_##name;                                          \
+static MailPoolCb os_mailQ_pcb_##name;                                           \
+static StaticQueue_t os_mailQ_queue_##name;                                      \
+static void *os_mailQ_buffer_##name[queue_sz];                                   \
+static uint8_t os_mailQ_markers_##name[queue_sz];                                \
+static uint32_t os_mailQ_pool_##name[(queue_sz)*MAIL_ITEM_WORDS(type)];          \
+static const osStaticMailQDef_t os_mailQ_static_##name = {                       \
+    &os_mailQ_qcb_##name, &os_mailQ_pcb_##name, &os_mailQ_queue_##name,          \
+    (uint8_t *)os_mailQ_buffer_##name, os_mailQ_markers_##name,                  \
+    os_mailQ_pool_##name};                                                       \
+static osMailQDef(name, queue_sz, type)
+
+/* Storage of a mail queue defined with osMailQStaticDef() */
+#define osMailQStatic(name) (&os_mailQ_static_##name)
+
+/* Typedefs ------------------------------------------------------------------*/
+/* Control blocks of a mail queue and of its pool, as laid out by cmsis_os.c,
+ * which does not export them. */
+typedef struct {
+    const osMailQDef_t *queue_def;
+    QueueHandle_t handle;  // Queue of pointers to the blocks of the pool
+    osPoolId pool;
+} MailQueueCb;
+
+typedef struct {
+    void *pool;
+    uint8_t *markers;      // 1 for the blocks in use
+    uint32_t pool_sz;
+    uint32_t item_sz;
+    uint32_t currentIndex;
+} MailPoolCb;
+
+typedef struct {
+    MailQueueCb *queue_cb;
+    MailPoolCb *pool_cb;
+    StaticQueue_t *queue;
+    uint8_t *queue_buffer;
+    uint8_t *markers;
+    uint32_t *pool;
+} osStaticMailQDef_t;
+
+/* Function Prototypes -------------------------------------------------------*/
+osMailQId osMailCreateStatic(const osMailQDef_t *queue_def, const osStaticMailQDef_t *storage);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RTOS_STATIC_H__ */
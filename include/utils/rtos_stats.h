@@ -0,0 +1,35 @@
+/**
+  ******************************************************************************
+  * @file    rtos_stats.h
+  * @brief   This file contains all the function prototypes for
+  *          the rtos_stats.c file
+  ******************************************************************************
+  */
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __RTOS_STATS_H__
+#define __RTOS_STATS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Defines -------------------------------------------------------------------*/
+/* The run time counters tick at the CPU frequency divided by 2^shift, 2.6 MHz
+ * at 168 MHz, and wrap around every 27 min. */
+#define RTOS_RUN_TIME_SHIFT (6)
+
+/* Function Prototypes -------------------------------------------------------*/
+uint32_t rtosRunTimeCounter(void);
+void rtosStatsIdleHook(void);
+void rtosStatsTickHook(void);
+int rtosStatsSend(bool reset_peaks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RTOS_STATS_H__ */
@@ -32,6 +32,8 @@ extern "C" {
 /* USER CODE END Includes */
 
 extern SPI_HandleTypeDef hspi1;
+extern DMA_HandleTypeDef hdma_spi1_rx;
+extern DMA_HandleTypeDef hdma_spi1_tx;
 
 /* USER CODE BEGIN Private defines */
 #define SPI_TIMEOUT 10
@@ -43,6 +45,7 @@ void MX_SPI1_Init(void);
 void port_set_dw1000_slowrate(void);
 void port_set_dw1000_fastrate(void);
 void SPI1_DeInit(void);
+uint32_t spiDmaWaitCycles(void);
 /* USER CODE END Prototypes */
 
 #ifdef __cplusplus
@@ -28,6 +28,8 @@ extern "C" {
 /* USER CODE BEGIN Prototypes */
 void dw_test(void);
 void read_id(void);
+void spi_benchmark(void);
+void ranging_math_benchmark(void);
 /* USER CODE END Prototypes */
 
 #ifdef __cplusplus
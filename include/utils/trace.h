@@ -0,0 +1,87 @@
+/**
+  ******************************************************************************
+  * @file    trace.h
+  * @brief   This file contains all the function prototypes for
+  *          the trace.c file
+  ******************************************************************************
+  */
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "stm32f4xx_hal.h"
+
+/* Defines -------------------------------------------------------------------*/
+/* Set to 0 to compile the trace points out. */
+#ifndef UWB_TRACE
+#define UWB_TRACE (1)
+#endif
+
+/* What trace() reports, see c17_get_trace() */
+#define TRACE_REPORT_STATS  (0) // Statistics of each phase
+#define TRACE_REPORT_RESET  (1) // Same, then start over
+#define TRACE_REPORT_RECENT (2) // The last TRACE_RING_LEN samples
+
+/* Typedefs ------------------------------------------------------------------*/
+/* Phases timed by the trace points, in CPU cycles. */
+typedef enum {
+    TRACE_ISR,            // uwb_isr(), all of the DW1000 interrupt
+    TRACE_RX_READ,        // Frame and RX time-stamp reads in rx_ok_cb()
+    TRACE_RX_POWER,       // retrievePower()
+    TRACE_RX_SKEW,        // retrieveSkew()
+    TRACE_EVENT_LATENCY,  // From posting an event to the UWB task to handling it
+    TRACE_EVENT,          // Handling of an event by the UWB task
+    TRACE_POLL_START,     // twrStartInitiator(), up to dwt_starttx()
+    TRACE_RESPONSE_WAIT,  // From the start of the poll to the first frame of the
+                          // exchange, unscheduled polls only
+    TRACE_EXCHANGE,       // From the start of an exchange to its end
+    TRACE_RECORD_FORMAT,  // Formatting of an ASCII record, up to usb_print()
+    TRACE_USB_PRINT,      // usb_print()
+    NUM_TRACE_PHASES
+} TracePhase;
+
+/* Function Prototypes -------------------------------------------------------*/
+#ifdef UWB_SIM
+uint32_t simCycles(void);
+#endif
+
+/*! ----------------------------------------------------------------------------
+ * Function: traceCycles()
+ *
+ * @brief Current CPU cycle count, from the DWT cycle counter enabled by
+ * DWT_Delay_Init(). Wraps around every 25 s at 168 MHz.
+ */
+static inline uint32_t traceCycles(void){
+#ifdef UWB_SIM
+    return simCycles();
+#else
+    return DWT->CYCCNT;
+#endif
+}
+
+void traceRecord(uint8_t phase, uint32_t start, uint32_t end);
+void traceReport(uint8_t what);
+
+/*! ----------------------------------------------------------------------------
+ * Function: traceEnd()
+ *
+ * @brief Record a phase that started at traceCycles() == start and ends now.
+ */
+static inline void traceEnd(uint8_t phase, uint32_t start){
+#if UWB_TRACE
+    traceRecord(phase, start, traceCycles());
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TRACE_H__ */
@@ -67,6 +67,15 @@
   */
 
 /* USER CODE BEGIN EXPORTED_TYPES */
+/* Statistics of the buffered transmit path. */
+typedef struct {
+  uint32_t queued_bytes;  // bytes accepted into the ring buffer
+  uint32_t sent_bytes;    // bytes handed to the driver
+  uint32_t dropped_msgs;  // messages rejected because the ring was full
+  uint32_t dropped_bytes; // bytes rejected because the ring was full
+  uint32_t high_water;    // largest ring occupancy seen, in bytes
+  uint32_t pending;       // current ring occupancy, in bytes
+} CdcTxStats;
 
 /* USER CODE END EXPORTED_TYPES */
 
@@ -111,6 +120,8 @@ extern USBD_CDC_ItfTypeDef USBD_Interface_fops_FS;
 uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len);
 
 /* USER CODE BEGIN EXPORTED_FUNCTIONS */
+uint8_t CDC_Write_FS(const uint8_t* Buf, uint16_t Len);
+void CDC_GetTxStats_FS(CdcTxStats* stats);
 /* USER CODE END EXPORTED_FUNCTIONS */
 
 /**
@@ -0,0 +1,80 @@
+"""
+Tests of the host driver against the fake boards of bench.py. From the python
+directory:
+
+    python -m unittest discover tests
+"""
+import asyncio
+import unittest
+
+from uwb.bench import FakeBoard
+from uwb.host import Board
+
+
+class LossyBoard(FakeBoard):
+    """Does not answer the messages listed in drop, by their order of
+    arrival, like the firmware with a message it cannot parse."""
+
+    def __init__(self, board_id: int, delay: float, drop=()):
+        self.drop = set(drop)
+        self.received = 0
+        super().__init__(board_id, delay)
+
+    def _reply(self, msg: bytes) -> bytes:
+        self.received += 1
+        if self.received in self.drop:
+            return b""
+        return super()._reply(msg)
+
+
+class TestBoard(unittest.TestCase):
+    def run_board(self, fake, commands, **kwargs):
+        """Runs commands, a list of (number, fields), pipelined on a Board and
+        returns the replies or the exceptions."""
+        async def run():
+            async with Board(fake.port, **kwargs) as board:
+                return await asyncio.gather(
+                    *(board.command(number, *fields) for number, fields in commands),
+                    return_exceptions=True)
+        try:
+            return asyncio.run(run())
+        finally:
+            fake.close()
+
+    def test_lost_reply(self):
+        # The reply to the first command is lost. Only that one times out,
+        # and the others still get their own replies.
+        fake = LossyBoard(7, 0.0, drop=[1])
+        replies = self.run_board(fake, [(5, (2, 0, 1, 0))]
+                                 + [(1, ())] * 4
+                                 + [(5, (3 + i, 0, 1, 0)) for i in range(4)],
+                                 timeout=0.3)
+
+        self.assertIsInstance(replies[0], asyncio.TimeoutError)
+        for reply in replies[1:5]:
+            self.assertEqual(reply.tag, "R01")
+            self.assertEqual(reply.fields, ["7"])
+        self.assertEqual([r.neighbour_id for r in replies[5:]], [3, 4, 5, 6])
+
+    def test_lost_range(self):
+        # The record of C05 is not numbered, so that of the next C05 must not
+        # be taken for the lost one.
+        fake = LossyBoard(7, 0.0, drop=[1])
+        replies = self.run_board(fake, [(5, (2 + i, 0, 1, 0)) for i in range(5)],
+                                 timeout=0.3, max_in_flight=1)
+
+        self.assertIsInstance(replies[0], asyncio.TimeoutError)
+        self.assertEqual([r.neighbour_id for r in replies[1:]], [3, 4, 5, 6])
+
+    def test_timeout_from_previous_reply(self):
+        # Each C05 takes 0.2 s, so the last of 4 pipelined ones is answered
+        # 0.8 s after it was sent, but only 0.2 s after the previous reply.
+        fake = LossyBoard(7, 0.2)
+        replies = self.run_board(fake, [(5, (2 + i, 0, 1, 0)) for i in range(4)],
+                                 timeout=0.5, max_in_flight=4)
+
+        self.assertEqual([r.neighbour_id for r in replies], [2, 3, 4, 5])
+
+
+if __name__ == "__main__":
+    unittest.main()
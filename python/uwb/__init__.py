@@ -0,0 +1 @@
+"""Host-side tools for the UWB module firmware."""
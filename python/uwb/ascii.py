@@ -0,0 +1,188 @@
+"""
+Parser for the ASCII output of the firmware, the default output mode. Lines
+are converted into the same record objects as their binary equivalents (see
+records.py), with seq set to None, so that host scripts work the same in both
+modes:
+
+    R05, S05  -> RangeRecord
+    S01       -> PassiveRecord
+    S10       -> CirRecord
+    R11       -> BurstRecord
+    S13       -> CirWindowRecord
+    S14       -> TdoaRecord
+    S06       -> Broadcast
+
+Failures ("TWR FAIL: ...", "COMMANDED TASK FAILED AFTER 5 ATTEMPTS.", ...)
+become Failure objects, the other tagged lines (R00, R17, T17, ...) Response
+objects, and anything else Text.
+
+StreamParser does the framing as well, so that it can be fed arbitrary chunks
+of the USB byte stream, in either output mode.
+"""
+import re
+import struct
+from dataclasses import dataclass, field
+from typing import List, Union
+
+from .records import (FLAG_DS_TWR, FLAG_HAS_RANGE, FLAG_INCOMPLETE,
+                      FLAG_INITIATOR, FLAG_SKEW_CORR, CIR_FLAG_IQ,
+                      BurstRecord, CirRecord,
+                      CirWindowRecord, PassiveRecord, RangeRecord, Record,
+                      RecordDecoder, TdoaRecord)
+
+_TAG = re.compile(rb"^([RST])(\d\d)$")
+
+# Lines printed in place of the reply of a command
+_FAILURES = (b" FAIL", b"COMMANDED TASK FAILED", b"Unknown command number.")
+
+
+@dataclass
+class Broadcast:
+    """S06: data broadcast by another board with C06."""
+    data: bytes
+
+
+@dataclass
+class Response:
+    """Any other tagged line, split into its fields. data holds the raw bytes
+    of R03, and lines the T17 lines that follow R17 (see host.py)."""
+    tag: str
+    fields: List[str]
+    data: bytes = b""
+    lines: List["Response"] = field(default_factory=list)
+
+    @property
+    def number(self) -> int:
+        return int(self.tag[1:])
+
+
+@dataclass
+class Failure:
+    """A command could not be executed."""
+    text: str
+
+
+@dataclass
+class Text:
+    """A line of no known format."""
+    text: str
+
+
+Item = Union[Record, Broadcast, Response, Failure, Text]
+
+
+def _range(tag: bytes, f: List[bytes]) -> RangeRecord:
+    flags = FLAG_INITIATOR if tag == b"R05" else 0
+    ts = [int(x) for x in f[2:8]]
+    if ts[4] or ts[5]:
+        flags |= FLAG_DS_TWR
+    return RangeRecord(None, int(f[0]), flags, float(f[1]), *ts,
+                       *(float(x) for x in f[8:12]))
+
+
+def _passive(f: List[bytes]) -> PassiveRecord:
+    ints = [int(x) for x in f[2:11]]
+    floats = [float(x) for x in f[11:21]]
+    flags = 0 if any(ints) else FLAG_INCOMPLETE
+    return PassiveRecord(None, int(f[0]), int(f[1]), flags, *ints, *floats)
+
+
+def _tdoa(f: List[bytes]) -> TdoaRecord:
+    # Incomplete records are printed with integer zeros
+    flags = FLAG_INCOMPLETE if f[2:6] == [b"0"] * 4 else 0
+    tdoa, rng, fpp1, fpp2 = (float(x) for x in f[2:6])
+    if rng != 0:
+        flags |= FLAG_HAS_RANGE
+    return TdoaRecord(None, int(f[0]), int(f[1]), flags, tdoa, rng, fpp1, fpp2)
+
+
+def _first_path(integer: bytes, thousandths: bytes) -> float:
+    return int(integer) + int(thousandths) / 1000.0
+
+
+def _burst(f: List[bytes]) -> BurstRecord:
+    # Bursts are always corrected for the clock offset of each target
+    ranges = []
+    for i in range(int(f[0])):
+        r = f[1 + 10 * i:11 + 10 * i]
+        ranges.append(RangeRecord(None, int(r[0]), FLAG_INITIATOR | FLAG_SKEW_CORR,
+                                  float(r[1]),
+                                  *(int(x) for x in r[2:6]), 0, 0,
+                                  *(float(x) for x in r[6:10])))
+    return BurstRecord(None, ranges)
+
+
+def _cir_window(f: List[bytes]) -> CirWindowRecord:
+    iq = int(f[5])
+    values = [int(x) for x in f[6:]]
+    if iq:
+        taps = [complex(re_, im) for re_, im in zip(values[0::2], values[1::2])]
+    else:
+        taps = values
+    return CirWindowRecord(None, int(f[0]), int(f[1]), _first_path(f[2], f[3]),
+                           int(f[4]), CIR_FLAG_IQ if iq else 0, taps)
+
+
+def _binary(tag: bytes, line: bytes) -> Item:
+    # The length-prefixed field comes after the text fields
+    num_text = 0 if tag == b"S06" else 5
+    parts = line.split(b"|", num_text + 1)
+    (length,) = struct.unpack_from("<H", parts[-1])
+    data = parts[-1][2:2 + length]
+    if tag == b"S06":
+        return Broadcast(data)
+    return Response("R03", [p.decode("ascii", "replace") for p in parts[1:-1]],
+                    data)
+
+
+def parse_line(line: bytes) -> Item:
+    """Converts a line of the byte stream, with or without its "\\r\\n", into
+    an object. Malformed lines are returned as Text."""
+    tag = line[:3]
+    try:
+        # Their raw bytes could look like anything
+        if tag in (b"S06", b"R03"):
+            return _binary(tag, line)
+    except struct.error:
+        return Text(line.decode("ascii", "replace").strip())
+
+    if any(f in line for f in _FAILURES):
+        return Failure(line.decode("ascii", "replace").strip())
+    if not _TAG.match(tag):
+        return Text(line.decode("ascii", "replace").strip())
+    try:
+        f = line.rstrip(b"\r\n").split(b"|")[1:]
+        if tag in (b"R05", b"S05"):
+            return _range(tag, f)
+        if tag == b"S01":
+            return _passive(f)
+        if tag == b"S10":
+            return CirRecord(None, int(f[0]), int(f[1]), _first_path(f[2], f[3]),
+                             [int(x) for x in f[4:]])
+        if tag == b"R11":
+            return _burst(f)
+        if tag == b"S13":
+            return _cir_window(f)
+        if tag == b"S14":
+            return _tdoa(f)
+        return Response(tag.decode(), [x.decode("ascii", "replace") for x in f])
+    except (ValueError, IndexError, struct.error):
+        return Text(line.decode("ascii", "replace").strip())
+
+
+class StreamParser:
+    """
+    Incremental parser of the whole USB byte stream: binary records are
+    decoded by RecordDecoder, and ASCII lines by parse_line().
+
+        parser = StreamParser()
+        for item in parser.feed(data):
+            ...
+    """
+
+    def __init__(self):
+        self.decoder = RecordDecoder()
+
+    def feed(self, data: bytes) -> List[Item]:
+        return [parse_line(item) if isinstance(item, bytes) else item
+                for item in self.decoder.feed(data)]
@@ -0,0 +1,134 @@
+"""
+Throughput of the host driver, against fake boards on pseudo-terminals:
+
+    python -m uwb.bench --boards 8 --commands 200 --delay 0.002
+
+Each fake board answers C01 and C05 like the firmware: one command at a time,
+C05 after a delay that stands for the ranging exchange. The same commands are
+run three ways: one board after the other, waiting for each reply (the way a
+serial script usually does it), then with host.Board on every board at once,
+without and with pipelining.
+"""
+import argparse
+import asyncio
+import os
+import pty
+import threading
+import time
+import tty
+from typing import List
+
+from .ascii import StreamParser
+from .host import Board, encode_command
+from .records import RangeRecord
+
+
+class FakeBoard:
+    """A board on the slave side of a pseudo-terminal, run by a thread."""
+
+    def __init__(self, board_id: int, delay: float):
+        self.board_id = board_id
+        self.delay = delay
+        self._master, self._slave = pty.openpty()
+        tty.setraw(self._slave)  # No echo, and "\r" left alone
+        self.port = os.ttyname(self._slave)
+        self._thread = threading.Thread(target=self._run, daemon=True)
+        self._thread.start()
+
+    def _reply(self, msg: bytes) -> bytes:
+        fields = msg.split(b"|")
+        if fields[0] == b"C01":
+            return b"R01|%d\r\n" % self.board_id
+        if fields[0] == b"C05":
+            time.sleep(self.delay)
+            return (b"R05|%s|1.2345|1000|2000|3000|4000|0|0|-80.1000|-81.2000|"
+                    b"0.0000|0.0000\r\n" % fields[1])
+        return b"Unknown command number.\r\n"
+
+    def _run(self):
+        buffer = b""
+        while True:
+            try:
+                data = os.read(self._master, 4096)
+            except OSError:
+                return
+            buffer += data
+            *messages, buffer = buffer.split(b"\r")
+            for msg in messages:
+                if msg.startswith(b"C"):
+                    os.write(self._master, self._reply(msg))
+
+    def close(self):
+        os.close(self._slave)
+        os.close(self._master)
+
+
+def run_sequential(ports: List[str], num_commands: int) -> int:
+    """One command at a time, one board after the other."""
+    fds = [os.open(port, os.O_RDWR | os.O_NOCTTY) for port in ports]
+    parsers = [StreamParser() for _ in ports]
+    done = 0
+    for i in range(num_commands):
+        for fd, parser in zip(fds, parsers):
+            os.write(fd, encode_command(5, i % 250 + 1, 0, 1, 0))
+            reply = []
+            while not reply:
+                reply = parser.feed(os.read(fd, 4096))
+            done += isinstance(reply[0], RangeRecord)
+    for fd in fds:
+        os.close(fd)
+    return done
+
+
+async def run_async(ports: List[str], num_commands: int, max_in_flight: int) -> int:
+    boards = [Board(port, max_in_flight=max_in_flight) for port in ports]
+    for board in boards:
+        await board.open()
+
+    async def run(board):
+        replies = await asyncio.gather(*(board.command(5, i % 250 + 1, 0, 1, 0)
+                                         for i in range(num_commands)))
+        return sum(isinstance(r, RangeRecord) for r in replies)
+
+    done = sum(await asyncio.gather(*(run(board) for board in boards)))
+    for board in boards:
+        board.close()
+    return done
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--boards", type=int, default=8)
+    parser.add_argument("--commands", type=int, default=200,
+                        help="C05 commands per board")
+    parser.add_argument("--delay", type=float, default=0.002,
+                        help="Time a fake board takes to range, in s")
+    parser.add_argument("--in-flight", type=int, default=4,
+                        help="Commands pipelined per board")
+    args = parser.parse_args()
+
+    fakes = [FakeBoard(i + 1, args.delay) for i in range(args.boards)]
+    ports = [fake.port for fake in fakes]
+    total = args.boards * args.commands
+    runs = [
+        ("sequential", lambda: run_sequential(ports, args.commands)),
+        ("async", lambda: asyncio.run(run_async(ports, args.commands, 1))),
+        ("async, pipelined", lambda: asyncio.run(
+            run_async(ports, args.commands, args.in_flight))),
+    ]
+
+    print("%d boards, %d commands each, %.1f ms per command"
+          % (args.boards, args.commands, args.delay * 1000))
+    for name, run in runs:
+        start = time.perf_counter()
+        done = run()
+        elapsed = time.perf_counter() - start
+        print("  %-18s %8.0f commands/s  (%d/%d replies)"
+              % (name, done / elapsed, done, total))
+
+    for fake in fakes:
+        fake.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,164 @@
+"""
+Antenna delay calibration of three or more boards at known positions, after
+Decawave's APS014:
+
+    python -m uwb.calibrate /dev/ttyACM0 /dev/ttyACM1 /dev/ttyACM2 \\
+        --position 1=0,0 --position 2=5,0 --position 3=2.5,4.33
+
+Every pair of boards ranges with DS-TWR, in both directions. The median
+distance of a pair is off from the true one by the delay errors of its two
+boards, which are solved for by least squares, then added to the antenna
+delays of each board with C20. Any range bias tables (C19) are applied on
+board before that, so should be loaded first.
+
+The delays are not kept across resets: run this, or send C20 with the
+printed values, after each power-up.
+"""
+import argparse
+import asyncio
+import itertools
+import statistics
+from typing import Dict, List, Sequence, Tuple
+
+from .host import Board, CommandError
+from .records import RangeRecord
+
+# Metres of the DW1000 time unit, see TOF_TO_METRES in ranging_math.h
+METRES_PER_TICK = 299702547.0 / (499.2e6 * 128.0)
+
+TWR_MODE_DS = 1
+
+Pair = Tuple[int, int]
+
+
+def solve_delays(errors: Dict[Pair, float]) -> Dict[int, float]:
+    """Delay errors of the boards, in DW1000 time units, from the range
+    errors of pairs of them, in metres: the error of a pair (i, j) is
+    e[i] + e[j]. Least squares, by Gaussian elimination of the normal
+    equations. Needs the pairs to link the boards in a cycle of odd length,
+    e.g. three boards ranging to each other."""
+    ids = sorted({i for pair in errors for i in pair})
+    index = {board: k for k, board in enumerate(ids)}
+    n = len(ids)
+    a = [[0.0] * (n + 1) for _ in range(n)]  # [A^T A | A^T b]
+    for (i, j), error in errors.items():
+        for p in (index[i], index[j]):
+            a[p][index[i]] += 1
+            a[p][index[j]] += 1
+            a[p][n] += error / METRES_PER_TICK
+
+    for col in range(n):
+        pivot = max(range(col, n), key=lambda r: abs(a[r][col]))
+        if abs(a[pivot][col]) < 1e-9:
+            raise ValueError("The pairs do not determine the delays of every board")
+        a[col], a[pivot] = a[pivot], a[col]
+        for r in range(n):
+            if r != col:
+                f = a[r][col] / a[col][col]
+                a[r] = [x - f * y for x, y in zip(a[r], a[col])]
+    return {board: a[k][n] / a[k][k] for board, k in index.items()}
+
+
+def true_distance(positions: Dict[int, Sequence[float]], pair: Pair) -> float:
+    p, q = positions[pair[0]], positions[pair[1]]
+    return sum((x - y) ** 2 for x, y in zip(p, q)) ** 0.5
+
+
+async def measure(boards: Dict[int, Board], count: int) -> Dict[Pair, List[float]]:
+    """count DS-TWR exchanges each way between every pair of boards, one at a
+    time so that they do not collide. Failed exchanges are left out."""
+    ranges: Dict[Pair, List[float]] = {}
+    for i, j in itertools.combinations(sorted(boards), 2):
+        ranges[(i, j)] = []
+        for _ in range(count):
+            for initiator, target in ((i, j), (j, i)):
+                try:
+                    reply = await boards[initiator].command(5, target, 0, TWR_MODE_DS, 0)
+                except (CommandError, asyncio.TimeoutError):
+                    continue
+                if isinstance(reply, RangeRecord):
+                    ranges[(i, j)].append(reply.distance)
+    return ranges
+
+
+async def calibrate(boards: Dict[int, Board], positions: Dict[int, Sequence[float]],
+                    count: int, profile: int, apply: bool = True) -> Dict[int, Tuple[int, int]]:
+    """One round of calibration. Returns the new TX and RX delays of each
+    board, which are sent to it unless apply is False."""
+    current = {}
+    for board_id, board in boards.items():
+        reply = await board.command(20, profile, 0, 0)
+        current[board_id] = (int(reply.fields[0]), int(reply.fields[1]))
+
+    ranges = await measure(boards, count)
+    errors = {}
+    for pair, values in ranges.items():
+        if not values:
+            print("  %d-%d: no ranges" % pair)
+            continue
+        errors[pair] = statistics.median(values) - true_distance(positions, pair)
+    delays = solve_delays(errors)
+
+    for (i, j), error in errors.items():
+        residual = error - (delays[i] + delays[j]) * METRES_PER_TICK
+        print("  %d-%d: %+.3f m off, %+.3f m left after correction (%d ranges)"
+              % (i, j, error, residual, len(ranges[(i, j)])))
+
+    new = {}
+    for board_id, (tx, rx) in current.items():
+        step = round(delays.get(board_id, 0.0))
+        new[board_id] = (tx + step, rx + step)
+        print("  board %d: %d/%d -> %d/%d" % (board_id, tx, rx, *new[board_id]))
+        if apply:
+            await boards[board_id].command(20, profile, *new[board_id])
+    return new
+
+
+def _position(text: str) -> Tuple[int, List[float]]:
+    board_id, coords = text.split("=")
+    return int(board_id), [float(x) for x in coords.split(",")]
+
+
+async def _main(args):
+    positions = dict(args.position)
+    boards = {}
+    for port in args.ports:
+        board = Board(port)
+        await board.open()
+        reply = await board.command(1)
+        boards[int(reply.fields[0])] = board
+
+    missing = set(boards) - set(positions)
+    if missing:
+        raise SystemExit("No position for boards %s" % sorted(missing))
+    try:
+        for r in range(args.rounds):
+            print("Round %d" % (r + 1))
+            await calibrate(boards, positions, args.count, args.profile,
+                            apply=not args.dry_run)
+    finally:
+        for board in boards.values():
+            board.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("ports", nargs="+", help="Serial ports of the boards")
+    parser.add_argument("--position", type=_position, action="append", required=True,
+                        metavar="ID=X,Y[,Z]", help="Position of a board, in m")
+    parser.add_argument("--count", type=int, default=20,
+                        help="Exchanges each way per pair and round")
+    parser.add_argument("--profile", type=int, default=0,
+                        help="Radio profile in use, RADIO_PROFILE_")
+    parser.add_argument("--rounds", type=int, default=1,
+                        help="Measure and correct this many times")
+    parser.add_argument("--dry-run", action="store_true",
+                        help="Print the delays without setting them")
+    args = parser.parse_args()
+    if len(args.ports) < 3:
+        parser.error("At least three boards are needed")
+    asyncio.run(_main(args))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,258 @@
+"""
+Asynchronous host driver, to run many boards from a single thread:
+
+    async def main():
+        async with Board("/dev/ttyACM0") as a, Board("/dev/ttyACM1") as b:
+            ranges = await asyncio.gather(a.command(5, 2, 0, 1, 0),
+                                          b.command(5, 1, 0, 1, 0))
+            record = await b.records.get()  # The S05 of the target
+
+    asyncio.run(main())
+
+The firmware executes commands one at a time, in the order it receives them,
+and answers each one with its reply or a failure line. Commands are therefore
+pipelined: up to max_in_flight are sent ahead, and the replies are matched to
+them in order. Everything else the board sends (the records of the target and
+of the passive listeners, CIRs, broadcasts, ...) goes to Board.records.
+
+Replies can be lost, as the firmware does not answer the messages it cannot
+parse or has no room for. Since the commands run one after the other, the
+timeout of a command runs from the reply to the previous one, and a command
+that times out is dropped. A numbered reply (R01, R17, ...) that belongs to a
+later command ends the wait of the commands before it right away, and the
+record of C05 must be of the requested target.
+
+Only the standard library is used. The serial port is opened in raw mode and
+read from the event loop, which needs a POSIX system.
+"""
+import asyncio
+import collections
+import os
+import struct
+import termios
+import tty
+from dataclasses import dataclass
+from typing import Any, Deque, Iterable, List, Optional
+
+from .ascii import Failure, Item, Response, StreamParser
+from .records import BurstRecord, RangeRecord, RtosRecord
+
+# Complete messages waiting in the firmware. Its receive buffer holds 8 USB
+# packets, see USB_QUEUE_SIZE.
+DEFAULT_MAX_IN_FLIGHT = 4
+
+# Longest a command takes, retries included
+DEFAULT_TIMEOUT = 2.0
+
+
+class CommandError(Exception):
+    """The board answered a command with a failure line."""
+
+
+def encode_command(number: int, *fields: Any) -> bytes:
+    """Builds the message of command number, see parseMessage() in the
+    firmware: integers and booleans as decimal text, floats as 4 raw bytes,
+    bytes after a 2-byte length."""
+    msg = b"C%02d" % number
+    for value in fields:
+        msg += b"|"
+        if isinstance(value, (bool, int)):
+            msg += b"%d" % value
+        elif isinstance(value, float):
+            msg += struct.pack("<f", value)
+        elif isinstance(value, (bytes, bytearray)):
+            msg += struct.pack("<H", len(value)) + bytes(value)
+        else:
+            msg += str(value).encode("ascii")
+    return msg + b"\r"
+
+
+@dataclass
+class _Pending:
+    number: int
+    fields: tuple
+    future: asyncio.Future
+    timeout: float
+    reply: Optional[Response] = None  # R17, until its T17 lines are in
+    expected: int = 0
+    timer: Optional[asyncio.TimerHandle] = None  # Once first in the queue
+
+
+class Board:
+    """One board on a serial port."""
+
+    def __init__(self, port: str, max_in_flight: int = DEFAULT_MAX_IN_FLIGHT,
+                 timeout: float = DEFAULT_TIMEOUT):
+        self.port = port
+        self.timeout = timeout
+        self.records: asyncio.Queue = asyncio.Queue()
+        self._slots = asyncio.Semaphore(max_in_flight)
+        self._pending: Deque[_Pending] = collections.deque()
+        self._parser = StreamParser()
+        self._fd: Optional[int] = None
+        self._out = bytearray()
+        self._loop: Optional[asyncio.AbstractEventLoop] = None
+
+    async def open(self):
+        self._loop = asyncio.get_running_loop()
+        self._fd = os.open(self.port, os.O_RDWR | os.O_NOCTTY | os.O_NONBLOCK)
+        if os.isatty(self._fd):
+            tty.setraw(self._fd)
+            termios.tcflush(self._fd, termios.TCIOFLUSH)
+        self._loop.add_reader(self._fd, self._on_readable)
+
+    def close(self):
+        if self._fd is None:
+            return
+        self._loop.remove_reader(self._fd)
+        if self._out:
+            self._loop.remove_writer(self._fd)
+        os.close(self._fd)
+        self._fd = None
+        for pending in self._pending:
+            if pending.timer is not None:
+                pending.timer.cancel()
+            if not pending.future.done():
+                pending.future.set_exception(ConnectionError(self.port + " closed"))
+        self._pending.clear()
+
+    async def __aenter__(self):
+        await self.open()
+        return self
+
+    async def __aexit__(self, *exc):
+        self.close()
+
+    async def command(self, number: int, *fields: Any,
+                      timeout: Optional[float] = None) -> Item:
+        """Sends a command and waits for its reply: a Response, or the record
+        of C05 (RangeRecord), C11 (BurstRecord) and C18 (RtosRecord). The
+        reply of C17 is its R17 Response, with the T17 lines in lines.
+        Raises CommandError if the board answers with a failure."""
+        async with self._slots:
+            pending = _Pending(number, fields, self._loop.create_future(),
+                               timeout or self.timeout)
+            self._pending.append(pending)
+            if len(self._pending) == 1:
+                self._start_timer()
+            self._write(encode_command(number, *fields))
+            # If the caller gives up, the command stays in the queue until its
+            # reply or its timeout, so that the reply is not matched to the
+            # next command.
+            return await pending.future
+
+    def _write(self, data: bytes):
+        if not self._out:
+            try:
+                data = data[os.write(self._fd, data):]
+            except BlockingIOError:
+                pass
+            if data:
+                self._loop.add_writer(self._fd, self._on_writable)
+        self._out += data
+
+    def _on_writable(self):
+        try:
+            del self._out[:os.write(self._fd, self._out)]
+        except BlockingIOError:
+            return
+        if not self._out:
+            self._loop.remove_writer(self._fd)
+
+    def _on_readable(self):
+        try:
+            data = os.read(self._fd, 4096)
+        except (BlockingIOError, InterruptedError):
+            return
+        except OSError as error:
+            # The board was unplugged
+            self.close()
+            self.records.put_nowait(error)
+            return
+        for item in self._parser.feed(data):
+            if not self._match(item):
+                self.records.put_nowait(item)
+
+    def _match(self, item: Item) -> bool:
+        """Completes the command that item is the reply of, if any."""
+        if not self._pending:
+            return False
+        pending = self._pending[0]
+
+        if isinstance(item, Failure):
+            self._complete(pending, exception=CommandError(item.text))
+            return True
+        if pending.expected:
+            if isinstance(item, Response) and item.tag == "T17":
+                pending.reply.lines.append(item)
+                if len(pending.reply.lines) == pending.expected:
+                    self._complete(pending, result=pending.reply)
+                return True
+            return False
+
+        if isinstance(item, Response) and item.tag.startswith("R"):
+            for pending in self._pending:
+                if item.tag == "R%02d" % pending.number:
+                    break
+            else:
+                return False
+            # The board answers in order, so the commands before lost theirs
+            while self._pending[0] is not pending:
+                self._complete(self._pending[0], exception=asyncio.TimeoutError())
+            if pending.number == 17 and int(item.fields[1]) > 0:
+                # The trace lines follow
+                pending.reply = item
+                pending.expected = int(item.fields[1])
+                return True
+            self._complete(pending, result=item)
+            return True
+        # Ranging records are not numbered, and the on-board scheduler outputs
+        # R05 as well, so they only complete the oldest command.
+        if ((pending.number == 5 and isinstance(item, RangeRecord) and item.is_initiator
+             and pending.fields and item.neighbour_id == pending.fields[0])
+                or (pending.number == 11 and isinstance(item, BurstRecord))
+                or (pending.number == 18 and isinstance(item, RtosRecord))):
+            self._complete(pending, result=item)
+            return True
+        return False
+
+    def _start_timer(self):
+        """Starts the timeout of the oldest command, which the board is now
+        executing."""
+        if self._pending:
+            pending = self._pending[0]
+            pending.timer = self._loop.call_later(pending.timeout, self._expire,
+                                                  pending)
+
+    def _expire(self, pending: _Pending):
+        """Drops a command whose reply was lost."""
+        if self._pending and self._pending[0] is pending:
+            self._complete(pending, exception=asyncio.TimeoutError())
+
+    def _complete(self, pending: _Pending, result: Any = None,
+                  exception: Optional[Exception] = None):
+        self._pending.popleft()
+        pending.timer.cancel()
+        self._start_timer()
+        if pending.future.done():
+            return  # Given up on
+        if exception is not None:
+            pending.future.set_exception(exception)
+        else:
+            pending.future.set_result(result)
+
+
+async def open_boards(ports: Iterable[str], **kwargs) -> List[Board]:
+    """Opens a Board on each port."""
+    boards = [Board(port, **kwargs) for port in ports]
+    for board in boards:
+        await board.open()
+    return boards
+
+
+async def command_all(boards: Iterable[Board], number: int, *fields: Any,
+                      return_exceptions: bool = True) -> List[Any]:
+    """Sends the same command to every board at once. Failures are returned
+    in place of the replies unless return_exceptions is False."""
+    return await asyncio.gather(*(b.command(number, *fields) for b in boards),
+                                return_exceptions=return_exceptions)
@@ -0,0 +1,417 @@
+"""
+Offline decoder of logs of the ASCII output of the firmware. The R05/S05 and
+S01 lines of a log are decoded into numpy structured arrays, one column per
+field, and the ranges, TDOA pseudo-ranges and skew-corrected distances are
+computed again from the raw time-stamps, with the integer arithmetic of
+src/core/ranging_math.c.
+
+    python -m uwb.logs test.log --save test.npz
+
+or from a script:
+
+    log = load("test.log")
+    ds = log.ranges[log.ranges["ds_twr"]]
+    print(ds["neighbour_id"], ds["range"])
+
+The file is memory-mapped and decoded in chunks of whole lines. Every step
+is a numpy operation on a whole column, so no Python code runs per line.
+Lines of other kinds, and lines that do not parse, are skipped. Needs numpy.
+"""
+import argparse
+import sys
+import time
+from dataclasses import dataclass
+
+import numpy as np
+
+# See ranging_math.h
+TS_MASK = np.uint64((1 << 40) - 1)  # The DW1000 clock wraps around every 17.2 s
+TOF_FRAC_BITS = 6
+TOF_TO_METRES = np.float32(7.3286826e-5)
+_SKEW_SCALE = np.float32(1e-6) * np.float32(1 << TOF_FRAC_BITS)
+
+_TS = ["tx1", "rx1", "tx2", "rx2", "tx3", "rx3"]
+_PASSIVE_TS = ["rx1", "rx2", "rx3", "tx1_n", "rx1_n", "tx2_n", "rx2_n",
+               "tx3_n", "rx3_n"]
+_PASSIVE_FLOATS = ["fpp1", "fpp2", "fpp3", "skew1", "skew2", "skew3",
+                   "fpp1_n", "fpp2_n", "skew1_n", "skew2_n"]
+
+# R05 (initiator) and S05 (target) lines. distance is the one computed by the
+# board; range is computed again without the skew correction of SS-TWR, and
+# range_skew with it. Both are the same for DS-TWR.
+RANGE_DTYPE = np.dtype(
+    [("offset", "<u8"), ("initiator", "?"), ("neighbour_id", "u1"),
+     ("ds_twr", "?"), ("distance", "<f4")]
+    + [(name, "<u8") for name in _TS]
+    + [(name, "<f4") for name in ["fpp1", "fpp2", "skew1", "skew2"]]
+    + [("range", "<f4"), ("range_skew", "<f4")])
+
+# S01 lines. tdoa and range are computed as the S14 output of the listener
+# would have them, see outputPassive(). has_range is set if the initiator sent
+# its final message, which makes range the distance between the two boards.
+PASSIVE_DTYPE = np.dtype(
+    [("offset", "<u8"), ("initiator_id", "u1"), ("target_id", "u1"),
+     ("complete", "?"), ("ds_twr", "?"), ("has_range", "?")]
+    + [(name, "<u8") for name in _PASSIVE_TS]
+    + [(name, "<f4") for name in _PASSIVE_FLOATS]
+    + [("tdoa", "<f4"), ("range", "<f4")])
+
+_NL, _CR, _PIPE, _MINUS, _DOT = (ord(c) for c in "\n\r|-.")
+_RANGE_PIPES = 12
+_PASSIVE_PIPES = 21
+
+# Widest field: a 40-bit time-stamp has up to 13 digits
+_PAD = 16
+
+
+@dataclass
+class Log:
+    ranges: np.ndarray  # RANGE_DTYPE
+    passive: np.ndarray  # PASSIVE_DTYPE
+    skipped: int = 0  # R05, S05 and S01 lines that could not be decoded
+
+
+# Kernels of ranging_math.c, element-wise ---------------------------------------
+def ts_diff(later: np.ndarray, earlier: np.ndarray) -> np.ndarray:
+    """tsDiff(): later - earlier, modulo the wrap-around of the clock."""
+    return (later - earlier) & TS_MASK
+
+
+def _cdiv(num: np.ndarray, den) -> np.ndarray:
+    # Integer division truncated toward zero, as in C
+    q = np.abs(num) // np.abs(den)
+    return np.where((num < 0) != (np.asarray(den) < 0), -q, q)
+
+
+def _div_round(num: np.ndarray, den: np.ndarray) -> np.ndarray:
+    den = np.where(den == 0, 1, den)
+    half = _cdiv(den, 2)
+    return _cdiv(np.where((num < 0) != (den < 0), num - half, num + half), den)
+
+
+def _cross_diff(ra1, ra2, db1, db2) -> np.ndarray:
+    # Ra1*Db2 - Ra2*Db1 modulo 2^64, see crossDiff()
+    return (ra1 * db2 - ra2 * db1).view(np.int64)
+
+
+def _skew_corr(db: np.ndarray, skew: np.ndarray) -> np.ndarray:
+    # Rounded Db*skew, in single precision like the firmware
+    corr = db.astype(np.float32) * skew.astype(np.float32) * _SKEW_SCALE
+    half = np.where(corr < 0, np.float32(-0.5), np.float32(0.5))
+    return np.trunc(corr + half).astype(np.int64)
+
+
+def _signed_diff(a: np.ndarray, b: np.ndarray) -> np.ndarray:
+    return a.view(np.int64) - b.view(np.int64)
+
+
+def tof_ss(ra, db) -> np.ndarray:
+    """tofSS()"""
+    return (_signed_diff(ra, db) * (1 << TOF_FRAC_BITS) // 2).astype(np.int32)
+
+
+def tof_ss_skew(ra, db, skew) -> np.ndarray:
+    """tofSSSkew()"""
+    diff = _signed_diff(ra, db) * (1 << TOF_FRAC_BITS)
+    return _cdiv(diff - _skew_corr(db, skew), 2).astype(np.int32)
+
+
+def tof_ds(ra1, ra2, db1, db2) -> np.ndarray:
+    """tofDS()"""
+    tof = _div_round(_cross_diff(ra1, ra2, db1, db2) * (1 << TOF_FRAC_BITS),
+                     2 * db2.view(np.int64))
+    return np.where(db2 == 0, 0, tof).astype(np.int32)
+
+
+def tdoa_ss(rp, db, skew) -> np.ndarray:
+    """tdoaSS()"""
+    diff = _signed_diff(rp, db) * (1 << TOF_FRAC_BITS)
+    return (diff - _skew_corr(db, skew)).astype(np.int32)
+
+
+def tdoa_ds(rp1, rp2, db1, db2) -> np.ndarray:
+    """tdoaDS()"""
+    tdoa = _div_round(_cross_diff(rp1, rp2, db1, db2) * (1 << TOF_FRAC_BITS),
+                      db2.view(np.int64))
+    return np.where(db2 == 0, 0, tdoa).astype(np.int32)
+
+
+def tof_to_distance(tof: np.ndarray) -> np.ndarray:
+    """tofToDistance()"""
+    return tof.astype(np.float32) * TOF_TO_METRES
+
+
+# Parsing -----------------------------------------------------------------------
+# The digits of a field are read as little-endian 64-bit words, right-aligned
+# on the end of the field, and converted 8 at a time with integer arithmetic
+# on the whole column ("SWAR"). Bytes before the field are replaced by "0".
+# The characters of the lines are checked beforehand, so only a "." or "-"
+# out of place has to be caught in a field.
+_U64 = np.dtype("<u8")
+_ZEROS = np.uint64(0x3030303030303030)
+_HIGH = np.uint64(0xF0F0F0F0F0F0F0F0)
+
+# For n = 0 to 8: the bytes of the last n characters of a word, and "0" in
+# the others
+_KEEP = np.array([((1 << 64) - 1) ^ ((1 << (64 - 8 * n)) - 1) for n in range(9)],
+                 dtype=_U64)
+_FILL = _ZEROS & ~_KEEP
+
+
+def _swar8(word):
+    """Value of 8 ASCII digits, the first one in the lowest byte."""
+    word = word - _ZEROS
+    word = (word * np.uint64(10) + (word >> np.uint64(8))) & np.uint64(0x00FF00FF00FF00FF)
+    word = (word * np.uint64(100) + (word >> np.uint64(16))) & np.uint64(0x0000FFFF0000FFFF)
+    return (word * np.uint64(10000) + (word >> np.uint64(32))) & np.uint64(0xFFFFFFFF)
+
+
+class _Lines:
+    """The lines of buf. buf starts with _PAD bytes of padding and ends with
+    a newline."""
+
+    def __init__(self, buf):
+        self.buf = buf
+        self.special = np.flatnonzero((buf == _PIPE) | (buf == _NL))
+        self.newlines = np.flatnonzero(buf[self.special] == _NL)  # In special
+        self.prev = np.empty_like(self.newlines)
+        self.prev[0] = -1
+        self.prev[1:] = self.newlines[:-1]
+        self.num_pipes = self.newlines - self.prev - 1
+
+        self.starts = np.empty_like(self.newlines)
+        self.starts[0] = 0
+        self.starts[1:] = self.special[self.newlines[:-1]] + 1
+        self.ends = self.special[self.newlines]
+        self.ends -= buf[self.ends - 1] == _CR
+
+        # First 3 bytes of each line, which is at least 4 bytes long if
+        # selected
+        head = np.minimum(self.starts, len(buf) - 4)
+        self.code = ((buf[head].astype(np.uint32) << 16)
+                     | (buf[head + 1].astype(np.uint32) << 8) | buf[head + 2])
+        self.valid = (buf[head + 3] == _PIPE) & self._valid_chars()
+
+        # The 8 bytes from any position p, as words[p % 8][p // 8], so that
+        # they are read with aligned loads
+        num = len(buf) // 8 + 1
+        padded = np.zeros(8 * num + 8, dtype=np.uint8)
+        padded[:len(buf)] = buf
+        self.words = np.empty((8, num), dtype=_U64)
+        for r in range(8):
+            self.words[r] = np.frombuffer(padded, dtype=_U64, count=num, offset=r)
+        self.words = self.words.ravel()
+
+    def _valid_chars(self):
+        # Lines with nothing but digits, "|", ".", "-" and "\r" after the
+        # first character
+        buf = self.buf
+        other = ((buf - np.uint8(ord("0")) > 9) & (buf != _PIPE) & (buf != _DOT)
+                 & (buf != _MINUS) & (buf != _CR) & (buf != _NL))
+        other[self.starts] = False
+        lines = np.searchsorted(self.starts, np.flatnonzero(other), side="right") - 1
+        valid = np.ones(len(self.starts), dtype=bool)
+        valid[lines] = False
+        return valid
+
+    def word(self, end):
+        """The 8 bytes before each position of end."""
+        pos = end - 8
+        return self.words[(pos & 7) * (len(self.words) // 8) + (pos >> 3)]
+
+    def select(self, tags, num_pipes):
+        """The lines that start with one of tags and have num_pipes fields."""
+        tagged = np.zeros(len(self.code), dtype=bool)
+        for tag in tags:
+            tagged |= self.code == _tag(tag)
+        wanted = tagged & self.valid & (self.num_pipes == num_pipes)
+        cols = _Columns(self, np.flatnonzero(wanted), num_pipes)
+        cols.rejected = int(tagged.sum()) - len(cols.bad)
+        return cols
+
+
+def _digits(lines, start, end, width):
+    """Values of the unsigned decimal fields [start, end) of lines, up to width
+    (8 or 16) digits long, and the mask of the fields that are not."""
+    length = end - start
+    bad = (length < 1) | (length > width)
+
+    n = np.clip(length, 0, 8)
+    word = (lines.word(end) & _KEEP[n]) | _FILL[n]
+    bad |= (word & _HIGH) != _ZEROS
+    value = _swar8(word)
+    if width == 16:
+        n = np.clip(length - 8, 0, 8)
+        word = (lines.word(end - 8) & _KEEP[n]) | _FILL[n]
+        bad |= (word & _HIGH) != _ZEROS
+        value += _swar8(word) * np.uint64(100000000)
+    return value, bad
+
+
+def _floats(lines, start, end, width):
+    """Fields printed by convert_float_to_string(), "-12.3456", or "0", with
+    up to width digits before the point."""
+    neg = lines.buf[start] == _MINUS
+    start = start + neg
+    dot = (end - start >= 6) & (lines.buf[end - 5] == _DOT)
+    integer, bad = _digits(lines, start, np.where(dot, end - 5, end), width)
+    frac, bad_frac = _digits(lines, end - 4, end, 8)
+    value = integer + np.where(dot, frac, 0) / 1e4
+    return np.where(neg, -value, value), bad | (dot & bad_frac)
+
+
+class _Columns:
+    """The fields of some of the lines, as (start, end) positions."""
+
+    def __init__(self, lines, selected, num_pipes):
+        pipes = lines.special[lines.prev[selected][:, None] + 1 + np.arange(num_pipes)]
+        self.lines = lines
+        self.starts = lines.starts[selected]
+        self.code = lines.code[selected]
+        self.start = pipes + 1
+        self.end = np.empty_like(pipes)
+        self.end[:, :-1] = pipes[:, 1:]
+        self.end[:, -1] = lines.ends[selected]
+        self.bad = np.zeros(len(selected), dtype=bool)
+        self.rejected = 0  # Lines with the tag, but not the format
+
+    def ints(self, first, num, width=8):
+        """Fields first to first + num - 1, one column each."""
+        cols = slice(first, first + num)
+        value, bad = _digits(self.lines, self.start[:, cols], self.end[:, cols], width)
+        self.bad |= bad.any(axis=1)
+        return value
+
+    def ts(self, first, num):
+        return self.ints(first, num, 16)
+
+    def floats(self, first, num, width=8):
+        cols = slice(first, first + num)
+        value, bad = _floats(self.lines, self.start[:, cols], self.end[:, cols], width)
+        self.bad |= bad.any(axis=1)
+        return value.astype(np.float32)
+
+
+def _tag(tag: bytes) -> int:
+    return int.from_bytes(tag, "big")
+
+
+def _decode_ranges(lines, base):
+    cols = lines.select((b"R05", b"S05"), _RANGE_PIPES)
+    rec = np.zeros(len(cols.bad), dtype=RANGE_DTYPE)
+    rec["offset"] = cols.starts - _PAD + base
+    rec["initiator"] = cols.code == _tag(b"R05")
+    rec["neighbour_id"] = cols.ints(0, 1)[:, 0]
+    rec["distance"] = cols.floats(1, 1, 16)[:, 0]
+    ts = cols.ts(2, 6)
+    for k, name in enumerate(_TS):
+        rec[name] = ts[:, k]
+    floats = cols.floats(8, 4)
+    for k, name in enumerate(["fpp1", "fpp2", "skew1", "skew2"]):
+        rec[name] = floats[:, k]
+    rec = rec[~cols.bad]
+
+    # The SS-TWR lines have no third signal
+    rec["ds_twr"] = (rec["tx3"] != 0) | (rec["rx3"] != 0)
+    ra1 = ts_diff(rec["rx2"], rec["tx1"])
+    db1 = ts_diff(rec["tx2"], rec["rx1"])
+    tof = tof_ds(ra1, ts_diff(rec["rx3"], rec["rx2"]), db1, ts_diff(rec["tx3"], rec["tx2"]))
+    ds = rec["ds_twr"]
+    rec["range"] = tof_to_distance(np.where(ds, tof, tof_ss(ra1, db1)))
+    rec["range_skew"] = tof_to_distance(np.where(ds, tof, tof_ss_skew(ra1, db1, rec["skew2"])))
+    return rec, cols.rejected + int(cols.bad.sum())
+
+
+def _decode_passive(lines, base):
+    cols = lines.select((b"S01",), _PASSIVE_PIPES)
+    rec = np.zeros(len(cols.bad), dtype=PASSIVE_DTYPE)
+    rec["offset"] = cols.starts - _PAD + base
+    ids = cols.ints(0, 2)
+    rec["initiator_id"] = ids[:, 0]
+    rec["target_id"] = ids[:, 1]
+    ts = cols.ts(2, 9)
+    for k, name in enumerate(_PASSIVE_TS):
+        rec[name] = ts[:, k]
+    floats = cols.floats(11, 10)
+    for k, name in enumerate(_PASSIVE_FLOATS):
+        rec[name] = floats[:, k]
+    rec = rec[~cols.bad]
+
+    # Incomplete exchanges are printed with all zeros
+    rec["complete"] = (rec["rx1"] != 0) | (rec["rx2"] != 0) | (rec["rx3"] != 0)
+    rec["ds_twr"] = rec["tx3_n"] != 0
+    rec["has_range"] = rec["tx1_n"] != 0
+
+    rp1 = ts_diff(rec["rx2"], rec["rx1"])
+    db1 = ts_diff(rec["tx2_n"], rec["rx1_n"])
+    db2 = ts_diff(rec["tx3_n"], rec["tx2_n"])
+    ra1 = ts_diff(rec["rx2_n"], rec["tx1_n"])
+    ds = rec["ds_twr"]
+    pseudo = np.where(ds, tdoa_ds(rp1, ts_diff(rec["rx3"], rec["rx2"]), db1, db2),
+                      tdoa_ss(rp1, db1, rec["skew2"]))
+    tof = np.where(ds, tof_ds(ra1, ts_diff(rec["rx3_n"], rec["rx2_n"]), db1, db2),
+                   tof_ss_skew(ra1, db1, rec["skew2_n"]))
+    tof = np.where(rec["has_range"], tof, 0).astype(np.int32)
+    complete = rec["complete"]
+    rec["tdoa"] = np.where(complete, tof_to_distance(pseudo - tof), 0)
+    rec["range"] = np.where(complete, tof_to_distance(tof), 0)
+    return rec, cols.rejected + int(cols.bad.sum())
+
+
+def decode(data, base: int = 0) -> Log:
+    """Decodes whole lines of a log. A last line without its newline is
+    decoded as well. base is added to the offsets of the lines."""
+    data = np.frombuffer(data, dtype=np.uint8) if not isinstance(data, np.ndarray) else data
+    buf = np.empty(_PAD + len(data) + 1, dtype=np.uint8)
+    buf[:_PAD] = _NL
+    buf[_PAD:-1] = data
+    buf[-1] = _NL
+    lines = _Lines(buf)
+    ranges, bad_ranges = _decode_ranges(lines, base)
+    passive, bad_passive = _decode_passive(lines, base)
+    return Log(ranges, passive, bad_ranges + bad_passive)
+
+
+def load(path: str, chunk_size: int = 1 << 20) -> Log:
+    """Memory-maps a log file and decodes it chunk_size bytes at a time."""
+    try:
+        data = np.memmap(path, dtype=np.uint8, mode="r")
+    except ValueError:  # Empty file
+        return decode(b"")
+
+    logs = []
+    pos = 0
+    while pos < len(data):
+        end = min(pos + chunk_size, len(data))
+        if end < len(data):
+            # Cut after the last complete line of the chunk
+            newlines = np.flatnonzero(data[pos:end] == _NL)
+            if len(newlines):
+                end = pos + newlines[-1] + 1
+        logs.append(decode(data[pos:end], pos))
+        pos = end
+
+    return Log(np.concatenate([log.ranges for log in logs]),
+               np.concatenate([log.passive for log in logs]),
+               sum(log.skipped for log in logs))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode R05/S05/S01 logs.")
+    parser.add_argument("log")
+    parser.add_argument("--save", help="Write the arrays to this .npz file")
+    args = parser.parse_args()
+
+    start = time.perf_counter()
+    log = load(args.log)
+    elapsed = time.perf_counter() - start
+    num = len(log.ranges) + len(log.passive)
+    print("%d ranges, %d passive records, %d skipped lines in %.2f s (%.0f records/s)"
+          % (len(log.ranges), len(log.passive), log.skipped, elapsed,
+             num / elapsed if elapsed > 0 else 0))
+    if args.save:
+        np.savez(args.save, ranges=log.ranges, passive=log.passive)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,431 @@
+"""
+Decoder for the binary records sent by the firmware once the output mode has
+been switched with the command
+
+    C10|1\r
+
+Every record is framed as
+
+    | sync (0xA5) | version | type | seq | len (2) | payload (len) | crc (2) |
+
+with all fields little-endian. The CRC is CRC-16/CCITT-FALSE computed over
+everything between the sync byte and the CRC itself. See
+include/core/records.h for the payload layouts, which must be kept in sync
+with the struct formats below.
+
+Command responses (R00, R01, ...) are always sent as ASCII lines, so the
+decoder also passes through any ASCII line found between binary frames. The
+S06 and R03 lines carry raw bytes after a 2-byte length, and are framed by
+that length rather than by their "\r\n".
+"""
+import struct
+from dataclasses import dataclass
+from typing import List, Optional, Union
+
+SYNC_BYTE = 0xA5
+VERSION = 3  # 40-bit time-stamps since version 2, packed into 5 bytes since 3
+HEADER = struct.Struct("<BBBBH")
+CRC = struct.Struct("<H")
+MAX_PAYLOAD_LEN = 9 + 4 * 512  # A windowed CIR record of complex taps
+
+TYPE_PASSIVE = 0x01
+TYPE_RANGE = 0x05
+TYPE_CIR = 0x10
+TYPE_BURST = 0x11
+TYPE_CIR_WINDOW = 0x13
+TYPE_TDOA = 0x14
+TYPE_RTOS = 0x18
+
+FLAG_INITIATOR = 0x01
+FLAG_DS_TWR = 0x02
+FLAG_INCOMPLETE = 0x04
+FLAG_SKEW_CORR = 0x08
+FLAG_HAS_RANGE = 0x10
+FLAG_BIAS_CORR = 0x20
+
+CIR_FLAG_IQ = 0x01
+
+# Time-stamps are sent as 5 bytes, which struct has no format for. They are
+# unpacked as a uint32 and a uint8, see _join_ts().
+_RANGE = struct.Struct("<BBf" + "IB" * 6 + "4f")
+_PASSIVE = struct.Struct("<BBB" + "IB" * 9 + "10f")
+_TDOA = struct.Struct("<BBB4f")
+_CIR_HEADER = struct.Struct("<BBHH")
+_CIR_WINDOW_HEADER = struct.Struct("<BBHHHB")
+_RTOS_HEADER = struct.Struct("<IIIHBB")
+_RTOS_TASK = struct.Struct("<12sBBHI")
+_RTOS_QUEUE = struct.Struct("<12sBBB")
+_RTOS_USB = struct.Struct("<IIIIHH")
+
+# Prefix of the lines with a length-prefixed binary field, and the number of
+# "|" up to that field.
+_BINARY_LINES = {b"S06|": 1, b"R03|": 6}
+
+
+def _join_ts(fields, start: int, count: int) -> list:
+    """Joins count (low, high) time-stamp pairs from fields[start:]."""
+    ts = [fields[start + 2 * i] | fields[start + 2 * i + 1] << 32
+          for i in range(count)]
+    return list(fields[:start]) + ts + list(fields[start + 2 * count:])
+
+
+def _range(seq: int, payload: bytes, offset: int = 0) -> "RangeRecord":
+    return RangeRecord(seq, *_join_ts(_RANGE.unpack_from(payload, offset), 3, 6))
+
+
+def crc16(data: bytes, crc: int = 0xFFFF) -> int:
+    """CRC-16/CCITT-FALSE, matching recordsCrc16() in the firmware."""
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+@dataclass
+class RangeRecord:
+    """Binary equivalent of the R05 (initiator) and S05 (target) strings."""
+    seq: int
+    neighbour_id: int
+    flags: int
+    distance: float
+    tx1: int
+    rx1: int
+    tx2: int
+    rx2: int
+    tx3: int
+    rx3: int
+    fpp1: float
+    fpp2: float
+    skew1: float
+    skew2: float
+
+    @property
+    def is_initiator(self) -> bool:
+        return bool(self.flags & FLAG_INITIATOR)
+
+    @property
+    def is_ds_twr(self) -> bool:
+        return bool(self.flags & FLAG_DS_TWR)
+
+    @property
+    def is_skew_corrected(self) -> bool:
+        return bool(self.flags & FLAG_SKEW_CORR)
+
+    @property
+    def is_bias_corrected(self) -> bool:
+        return bool(self.flags & FLAG_BIAS_CORR)
+
+
+@dataclass
+class PassiveRecord:
+    """Binary equivalent of the S01 string."""
+    seq: int
+    initiator_id: int
+    target_id: int
+    flags: int
+    rx1: int
+    rx2: int
+    rx3: int
+    tx1_n: int
+    rx1_n: int
+    tx2_n: int
+    rx2_n: int
+    tx3_n: int
+    rx3_n: int
+    fpp1: float
+    fpp2: float
+    fpp3: float
+    skew1: float
+    skew2: float
+    skew3: float
+    fpp1_n: float
+    fpp2_n: float
+    skew1_n: float
+    skew2_n: float
+
+    @property
+    def is_complete(self) -> bool:
+        return not self.flags & FLAG_INCOMPLETE
+
+
+@dataclass
+class TdoaRecord:
+    """Binary equivalent of the S14 string: the pseudo-range computed by a
+    passive listener, tdoa = d(target, listener) - d(initiator, listener).
+    Without has_range, range is 0 and tdoa still includes the distance
+    between the initiator and the target."""
+    seq: int
+    initiator_id: int
+    target_id: int
+    flags: int
+    tdoa: float
+    range: float
+    fpp1: float
+    fpp2: float
+
+    @property
+    def is_complete(self) -> bool:
+        return not self.flags & FLAG_INCOMPLETE
+
+    @property
+    def has_range(self) -> bool:
+        return bool(self.flags & FLAG_HAS_RANGE)
+
+
+@dataclass
+class CirRecord:
+    """Binary equivalent of the S10 string."""
+    seq: int
+    initiator_id: int
+    target_id: int
+    first_path_idx: float
+    taps: List[int]
+
+
+@dataclass
+class CirWindowRecord:
+    """Binary equivalent of the S13 string: the taps of the CIR around the
+    first path. The taps are magnitudes, or complex numbers if is_iq."""
+    seq: int
+    initiator_id: int
+    target_id: int
+    first_path_idx: float
+    first_tap: int
+    flags: int
+    taps: List[Union[int, complex]]
+
+    @property
+    def is_iq(self) -> bool:
+        return bool(self.flags & CIR_FLAG_IQ)
+
+
+@dataclass
+class BurstRecord:
+    """Binary equivalent of the R11 string: the ranges obtained by one
+    multi-target burst at the initiator."""
+    seq: int
+    ranges: List[RangeRecord]
+
+
+@dataclass
+class RtosTask:
+    name: str
+    priority: int
+    state: int  # eTaskState, 0 running to 4 deleted
+    stack_free: int  # Least free stack since startup, in words
+    run_time: int
+
+
+@dataclass
+class RtosQueue:
+    name: str
+    size: int
+    used: int
+    peak: int
+
+
+@dataclass
+class RtosUsb:
+    """Transmit ring buffer of the USB link. Counts since startup."""
+    queued_bytes: int
+    sent_bytes: int
+    dropped_msgs: int  # Output lost because the ring was full
+    dropped_bytes: int
+    high_water: int  # Most bytes waiting in the ring
+    pending: int
+
+
+@dataclass
+class RtosRecord:
+    """Answer to C18: a snapshot of the tasks and mail queues of the
+    firmware. Run times are in units of 1/run_time_hz s and wrap around."""
+    seq: int
+    tick: int
+    run_time: int
+    run_time_hz: int
+    cpu_load: float  # Over the last second, 0 to 1
+    tasks: List[RtosTask]
+    queues: List[RtosQueue]
+    usb: Optional[RtosUsb]  # None from firmware without the USB statistics
+
+
+Record = Union[RangeRecord, PassiveRecord, TdoaRecord, CirRecord,
+               CirWindowRecord, BurstRecord, RtosRecord]
+
+
+def decode_payload(rec_type: int, seq: int, payload: bytes) -> Optional[Record]:
+    """Converts the payload of a frame into a record object. Unknown record
+    types are returned as None, so that newer firmware does not break older
+    host scripts."""
+    if rec_type == TYPE_RANGE:
+        return _range(seq, payload)
+    if rec_type == TYPE_PASSIVE:
+        return PassiveRecord(seq, *_join_ts(_PASSIVE.unpack(payload), 3, 9))
+    if rec_type == TYPE_TDOA:
+        return TdoaRecord(seq, *_TDOA.unpack(payload))
+    if rec_type == TYPE_CIR:
+        initiator, target, fp_idx, num_taps = _CIR_HEADER.unpack_from(payload)
+        taps = list(struct.unpack_from("<%dH" % num_taps, payload,
+                                       _CIR_HEADER.size))
+        return CirRecord(seq, initiator, target, fp_idx / 64.0, taps)
+    if rec_type == TYPE_BURST:
+        ranges = [_range(seq, payload, 1 + i * _RANGE.size)
+                  for i in range(payload[0])]
+        return BurstRecord(seq, ranges)
+    if rec_type == TYPE_CIR_WINDOW:
+        (initiator, target, fp_idx, first_tap, num_taps,
+         flags) = _CIR_WINDOW_HEADER.unpack_from(payload)
+        if flags & CIR_FLAG_IQ:
+            values = struct.unpack_from("<%dh" % (2 * num_taps), payload,
+                                        _CIR_WINDOW_HEADER.size)
+            taps = [complex(re, im) for re, im in zip(values[0::2], values[1::2])]
+        else:
+            taps = list(struct.unpack_from("<%dH" % num_taps, payload,
+                                           _CIR_WINDOW_HEADER.size))
+        return CirWindowRecord(seq, initiator, target, fp_idx / 64.0,
+                               first_tap, flags, taps)
+    if rec_type == TYPE_RTOS:
+        (tick, run_time, run_time_hz, load, num_tasks,
+         num_queues) = _RTOS_HEADER.unpack_from(payload)
+        offset = _RTOS_HEADER.size
+        tasks = []
+        for _ in range(num_tasks):
+            name, *fields = _RTOS_TASK.unpack_from(payload, offset)
+            tasks.append(RtosTask(_name(name), *fields))
+            offset += _RTOS_TASK.size
+        queues = []
+        for _ in range(num_queues):
+            name, *fields = _RTOS_QUEUE.unpack_from(payload, offset)
+            queues.append(RtosQueue(_name(name), *fields))
+            offset += _RTOS_QUEUE.size
+        usb = None
+        if len(payload) >= offset + _RTOS_USB.size:
+            usb = RtosUsb(*_RTOS_USB.unpack_from(payload, offset))
+        return RtosRecord(seq, tick, run_time, run_time_hz, load / 1000.0,
+                          tasks, queues, usb)
+    return None
+
+
+def _name(raw: bytes) -> str:
+    # Not NUL-terminated when RECORD_RTOS_NAME_LEN long
+    return raw.split(b"\0", 1)[0].decode("ascii", "replace")
+
+
+class RecordDecoder:
+    """
+    Incremental decoder. Feed it arbitrary chunks of the USB byte stream, and
+    it returns the binary records and ASCII lines completed so far.
+
+        decoder = RecordDecoder()
+        while True:
+            for item in decoder.feed(ser.read(ser.in_waiting or 1)):
+                print(item)
+
+    ASCII lines are returned as bytes, including their "\\r\\n" terminator.
+    """
+
+    def __init__(self):
+        self._buffer = bytearray()
+        self.crc_errors = 0
+        self.dropped_records = 0
+        self._last_seq = None
+
+    def feed(self, data: bytes) -> List[Union[Record, bytes]]:
+        self._buffer += data
+        out = []
+        while self._buffer:
+            if self._buffer[0] != SYNC_BYTE:
+                item = self._take_line()
+                if item is None:
+                    break
+                out.append(item)
+                continue
+
+            if len(self._buffer) < HEADER.size:
+                break
+            _, version, rec_type, seq, length = HEADER.unpack_from(self._buffer)
+            if version != VERSION or length > MAX_PAYLOAD_LEN:
+                self.crc_errors += 1
+                del self._buffer[0]
+                continue
+            frame_len = HEADER.size + length + CRC.size
+            if len(self._buffer) < frame_len:
+                break
+
+            frame = bytes(self._buffer[:frame_len])
+            (crc,) = CRC.unpack_from(frame, HEADER.size + length)
+            if crc16(frame[1:HEADER.size + length]) != crc:
+                # Not a valid frame. Resynchronise on the next sync byte.
+                self.crc_errors += 1
+                del self._buffer[0]
+                continue
+
+            del self._buffer[:frame_len]
+            self._check_seq(seq)
+            record = decode_payload(rec_type, seq, frame[HEADER.size:HEADER.size + length])
+            if record is not None:
+                out.append(record)
+        return out
+
+    def _take_line(self) -> Optional[bytes]:
+        length = self._binary_line_len()
+        if length is not None:
+            if length < 0 or len(self._buffer) < length:
+                return None
+            line = bytes(self._buffer[:length])
+            del self._buffer[:length]
+            return line
+
+        # A line ends at "\r\n", or wherever the next binary frame starts.
+        end = self._buffer.find(b"\r\n")
+        sync = self._buffer.find(bytes([SYNC_BYTE]))
+        if end >= 0 and (sync < 0 or end < sync):
+            line = bytes(self._buffer[:end + 2])
+            del self._buffer[:end + 2]
+            return line
+        if sync > 0:
+            line = bytes(self._buffer[:sync])
+            del self._buffer[:sync]
+            return line
+        return None
+
+    def _binary_line_len(self) -> Optional[int]:
+        """Length of the line at the start of the buffer if it has a binary
+        field, -1 if it is not known yet, and None for the other lines."""
+        prefix = bytes(self._buffer[:4])
+        if len(prefix) < 4:
+            if any(p.startswith(prefix) for p in _BINARY_LINES):
+                return -1
+            return None
+        if prefix not in _BINARY_LINES:
+            return None
+
+        # The text fields before the length cannot contain "|", nor end the
+        # line, which would make it a malformed one.
+        end = self._buffer.find(b"\r\n")
+        pos = -1
+        for _ in range(_BINARY_LINES[prefix]):
+            pos = self._buffer.find(b"|", pos + 1)
+            if 0 <= end < pos or (pos < 0 and end >= 0):
+                return None
+            if pos < 0:
+                return -1
+        if len(self._buffer) < pos + 3:
+            return -1
+        (length,) = struct.unpack_from("<H", self._buffer, pos + 1)
+        return pos + 3 + length + 2
+
+    def _check_seq(self, seq: int):
+        if self._last_seq is not None:
+            self.dropped_records += (seq - self._last_seq - 1) % 256
+        self._last_seq = seq
+
+
+def encode_frame(rec_type: int, seq: int, payload: bytes) -> bytes:
+    """Builds a frame exactly like sendRecord() in the firmware. Mostly useful
+    to generate test streams on the host."""
+    header = HEADER.pack(SYNC_BYTE, VERSION, rec_type, seq, len(payload))
+    crc = crc16(header[1:] + payload)
+    return header + payload + CRC.pack(crc)
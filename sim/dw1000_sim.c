@@ -0,0 +1,800 @@
+/**
+  ******************************************************************************
+  * @file    dw1000_sim.c
+  * @brief   Register-level model of the DW1000, sitting behind writetospi()
+  *          and readfromspi() in the host simulator build.
+  *
+  * The model keeps a plain register file and only gives meaning to the
+  * registers the decadriver and the ranging code rely on: SYS_CTRL commands,
+  * the write-1-to-clear SYS_STATUS, the TX/RX buffers and frame information,
+  * the 40-bit system clock and timestamps, delayed TX/RX against DX_TIME, the
+  * RX timeouts, the diagnostics used by bias.c and the accumulator, frame
+  * filtering and the double RX buffer.
+  *
+  * Every node has its own crystal, modelled as a constant frequency offset in
+  * ppm and a time offset. Frames are exchanged over the shared channel in
+  * sim_channel.c, where the receiver computes the time of flight from the
+  * node positions.
+  ******************************************************************************
+  */
+/* Includes ------------------------------------------------------------------*/
+#include "dw1000_sim.h"
+#include "deca_device_api.h"
+#include "deca_regs.h"
+#include "deca_param_types.h"
+#include "dwt_general.h"
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Defines -------------------------------------------------------------------*/
+#define DW_TICK_HZ (499.2e6*128.0)      // System clock, 15.65 ps per tick
+#define DW_TIME_MASK (0xFFFFFFFFFFULL)  // Timestamps wrap after 40 bits
+#define DW_TIME_HALF (0x8000000000ULL)
+#define DW_DX_TIME_MASK (0xFFFFFFFE00ULL) // Low 9 bits of DX_TIME are ignored
+#define DW_UUS (512.0/499.2e6)          // 1.0256 us, unit of timeouts and W4R
+
+#define SIM_REG_LEN (0x8000)            // Full 15-bit sub-address range
+#define SIM_TX_LATENCY (5e-6)           // [s] TXSTRT to start of preamble
+#define SIM_TX_POWER_UP (10e-6)         // [s] Minimum lead before a delayed preamble
+#define SIM_ACQ_SYMBOLS (16)            // Preamble symbols needed to lock on a frame
+#define SIM_RXPACC (128)
+#define SIM_FPP_STD (0.5)               // [dB] Spread of the first path power
+#define SIM_SKEW_STD (0.02)             // [ppm] Carrier integrator noise
+#define SIM_FP_INDEX (745)              // First path tap in the accumulator
+#define SIM_CIR_TAPS (1016)
+#define SIM_CIR_NOISE (40.0)
+#define SIM_F_MAX (26000.0)             // Keeps F1^2+F2^2+F3^2 inside an int
+
+/* Events of a received frame, which belong to its buffer with double
+ * buffering. */
+#define SIM_RX_FRAME_BITS (SYS_STATUS_RXPRD | SYS_STATUS_RXSFDD | SYS_STATUS_LDEDONE \
+                           | SYS_STATUS_RXPHD | SYS_STATUS_RXDFR | SYS_STATUS_RXFCG)
+
+#define SYS_STATE_TX_OFFSET (0)
+#define SYS_STATE_RX_OFFSET (1)
+#define SYS_STATE_PMSC_OFFSET (2)
+#define SIM_STATE_TX_ACTIVE (0x02)      // TX_STATE while sending the preamble
+#define SIM_STATE_RX_ACTIVE (0x01)      // RX_STATE while hunting for a preamble
+#define SIM_PMSC_IDLE (0x03)
+#define SIM_PMSC_TX (0x06)
+#define SIM_PMSC_RX (0x05)
+
+/* Typedefs ------------------------------------------------------------------*/
+typedef enum {RADIO_IDLE, RADIO_TX, RADIO_RX} RadioState;
+
+/* One of the two sets of the double RX buffer: the frame, its information,
+ * time-stamps and quality, and its events. */
+typedef struct {
+    int full;
+    uint8_t data[SIM_MAX_FRAME_LEN];
+    uint8_t finfo[RX_FINFO_LEN];
+    uint8_t time[RX_TIME_LLEN];
+    uint8_t fqual[RX_FQUAL_LEN];
+    uint32_t status;
+} RxBufferSet;
+
+/* Private variables ---------------------------------------------------------*/
+/* One process simulates one node, so the radio is a singleton. */
+static struct {
+    pthread_mutex_t lock;
+    SimChannel *ch;
+    int node;
+    double ppm;
+    DwSimConfig cfg;
+    unsigned int rng;
+    uint8_t regs[0x40][SIM_REG_LEN];
+
+    RadioState state;
+
+    /* Frame being transmitted */
+    uint32_t tx_seq;
+    double tx_end;
+    uint64_t tx_stamp, tx_raw;
+    int rx_after_tx;
+    double rx_after_tx_delay;
+
+    /* Receiver */
+    double rx_on;
+    double fwto_deadline;
+    double pto_deadline;
+    uint32_t scan_seq; // Oldest channel frame that could still be received
+
+    /* Double buffer. The registers always show the host side set. */
+    RxBufferSet rx_sets[2];
+    int ic_set, host_set;
+
+    DwSimStats stats;
+} dw;
+
+/* Private functions ---------------------------------------------------------*/
+static uint64_t regGet(uint8_t reg, uint16_t off, int len){
+    uint64_t val = 0;
+    int i;
+    for (i = len - 1; i >= 0; i--){
+        val = (val << 8) | dw.regs[reg][off + i];
+    }
+    return val;
+}
+
+static void regSet(uint8_t reg, uint16_t off, int len, uint64_t val){
+    int i;
+    for (i = 0; i < len; i++){
+        dw.regs[reg][off + i] = (uint8_t)(val >> (8*i));
+    }
+}
+
+static void setStatus(uint64_t bits){
+    regSet(SYS_STATUS_ID, 0, SYS_STATUS_LEN, regGet(SYS_STATUS_ID, 0, SYS_STATUS_LEN) | bits);
+}
+
+static int doubleBuffered(void){
+    return !(regGet(SYS_CFG_ID, 0, 4) & SYS_CFG_DIS_DRXB);
+}
+
+static void saveRxSet(RxBufferSet *set){
+    memcpy(set->data, dw.regs[RX_BUFFER_ID], SIM_MAX_FRAME_LEN);
+    memcpy(set->finfo, dw.regs[RX_FINFO_ID], RX_FINFO_LEN);
+    memcpy(set->time, dw.regs[RX_TIME_ID], RX_TIME_LLEN);
+    memcpy(set->fqual, dw.regs[RX_FQUAL_ID], RX_FQUAL_LEN);
+    set->status = (uint32_t)regGet(SYS_STATUS_ID, 0, 4) & SIM_RX_FRAME_BITS;
+}
+
+static void loadRxSet(const RxBufferSet *set){
+    memcpy(dw.regs[RX_BUFFER_ID], set->data, SIM_MAX_FRAME_LEN);
+    memcpy(dw.regs[RX_FINFO_ID], set->finfo, RX_FINFO_LEN);
+    memcpy(dw.regs[RX_TIME_ID], set->time, RX_TIME_LLEN);
+    memcpy(dw.regs[RX_FQUAL_ID], set->fqual, RX_FQUAL_LEN);
+    regSet(SYS_STATUS_ID, 0, 4, ((uint32_t)regGet(SYS_STATUS_ID, 0, 4) & ~SIM_RX_FRAME_BITS) | set->status);
+}
+
+/* HRBT: the host is done with its set, and moves on to the other one, whose
+ * events show up at once if it already holds a frame. */
+static void toggleHostSet(void){
+    if (!doubleBuffered()){
+        return;
+    }
+    dw.rx_sets[dw.host_set].full = 0;
+    dw.host_set ^= 1;
+    if (dw.rx_sets[dw.host_set].full){
+        loadRxSet(&dw.rx_sets[dw.host_set]);
+    }
+    else {
+        regSet(SYS_STATUS_ID, 0, 4, (uint32_t)regGet(SYS_STATUS_ID, 0, 4) & ~SIM_RX_FRAME_BITS);
+    }
+}
+
+static double uniform(void){
+    return (rand_r(&dw.rng) + 1.0)/(RAND_MAX + 2.0);
+}
+
+static double gauss(void){
+    return sqrt(-2.0*log(uniform()))*cos(2.0*M_PI*uniform());
+}
+
+/* Whether a frame of the channel is lost for this node. receive() looks at
+ * the same frames many times, so this is a hash of the frame and the seed
+ * rather than a draw. */
+static int frameLost(uint32_t seq){
+    uint32_t h = (seq ^ (dw.cfg.seed*0x9E3779B9u))*0x85EBCA6Bu;
+
+    if (dw.cfg.loss <= 0){
+        return 0;
+    }
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h < dw.cfg.loss*4294967296.0;
+}
+
+/* Local clock of this node at global time t, in ticks. */
+static uint64_t localTicks(double t){
+    double ticks = (t*(1.0 + dw.ppm*1e-6) + dw.cfg.clock_offset)*DW_TICK_HZ;
+    return (uint64_t)floor(ticks) & DW_TIME_MASK;
+}
+
+/* Global time at which the local clock next reads t40. */
+static double localToGlobal(uint64_t t40, double now){
+    uint64_t ahead = (t40 - localTicks(now)) & DW_TIME_MASK;
+    return now + ahead/(DW_TICK_HZ*(1.0 + dw.ppm*1e-6));
+}
+
+/* Frame timing, derived from the TX_FCTRL of the sender. */
+static double symbolDuration(uint32_t fctrl){
+    return ((fctrl & TX_FCTRL_TXPRF_MASK) == TX_FCTRL_TXPRF_16M) ? 993.59e-9 : 1017.63e-9;
+}
+
+static int preambleSymbols(uint32_t fctrl){
+    switch (fctrl & TX_FCTRL_TXPSR_PE_MASK){
+        case TX_FCTRL_TXPSR_PE_64:   return 64;
+        case TX_FCTRL_TXPSR_PE_128:  return 128;
+        case TX_FCTRL_TXPSR_PE_256:  return 256;
+        case TX_FCTRL_TXPSR_PE_512:  return 512;
+        case TX_FCTRL_TXPSR_PE_1024: return 1024;
+        case TX_FCTRL_TXPSR_PE_1536: return 1536;
+        case TX_FCTRL_TXPSR_PE_2048: return 2048;
+        case TX_FCTRL_TXPSR_PE_4096: return 4096;
+        default:                     return 16;
+    }
+}
+
+static int sfdSymbols(uint32_t fctrl){
+    return ((fctrl & TX_FCTRL_TXBR_MASK) == TX_FCTRL_TXBR_110k) ? 64 : 8;
+}
+
+/* PAC size the receiver is configured with, found from the DRX_TUNE2 value
+ * dwt_configure() writes for it. */
+static int pacSymbols(void){
+    static const int pac[NUM_PACS] = {8, 16, 32, 64};
+    uint32_t tune2 = (uint32_t)regGet(DRX_CONF_ID, DRX_TUNE2_OFFSET, 4);
+
+    for (int prf = 0; prf < NUM_PRF; prf++){
+        for (int i = 0; i < NUM_PACS; i++){
+            if (digital_bb_config[prf][i] == tune2){
+                return pac[i];
+            }
+        }
+    }
+    return 8;
+}
+
+/* First path power constant of the user manual, 4.7.1, and correction of
+ * RXPACC for the SFD, as in the radio profiles of dwt_general.c. */
+static double powerConstant(uint32_t fctrl){
+    return ((fctrl & TX_FCTRL_TXPRF_MASK) == TX_FCTRL_TXPRF_16M) ? 113.77 : 121.74;
+}
+
+static int rxpaccAdjustment(uint32_t fctrl){
+    return ((fctrl & TX_FCTRL_TXBR_MASK) == TX_FCTRL_TXBR_110k) ? -64 : -10;
+}
+
+static double preambleDuration(uint32_t fctrl){
+    return (preambleSymbols(fctrl) + sfdSymbols(fctrl))*symbolDuration(fctrl);
+}
+
+static double payloadDuration(uint32_t fctrl, uint16_t len){
+    double phr_bit, data_bit;
+    uint32_t bits = 8*len;
+
+    switch (fctrl & TX_FCTRL_TXBR_MASK){
+        case TX_FCTRL_TXBR_110k: phr_bit = 8205.13e-9; data_bit = 8205.13e-9; break;
+        case TX_FCTRL_TXBR_850k: phr_bit = 1025.64e-9; data_bit = 1025.64e-9; break;
+        default:                 phr_bit = 1025.64e-9; data_bit = 128.21e-9;  break;
+    }
+    bits += 48*((bits + 329)/330); // Reed-Solomon parity
+    return 21*phr_bit + bits*data_bit;
+}
+
+/* IEEE 802.15.4 FCS: CRC-16/KERMIT, transmitted LSB first. */
+static uint16_t frameCrc(const uint8_t *data, uint16_t len){
+    uint16_t crc = 0;
+    int i, j;
+    for (i = 0; i < len; i++){
+        crc ^= data[i];
+        for (j = 0; j < 8; j++){
+            crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+/* Physical antenna delay, the default value off by the configured error. The
+ * programmed value only shifts the time-stamps, so that a calibrated delay
+ * cancels the error. */
+static double antennaDelay(uint16_t nominal){
+    return nominal/DW_TICK_HZ + dw.cfg.ant_dly_err;
+}
+
+static void beginRx(double t_on){
+    uint32_t fctrl = (uint32_t)regGet(TX_FCTRL_ID, 0, 4);
+    uint32_t sys_cfg = (uint32_t)regGet(SYS_CFG_ID, 0, 4);
+    uint16_t fwto = (uint16_t)regGet(RX_FWTO_ID, 0, 2);
+    uint16_t pretoc = (uint16_t)regGet(DRX_CONF_ID, DRX_PRETOC_OFFSET, 2);
+
+    dw.state = RADIO_RX;
+    dw.rx_on = t_on;
+    dw.fwto_deadline = ((sys_cfg & SYS_CFG_RXWTOE) && fwto) ? t_on + fwto*DW_UUS : INFINITY;
+    dw.pto_deadline = pretoc ? t_on + pretoc*pacSymbols()*symbolDuration(fctrl) : INFINITY;
+}
+
+static void radioOff(void){
+    if (dw.state == RADIO_TX){
+        simChannelCancel(dw.ch, dw.tx_seq);
+    }
+    dw.state = RADIO_IDLE;
+    dw.rx_after_tx = 0;
+}
+
+static void startTx(uint32_t cmd, double now){
+    uint32_t fctrl = (uint32_t)regGet(TX_FCTRL_ID, 0, 4);
+    uint16_t len = fctrl & TX_FCTRL_FLE_MASK;
+    uint16_t boffs = (fctrl & TX_FCTRL_TXBOFFS_MASK) >> TX_FCTRL_TXBOFFS_SHFT;
+    uint16_t antd = (uint16_t)regGet(TX_ANTD_ID, 0, 2);
+    double rmarker;
+    uint64_t raw;
+    uint16_t crc;
+    SimFrame frame;
+
+    if (len < 2 || len > SIM_MAX_FRAME_LEN){
+        setStatus(SYS_STATUS_TXBERR);
+        return;
+    }
+
+    memset(&frame, 0, sizeof(frame));
+    frame.src = dw.node;
+    frame.len = len;
+    frame.tx_fctrl = fctrl;
+    frame.preamble_dur = preambleDuration(fctrl);
+    frame.payload_dur = payloadDuration(fctrl, len);
+    memcpy(frame.data, &dw.regs[TX_BUFFER_ID][boffs], len - 2);
+    crc = frameCrc(frame.data, len - 2);
+    frame.data[len - 2] = crc & 0xFF;
+    frame.data[len - 1] = crc >> 8;
+
+    if (cmd & SYS_CTRL_TXDLYS){
+        raw = regGet(DX_TIME_ID, 0, 5) & DW_DX_TIME_MASK;
+        if (((raw - localTicks(now)) & DW_TIME_MASK) >= DW_TIME_HALF){
+            /* Already passed, the chip would wait for the clock to wrap. */
+            setStatus(SYS_STATUS_HPDWARN);
+            dw.stats.tx_late++;
+            return;
+        }
+        rmarker = localToGlobal(raw, now);
+        if (rmarker - frame.preamble_dur - SIM_TX_POWER_UP < now){
+            setStatus(SYS_STATUS_TXPUTE);
+            dw.stats.tx_late++;
+            return;
+        }
+    }
+    else {
+        rmarker = now + SIM_TX_LATENCY + frame.preamble_dur;
+        raw = localTicks(rmarker);
+    }
+
+    /* A transmission aborts any reception in progress. */
+    radioOff();
+
+    frame.rmarker = rmarker + antennaDelay(TX_ANT_DLY);
+    dw.tx_seq = simChannelPost(dw.ch, &frame);
+    dw.tx_raw = raw;
+    dw.tx_stamp = (raw + antd) & DW_TIME_MASK;
+    dw.tx_end = rmarker + frame.payload_dur;
+    dw.state = RADIO_TX;
+    if (cmd & SYS_CTRL_WAIT4RESP){
+        dw.rx_after_tx = 1;
+        dw.rx_after_tx_delay = (regGet(ACK_RESP_T_ID, 0, 4) & ACK_RESP_T_W4R_TIM_MASK)*DW_UUS;
+    }
+    dw.stats.frames_tx++;
+}
+
+static void startRx(uint32_t cmd, double now){
+    uint64_t dx;
+
+    if (dw.state == RADIO_TX){
+        /* The receiver comes up as soon as the frame is out. */
+        if (!dw.rx_after_tx){
+            dw.rx_after_tx = 1;
+            dw.rx_after_tx_delay = 0;
+        }
+        return;
+    }
+
+    if (cmd & SYS_CTRL_RXDLYE){
+        dx = regGet(DX_TIME_ID, 0, 5) & DW_DX_TIME_MASK;
+        if (((dx - localTicks(now)) & DW_TIME_MASK) >= DW_TIME_HALF){
+            setStatus(SYS_STATUS_HPDWARN);
+            return;
+        }
+        beginRx(localToGlobal(dx, now));
+    }
+    else {
+        beginRx(now);
+    }
+}
+
+static void sysCtrl(uint32_t cmd, double now){
+    /* TRXOFF wins over a start requested in the same write, dwt_configure()
+     * relies on this to initialise the SFD. */
+    if (cmd & SYS_CTRL_TRXOFF){
+        radioOff();
+    }
+    else if (cmd & SYS_CTRL_TXSTRT){
+        startTx(cmd, now);
+    }
+    else if (cmd & SYS_CTRL_RXENAB){
+        startRx(cmd, now);
+    }
+    if (cmd & SYS_CTRL_HRBT){
+        toggleHostSet();
+    }
+}
+
+static void fillAccumulator(double fp_index, double amplitude){
+    /* First path followed by a few weaker reflections. */
+    static const double path_delay[] = {0.0, 6.3, 15.1, 28.7};
+    static const double path_gain[]  = {1.0, 0.45, 0.25, 0.12};
+    double phase[4];
+    double re, im, pulse;
+    int i, p;
+
+    for (p = 0; p < 4; p++){
+        phase[p] = 2.0*M_PI*uniform();
+    }
+    for (i = 0; i < SIM_CIR_TAPS; i++){
+        re = SIM_CIR_NOISE*gauss();
+        im = SIM_CIR_NOISE*gauss();
+        for (p = 0; p < 4; p++){
+            pulse = i - fp_index - path_delay[p];
+            if (fabs(pulse) < 6.0){
+                pulse = amplitude*path_gain[p]*exp(-0.5*pulse*pulse/0.64);
+                re += pulse*cos(phase[p]);
+                im += pulse*sin(phase[p]);
+            }
+        }
+        regSet(ACC_MEM_ID, 4*i, 2, (uint16_t)(int16_t)fmax(-32768, fmin(32767, re)));
+        regSet(ACC_MEM_ID, 4*i + 2, 2, (uint16_t)(int16_t)fmax(-32768, fmin(32767, im)));
+    }
+}
+
+static void deliver(const SimFrame *frame, double arrival, double distance, double remote_ppm){
+    uint16_t rx_antd = (uint16_t)regGet(LDE_IF_ID, LDE_RXANTD_OFFSET, 2);
+    double noise = dw.cfg.noise_std/SIM_SPEED_OF_LIGHT*gauss();
+    uint64_t raw = localTicks(arrival + antennaDelay(RX_ANT_DLY) + noise);
+    uint16_t n = SIM_RXPACC + rxpaccAdjustment(frame->tx_fctrl);
+    double freq_offset;
+    double fpp, f, ci;
+    uint32_t finfo;
+    int dbl = doubleBuffered();
+    RxBufferSet host;
+
+    /* Both sets hold a frame the host has not released */
+    if (dbl && dw.rx_sets[dw.ic_set].full){
+        setStatus(SYS_STATUS_RXOVRR);
+        beginRx(arrival + frame->payload_dur);
+        return;
+    }
+    if (dbl){
+        saveRxSet(&host);
+    }
+
+    memcpy(dw.regs[RX_BUFFER_ID], frame->data, frame->len);
+
+    finfo = frame->len
+          | (frame->tx_fctrl & (TX_FCTRL_TXBR_MASK | TX_FCTRL_TR | TX_FCTRL_TXPRF_MASK | TX_FCTRL_TXPSR_MASK))
+          | ((uint32_t)SIM_RXPACC << RX_FINFO_RXPACC_SHIFT);
+    regSet(RX_FINFO_ID, 0, 4, finfo);
+
+    /* Timestamps. The first path index carries the sub-tap part of the
+     * arrival in its 6 fractional bits. */
+    regSet(RX_TIME_ID, RX_TIME_RX_STAMP_OFFSET, 5, (raw - rx_antd) & DW_TIME_MASK);
+    regSet(RX_TIME_ID, RX_TIME_FP_RAWST_OFFSET, 5, raw);
+    regSet(RX_TIME_ID, RX_TIME_FP_INDEX_OFFSET, 2, SIM_FP_INDEX*64 + (raw & 0x3F));
+
+    /* Diagnostics: invert the first path power formula of the user manual
+     * for three equal amplitudes. */
+    fpp = dw.cfg.fpp_1m - 20.0*log10(fmax(distance, 0.1)) + SIM_FPP_STD*gauss();
+    f = fmin(SIM_F_MAX, sqrt(pow(10.0, (fpp + powerConstant(frame->tx_fctrl))/10.0)*n*n/3.0));
+    regSet(RX_TIME_ID, RX_TIME_FP_AMPL1_OFFSET, 2, (uint16_t)f);
+    regSet(RX_FQUAL_ID, 0, 2, (uint16_t)SIM_CIR_NOISE);
+    regSet(RX_FQUAL_ID, 2, 2, (uint16_t)f);
+    regSet(RX_FQUAL_ID, 4, 2, (uint16_t)f);
+    regSet(RX_FQUAL_ID, 6, 2, (uint16_t)fmin(65535.0, 4.0*f));
+
+    /* Carrier integrator, 21-bit signed, reports the remote clock relative to
+     * the local one. */
+    freq_offset = ((frame->tx_fctrl & TX_FCTRL_TXBR_MASK) == TX_FCTRL_TXBR_110k)
+                ? FREQ_OFFSET_MULTIPLIER_110KB : FREQ_OFFSET_MULTIPLIER;
+    ci = (remote_ppm - dw.ppm + SIM_SKEW_STD*gauss())/(freq_offset*HERTZ_TO_PPM_MULTIPLIER_CHAN_2);
+    regSet(DRX_CONF_ID, DRX_CARRIER_INT_OFFSET, 3, (uint32_t)(int32_t)lround(ci) & 0x1FFFFF);
+
+    fillAccumulator(SIM_FP_INDEX + (raw & 0x3F)/64.0, f);
+
+    setStatus(SIM_RX_FRAME_BITS);
+    dw.state = RADIO_IDLE;
+    dw.stats.frames_rx++;
+
+    /* The frame goes to the IC side set, which is only shown if the host is
+     * on it as well. With RXAUTR, the receiver carries on into the other set
+     * straight away. */
+    if (dbl){
+        saveRxSet(&dw.rx_sets[dw.ic_set]);
+        dw.rx_sets[dw.ic_set].full = 1;
+        if (dw.ic_set != dw.host_set){
+            loadRxSet(&host);
+        }
+        dw.ic_set ^= 1;
+        if (regGet(SYS_CFG_ID, 0, 4) & SYS_CFG_RXAUTR){
+            beginRx(arrival + frame->payload_dur);
+        }
+    }
+}
+
+/* Frame filtering, for the data frames with short addresses of the firmware:
+ * the PAN ID and the destination must be this node's, or broadcast. Other
+ * frame types and addressing modes are rejected. */
+static int frameAccepted(const SimFrame *frame){
+    uint32_t sys_cfg = (uint32_t)regGet(SYS_CFG_ID, 0, 4);
+    uint16_t fc, pan, dest;
+
+    if (!(sys_cfg & SYS_CFG_FFE)){
+        return 1;
+    }
+    if (frame->len < 9 || !(sys_cfg & SYS_CFG_FFAD)){
+        return 0;
+    }
+    fc = frame->data[0] | (frame->data[1] << 8);
+    if ((fc & 0x7) != 1 || ((fc >> 10) & 0x3) != 2){
+        return 0; // Not a data frame with a short destination address
+    }
+    pan = frame->data[3] | (frame->data[4] << 8);
+    dest = frame->data[5] | (frame->data[6] << 8);
+    return (pan == 0xFFFF || pan == regGet(PANADR_ID, PANADR_PAN_ID_OFFSET, 2))
+        && (dest == 0xFFFF || dest == regGet(PANADR_ID, PANADR_SHORT_ADDR_OFFSET, 2));
+}
+
+/* A frame rejected by the filter. With RXAUTR, the receiver is back on at
+ * the end of the frame without any status, as the DW1000 does in hardware. */
+static void reject(double end){
+    dw.stats.frames_filtered++;
+    if (regGet(SYS_CFG_ID, 0, 4) & SYS_CFG_RXAUTR){
+        dw.rx_on = end;
+    }
+    else{
+        setStatus(SYS_STATUS_AFFREJ);
+        dw.state = RADIO_IDLE;
+    }
+}
+
+static void rxTimeout(uint64_t bit){
+    setStatus(bit);
+    dw.state = RADIO_IDLE;
+    dw.stats.rx_timeouts++;
+}
+
+/* Find the frame the receiver locks on: the first one whose preamble is
+ * still long enough when the receiver is on. Later overlapping frames are
+ * lost, which is the usual capture behaviour for equal powers. */
+static void receive(double now){
+    const SimFrame *f;
+    SimFrame best;
+    double best_detect = INFINITY;
+    double best_arrival = 0, best_distance = 0, best_ppm = 0;
+    double distance, arrival, detect, sym;
+    uint32_t own_fctrl = (uint32_t)regGet(TX_FCTRL_ID, 0, 4);
+    uint32_t seq, next_seq;
+    int found = 0;
+
+    simChannelLock(dw.ch);
+    next_seq = dw.ch->next_seq;
+    for (seq = dw.scan_seq; seq < next_seq; seq++){
+        f = simChannelFrame(dw.ch, seq);
+        if (f == NULL || f->src == dw.node || f->cancelled){
+            if (seq == dw.scan_seq) dw.scan_seq++;
+            continue;
+        }
+        distance = simDistance(dw.ch, dw.node, f->src);
+        arrival = f->rmarker + distance/SIM_SPEED_OF_LIGHT;
+        if (arrival + f->payload_dur < dw.rx_on){
+            if (seq == dw.scan_seq) dw.scan_seq++;
+            continue;
+        }
+        sym = symbolDuration(f->tx_fctrl);
+        if (dw.rx_on > arrival - (sfdSymbols(f->tx_fctrl) + SIM_ACQ_SYMBOLS)*sym){
+            continue; // Turned on too late in the preamble
+        }
+        if (dw.cfg.fpp_1m - 20.0*log10(fmax(distance, 0.1)) < dw.cfg.sensitivity){
+            continue;
+        }
+        if (frameLost(seq)){
+            continue;
+        }
+        if ((f->tx_fctrl ^ own_fctrl) & (TX_FCTRL_TXBR_MASK | TX_FCTRL_TXPRF_MASK)){
+            continue; // Other data rate or PRF, not heard
+        }
+        detect = fmax(dw.rx_on, arrival - f->preamble_dur) + pacSymbols()*sym;
+        if (!found || detect < best_detect){
+            found = 1;
+            best = *f;
+            best_detect = detect;
+            best_arrival = arrival;
+            best_distance = distance;
+            best_ppm = dw.ch->nodes[f->src].ppm;
+        }
+    }
+    simChannelUnlock(dw.ch);
+
+    if (found && best_detect <= dw.pto_deadline){
+        if (best_arrival + best.payload_dur <= dw.fwto_deadline){
+            if (now >= best_arrival + best.payload_dur){
+                if (frameAccepted(&best)){
+                    deliver(&best, best_arrival, best_distance, best_ppm);
+                }
+                else{
+                    reject(best_arrival + best.payload_dur);
+                }
+            }
+            return;
+        }
+        if (now >= best_detect){
+            dw.pto_deadline = INFINITY; // Preamble found, only the frame wait timeout is left
+        }
+    }
+
+    if (now >= dw.pto_deadline){
+        rxTimeout(SYS_STATUS_RXPTO);
+    }
+    else if (now >= dw.fwto_deadline){
+        rxTimeout(SYS_STATUS_RXRFTO);
+    }
+}
+
+/* Advance the radio to the current simulation time. */
+static double update(void){
+    double now = simNow(dw.ch);
+
+    if (dw.state == RADIO_TX && now >= dw.tx_end){
+        regSet(TX_TIME_ID, TX_TIME_TX_STAMP_OFFSET, 5, dw.tx_stamp);
+        regSet(TX_TIME_ID, TX_TIME_TX_RAWST_OFFSET, 5, dw.tx_raw);
+        setStatus(SYS_STATUS_TXFRB | SYS_STATUS_TXPRS | SYS_STATUS_TXPHS | SYS_STATUS_TXFRS);
+        dw.state = RADIO_IDLE;
+        if (dw.rx_after_tx){
+            dw.rx_after_tx = 0;
+            beginRx(dw.tx_end + dw.rx_after_tx_delay);
+        }
+    }
+    if (dw.state == RADIO_RX){
+        receive(now);
+    }
+    return now;
+}
+
+static void decodeHeader(uint16_t header_len, const uint8_t *header, uint8_t *reg, uint16_t *off){
+    *reg = header[0] & 0x3F;
+    *off = 0;
+    if (header_len > 1 && (header[0] & 0x40)){
+        *off = header[1] & 0x7F;
+        if (header_len > 2 && (header[1] & 0x80)){
+            *off |= (uint16_t)header[2] << 7;
+        }
+    }
+}
+
+/* Public functions ----------------------------------------------------------*/
+/**
+ * @brief Power up the simulated DW1000 of a node that joined the channel.
+ */
+void dw1000SimInit(SimChannel *ch, int node, const DwSimConfig *cfg){
+    pthread_mutexattr_t attr;
+
+    memset(&dw, 0, sizeof(dw));
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&dw.lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    dw.ch = ch;
+    dw.node = node;
+    dw.ppm = ch->nodes[node].ppm;
+    dw.cfg = *cfg;
+    dw.rng = cfg->seed;
+    dw.state = RADIO_IDLE;
+    dw.scan_seq = ch->next_seq;
+
+    regSet(DEV_ID_ID, 0, 4, DWT_DEVICE_ID);
+    regSet(SYS_CFG_ID, 0, 4, SYS_CFG_DIS_DRXB | SYS_CFG_HIRQ_POL); // Reset value
+}
+
+void dw1000SimSpiWrite(uint16_t header_len, const uint8_t *header,
+                       uint32_t body_len, const uint8_t *body){
+    uint8_t reg;
+    uint16_t off;
+    uint32_t i, cmd = 0;
+    double now;
+
+    decodeHeader(header_len, header, &reg, &off);
+    if (off + body_len > SIM_REG_LEN){
+        body_len = SIM_REG_LEN - off;
+    }
+
+    pthread_mutex_lock(&dw.lock);
+    now = update();
+    dw.stats.spi_writes++;
+    dw.stats.spi_bytes += header_len + body_len;
+
+    switch (reg){
+        case SYS_STATUS_ID:
+            for (i = 0; i < body_len; i++){
+                dw.regs[reg][off + i] &= ~body[i]; // Write 1 to clear
+            }
+            break;
+        case SYS_CTRL_ID:
+            for (i = 0; i < body_len && off + i < 4; i++){
+                cmd |= (uint32_t)body[i] << (8*(off + i));
+            }
+            sysCtrl(cmd, now);
+            break;
+        default:
+            memcpy(&dw.regs[reg][off], body, body_len);
+            break;
+    }
+    pthread_mutex_unlock(&dw.lock);
+}
+
+void dw1000SimSpiRead(uint16_t header_len, const uint8_t *header,
+                      uint32_t read_len, uint8_t *buffer){
+    uint8_t reg;
+    uint16_t off;
+    uint32_t status;
+    double now;
+
+    decodeHeader(header_len, header, &reg, &off);
+    if (off + read_len > SIM_REG_LEN){
+        memset(buffer, 0, read_len);
+        read_len = SIM_REG_LEN - off;
+    }
+
+    pthread_mutex_lock(&dw.lock);
+    now = update();
+    dw.stats.spi_reads++;
+    dw.stats.spi_bytes += header_len + read_len;
+
+    switch (reg){
+        case SYS_TIME_ID:
+            regSet(SYS_TIME_ID, 0, SYS_TIME_LEN, localTicks(now) & DW_DX_TIME_MASK);
+            memcpy(buffer, &dw.regs[reg][off], read_len);
+            break;
+        case SYS_STATUS_ID:
+            status = (uint32_t)regGet(SYS_STATUS_ID, 0, 4) & ~(SYS_STATUS_IRQS | SYS_STATUS_ICRBP | SYS_STATUS_HSRBP);
+            status |= (dw.ic_set ? SYS_STATUS_ICRBP : 0) | (dw.host_set ? SYS_STATUS_HSRBP : 0);
+            if (status & (uint32_t)regGet(SYS_MASK_ID, 0, 4)){
+                status |= SYS_STATUS_IRQS;
+            }
+            regSet(SYS_STATUS_ID, 0, 4, status);
+            memcpy(buffer, &dw.regs[reg][off], read_len);
+            break;
+        case SYS_STATE_ID:
+            dw.regs[reg][SYS_STATE_TX_OFFSET] = (dw.state == RADIO_TX) ? SIM_STATE_TX_ACTIVE : 0;
+            dw.regs[reg][SYS_STATE_RX_OFFSET] = (dw.state == RADIO_RX) ? SIM_STATE_RX_ACTIVE : 0;
+            dw.regs[reg][SYS_STATE_PMSC_OFFSET] = (dw.state == RADIO_TX) ? SIM_PMSC_TX :
+                                                  (dw.state == RADIO_RX) ? SIM_PMSC_RX : SIM_PMSC_IDLE;
+            memcpy(buffer, &dw.regs[reg][off], read_len);
+            break;
+        case ACC_MEM_ID:
+            /* The first byte of an accumulator read is a dummy. */
+            if (read_len > 0){
+                buffer[0] = 0;
+                memcpy(buffer + 1, &dw.regs[reg][off], read_len - 1);
+            }
+            break;
+        default:
+            memcpy(buffer, &dw.regs[reg][off], read_len);
+            break;
+    }
+    pthread_mutex_unlock(&dw.lock);
+
+    /* The firmware busy-waits on SYS_STATUS, let the other nodes run. */
+    if (reg == SYS_STATUS_ID){
+        sched_yield();
+    }
+}
+
+/**
+ * @brief State of the IRQ line, after bringing the radio up to date.
+ */
+int dw1000SimIrqPending(void){
+    int pending;
+
+    pthread_mutex_lock(&dw.lock);
+    update();
+    pending = (regGet(SYS_STATUS_ID, 0, 4) & regGet(SYS_MASK_ID, 0, 4)) != 0;
+    pthread_mutex_unlock(&dw.lock);
+    return pending;
+}
+
+void dw1000SimGetStats(DwSimStats *stats){
+    pthread_mutex_lock(&dw.lock);
+    *stats = dw.stats;
+    pthread_mutex_unlock(&dw.lock);
+}
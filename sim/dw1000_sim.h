@@ -0,0 +1,57 @@
+/**
+  ******************************************************************************
+  * @file    dw1000_sim.h
+  * @brief   This file contains all the function prototypes for
+  *          the dw1000_sim.c file
+  ******************************************************************************
+  */
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __DW1000_SIM_H__
+#define __DW1000_SIM_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include "sim_channel.h"
+
+/* Typedefs ------------------------------------------------------------------*/
+/* Physical parameters of one simulated DW1000. */
+typedef struct {
+    double noise_std;    // [m] Standard deviation of the RX timestamp noise.
+    double fpp_1m;       // [dBm] First path power received at 1 m.
+    double sensitivity;  // [dBm] Weakest first path that is still received.
+    double clock_offset; // [s] Offset of the node's clock at simulation time zero.
+    double ant_dly_err;  // [s] Error of the default antenna delays, TX and RX each.
+    double loss;         // Probability that a frame is not received at all.
+    uint32_t seed;
+} DwSimConfig;
+
+/* Counters of the SPI traffic and radio events, for profiling the firmware. */
+typedef struct {
+    uint32_t spi_reads;
+    uint32_t spi_writes;
+    uint64_t spi_bytes;
+    uint32_t frames_tx;
+    uint32_t frames_rx;
+    uint32_t frames_filtered; // Rejected by frame filtering, never seen by the MCU.
+    uint32_t rx_timeouts;
+    uint32_t tx_late; // Delayed transmissions rejected with HPDWARN/TXPUTE.
+} DwSimStats;
+
+/* Function Prototypes -------------------------------------------------------*/
+void dw1000SimInit(SimChannel *ch, int node, const DwSimConfig *cfg);
+void dw1000SimSpiWrite(uint16_t header_len, const uint8_t *header,
+                       uint32_t body_len, const uint8_t *body);
+void dw1000SimSpiRead(uint16_t header_len, const uint8_t *header,
+                      uint32_t read_len, uint8_t *buffer);
+int dw1000SimIrqPending(void);
+void dw1000SimGetStats(DwSimStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DW1000_SIM_H__ */
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Runs a TWR scenario on the host simulator: node 1 initiates exchanges with
+# node 2, 5 m away, while node 3 listens passively. Extra arguments go to the
+# initiator, e.g.
+#
+#   ./sim/run_twr.sh --ds 1 --targ-meas --count 50
+#
+# The USB output of every node is written to build/sim/node<ID>.log, and the
+# timing statistics are printed on exit.
+cd "$(dirname "$0")/.."
+
+SIM=build/sim/uwb_sim
+CHANNEL=uwb_sim_$$
+LOGS=build/sim
+
+make -s sim || exit 1
+
+$SIM --channel $CHANNEL --id 2 --pos 5,0,0 --ppm 3 > $LOGS/node2.log &
+RESPONDER=$!
+$SIM --channel $CHANNEL --id 3 --pos 2,4,0 --ppm -2 --passive > $LOGS/node3.log &
+LISTENER=$!
+trap 'kill $RESPONDER $LISTENER; rm -f /dev/shm/$CHANNEL' INT TERM
+
+sleep 0.5
+$SIM --channel $CHANNEL --id 1 --pos 0,0,0 --ppm -5 --target 2 "$@" > $LOGS/node1.log
+STATUS=$?
+
+kill $RESPONDER $LISTENER
+wait
+rm -f /dev/shm/$CHANNEL
+exit $STATUS
@@ -0,0 +1,211 @@
+/**
+  ******************************************************************************
+  * @file    sim_channel.c
+  * @brief   Shared radio channel of the host simulator. Frames are posted by
+  *          the transmitting node and picked up by every other node's DW1000
+  *          model, which decides on its own whether it could hear them.
+  ******************************************************************************
+  */
+/* Includes ------------------------------------------------------------------*/
+#include "sim_channel.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Defines -------------------------------------------------------------------*/
+#define SIM_CHANNEL_MAGIC (0x55574231) // "UWB1"
+
+/* Private functions ---------------------------------------------------------*/
+static int64_t monotonicNs(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+static void initChannel(SimChannel *ch, double slowdown){
+    pthread_mutexattr_t attr;
+
+    memset(ch, 0, sizeof(*ch));
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&ch->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    ch->slowdown = slowdown;
+    ch->next_seq = 1;
+    ch->epoch_ns = monotonicNs();
+    __atomic_store_n(&ch->magic, SIM_CHANNEL_MAGIC, __ATOMIC_RELEASE);
+}
+
+/* Public functions ----------------------------------------------------------*/
+/**
+ * @brief Open the shared channel, creating it if this is the first node.
+ *
+ * @param name Name of the POSIX shared memory object.
+ * @param slowdown Wall-clock seconds per simulated second. Only used by the
+ * node that creates the channel.
+ * @return SimChannel* Mapped channel, NULL on failure.
+ */
+SimChannel* simChannelOpen(const char *name, double slowdown){
+    char shm_name[64];
+    struct stat st;
+    SimChannel *ch;
+    int created = 1;
+    int fd;
+
+    snprintf(shm_name, sizeof(shm_name), "%s%s", (name[0] == '/') ? "" : "/", name);
+
+    fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST){
+        created = 0;
+        fd = shm_open(shm_name, O_RDWR, 0600);
+    }
+    if (fd < 0){
+        perror("shm_open");
+        return NULL;
+    }
+
+    if (created){
+        if (ftruncate(fd, sizeof(SimChannel)) != 0){
+            perror("ftruncate");
+            close(fd);
+            return NULL;
+        }
+    }
+    else {
+        /* The creator may not have sized the object yet. */
+        do {
+            fstat(fd, &st);
+        } while ((size_t)st.st_size < sizeof(SimChannel) && usleep(1000) == 0);
+    }
+
+    ch = mmap(NULL, sizeof(SimChannel), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ch == MAP_FAILED){
+        perror("mmap");
+        return NULL;
+    }
+
+    if (created){
+        initChannel(ch, slowdown);
+    }
+    else {
+        while (__atomic_load_n(&ch->magic, __ATOMIC_ACQUIRE) != SIM_CHANNEL_MAGIC){
+            usleep(1000);
+        }
+    }
+    return ch;
+}
+
+/**
+ * @brief Register a node on the channel.
+ *
+ * @return int Node index, or -1 if the channel is full.
+ */
+int simChannelJoin(SimChannel *ch, uint8_t board_id, const double pos[3], double ppm){
+    int i;
+    int idx = -1;
+
+    simChannelLock(ch);
+    for (i = 0; i < SIM_MAX_NODES; i++){
+        if (!ch->nodes[i].active){
+            ch->nodes[i].board_id = board_id;
+            memcpy(ch->nodes[i].pos, pos, sizeof(ch->nodes[i].pos));
+            ch->nodes[i].ppm = ppm;
+            ch->nodes[i].active = 1;
+            idx = i;
+            break;
+        }
+    }
+    simChannelUnlock(ch);
+    return idx;
+}
+
+void simChannelLock(SimChannel *ch){
+    /* A node killed while holding the lock leaves the channel consistent, as
+     * all updates under the lock are single stores or slot copies. */
+    if (pthread_mutex_lock(&ch->lock) == EOWNERDEAD){
+        pthread_mutex_consistent(&ch->lock);
+    }
+}
+
+void simChannelUnlock(SimChannel *ch){
+    pthread_mutex_unlock(&ch->lock);
+}
+
+/**
+ * @brief Current global simulation time in seconds.
+ */
+double simNow(const SimChannel *ch){
+    return (double)(monotonicNs() - ch->epoch_ns)*1e-9/ch->slowdown;
+}
+
+/**
+ * @brief Convert a simulated duration to wall-clock seconds.
+ */
+double simWallSeconds(const SimChannel *ch, double sim_seconds){
+    return sim_seconds*ch->slowdown;
+}
+
+/**
+ * @brief Distance in metres between two nodes.
+ */
+double simDistance(const SimChannel *ch, int a, int b){
+    const double *pa = ch->nodes[a].pos;
+    const double *pb = ch->nodes[b].pos;
+    return sqrt((pa[0]-pb[0])*(pa[0]-pb[0])
+              + (pa[1]-pb[1])*(pa[1]-pb[1])
+              + (pa[2]-pb[2])*(pa[2]-pb[2]));
+}
+
+/**
+ * @brief Put a frame on air.
+ *
+ * @return uint32_t Sequence number of the frame, used to cancel it.
+ */
+uint32_t simChannelPost(SimChannel *ch, const SimFrame *frame){
+    uint32_t seq;
+    SimFrame *slot;
+
+    simChannelLock(ch);
+    seq = ch->next_seq++;
+    slot = &ch->frames[seq % SIM_CHANNEL_SLOTS];
+    *slot = *frame;
+    slot->seq = seq;
+    slot->cancelled = 0;
+    simChannelUnlock(ch);
+    return seq;
+}
+
+/**
+ * @brief Withdraw a frame whose transmission was aborted.
+ */
+void simChannelCancel(SimChannel *ch, uint32_t seq){
+    SimFrame *slot;
+
+    simChannelLock(ch);
+    slot = &ch->frames[seq % SIM_CHANNEL_SLOTS];
+    if (slot->seq == seq){
+        slot->cancelled = 1;
+    }
+    simChannelUnlock(ch);
+}
+
+/**
+ * @brief Look up a frame by sequence number. Must be called with the channel
+ * locked.
+ *
+ * @return const SimFrame* The frame, NULL if its slot was already reused.
+ */
+const SimFrame* simChannelFrame(const SimChannel *ch, uint32_t seq){
+    const SimFrame *slot = &ch->frames[seq % SIM_CHANNEL_SLOTS];
+    return (slot->seq == seq) ? slot : NULL;
+}
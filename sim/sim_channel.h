@@ -0,0 +1,77 @@
+/**
+  ******************************************************************************
+  * @file    sim_channel.h
+  * @brief   This file contains all the function prototypes for
+  *          the sim_channel.c file
+  ******************************************************************************
+  */
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __SIM_CHANNEL_H__
+#define __SIM_CHANNEL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <pthread.h>
+
+/* Defines -------------------------------------------------------------------*/
+#define SIM_MAX_NODES (16)
+#define SIM_CHANNEL_SLOTS (256) // Frames kept on air, oldest slot is reused.
+#define SIM_MAX_FRAME_LEN (127) // Including the 2-byte FCS.
+#define SIM_SPEED_OF_LIGHT (299702547.0) // [m/s] in air
+
+/* Typedefs ------------------------------------------------------------------*/
+/* A frame put on air by one of the nodes. All times are global simulation
+ * times in seconds. */
+typedef struct {
+    uint32_t seq;        // Sequence number of the slot's current frame, 0 if unused.
+    uint8_t src;         // Node index of the sender.
+    uint8_t cancelled;   // Transmission aborted before the preamble started.
+    uint16_t len;        // Frame length, including the FCS.
+    uint32_t tx_fctrl;   // Sender's TX_FCTRL, carries the data rate and ranging bit.
+    double rmarker;      // RMARKER leaving the sender's antenna.
+    double preamble_dur; // Preamble and SFD, ends at the RMARKER.
+    double payload_dur;  // PHR and data, starts at the RMARKER.
+    uint8_t data[SIM_MAX_FRAME_LEN];
+} SimFrame;
+
+/* Static description of a node on the channel. */
+typedef struct {
+    uint8_t active;
+    uint8_t board_id;
+    double pos[3]; // [m]
+    double ppm;    // Crystal offset of the node.
+} SimNode;
+
+/* The channel lives in POSIX shared memory so that every virtual node can be
+ * its own process, running the firmware modules unmodified. */
+typedef struct {
+    uint32_t magic;
+    pthread_mutex_t lock;
+    int64_t epoch_ns;   // CLOCK_MONOTONIC at simulation time zero.
+    double slowdown;    // Wall-clock seconds per simulated second.
+    uint32_t next_seq;
+    SimNode nodes[SIM_MAX_NODES];
+    SimFrame frames[SIM_CHANNEL_SLOTS];
+} SimChannel;
+
+/* Function Prototypes -------------------------------------------------------*/
+SimChannel* simChannelOpen(const char *name, double slowdown);
+int simChannelJoin(SimChannel *ch, uint8_t board_id, const double pos[3], double ppm);
+double simNow(const SimChannel *ch);
+double simWallSeconds(const SimChannel *ch, double sim_seconds);
+double simDistance(const SimChannel *ch, int a, int b);
+void simChannelLock(SimChannel *ch);
+void simChannelUnlock(SimChannel *ch);
+uint32_t simChannelPost(SimChannel *ch, const SimFrame *frame);
+void simChannelCancel(SimChannel *ch, uint32_t seq);
+const SimFrame* simChannelFrame(const SimChannel *ch, uint32_t seq);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SIM_CHANNEL_H__ */
@@ -0,0 +1,432 @@
+/**
+  ******************************************************************************
+  * @file    sim_main.c
+  * @brief   Entry point of one simulated node. Runs the same initialisation
+  *          and task bodies as main.c and freertos.c, on top of a simulated
+  *          DW1000 attached to a shared channel. Start one process per node,
+  *          all with the same --channel.
+  ******************************************************************************
+  */
+/* Includes ------------------------------------------------------------------*/
+#include "sim_port.h"
+#include "dw1000_sim.h"
+#include "dwt_general.h"
+#include "ranging.h"
+#include "records.h"
+#include "cir.h"
+#include "trace.h"
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Typedefs ------------------------------------------------------------------*/
+typedef struct {
+    const char *channel;
+    const char *out;
+    int id;
+    double pos[3];
+    double ppm;
+    double slowdown;
+    DwSimConfig radio;
+    int target;          // -1 if this node does not initiate
+    uint8_t burst[BURST_MAX_TARGETS]; // Targets of a burst, in place of target
+    int num_burst;       // 0 if this node does not initiate bursts
+    TdmaSlot slots[TDMA_MAX_SLOTS]; // Schedule given to every node (C12)
+    int num_slots;
+    int slot_len;        // [UUS]
+    bool targ_meas;
+    uint8_t ds_twr;
+    bool get_cir;
+    int cir_window;      // Half-window around the first path, 0 for all taps
+    bool cir_iq;
+    bool passive;
+    bool passive_tdoa;
+    bool rx_double;
+    int profile;         // RADIO_PROFILE_
+    bool trace;
+    int resp_delay;      // [us] Second-response delay of DS-TWR, 0 for the default
+    int ant_dly;         // Antenna delays, TX and RX, 0 for the default
+    bool binary;
+    double period;       // [s] between two initiations
+    int count;           // Number of initiations
+    double duration;     // [s] Run time of a non-initiating node, 0 for ever
+} SimArgs;
+
+typedef struct {
+    int attempts;
+    int successes;
+    double sim_sum, sim_max;   // [s]
+    double wall_sum, wall_max; // [s]
+    uint64_t spi_transfers;
+    uint64_t spi_bytes;
+} ExchangeStats;
+
+/* Private variables ---------------------------------------------------------*/
+static volatile sig_atomic_t running = 1;
+
+/* Private functions ---------------------------------------------------------*/
+static void usage(const char *prog){
+    fprintf(stderr,
+        "Usage: %s --id N [options]\n"
+        "  --channel NAME     shared channel, one per simulation (default uwb_sim)\n"
+        "  --pos X,Y,Z        position in metres (default 0,0,0)\n"
+        "  --ppm P            crystal offset in ppm (default 0)\n"
+        "  --noise S          RX timestamp noise, std in metres (default 0.02)\n"
+        "  --ant-err S        antenna delay error in metres (default 0)\n"
+        "  --loss P           probability of missing each frame (default 0)\n"
+        "  --ant-dly N        program the TX and RX antenna delays, in DW1000\n"
+        "                     time units (default %d) (C20)\n"
+        "  --slowdown K       wall seconds per simulated second (default 50)\n"
+        "  --seed N           noise seed (default: the board ID)\n"
+        "  --out FILE         USB output, default stdout\n"
+        "  --binary           binary records instead of ASCII (C10)\n"
+        "  --passive          passive listening on (C04)\n"
+        "  --tdoa             passive pseudo-ranges instead of timestamps (C14)\n"
+        "  --rx-double        double-buffered receiver (C15)\n"
+        "  --profile N        radio profile, RADIO_PROFILE_ (default 0) (C16)\n"
+        "  --trace            output the trace statistics at the end (C17), in\n"
+        "                     host time\n"
+        "  --target T         initiate TWR with board T (C05)\n"
+        "  --burst T1,T2,...  initiate multi-target bursts instead (C11)\n"
+        "  --tdma I-T,...     run the on-board schedule, one initiator-target pair\n"
+        "                     per slot, with --ds, --targ-meas and --cir (C12)\n"
+        "  --slot UUS         slot length of the schedule (default: the shortest\n"
+        "                     the radio profile allows)\n"
+        "  --targ-meas        ask the target to compute the range as well\n"
+        "  --ds MODE          0 for SS-TWR, 1 for DS-TWR, 2 for corrected SS-TWR (default 0)\n"
+        "  --resp-delay US    second-response delay of DS-TWR as a target (C08)\n"
+        "  --cir              output the CIR of the exchange\n"
+        "  --cir-window N     only the N taps on each side of the first path (C13)\n"
+        "  --cir-iq           complex taps instead of magnitudes, needs --cir-window\n"
+        "  --period MS        simulated ms between initiations (default 100)\n"
+        "  --count N          number of initiations (default 10)\n"
+        "  --duration MS      run time of a listening node, 0 for ever (default 0)\n",
+        prog, TX_ANT_DLY);
+}
+
+static int parseArgs(int argc, char **argv, SimArgs *args){
+    static const struct option options[] = {
+        {"channel",   required_argument, NULL, 'c'},
+        {"id",        required_argument, NULL, 'i'},
+        {"pos",       required_argument, NULL, 'p'},
+        {"ppm",       required_argument, NULL, 'f'},
+        {"noise",     required_argument, NULL, 'n'},
+        {"ant-err",   required_argument, NULL, 'a'},
+        {"loss",      required_argument, NULL, 'L'},
+        {"ant-dly",   required_argument, NULL, 'y'},
+        {"slowdown",  required_argument, NULL, 'k'},
+        {"seed",      required_argument, NULL, 's'},
+        {"out",       required_argument, NULL, 'o'},
+        {"binary",    no_argument,       NULL, 'b'},
+        {"passive",   no_argument,       NULL, 'l'},
+        {"tdoa",      no_argument,       NULL, 'A'},
+        {"rx-double", no_argument,       NULL, 'x'},
+        {"profile",   required_argument, NULL, 'g'},
+        {"trace",     no_argument,       NULL, 'z'},
+        {"target",    required_argument, NULL, 't'},
+        {"burst",     required_argument, NULL, 'B'},
+        {"tdma",      required_argument, NULL, 'T'},
+        {"slot",      required_argument, NULL, 'S'},
+        {"targ-meas", no_argument,       NULL, 'm'},
+        {"ds",        required_argument, NULL, 'd'},
+        {"resp-delay", required_argument, NULL, 'R'},
+        {"cir",       no_argument,       NULL, 'r'},
+        {"cir-window", required_argument, NULL, 'w'},
+        {"cir-iq",    no_argument,       NULL, 'q'},
+        {"period",    required_argument, NULL, 'P'},
+        {"count",     required_argument, NULL, 'N'},
+        {"duration",  required_argument, NULL, 'D'},
+        {"help",      no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    bool seeded = false;
+    char *tok;
+    int initiator, target;
+
+    memset(args, 0, sizeof(*args));
+    args->channel = "uwb_sim";
+    args->id = -1;
+    args->slowdown = 50;
+    args->radio.noise_std = 0.02;
+    args->radio.fpp_1m = -72.0;
+    args->radio.sensitivity = -110.0;
+    args->target = -1;
+    args->period = 0.1;
+    args->count = 10;
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1){
+        switch (opt){
+            case 'c': args->channel = optarg; break;
+            case 'i': args->id = atoi(optarg); break;
+            case 'p':
+                if (sscanf(optarg, "%lf,%lf,%lf", &args->pos[0], &args->pos[1], &args->pos[2]) != 3){
+                    return 0;
+                }
+                break;
+            case 'f': args->ppm = atof(optarg); break;
+            case 'n': args->radio.noise_std = atof(optarg); break;
+            case 'a': args->radio.ant_dly_err = atof(optarg)/SIM_SPEED_OF_LIGHT; break;
+            case 'L': args->radio.loss = atof(optarg); break;
+            case 'y': args->ant_dly = atoi(optarg); break;
+            case 'k': args->slowdown = atof(optarg); break;
+            case 's': args->radio.seed = strtoul(optarg, NULL, 0); seeded = true; break;
+            case 'o': args->out = optarg; break;
+            case 'b': args->binary = true; break;
+            case 'l': args->passive = true; break;
+            case 'A': args->passive_tdoa = true; break;
+            case 'x': args->rx_double = true; break;
+            case 'g': args->profile = atoi(optarg); break;
+            case 'z': args->trace = true; break;
+            case 't': args->target = atoi(optarg); break;
+            case 'B':
+                for (tok = strtok(optarg, ","); tok != NULL; tok = strtok(NULL, ",")){
+                    if (args->num_burst == BURST_MAX_TARGETS){
+                        return 0;
+                    }
+                    args->burst[args->num_burst++] = atoi(tok);
+                }
+                break;
+            case 'T':
+                for (tok = strtok(optarg, ","); tok != NULL; tok = strtok(NULL, ",")){
+                    if (args->num_slots == TDMA_MAX_SLOTS || sscanf(tok, "%d-%d", &initiator, &target) != 2){
+                        return 0;
+                    }
+                    args->slots[args->num_slots].initiator = initiator;
+                    args->slots[args->num_slots].target = target;
+                    args->num_slots++;
+                }
+                break;
+            case 'S': args->slot_len = atoi(optarg); break;
+            case 'm': args->targ_meas = true; break;
+            case 'd': args->ds_twr = atoi(optarg); break;
+            case 'R': args->resp_delay = atoi(optarg); break;
+            case 'r': args->get_cir = true; break;
+            case 'w': args->cir_window = atoi(optarg); break;
+            case 'q': args->cir_iq = true; break;
+            case 'P': args->period = atof(optarg)*1e-3; break;
+            case 'N': args->count = atoi(optarg); break;
+            case 'D': args->duration = atof(optarg)*1e-3; break;
+            default: return 0;
+        }
+    }
+    if (args->id < 0 || args->id > 255 || args->target == args->id || args->slowdown <= 0){
+        return 0;
+    }
+    if (args->profile < 0 || args->profile >= NUM_RADIO_PROFILES){
+        return 0;
+    }
+    if (args->ant_dly < 0 || args->ant_dly > UINT16_MAX){
+        return 0;
+    }
+    if (args->slot_len == 0){
+        args->slot_len = radioProfileById(args->profile)->min_slot_uus;
+    }
+    for (int i=0; i<args->num_slots; i++){
+        args->slots[i].ds_twr = args->ds_twr;
+        args->slots[i].flags = (args->targ_meas ? TDMA_FLAG_TARG_MEAS : 0)
+                             | (args->get_cir ? TDMA_FLAG_GET_CIR : 0);
+    }
+    for (int i=0; i<args->num_burst; i++){
+        if (args->burst[i] == args->id){
+            return 0;
+        }
+    }
+    if (!seeded){
+        args->radio.seed = args->id;
+    }
+    return 1;
+}
+
+static void onSignal(int sig){
+    (void)sig;
+    running = 0;
+}
+
+static double wallSeconds(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/* Same body as uwbInterruptTask() in freertos.c. */
+static void* uwbInterruptThread(void *arg){
+    (void)arg;
+
+    dwt_setrxaftertxdelay(40);
+    while (1){
+        uwbFrameHandler();
+    }
+    return NULL;
+}
+
+/* Same body as the TDMA task created in freertos.c. */
+static void* tdmaThread(void *arg){
+    (void)arg;
+
+    tdmaTask(NULL);
+    return NULL;
+}
+
+/* Time one call of twrInitiateInstance() or twrBurstInstance(), as the C05 or
+ * C11 command would run it. */
+static void initiate(const SimArgs *args, ExchangeStats *stats){
+    DwSimStats before, after;
+    double sim_start, wall_start, sim_dur, wall_dur;
+
+    dw1000SimGetStats(&before);
+    sim_start = simNow(sim_channel);
+    wall_start = wallSeconds();
+
+    if (args->num_burst > 0){
+        if (twrBurstInstance(args->burst, args->num_burst, args->targ_meas)){
+            stats->successes++;
+        }
+    }
+    else if (twrInitiateInstance(args->target, args->targ_meas, args->ds_twr, args->get_cir)){
+        stats->successes++;
+    }
+
+    sim_dur = simNow(sim_channel) - sim_start;
+    wall_dur = wallSeconds() - wall_start;
+    dw1000SimGetStats(&after);
+
+    stats->attempts++;
+    stats->sim_sum += sim_dur;
+    stats->sim_max = fmax(stats->sim_max, sim_dur);
+    stats->wall_sum += wall_dur;
+    stats->wall_max = fmax(stats->wall_max, wall_dur);
+    stats->spi_transfers += (after.spi_reads + after.spi_writes) - (before.spi_reads + before.spi_writes);
+    stats->spi_bytes += after.spi_bytes - before.spi_bytes;
+}
+
+static void report(const SimArgs *args, const ExchangeStats *stats){
+    DwSimStats radio;
+    UwbRxStats rx;
+
+    dw1000SimGetStats(&radio);
+    uwbRxStats(&rx);
+    fprintf(stderr, "node %d: %u frames sent, %u received, %u filtered, %u RX timeouts, %u late TX, %u/%u SPI reads/writes\n",
+            args->id, radio.frames_tx, radio.frames_rx, radio.frames_filtered, radio.rx_timeouts, radio.tx_late,
+            radio.spi_reads, radio.spi_writes);
+    fprintf(stderr, "node %d: %u frames to the UWB task, %u frames and %u events dropped, %u oversized, %u overruns\n",
+            args->id, rx.frames, rx.dropped, rx.events_dropped, rx.oversized, rx.overruns);
+    if (args->rx_double){
+        fprintf(stderr, "node %d: %u/%u frames from RX buffer A/B, %u back to back\n",
+                args->id, rx.buffer_frames[0], rx.buffer_frames[1], rx.back_to_back);
+    }
+    if (stats->attempts > 0){
+        if (args->num_burst > 0){
+            fprintf(stderr, "node %d: bursts to %d targets\n", args->id, args->num_burst);
+        }
+        fprintf(stderr, "node %d: %d/%d exchanges with %d succeeded, "
+                "%.1f us simulated (max %.1f), %.2f ms wall (max %.2f), "
+                "%.1f SPI transfers and %.0f bytes per exchange\n",
+                args->id, stats->successes, stats->attempts, args->target,
+                stats->sim_sum/stats->attempts*1e6, stats->sim_max*1e6,
+                stats->wall_sum/stats->attempts*1e3, stats->wall_max*1e3,
+                (double)stats->spi_transfers/stats->attempts,
+                (double)stats->spi_bytes/stats->attempts);
+    }
+}
+
+/* Main ----------------------------------------------------------------------*/
+int main(int argc, char **argv){
+    SimArgs args;
+    SimChannel *ch;
+    ExchangeStats stats;
+    FILE *out = stdout;
+    pthread_t irq_thread, uwb_thread, tdma_thread;
+    double next_initiation, end_time;
+    int node;
+
+    if (!parseArgs(argc, argv, &args)){
+        usage(argv[0]);
+        return 2;
+    }
+
+    ch = simChannelOpen(args.channel, args.slowdown);
+    if (ch == NULL){
+        return 1;
+    }
+    node = simChannelJoin(ch, args.id, args.pos, args.ppm);
+    if (node < 0){
+        fprintf(stderr, "Channel %s is full.\n", args.channel);
+        return 1;
+    }
+    if (args.out != NULL && (out = fopen(args.out, "wb")) == NULL){
+        perror(args.out);
+        return 1;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    simPortInit(ch, args.id, out);
+    dw1000SimInit(ch, node, &args.radio);
+
+    /* As in main() */
+    recordsInit();
+    uwb_init();
+    ranging_init();
+    setOutputMode(args.binary ? OUTPUT_BINARY : OUTPUT_ASCII);
+    setPassiveToggle(args.passive);
+    setPassiveOutput(args.passive_tdoa ? PASSIVE_OUTPUT_TDOA : PASSIVE_OUTPUT_RAW);
+    setRxBuffering(args.rx_double ? RX_BUFFER_DOUBLE : RX_BUFFER_SINGLE);
+    setRadioProfile(args.profile);
+    if (args.ant_dly > 0){
+        setAntennaDelay(args.profile, args.ant_dly, args.ant_dly);
+    }
+    if (args.resp_delay > 0){
+        setResponseDelay(args.resp_delay);
+    }
+    tdma_init();
+    if (!cirConfigure(args.cir_window, args.cir_iq)){
+        fprintf(stderr, "Invalid CIR window.\n");
+        return 2;
+    }
+
+    pthread_create(&irq_thread, NULL, simIrqThread, NULL);
+    pthread_create(&uwb_thread, NULL, uwbInterruptThread, NULL);
+    pthread_create(&tdma_thread, NULL, tdmaThread, NULL);
+
+    if (args.num_slots > 0 && !tdmaConfigure(args.slots, args.num_slots, args.slot_len)){
+        fprintf(stderr, "Invalid schedule.\n");
+        return 2;
+    }
+
+    /* Same loop as StartUsbReceive() in freertos.c, with the scenario in
+     * place of the USB commands. */
+    memset(&stats, 0, sizeof(stats));
+    next_initiation = simNow(ch) + args.period;
+    end_time = (args.duration > 0) ? simNow(ch) + args.duration : INFINITY;
+    while (running){
+        if (args.target >= 0 || args.num_burst > 0){
+            if (stats.attempts >= args.count){
+                break;
+            }
+            if (simNow(ch) >= next_initiation){
+                initiate(&args, &stats);
+                next_initiation += args.period;
+            }
+        }
+        else if (simNow(ch) >= end_time){
+            break;
+        }
+
+        ensureRxEnabled();
+
+        osDelay(1);
+    }
+
+    report(&args, &stats);
+    if (args.trace){
+        traceReport(TRACE_REPORT_STATS);
+    }
+    fflush(out);
+    return 0;
+}
@@ -0,0 +1,186 @@
+/**
+  ******************************************************************************
+  * @file    sim_os.c
+  * @brief   The subset of CMSIS-RTOS used by the firmware modules linked into
+  *          the host simulator, implemented on top of pthreads. Delays and
+  *          timeouts are in simulated milliseconds.
+  ******************************************************************************
+  */
+/* Includes ------------------------------------------------------------------*/
+#include "cmsis_os.h"
+#include "sim_port.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Typedefs ------------------------------------------------------------------*/
+struct os_mailQ_cb {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t queue_sz;
+    uint32_t item_sz;
+    uint8_t *pool;
+    uint8_t *used;
+    void **fifo;
+    uint32_t head;
+    uint32_t count;
+};
+
+/* osMutexId is a FreeRTOS semaphore handle, whose structure the simulator
+ * defines as a plain mutex. */
+struct QueueDefinition {
+    pthread_mutex_t lock;
+};
+
+/* Private functions ---------------------------------------------------------*/
+static void* mailAlloc(osMailQId q, int clear){
+    void *item = NULL;
+    uint32_t i;
+
+    pthread_mutex_lock(&q->lock);
+    for (i = 0; i < q->queue_sz; i++){
+        if (!q->used[i]){
+            q->used[i] = 1;
+            item = q->pool + i*q->item_sz;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    if (item != NULL && clear){
+        memset(item, 0, q->item_sz);
+    }
+    return item;
+}
+
+/* Public functions ----------------------------------------------------------*/
+osStatus osDelay(uint32_t millisec){
+    simSleep(millisec*1e-3);
+    return osOK;
+}
+
+uint32_t osKernelSysTick(void){
+    return (uint32_t)(simNow(sim_channel)*1000.0);
+}
+
+osMutexId osMutexCreate(const osMutexDef_t *mutex_def){
+    osMutexId m = calloc(1, sizeof(*m));
+
+    (void)mutex_def;
+    pthread_mutex_init(&m->lock, NULL);
+    return m;
+}
+
+osStatus osMutexWait(osMutexId mutex_id, uint32_t millisec){
+    (void)millisec;
+    if (mutex_id == NULL){
+        return osErrorParameter;
+    }
+    pthread_mutex_lock(&mutex_id->lock);
+    return osOK;
+}
+
+osStatus osMutexRelease(osMutexId mutex_id){
+    if (mutex_id == NULL){
+        return osErrorParameter;
+    }
+    pthread_mutex_unlock(&mutex_id->lock);
+    return osOK;
+}
+
+osMailQId osMailCreate(const osMailQDef_t *queue_def, osThreadId thread_id){
+    osMailQId q = calloc(1, sizeof(*q));
+
+    (void)thread_id;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->cond, NULL);
+    q->queue_sz = queue_def->queue_sz;
+    q->item_sz = queue_def->item_sz;
+    q->pool = calloc(q->queue_sz, q->item_sz);
+    q->used = calloc(q->queue_sz, 1);
+    q->fifo = calloc(q->queue_sz, sizeof(void*));
+    *queue_def->cb = q;
+    return q;
+}
+
+void* osMailAlloc(osMailQId queue_id, uint32_t millisec){
+    (void)millisec;
+    return mailAlloc(queue_id, 0);
+}
+
+void* osMailCAlloc(osMailQId queue_id, uint32_t millisec){
+    (void)millisec;
+    return mailAlloc(queue_id, 1);
+}
+
+osStatus osMailPut(osMailQId queue_id, void *mail){
+    osMailQId q = queue_id;
+
+    if (mail == NULL){
+        return osErrorParameter;
+    }
+    pthread_mutex_lock(&q->lock);
+    q->fifo[(q->head + q->count) % q->queue_sz] = mail;
+    q->count++;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+    return osOK;
+}
+
+osEvent osMailGet(osMailQId queue_id, uint32_t millisec){
+    osMailQId q = queue_id;
+    osEvent evt;
+    struct timespec deadline;
+    double wall;
+    int err = 0;
+
+    memset(&evt, 0, sizeof(evt));
+    evt.def.mail_id = q;
+
+    if (millisec != osWaitForever){
+        wall = simWallSeconds(sim_channel, millisec*1e-3);
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += (time_t)wall;
+        deadline.tv_nsec += (long)((wall - (time_t)wall)*1e9);
+        if (deadline.tv_nsec >= 1000000000L){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && err != ETIMEDOUT){
+        if (millisec == osWaitForever){
+            pthread_cond_wait(&q->cond, &q->lock);
+        }
+        else {
+            err = pthread_cond_timedwait(&q->cond, &q->lock, &deadline);
+        }
+    }
+    if (q->count > 0){
+        evt.status = osEventMail;
+        evt.value.p = q->fifo[q->head];
+        q->head = (q->head + 1) % q->queue_sz;
+        q->count--;
+    }
+    else {
+        evt.status = (millisec == 0) ? osOK : osEventTimeout;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return evt;
+}
+
+osStatus osMailFree(osMailQId queue_id, void *mail){
+    osMailQId q = queue_id;
+    uint32_t i = ((uint8_t*)mail - q->pool)/q->item_sz;
+
+    if (mail == NULL || i >= q->queue_sz){
+        return osErrorParameter;
+    }
+    pthread_mutex_lock(&q->lock);
+    q->used[i] = 0;
+    pthread_mutex_unlock(&q->lock);
+    return osOK;
+}
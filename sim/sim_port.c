@@ -0,0 +1,159 @@
+/**
+  ******************************************************************************
+  * @file    sim_port.c
+  * @brief   Host replacements for the board support code the firmware modules
+  *          depend on: the DW1000 SPI access, the DW1000 IRQ line and its
+  *          mutex, the USB CDC output and the few HAL calls made during reset.
+  *          Stands in for spi.c, dwt_iqr.c, usbd_cdc_if.c and get_board_id().
+  ******************************************************************************
+  */
+/* Includes ------------------------------------------------------------------*/
+#include "sim_port.h"
+#include "dw1000_sim.h"
+#include "deca_device_api.h"
+#include "dwt_iqr.h"
+#include "usbd_cdc_if.h"
+#include "spi.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Defines -------------------------------------------------------------------*/
+#define SIM_IRQ_POLL_US (20) // [us] wall-clock polling period of the IRQ line
+
+/* Variables -----------------------------------------------------------------*/
+SimChannel *sim_channel;
+
+/* Private variables ---------------------------------------------------------*/
+static uint8_t board_id;
+static FILE *usb_out;
+static pthread_mutex_t usb_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Held by the IRQ thread while the ISR runs, and by decamutexon() callers,
+ * which is what masking the EXTI line achieves on the board. */
+static pthread_mutex_t irq_lock;
+static port_deca_isr_t port_deca_isr = NULL;
+
+/* Public functions ----------------------------------------------------------*/
+void simPortInit(SimChannel *ch, uint8_t id, FILE *out){
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&irq_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    sim_channel = ch;
+    board_id = id;
+    usb_out = out;
+}
+
+/**
+ * @brief Sleep for a simulated duration.
+ */
+void simSleep(double sim_seconds){
+    double wall = simWallSeconds(sim_channel, sim_seconds);
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)wall;
+    ts.tv_nsec = (long)((wall - ts.tv_sec)*1e9);
+    nanosleep(&ts, NULL);
+}
+
+/**
+ * @brief Emulates the EXTI interrupt of the DW1000 IRQ pin, by polling the
+ * simulated chip.
+ */
+void* simIrqThread(void *arg){
+    (void)arg;
+
+    while (1){
+        if (port_deca_isr != NULL && dw1000SimIrqPending()){
+            pthread_mutex_lock(&irq_lock);
+            /* The line may have been cleared while the mutex was held. */
+            if (dw1000SimIrqPending()){
+                port_deca_isr();
+            }
+            pthread_mutex_unlock(&irq_lock);
+        }
+        else {
+            usleep(SIM_IRQ_POLL_US);
+        }
+    }
+    return NULL;
+}
+
+/* DW1000 SPI ----------------------------------------------------------------*/
+int writetospi(uint16 headerLength, const uint8 *headerBuffer, uint32 bodyLength, const uint8 *bodyBuffer){
+    dw1000SimSpiWrite(headerLength, headerBuffer, bodyLength, bodyBuffer);
+    return 0;
+}
+
+int readfromspi(uint16 headerLength, const uint8 *headerBuffer, uint32 readlength, uint8 *readBuffer){
+    dw1000SimSpiRead(headerLength, headerBuffer, readlength, readBuffer);
+    return 0;
+}
+
+void port_set_dw1000_slowrate(void){
+}
+
+void port_set_dw1000_fastrate(void){
+}
+
+/* DW1000 IRQ ----------------------------------------------------------------*/
+void port_set_deca_isr(port_deca_isr_t deca_isr){
+    pthread_mutex_lock(&irq_lock);
+    port_deca_isr = deca_isr;
+    pthread_mutex_unlock(&irq_lock);
+}
+
+decaIrqStatus_t decamutexon(void){
+    pthread_mutex_lock(&irq_lock);
+    return 1;
+}
+
+void decamutexoff(decaIrqStatus_t s){
+    if (s){
+        pthread_mutex_unlock(&irq_lock);
+    }
+}
+
+/* USB -----------------------------------------------------------------------*/
+/* usb_print() and usb_write() in common.c end up here. */
+uint8_t CDC_Write_FS(const uint8_t *Buf, uint16_t Len){
+    pthread_mutex_lock(&usb_lock);
+    fwrite(Buf, 1, Len, usb_out);
+    fflush(usb_out);
+    pthread_mutex_unlock(&usb_lock);
+    return USBD_OK;
+}
+
+/* Board ---------------------------------------------------------------------*/
+uint8_t get_board_id(void){
+    return board_id;
+}
+
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init){
+    (void)GPIOx;
+    (void)GPIO_Init;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState){
+    (void)GPIOx;
+    (void)GPIO_Pin;
+    (void)PinState;
+}
+
+uint32_t HAL_RCC_GetHCLKFreq(void){
+    return 168000000;
+}
+
+/* Stands in for the DWT cycle counter, see traceCycles(). Counts host time at
+ * the CPU frequency of the board, so durations are those of the host. */
+uint32_t simCycles(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec*168000000u + (uint64_t)ts.tv_nsec*168u/1000u);
+}
@@ -0,0 +1,33 @@
+/**
+  ******************************************************************************
+  * @file    sim_port.h
+  * @brief   This file contains all the function prototypes for
+  *          the sim_port.c and sim_os.c files
+  ******************************************************************************
+  */
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __SIM_PORT_H__
+#define __SIM_PORT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdio.h>
+#include "sim_channel.h"
+
+/* Variable Declarations -----------------------------------------------------*/
+extern SimChannel *sim_channel;
+
+/* Function Prototypes -------------------------------------------------------*/
+void simPortInit(SimChannel *ch, uint8_t board_id, FILE *out);
+void* simIrqThread(void *arg);
+void simSleep(double sim_seconds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SIM_PORT_H__ */
@@ -0,0 +1,24 @@
+/**
+  ******************************************************************************
+  * @file    sim_prelude.h
+  * @brief   Force-included ahead of every translation unit of the host
+  *          simulator build (gcc -include).
+  ******************************************************************************
+  */
+#ifndef __SIM_PRELUDE_H__
+#define __SIM_PRELUDE_H__
+
+/* The decadriver defines its 32-bit types as "long", which is 64 bits wide on
+ * a Linux host and breaks every register access. Pin them to 32 bits before
+ * deca_types.h gets a chance to define them. */
+#include <stdint.h>
+
+#define _DECA_UINT32_
+typedef uint32_t uint32;
+#define _DECA_INT32_
+typedef int32_t int32;
+
+/* Marks code paths of the firmware that are compiled for the simulator. */
+#define UWB_SIM (1)
+
+#endif /* __SIM_PRELUDE_H__ */
@@ -0,0 +1,59 @@
+#!/bin/sh
+# Checks the ranges of multi-target bursts (C11) on the host simulator: node 1
+# bursts to three targets, all 5 m away and with crystal offsets of several
+# ppm, and every range reported, at the initiator (R11) and at the targets
+# (S05), must be within TOLERANCE metres of 5 m.
+#
+# Run by "make test-sim". The USB output of every node is written to
+# build/sim/burst<ID>.log.
+cd "$(dirname "$0")/.."
+
+SIM="build/sim/uwb_sim --slowdown 20 --noise 0.005"
+CHANNEL=uwb_burst_$$
+LOGS=build/sim
+DISTANCE=5
+TOLERANCE=0.05
+COUNT=5
+
+make -s sim || exit 1
+
+$SIM --channel $CHANNEL --id 2 --pos 5,0,0 --ppm 10 > $LOGS/burst2.log 2>/dev/null &
+T2=$!
+$SIM --channel $CHANNEL --id 3 --pos 0,5,0 --ppm -10 > $LOGS/burst3.log 2>/dev/null &
+T3=$!
+$SIM --channel $CHANNEL --id 4 --pos -5,0,0 --ppm 8 > $LOGS/burst4.log 2>/dev/null &
+T4=$!
+trap 'kill $T2 $T3 $T4; rm -f /dev/shm/$CHANNEL' INT TERM
+
+sleep 0.5
+$SIM --channel $CHANNEL --id 1 --pos 0,0,0 --ppm -5 --burst 2,3,4 --targ-meas \
+     --count $COUNT > $LOGS/burst1.log 2>/dev/null
+STATUS=$?
+sleep 0.2
+
+kill $T2 $T3 $T4
+wait
+rm -f /dev/shm/$CHANNEL
+[ $STATUS -eq 0 ] || { echo "initiator failed"; exit 1; }
+
+# R11|count, then 10 fields per range, the distance second. S05 has the
+# distance third.
+cat $LOGS/burst1.log $LOGS/burst2.log $LOGS/burst3.log $LOGS/burst4.log | tr -d '\r' | \
+awk -F'|' -v d=$DISTANCE -v tol=$TOLERANCE -v count=$COUNT '
+    function check(tag, id, r) {
+        n++
+        if (r - d > tol || d - r > tol) {
+            printf "%s from/to %d: %s m, expected %s m\n", tag, id, r, d
+            bad++
+        }
+    }
+    $1 == "R11" { for (i = 0; i < $2; i++) check("R11", $(3 + 10*i), $(4 + 10*i)) }
+    $1 == "S05" { check("S05", $2, $3) }
+    END {
+        # Three ranges per burst at the initiator, and one at each target
+        if (n < 6*count) {
+            printf "only %d ranges out of %d\n", n, 6*count
+            bad++
+        }
+        exit bad != 0
+    }'
@@ -0,0 +1,124 @@
+#!/bin/sh
+# Checks single-node TWR (C05) on the host simulator, in each mode: node 1
+# ranges with node 2, 5 m away, while node 3 listens passively, all with
+# crystal offsets of several ppm. Every range reported, at the initiator (R05)
+# and at the target (S05), must be within TOLERANCE metres of 5 m, and the
+# pseudo-range tof(I,T) + tof(T,L) - tof(I,L) computed from the listener's
+# time-stamps (S01) within TOLERANCE of its true value. Plain SS-TWR is not
+# corrected for the clock offsets, so its expected range is offset by the
+# reply time of the target times the offset between the two crystals.
+#
+# The last run loses frames at the initiator and at the target, so that some
+# exchanges wait for a frame that never comes and are abandoned at their
+# deadline. The initiator must still go through all of them, and range in
+# the others.
+#
+# Run by "make test-sim". The USB output of every node is written to
+# build/sim/twr_<RUN><ID>.log.
+cd "$(dirname "$0")/.."
+
+SIM="build/sim/uwb_sim --slowdown 20 --noise 0.005"
+CHANNEL=uwb_twr_$$
+LOGS=build/sim
+DISTANCE=5
+TOLERANCE=0.05
+COUNT=10
+LOSSY_COUNT=20
+PPM_I=-5
+PPM_T=10
+PPM_L=-8
+
+make -s sim || exit 1
+
+# run NAME MODE COUNT [options of the initiator and target]
+run(){
+    name=$1
+    mode=$2
+    count=$3
+    shift 3
+
+    $SIM --channel $CHANNEL --id 2 --pos 5,0,0 --ppm $PPM_T "$@" > $LOGS/twr_${name}2.log 2>/dev/null &
+    T=$!
+    $SIM --channel $CHANNEL --id 3 --pos 2,4,0 --ppm $PPM_L --passive > $LOGS/twr_${name}3.log 2>/dev/null &
+    L=$!
+    trap 'kill $T $L; rm -f /dev/shm/$CHANNEL' INT TERM
+
+    sleep 0.5
+    timeout 120 $SIM --channel $CHANNEL --id 1 --pos 0,0,0 --ppm $PPM_I --target 2 \
+        --ds $mode --targ-meas --period 20 --count $count "$@" \
+        > $LOGS/twr_${name}1.log 2> $LOGS/twr_${name}1.err
+    status=$?
+    sleep 0.2
+
+    kill $T $L
+    wait
+    rm -f /dev/shm/$CHANNEL
+    [ $status -eq 0 ] || { echo "$name: initiator failed"; return 1; }
+}
+
+# check NAME MODE MIN_RANGES
+# At least MIN_RANGES R05, S05 and complete S01 lines each, all within
+# tolerance.
+check(){
+    cat $LOGS/twr_${1}1.log $LOGS/twr_${1}2.log $LOGS/twr_${1}3.log | tr -d '\r' | \
+    awk -F'|' -v name=$1 -v mode=$2 -v min=$3 -v d=$DISTANCE -v tol=$TOLERANCE \
+        -v ppm_i=$PPM_I -v ppm_t=$PPM_T '
+        BEGIN {
+            m = 299702547/(499.2e6*128)  # metres per DW1000 time unit
+            pseudo = 2*d - sqrt(2*2 + 4*4)
+        }
+        function diff(a, b) { return (a - b + 2^40) % 2^40 }
+        function check(tag, r, expected) {
+            n[tag]++
+            if (r - expected > tol || expected - r > tol) {
+                printf "%s: %s %s m, expected %s m\n", name, tag, r, expected
+                bad++
+            }
+        }
+        function range(tag) {
+            # tx1, rx1, tx2, rx2 from the fourth field on
+            expected = d
+            if (mode == 0)
+                expected += (ppm_i - ppm_t)*1e-6*diff($6, $5)*m/2
+            check(tag, $3, expected)
+        }
+        $1 == "R05" { range("R05") }
+        $1 == "S05" { range("S05") }
+        # rx1, rx2, rx3 at the listener, then tx1, rx1, tx2, rx2, tx3, rx3
+        # of the exchange, and skew2 of the target from the 17th field
+        $1 == "S01" && $4 != 0 {
+            if ($6 != 0)
+                p = diff($5, $4) - diff($9, $8)*diff($6, $5)/diff($11, $9)
+            else
+                p = diff($5, $4) - diff($9, $8)*(1 + $17*1e-6)
+            check("S01", p*m, pseudo)
+        }
+        END {
+            split("R05 S05 S01", tags, " ")
+            for (i = 1; i <= 3; i++) {
+                if (n[tags[i]] < min) {
+                    printf "%s: only %d %s ranges out of %d\n", name, n[tags[i]], tags[i], min
+                    bad++
+                }
+            }
+            exit bad != 0
+        }'
+}
+
+STATUS=0
+run ss 0 $COUNT && check ss 0 $COUNT || STATUS=1
+run ss_corrected 2 $COUNT && check ss_corrected 2 $COUNT || STATUS=1
+run ds 1 $COUNT && check ds 1 $COUNT || STATUS=1
+
+# "node 1: N/M exchanges with 2 succeeded"
+if run lossy 1 $LOSSY_COUNT --loss 0.2; then
+    SUCCEEDED=$(sed -n 's/^node 1: \([0-9]*\)\/[0-9]* exchanges.*/\1/p' $LOGS/twr_lossy1.err)
+    if [ -z "$SUCCEEDED" ] || [ "$SUCCEEDED" -eq 0 ] || [ "$SUCCEEDED" -ge $LOSSY_COUNT ]; then
+        echo "lossy: ${SUCCEEDED:-no} exchanges out of $LOSSY_COUNT succeeded"
+        STATUS=1
+    fi
+    check lossy 1 1 || STATUS=1
+else
+    STATUS=1
+fi
+exit $STATUS
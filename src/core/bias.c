@@ -5,20 +5,89 @@
   ******************************************************************************
   */
 
-// TODO: The following two constants are hard-coded, but could be automatically 
-// adjusted using the config parameter used to initialize the UWB chips in 
-// dwt_general.c.
-#define A_CONSTANT (121.74) // 113.77 for PRF of 16 MHz, 121.74 for PRF of 64 MHz
-#define N_ADJUSTMENT (-10) // SFD LENGTH-2 and adjustment as per SFD defined sequence
-
 /* Includes ------------------------------------------------------------------*/
 #include "bias.h"
-#include <math.h>
+#include "dwt_general.h"
+#include <string.h>
+
+/* Private defines -----------------------------------------------------------*/
+/* Mantissa bits indexing log_table */
+#define LOG_TABLE_BITS (6)
+
+/* 10*log10(2), the dB of one bit of the exponent */
+#define DB_PER_OCTAVE (3.010300f)
+
+/* Private variables ---------------------------------------------------------*/
+/* 10*log10(1 + i/64), for fastDb() */
+static const float log_table[(1 << LOG_TABLE_BITS) + 1] = {
+    0.000000f, 0.067334f, 0.133640f, 0.198948f, 0.263289f, 0.326691f,
+    0.389181f, 0.450784f, 0.511525f, 0.571429f, 0.630517f, 0.688813f,
+    0.746336f, 0.803108f, 0.859146f, 0.914471f, 0.969100f, 1.023050f,
+    1.076339f, 1.128981f, 1.180993f, 1.232390f, 1.283185f, 1.333393f,
+    1.383027f, 1.432100f, 1.480625f, 1.528614f, 1.576079f, 1.623030f,
+    1.669479f, 1.715436f, 1.760913f, 1.805918f, 1.850461f, 1.894552f,
+    1.938200f, 1.981414f, 2.024202f, 2.066573f, 2.108534f, 2.150093f,
+    2.191259f, 2.232038f, 2.272438f, 2.312465f, 2.352127f, 2.391430f,
+    2.430380f, 2.468985f, 2.507249f, 2.545179f, 2.582780f, 2.620059f,
+    2.657020f, 2.693670f, 2.730013f, 2.766054f, 2.801799f, 2.837251f,
+    2.872417f, 2.907300f, 2.941906f, 2.976237f, 3.010300f,
+};
+
+/* Range bias tables, by radio profile. Written by the USB task, read by the
+ * UWB task, which has the higher priority: num_points is cleared while a
+ * table is replaced, so that a partly written table is never used. */
+static BiasTable bias_tables[NUM_RADIO_PROFILES];
+static volatile uint8_t bias_num_points[NUM_RADIO_PROFILES];
 
-/* MAIN BIAS FUNCTIONS ---------------------------------------- */ 
+/* Private functions ---------------------------------------------------------*/
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: fastDb()
+ *
+ * @brief 10*log10(x), to within 0.001 dB. The integer part of log2(x) is the
+ *        position of its leading one, and the rest comes from the next bits,
+ *        interpolated in log_table.
+ *
+ * @param x (uint64_t) Greater than 0.
+ */
+static float fastDb(uint64_t x){
+    int exponent = 63 - __builtin_clzll(x);
+    /* The leading one at bit 31 */
+    uint32_t mantissa = (exponent >= 31) ? (uint32_t)(x >> (exponent - 31))
+                                         : (uint32_t)(x << (31 - exponent));
+    uint32_t idx = (mantissa >> (31 - LOG_TABLE_BITS)) & ((1 << LOG_TABLE_BITS) - 1);
+    float frac = (mantissa & ((1u << (31 - LOG_TABLE_BITS)) - 1))
+                 * (1.0f/(1u << (31 - LOG_TABLE_BITS)));
+
+    return exponent*DB_PER_OCTAVE + log_table[idx]
+           + frac*(log_table[idx + 1] - log_table[idx]);
+}
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: biasLookup()
+ *
+ * @brief Bias of one link, in mm, interpolated in a table with points.
+ */
+static float biasLookup(const BiasTable *table, uint8_t num_points, float fpp){
+    float pos = (fpp - table->fpp_start)/table->fpp_step;
+    int i;
+
+    if (pos <= 0){
+        return table->bias_mm[0];
+    }
+    if (pos >= num_points - 1){
+        return table->bias_mm[num_points - 1];
+    }
+    i = (int)pos;
+    return table->bias_mm[i] + (pos - i)*(table->bias_mm[i + 1] - table->bias_mm[i]);
+}
+
+/* MAIN BIAS FUNCTIONS ---------------------------------------- */
 int retrievePower(float* fpp){
+    /* The constants of the radio profile in use, see dwt_general.c */
+    const RadioProfile *profile = radioProfile();
     uint8_t F_reg_data[RX_FQUAL_LEN] = {0};
     uint16_t F1, F2, F3;
+    uint64_t power;
 
     /* Read the diagnostics register and save to local memory */
     dwt_readfromdevice(RX_FQUAL_ID, RX_FQUAL_OFFSET, RX_FQUAL_LEN, F_reg_data);
@@ -34,16 +103,52 @@ int retrievePower(float* fpp){
 
     dwt_readfromdevice(RX_FINFO_ID, RX_FINFO_OFFSET, RX_FINFO_LEN, N_reg_data); // Read the entire register
     N = (*(uint32_t*)N_reg_data & RX_FINFO_RXPACC_MASK) >> RX_FINFO_RXPACC_SHIFT; // Retrieve the subregister for N
-    N = N + N_ADJUSTMENT; // This is the adjustment for the SFD accumulation as per the manual.
+    N = N + profile->rxpacc_adjustment; // This is the adjustment for the SFD accumulation as per the manual.
                           // TODO: compare to RXPACC_NOSAT before implementing?
 
-    /* Compute the first path power */
-    *fpp = 10*log10((F1*F1 + F2*F2 + F3*F3)/(N*N)) - A_CONSTANT;
+    /* Compute the first path power, 10*log10((F1^2 + F2^2 + F3^2)/N^2) - A.
+       The sum of squares needs more than 32 bits. A power too low to be
+       measured is clamped. */
+    power = (uint64_t)F1*F1 + (uint64_t)F2*F2 + (uint64_t)F3*F3;
+    if (power == 0){
+        power = 1;
+    }
+    if (N == 0){
+        N = 1;
+    }
+    *fpp = fastDb(power) - fastDb((uint64_t)N*N) - profile->a_constant;
 
     return 1;
 }
 
 int retrieveSkew(float* skew){
-    *skew = - dwt_readcarrierintegrator() * (FREQ_OFFSET_MULTIPLIER * HERTZ_TO_PPM_MULTIPLIER_CHAN_2 );
+    *skew = dwt_readcarrierintegrator() * radioProfile()->skew_ppm_per_ci;
+    return 1;
+}
+
+int biasConfigure(uint8_t profile, const BiasTable *table){
+    if (profile >= NUM_RADIO_PROFILES || table->num_points > BIAS_TABLE_MAX_POINTS){
+        return 0;
+    }
+    if (table->num_points > 0 && !(table->fpp_step > 0)){
+        return 0;
+    }
+
+    bias_num_points[profile] = 0;
+    memcpy(&bias_tables[profile], table, sizeof(BiasTable));
+    bias_num_points[profile] = table->num_points;
     return 1;
-}
\ No newline at end of file
+}
+
+bool biasCorrectRange(float *distance, float fpp1, float fpp2){
+    uint8_t profile = radioProfileId();
+    uint8_t num_points = bias_num_points[profile];
+    const BiasTable *table = &bias_tables[profile];
+
+    if (num_points == 0){
+        return false;
+    }
+    *distance -= 0.0005f*(biasLookup(table, num_points, fpp1)
+                          + biasLookup(table, num_points, fpp2));
+    return true;
+}
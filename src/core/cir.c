@@ -1,76 +1,207 @@
+/**
+  ******************************************************************************
+  * @file    cir.c
+  * @brief   Capture and output of the channel impulse response (CIR) of the
+  *          last received frame.
+  *
+  *          Either the whole accumulator is output as magnitudes (S10), or
+  *          only a window of taps around the first path, as magnitudes or as
+  *          raw complex taps (S13). The capture is a single read of the
+  *          accumulator right after the exchange. It is then formatted and
+  *          sent in small steps by the UWB task whenever it has nothing else
+  *          to do, so that it never holds up the next exchange.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
 #include "cir.h"
-#include <math.h>
+#include "records.h"
+#include "dwt_general.h"
+#include <stdlib.h>
 
-// #define READ_SIZE 100
-#define NUM_CIR_POINTS 1016
-#define ACCUM_DATA_LEN (NUM_CIR_POINTS)
-static uint32 accum_data[ACCUM_DATA_LEN];
+/* Defines -------------------------------------------------------------------*/
+/* Captures waiting to be output. Any further capture is dropped. */
+#define CIR_NUM_CAPTURES (2)
 
-#define READ_SIZE 25
-#define NUM_SYMBOLS 50
-char buf[NUM_SYMBOLS*5], *pos = buf;
+/* Typedefs ------------------------------------------------------------------*/
+typedef struct {
+    bool ready;
+    bool window;             // S13 if set, S10 otherwise.
+    CirWindowHeader header;
+    uint16_t next;           // Next tap to output.
+    /* The accumulator is read into data[3], so that the taps, which follow
+     * a dummy byte, start aligned at data[4]. */
+    uint8_t data[4 + 4*NUM_CIR_POINTS] __attribute__((aligned(4)));
+} CirCapture;
 
-int read_cir(uint8_t initiator_id, uint8_t target_id){
-	uint8 *cir; cir = (uint8 *)malloc((1+READ_SIZE*4)*sizeof(uint8));
-	int16 real;
-	int16 imag;
-
-	uint16 first_path_idx = dwt_read16bitoffsetreg(
-		RX_TIME_ID, 
-		RX_TIME_FP_INDEX_OFFSET
-	);
-
-	for(int i = 0;i<NUM_CIR_POINTS;i+=READ_SIZE)
-	{
-		dwt_readaccdata(cir, (1+READ_SIZE*4), 0 + 4*i);
-		// accum_data[i] = (uint32)sqrt(pow(real,2) + pow(imag,2));
-		for (int j=0; j<READ_SIZE && j+i<NUM_CIR_POINTS; j++){
-			real =  (int16)cir[4*j+2] << 8 | (int16)cir[4*j+1];
-			imag =  (int16)cir[4*j+4] << 8 | (int16)cir[4*j+3];
-			accum_data[j+i] = (uint32)(
-				fmax(abs(real),abs(imag)) + fmin(abs(real),abs(imag))/4
-			);
-		}
-	}
-	free(cir);
-
-	// osDelay(1);
-	output_cir(initiator_id, target_id, first_path_idx);
-	return 1;
+/* Private variables ---------------------------------------------------------*/
+/* Set by cirConfigure(). A half-window of 0 outputs the whole accumulator. */
+static volatile uint16_t cir_half_window = 0;
+static volatile bool cir_iq = false;
+
+/* Only accessed by the UWB task. */
+static CirCapture captures[CIR_NUM_CAPTURES];
+static uint8_t cir_head = 0;  // Next capture to fill
+static uint8_t cir_tail = 0;  // Next capture to output
+
+/* Private functions ---------------------------------------------------------*/
+/*! ----------------------------------------------------------------------------
+ * Function: cirMagnitude()
+ *
+ * @brief Approximate magnitude of a complex tap, max + min/4, as output so
+ * far. Never exceeds 16 bits.
+ */
+static uint32_t cirMagnitude(const uint8_t *tap){
+    int16 real = (int16)tap[1] << 8 | (int16)tap[0];
+    int16 imag = (int16)tap[3] << 8 | (int16)tap[2];
+    uint32_t re = abs(real);
+    uint32_t im = abs(imag);
+
+    return (re > im) ? re + im/4 : im + re/4;
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: cirToMagnitudes()
+ *
+ * @brief Replace the complex taps of a capture by their magnitudes, in place.
+ * The magnitudes are 32 bits for S10 and 16 bits for S13, never longer than
+ * the 4-byte taps they overwrite.
+ */
+static void cirToMagnitudes(CirCapture *cap){
+    uint8_t *taps = &cap->data[4];
+    uint32_t *mag32 = (uint32_t*)taps;
+    uint16_t *mag16 = (uint16_t*)taps;
+
+    for (int i=0; i<cap->header.num_taps; i++){
+        if (cap->window){
+            mag16[i] = cirMagnitude(&taps[4*i]);
+        }
+        else{
+            mag32[i] = cirMagnitude(&taps[4*i]);
+        }
+    }
+}
+
+/* Public functions ----------------------------------------------------------*/
+/*! ----------------------------------------------------------------------------
+ * Function: cirConfigure()
+ *
+ * @brief Select which part of the CIR is output by the following captures.
+ *
+ * @param half_window (uint16_t) Taps kept on each side of the first path, 0
+ * for the whole accumulator.
+ * @param iq (bool) Output the raw complex taps instead of their magnitudes.
+ * Only available with a window of at most CIR_MAX_IQ_HALF_WINDOW.
+ *
+ * @return (int) 1 if the configuration was accepted.
+ */
+int cirConfigure(uint16_t half_window, bool iq){
+    if (iq && (half_window == 0 || half_window > CIR_MAX_IQ_HALF_WINDOW)){
+        return 0;
+    }
+    if (half_window >= NUM_CIR_POINTS){
+        return 0;
+    }
+
+    cir_half_window = half_window;
+    cir_iq = iq;
+    return 1;
 }
 
-void output_cir(uint8_t initiator_id, uint8_t target_id, uint16_t first_path_idx){
-	char response[21];
-	char* ptr = buf;
+/*! ----------------------------------------------------------------------------
+ * Function: read_cir()
+ *
+ * @brief Capture the CIR of the last received frame. Must be called by the
+ * UWB task before the receiver is re-enabled. The capture is output later
+ * by cirOutputStep().
+ *
+ * @return (int) 1 if captured, 0 if dropped because the previous captures
+ * have not been output yet.
+ */
+int read_cir(uint8_t initiator_id, uint8_t target_id){
+    CirCapture *cap = &captures[cir_head];
+    uint16_t half_window = cir_half_window;
+    uint16_t num_taps = radioProfile()->cir_taps;
+    uint16_t first_path_idx, center, first, last;
 
-	for (int lv0=0; lv0<NUM_CIR_POINTS; lv0+=NUM_SYMBOLS){
-		ptr = pos;
-		for (int lv1=lv0; lv1<lv0+NUM_SYMBOLS && lv1<NUM_CIR_POINTS; ++lv1){
-			if (lv1 == 0) {
-				sprintf(
-					response, "%s|%d|%d|%u|%u",
-					"S10", initiator_id, target_id, 
-					first_path_idx/64, (first_path_idx%64)*1000/64
-				);
-				strcpy(ptr, response);
-				ptr += strlen(response);
-			}
+    if (cap->ready){
+        return 0;
+    }
 
-			sprintf(response, "|%lu", accum_data[lv1]);
-			strcpy(ptr, response);
-			ptr += strlen(response);
-		}
+    first_path_idx = dwt_read16bitoffsetreg(
+        RX_TIME_ID, 
+        RX_TIME_FP_INDEX_OFFSET
+    );
 
-		osDelay(1);
+    if (half_window == 0){
+        first = 0;
+        last = num_taps - 1;
+    }
+    else{
+        center = (first_path_idx + 32) >> 6; // Nearest tap
+        if (center >= num_taps){
+            center = num_taps - 1;
+        }
+        first = (center > half_window) ? center - half_window : 0;
+        last = center + half_window;
+        if (last >= num_taps){
+            last = num_taps - 1;
+        }
+    }
 
-		usb_print(buf);
+    /* One SPI transaction for the whole window */
+    dwt_readaccdata(&cap->data[3], 1 + 4*(last - first + 1), 4*first);
 
-		// osDelay(1);
-	}
+    cap->window = (half_window != 0);
+    cap->header.initiator_id = initiator_id;
+    cap->header.target_id = target_id;
+    cap->header.first_path_idx = first_path_idx;
+    cap->header.first_tap = first;
+    cap->header.num_taps = last - first + 1;
+    cap->header.flags = (cap->window && cir_iq) ? RECORD_CIR_FLAG_IQ : 0;
+    cap->next = 0;
+    cap->ready = true;
+    cir_head = (cir_head + 1) % CIR_NUM_CAPTURES;
+    return 1;
+}
 
-	osDelay(1);
+/*! ----------------------------------------------------------------------------
+ * Function: cirOutputPending()
+ *
+ * @brief Whether a capture is waiting to be output.
+ */
+bool cirOutputPending(void){
+    return captures[cir_tail].ready;
+}
 
-	usb_print("\r\n");
+/*! ----------------------------------------------------------------------------
+ * Function: cirOutputStep()
+ *
+ * @brief Output the next chunk of the oldest capture.
+ */
+void cirOutputStep(void){
+    CirCapture *cap = &captures[cir_tail];
 
-	osDelay(1);
-}
\ No newline at end of file
+    if (!cap->ready){
+        return;
+    }
+
+    if (cap->next == 0 && !(cap->header.flags & RECORD_CIR_FLAG_IQ)){
+        cirToMagnitudes(cap);
+    }
+
+    if (cap->window){
+        cap->next = outputCirWindowRecord(&cap->header, &cap->data[4], cap->next);
+    }
+    else{
+        cap->next = outputCirRecord(cap->header.initiator_id, cap->header.target_id,
+                                    cap->header.first_path_idx,
+                                    (const uint32_t*)&cap->data[4],
+                                    cap->header.num_taps, cap->next);
+    }
+
+    if (cap->next >= cap->header.num_taps){
+        cap->ready = false;
+        cir_tail = (cir_tail + 1) % CIR_NUM_CAPTURES;
+    }
+}
@@ -20,7 +20,6 @@
 #include "commands.h"
 #include "common.h"
 #include "ranging.h"
-#include "uthash.h"
 #include "main.h" 
 #include <stdbool.h>
 #include "messaging.h"
@@ -30,14 +29,20 @@
 #include "usb_device.h"
 #include "spi.h"
 #include "cir.h"
-
-int c00_set_idle(IntParams *msg_ints, FloatParams *msg_floats, BoolParams *msg_bools, StrParams *msg_strs, ByteParams *msg_bytes){
+#include "records.h"
+#include "tdma.h"
+#include "trace.h"
+#include "rtos_stats.h"
+#include "bias.h"
+#include "testing.h"
+
+int c00_set_idle(const CommandParams *params){
     usb_print("R00\r\n");
     osDelay(1);
     return 1;
 }
 
-int c01_get_id(IntParams *msg_ints, FloatParams *msg_floats, BoolParams *msg_bools, StrParams *msg_strs, ByteParams *msg_bytes){
+int c01_get_id(const CommandParams *params){
     char id_str[10];
     sprintf(id_str, "R01|%u\r\n", BOARD_ID()); 
     usb_print(id_str);
@@ -45,7 +50,7 @@ int c01_get_id(IntParams *msg_ints, FloatParams *msg_floats, BoolParams *msg_boo
     return 1;
 }
 
-int c02_reset(IntParams *msg_ints, FloatParams *msg_floats, BoolParams *msg_bools, StrParams *msg_strs, ByteParams *msg_bytes){
+int c02_reset(const CommandParams *params){
     // Reset the UWB receiver. TODO: would we need to reset other things? Could even do a hard reset.
     dwt_rxreset();
 
@@ -56,90 +61,78 @@ int c02_reset(IntParams *msg_ints, FloatParams *msg_floats, BoolParams *msg_bool
     return 1;
 }
 
-int c03_do_tests(IntParams *msg_ints, FloatParams *msg_floats, BoolParams *msg_bools, StrParams *msg_strs, ByteParams *msg_bytes){
+int c03_do_tests(const CommandParams *params){
     /* TODO: 
     1) Add any other tests necessary.
     2) When we add tests, it might be worthwhile to give different 
        errors an ID and just output the error ID.
 
     */
-    IntParams *i;
-    BoolParams *b; 
-    StrParams *s;
-    FloatParams *f;
-    ByteParams *y;
+    const C03Params *p = &params->c03;
     char float_as_string[10] = {0};
     char response[300] = {0};
 
-    HASH_FIND_STR(msg_ints, "test_int", i);
-    HASH_FIND_STR(msg_strs, "test_str", s);
-    HASH_FIND_STR(msg_bools, "test_bool", b);
-    HASH_FIND_STR(msg_floats, "test_flt", f);
-    HASH_FIND_STR(msg_bytes, "test_byte", y);
-
     uint8_t my_id;
     uint8_t error_id = 0;
     dwt_geteui(&my_id);
     if(my_id != BOARD_ID()){
         error_id = 1;
     }
-    convert_float_to_string(float_as_string, f->value);
+    convert_float_to_string(float_as_string, p->test_flt);
 
-    sprintf(response,"R03|%u|%d|%s|%d|%s|", error_id, i->value, s->value, b->value, float_as_string);
+    sprintf(response,"R03|%u|%d|%s|%d|%s|", error_id, p->test_int, p->test_str, p->test_bool, float_as_string);
     uint16_t len = strlen(response);
 
-    memcpy(&response[len], &(y->len), 2);
+    // Truncate the echo rather than overflow the response buffer
+    uint16_t byte_len = p->test_byte.len;
+    if (byte_len > sizeof(response) - len - 4){
+        byte_len = sizeof(response) - len - 4;
+    }
+    memcpy(&response[len], &byte_len, 2);
     len += 2;
-    memcpy(&response[len], y->value, y->len);
-    len += y->len;
+    memcpy(&response[len], p->test_byte.value, byte_len);
+    len += byte_len;
     memcpy(&response[len],"\r\n", 2);
     len += 2;
-    CDC_Transmit_FS((u_int8_t *) &response[0], len);
+    usb_write((uint8_t *) &response[0], len);
    
     return 1;
 }
 
-int c04_toggle_passive(IntParams *msg_ints, FloatParams *msg_floats, BoolParams *msg_bools, StrParams *msg_strs, ByteParams *msg_bytes){
-    BoolParams *i;
-    
-    /* Extract the toggle */
-    HASH_FIND_STR(msg_bools, "toggle", i);
-    
-    setPassiveToggle(i->value);
+int c04_toggle_passive(const CommandParams *params){
+    setPassiveToggle(params->c04.toggle);
 
     usb_print("R04\r\n");
     
     return 1;
 }
 
-int c05_initiate_twr(IntParams *msg_ints, FloatParams *msg_floats, BoolParams *msg_bools, StrParams *msg_strs, ByteParams *msg_bytes){
+int c05_initiate_twr(const CommandParams *params){
     bool success;
     uint8_t target_ID, ds_twr;
-    IntParams *i;
     bool target_meas_bool;
     bool get_cir;
-    BoolParams *b;
 
     /* Extract the target */
-    HASH_FIND_STR(msg_ints, "target", i);
-    target_ID = i->value;
+    target_ID = params->c05.target;
 
     /* Extract the toggle that dictates if the target computes range measurements */
-    HASH_FIND_STR(msg_bools, "targ_meas", b);
-    target_meas_bool = b->value;
+    target_meas_bool = params->c05.targ_meas;
 
-    /* Extract the toggle that dictates if DS-TWR will be used */
-    HASH_FIND_STR(msg_ints, "ds_twr", i);
-    ds_twr = i->value;
+    /* Extract the ranging mode: 0 SS-TWR, 1 DS-TWR, 2 SS-TWR corrected for the clock offset */
+    ds_twr = params->c05.ds_twr;
 
-    /* Extract the toggle that dictates if the target computes range measurements */
-    HASH_FIND_STR(msg_bools, "get_cir", b);
-    get_cir = b->value;
+    /* Extract the toggle that dictates if the CIR is read and output */
+    get_cir = params->c05.get_cir;
 
     if (target_ID == BOARD_ID()){
         usb_print("TWR FAIL: The target ID is the same as the initiator's ID.\r\n");
         return 1;
     }
+    if (params->c05.ds_twr < TWR_MODE_SS || params->c05.ds_twr > TWR_MODE_SS_CORRECTED){
+        usb_print("TWR FAIL: Invalid ranging mode.\r\n");
+        return 1;
+    }
 
     success = twrInitiateInstance(target_ID, target_meas_bool, ds_twr, get_cir);
 
@@ -153,12 +146,10 @@ int c05_initiate_twr(IntParams *msg_ints, FloatParams *msg_floats, BoolParams *m
 }
 
 
-int c06_broadcast(IntParams *msg_ints, FloatParams *msg_floats, BoolParams *msg_bools, StrParams *msg_strs, ByteParams *msg_bytes){
+int c06_broadcast(const CommandParams *params){
     
-    ByteParams *b;
-    
-    HASH_FIND_STR(msg_bytes, "data", b);
-    uint8_t *msg = &(b->value[0]);
+    const BytesField *b = &params->c06.data;
+    uint8_t *msg = (uint8_t *) &(b->value[0]);
 
     // TODO: we need to standardize the response when success/fail.
     bool success;
@@ -174,20 +165,19 @@ int c06_broadcast(IntParams *msg_ints, FloatParams *msg_floats, BoolParams *msg_
     osDelay(1);
 }
 
-int c07_get_max_frame_len(IntParams *msg_ints, FloatParams *msg_floats, BoolParams *msg_bools, StrParams *msg_strs, ByteParams *msg_bytes){
+int c07_get_max_frame_len(const CommandParams *params){
     char response[20];
     sprintf(response, "R07|%u\r\n", MAX_FRAME_LEN); 
     usb_print(response);
     return 1;
 }
 
-int c08_set_response_delay(IntParams *msg_ints, FloatParams *msg_floats, BoolParams *msg_bools, StrParams *msg_strs, ByteParams *msg_bytes){
-    IntParams *i;
-    
-    /* Extract the toggle */
-    HASH_FIND_STR(msg_ints, "delay", i);
-
-    setResponseDelay(i->value);
+int c08_set_response_delay(const CommandParams *params){
+    if (params->c08.delay <= 0 || params->c08.delay > MAX_RESPONSE_DELAY_UUS){
+        usb_print("DELAY FAIL: Invalid response delay.\r\n");
+        return 1;
+    }
+    setResponseDelay(params->c08.delay);
 
     usb_print("R08\r\n");
     
@@ -203,13 +193,246 @@ int c08_set_response_delay(IntParams *msg_ints, FloatParams *msg_floats, BoolPar
  * https://stm32f4-discovery.net/2017/04/tutorial-jump-system-memory-software-stm32/
  * 
  */
-int c09_jump_to_bootloader(IntParams *msg_ints, FloatParams *msg_floats, BoolParams *msg_bools, StrParams *msg_strs, ByteParams *msg_bytes){
+int c09_jump_to_bootloader(const CommandParams *params){
     usb_print("R09\r\n");
     osDelay(100);
     jump_to_bootloader();
     return 0; // should never get here.
 }
 
+int c10_set_output_mode(const CommandParams *params){
+    /* Extract the output mode. 0 for ASCII, 1 for binary records. */
+    if (params->c10.mode == OUTPUT_BINARY){
+        setOutputMode(OUTPUT_BINARY);
+    }
+    else{
+        setOutputMode(OUTPUT_ASCII);
+    }
+
+    usb_print("R10\r\n");
+
+    return 1;
+}
+
+int c11_initiate_burst(const CommandParams *params){
+    const BytesField *targets = &params->c11.targets;
+
+    if (targets->len == 0 || targets->len > BURST_MAX_TARGETS){
+        usb_print("TWR FAIL: A burst must have between 1 and 6 targets.\r\n");
+        return 1;
+    }
+    for (int i=0; i<targets->len; i++){
+        if (targets->value[i] == BOARD_ID()){
+            usb_print("TWR FAIL: The target ID is the same as the initiator's ID.\r\n");
+            return 1;
+        }
+    }
+
+    /* The ranges are output inside `twrBurstInstance`, as a single R11 record */
+    return twrBurstInstance(targets->value, targets->len, params->c11.targ_meas);
+}
+
+int c12_set_schedule(const CommandParams *params){
+    /* Every slot is given as 4 bytes: initiator, target, DS-TWR mode and flags.
+       No slots stops the schedule, with any positive slot length. */
+    const BytesField *slots = &params->c12.slots;
+    TdmaSlot table[TDMA_MAX_SLOTS];
+    uint8_t num_slots = slots->len / TDMA_SLOT_LEN;
+
+    if (params->c12.slot_len <= 0){
+        usb_print("TDMA FAIL: Invalid slot length.\r\n");
+        return 1;
+    }
+    if (slots->len % TDMA_SLOT_LEN != 0 || slots->len > sizeof(table)){
+        usb_print("TDMA FAIL: Invalid slot table.\r\n");
+        return 1;
+    }
+    memcpy(table, slots->value, slots->len);
+    for (int i=0; i<num_slots; i++){
+        if (table[i].ds_twr > TWR_MODE_SS_CORRECTED){
+            usb_print("TDMA FAIL: Invalid ranging mode.\r\n");
+            return 1;
+        }
+    }
+
+    if (!tdmaConfigure(table, num_slots, params->c12.slot_len)){
+        usb_print("TDMA FAIL: Invalid slot length.\r\n");
+        return 1;
+    }
+
+    usb_print("R12\r\n");
+    return 1;
+}
+
+int c13_set_cir_window(const CommandParams *params){
+    /* Taps kept on each side of the first path by the following CIR captures,
+       0 for all of them, and whether the raw complex taps are output. */
+    int half_window = params->c13.half_window;
+
+    if (half_window < 0 || half_window >= NUM_CIR_POINTS){
+        usb_print("CIR FAIL: Invalid window.\r\n");
+        return 1;
+    }
+    if (!cirConfigure(half_window, params->c13.iq)){
+        usb_print("CIR FAIL: Complex taps need a window of 1 to 255 taps.\r\n");
+        return 1;
+    }
+
+    usb_print("R13\r\n");
+    return 1;
+}
+
+int c14_set_passive_output(const CommandParams *params){
+    /* 0 for the raw S01 timestamps, 1 for the S14 pseudo-ranges computed
+       on board. */
+    int mode = params->c14.mode;
+
+    if (mode != PASSIVE_OUTPUT_RAW && mode != PASSIVE_OUTPUT_TDOA){
+        usb_print("PASSIVE FAIL: Invalid output mode.\r\n");
+        return 1;
+    }
+    setPassiveOutput(mode);
+
+    usb_print("R14\r\n");
+    return 1;
+}
+
+int c15_set_rx_buffering(const CommandParams *params){
+    /* 0 for a single RX buffer, 1 for the double buffer of the DW1000. */
+    int mode = params->c15.mode;
+
+    if (mode != RX_BUFFER_SINGLE && mode != RX_BUFFER_DOUBLE){
+        usb_print("RXBUF FAIL: Invalid buffering mode.\r\n");
+        return 1;
+    }
+    setRxBuffering(mode);
+
+    usb_print("R15\r\n");
+    return 1;
+}
+
+int c16_set_radio_profile(const CommandParams *params){
+    /* RADIO_PROFILE_, see dwt_general.c. All boards must be switched. */
+    int profile = params->c16.profile;
+
+    if (profile < 0 || profile >= NUM_RADIO_PROFILES){
+        usb_print("PROFILE FAIL: Invalid radio profile.\r\n");
+        return 1;
+    }
+    setRadioProfile(profile);
+
+    usb_print("R16\r\n");
+    return 1;
+}
+
+int c17_get_trace(const CommandParams *params){
+    /* TRACE_REPORT_, see traceReport() for the output */
+    int report = params->c17.report;
+
+    if (report != TRACE_REPORT_STATS && report != TRACE_REPORT_RESET
+        && report != TRACE_REPORT_RECENT){
+        usb_print("TRACE FAIL: Invalid report.\r\n");
+        return 1;
+    }
+    traceReport(report);
+    return 1;
+}
+
+int c18_get_rtos_stats(const CommandParams *params){
+    /* 1 to start the queue peaks over. The snapshot is a binary record, see
+       rtos_stats.c */
+    int reset = params->c18.reset;
+
+    if (reset != 0 && reset != 1){
+        usb_print("RTOS FAIL: Invalid reset.\r\n");
+        return 1;
+    }
+    if (!rtosStatsSend(reset)){
+        usb_print("RTOS FAIL: USB busy.\r\n");
+    }
+    return 1;
+}
+
+int c19_set_bias_table(const CommandParams *params){
+    /* Range bias in mm, as little-endian int16 every fpp_step dB from
+       fpp_start dBm, for one radio profile. No points stops the correction. */
+    const C19Params *p = &params->c19;
+    BiasTable table;
+
+    if (p->profile < 0 || p->profile >= NUM_RADIO_PROFILES){
+        usb_print("BIAS FAIL: Invalid radio profile.\r\n");
+        return 1;
+    }
+    if (p->bias.len % sizeof(int16_t) != 0 || p->bias.len > sizeof(table.bias_mm)){
+        usb_print("BIAS FAIL: Invalid bias table.\r\n");
+        return 1;
+    }
+    table.fpp_start = p->fpp_start;
+    table.fpp_step = p->fpp_step;
+    table.num_points = p->bias.len / sizeof(int16_t);
+    memcpy(table.bias_mm, p->bias.value, p->bias.len);
+
+    if (!biasConfigure(p->profile, &table)){
+        usb_print("BIAS FAIL: Invalid point spacing.\r\n");
+        return 1;
+    }
+
+    usb_print("R19\r\n");
+    return 1;
+}
+
+int c20_set_antenna_delay(const CommandParams *params){
+    /* TX and RX antenna delays of this board for one radio profile, in DW1000
+       time units, 0 to leave one as it is. Replies with the delays now set. */
+    const C20Params *p = &params->c20;
+    uint16_t tx, rx;
+    char response[30];
+
+    if (p->profile < 0 || p->profile >= NUM_RADIO_PROFILES){
+        usb_print("ANTD FAIL: Invalid radio profile.\r\n");
+        return 1;
+    }
+    if (p->tx < 0 || p->tx > UINT16_MAX || p->rx < 0 || p->rx > UINT16_MAX){
+        usb_print("ANTD FAIL: Invalid antenna delay.\r\n");
+        return 1;
+    }
+    antennaDelayGet(p->profile, &tx, &rx);
+    if (p->tx != 0 || p->rx != 0){
+        tx = p->tx ? p->tx : tx;
+        rx = p->rx ? p->rx : rx;
+        setAntennaDelay(p->profile, tx, rx);
+    }
+
+    sprintf(response, "R20|%u|%u\r\n", tx, rx);
+    usb_print(response);
+    return 1;
+}
+
+int c21_run_benchmark(const CommandParams *params){
+    /* 0 for the SPI port, 1 for the range computation. The cycle counts are
+       printed ahead of the reply, see testing.c */
+    int benchmark = params->c21.benchmark;
+
+    if (benchmark != 0 && benchmark != 1){
+        usb_print("BENCH FAIL: Invalid benchmark.\r\n");
+        return 1;
+    }
+    if (benchmark == 0){
+        /* The benchmark uses the radio, which the schedule would too */
+        if (tdmaActive()){
+            usb_print("BENCH FAIL: Stop the schedule first.\r\n");
+            return 1;
+        }
+        spi_benchmark();
+    }
+    else{
+        ranging_math_benchmark();
+    }
+
+    usb_print("R21\r\n");
+    return 1;
+}
+
 void jump_to_bootloader(void){
     /**
      * Step: Set system memory address.
@@ -303,4 +526,4 @@ void jump_to_bootloader(void){
         HAL_GPIO_TogglePin(GPIOC, GPIO_PIN_7);
         HAL_Delay(50);
     }
-}
\ No newline at end of file
+}
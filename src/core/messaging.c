@@ -14,10 +14,12 @@
 #define PRE_TIMEOUT 8
 
 /* Prefix and Suffix of Message SENT over UWB */
-#define PREFIX_LEN 4 // in number of bytes
+#define PREFIX_LEN UWB_FRAME_HEADER_LEN // in number of bytes
+#define PREFIX_DEST_IDX 5 // Destination short address, broadcast
+#define PREFIX_SRC_IDX 7  // Source short address, the board ID
 #define SUFFIX_LEN 2 // in number of bytes
 #define MAX_MSG_LEN (MAX_FRAME_LEN - PREFIX_LEN - SUFFIX_LEN)
-uint8 msg_prefix[] = {0x41, 0x88, 0xD, 0};
+uint8 msg_prefix[] = {UWB_FRAME_HEADER(0xD)};
 uint8 msg_suffix[] = {0, 0};
 
 /* Prefix and Suffix of Message SENT over USB */
@@ -44,6 +46,9 @@ int broadcast(uint8* msg, uint16_t msg_len){
         uint8_t full_msg[MAX_FRAME_LEN];
         memset(full_msg, 0, MAX_FRAME_LEN);
         memcpy(full_msg                           , msg_prefix, PREFIX_LEN);
+        full_msg[PREFIX_DEST_IDX]     = (uint8_t)UWB_BROADCAST_ADDR;
+        full_msg[PREFIX_DEST_IDX + 1] = (uint8_t)(UWB_BROADCAST_ADDR >> 8);
+        full_msg[PREFIX_SRC_IDX]      = BOARD_ID();
         memcpy(full_msg + PREFIX_LEN              , &msg_len  , 2);
         memcpy(full_msg + PREFIX_LEN + 2          , msg       , msg_len);
         memcpy(full_msg + PREFIX_LEN + 2 + msg_len, msg_suffix, SUFFIX_LEN);
@@ -73,16 +78,23 @@ int broadcast(uint8* msg, uint16_t msg_len){
  * detected.
  * 
  * @param rx_data pointer to buffer containing data.
- * @return int 1 if successful
+ * @param rx_len length of the received frame, in bytes.
+ * @return int 1 if successful, 0 if the frame is shorter than its data length
  */
-int dataReceiveCallback(uint8_t *rx_data){    
+int dataReceiveCallback(uint8_t *rx_data, uint16_t rx_len){    
 
     // Pointer to RX_DATA with prefix removed.
     uint8_t * rx_data_no_prefix = rx_data + PREFIX_LEN;
     // First two bytes of byte array are always the length (in number of bytes)
     // of the upcoming byte array
     uint16_t data_len;
+    if (rx_len < PREFIX_LEN + 2 + SUFFIX_LEN){
+        return 0;
+    }
     memcpy(&data_len, rx_data_no_prefix, 2);
+    if (PREFIX_LEN + 2 + data_len + SUFFIX_LEN > rx_len){
+        return 0;
+    }
 
     // Get the length of the full string to be transmitted over USB.
     uint16_t prefix_len = 4;
@@ -97,6 +109,6 @@ int dataReceiveCallback(uint8_t *rx_data){
     
 
     // Transmit the final concatenated array over USB
-    CDC_Transmit_FS(full_msg, full_len);
+    usb_write(full_msg, full_len);
     return 1;
 }
\ No newline at end of file
@@ -3,6 +3,12 @@
   * @file    ranging.c
   * @brief   This file provides code for UWB ranging, such as one-way
   *          ranging (OWR) and two-way ranging (TWR).
+  *
+  *          All TWR exchanges, whether this tag is the initiator, the target
+  *          or a passive listener, run as a state machine in the UWB task.
+  *          The DW1000 interrupt only posts events (frame received, frame
+  *          sent, RX timeout, RX error) to a mail queue, and the task sleeps
+  *          between them instead of polling the status register.
   ******************************************************************************
   */
 
@@ -10,110 +16,255 @@
 #include "ranging.h"
 #include "bias.h"
 #include "messaging.h"
+#include "records.h"
+#include "ranging_math.h"
+#include "tdma.h"
+#include "trace.h"
+#include "rtos_static.h"
 #include <assert.h>
 #include "cmsis_os.h"
 #include <cir.h>
 
 extern osThreadId twrInterruptTaskHandle;
 
+/* Events posted to the UWB task. */
+typedef enum {
+    UWB_EVT_RX_OK = 0,   // Good frame received.
+    UWB_EVT_TX_DONE,     // Frame sent.
+    UWB_EVT_RX_TIMEOUT,  // Frame wait or preamble detection timeout.
+    UWB_EVT_RX_ERROR,    // PHR, CRC, sync loss or SFD timeout error.
+    UWB_EVT_INITIATE,    // TWR requested by twrInitiateInstance().
+    UWB_EVT_BURST,       // Multi-target TWR requested by twrBurstInstance().
+    UWB_EVT_RX_CONFIG,   // Filtering, buffering, radio profile or antenna delays may have to change, see uwbRxConfigUpdate().
+} UwbEvent;
+
+typedef struct {
+    uint8_t seq;
+    uint8_t target_id;
+    bool target_meas;
+    uint8_t ds_twr;
+    bool get_cir;
+    uint8_t num_targets;                 // Burst only.
+    uint8_t targets[BURST_MAX_TARGETS];  // Burst only.
+    bool scheduled;                      // Slot of the TDMA schedule, no result wanted.
+    TdmaTiming timing;                   // Scheduled only.
+} TwrRequest;
+
 typedef struct {
+    uint8_t event;
     uint8_t msg[MAX_FRAME_LEN];
     uint32_t len;
+    uint64 ts;      // RX or TX time-stamp, latched in the interrupt.
+    float fpp;      // First path power of a received frame.
+    float skew;     // Clock skew of a received frame.
+    TwrRequest req; // UWB_EVT_INITIATE only.
+    uint32_t posted; // traceCycles() when queued.
 } UwbMsg;
 
-/* Buffer to store received response message.
- * Its size is adjusted to longest frame that this example code is supposed to handle. */
-static uint8 rx_buffer[MAX_FRAME_LEN];
-
-/* Hold copy of status register state here for reference so that it can be examined at a debug breakpoint. */
-static uint32 status_reg = 0;
-
-/* Preamble timeout, in multiple of PAC size. See NOTE 6 below. */
-#define PRE_TIMEOUT 8
-
-/* This is the delay from the end of the frame transmission to the enable of the
- * receiver, as programmed for the DW1000's wait for response feature. */
-#define RESP_TX_TO_FINAL_RX_DLY_UUS 40 //500
-/* Receive final timeout. See NOTE 5 below. */
-#define FINAL_RX_TIMEOUT_UUS 600 //3300
-
-/* Frames used in the ranging process. See NOTE 2 below. */
-static uint8 tx_poll_msg[11]  = {0x41, 0x88, 0xA};
-static uint8 rx_resp_msg[8]  = {0x41, 0x88, 0xB};
-static uint8 tx_final_msg[28] = {0x41, 0x88, 0xC};
-
-/* Frames used in the ranging process. See NOTE 2 below. */
-static uint8 rx_poll_msg[8]  = {0x41, 0x88, 0xA};
-static uint8 tx_resp_msg[8]  = {0x41, 0x88, 0xB};
-static uint8 rx_final_msg[28] = {0x41, 0x88, 0xC};
-
-/* Length of the common part of the message (up to and including the function code, see NOTE 2 below). */
-#define ALL_MSG_COMMON_LEN (6)
-/* Indexes to access some of the fields in the frames defined above. */
-#define ALL_MSG_TYPE_IDX (2)
-#define ALL_MSG_SEQ_IDX (3)
-#define ALL_TX_BOARD_IDX (4)
-#define ALL_RX_BOARD_IDX (5)
-#define TX_POLL_TARG_MEAS_IDX (6) // the index associated with the target meas boolean
-#define TX_POLL_ds_twr_IDX (7) // the index associated with the DS-TWR boolean
-#define TX_POLL_GET_CIR_IDX (8) // the index associated with the get-CIR boolean
-#define FINAL_SIGNAL1_TS_IDX (6)
-#define FINAL_SIGNAL2_TS_IDX (10)
-#define FINAL_SIGNAL3_TS_IDX (14)
-#define FINAL_FPP_IDX (18) // First path power, as per Section 4.7.1 in the User Manual. Float. 
-#define FINAL_SKEW_IDX (22) // Clock skew measurement from the carrier integrator, 
+typedef struct {
+    uint8_t seq;
+    int success;
+} TwrResult;
+
+/* States of the TWR exchange the UWB task is taking part in. */
+typedef enum {
+    TWR_IDLE = 0,
+    TWR_INIT_WAIT_RESP,          // Initiator, DS-TWR: poll sent, awaiting the response.
+    TWR_INIT_WAIT_FINAL,         // Initiator: awaiting the target's final message.
+    TWR_BURST_WAIT_RESP,         // Burst initiator: awaiting the targets' responses.
+    TWR_RESP_WAIT_RESP_TX,       // Target, DS-TWR: response sent, awaiting its TX time-stamp.
+    TWR_RESP_WAIT_FINAL,         // Target: awaiting the initiator's final or burst final message.
+    TWR_WAIT_FINAL_TX,           // Own final message sent, awaiting the end of its transmission.
+    TWR_PASSIVE_WAIT_RESP,       // Passive, DS-TWR: awaiting the target's response.
+    TWR_PASSIVE_WAIT_FINAL,      // Passive: awaiting the target's final message.
+    TWR_PASSIVE_WAIT_TARG_FINAL, // Passive: awaiting the initiator's final message.
+} TwrState;
+
+/* The preamble timeout, in multiple of PAC size (see NOTE 6 below), the delay
+ * from the end of a transmission to the enable of the receiver, as programmed
+ * for the DW1000's wait for response feature, and the reply delays depend on
+ * the radio profile, see dwt_general.c. */
+
+/* Time allowed for each frame of an exchange before it is abandoned, in ms,
+ * on top of the second-response delay, frame_wait_ms of the profile. The
+ * preamble timeout is only used to reset the receiver, which is then
+ * re-enabled until this expires. */
+#define TWR_WAIT_TIMEOUT_MS (radioProfile()->frame_wait_ms)
+
+/* Earliest start of a scheduled poll after its request is handled, which
+ * leaves time for its preamble. A held poll is handled twice as early, to
+ * leave time to the UWB task. */
+#define TDMA_TX_LEAD_UUS (radioProfile()->tx_lead_uus)
+
+/* Reply delay of the target in SS-TWR, from the reception of the poll. The
+ * corrected mode does not need the reply time to be long and constant, since
+ * the clock offset is compensated, so it replies as soon as it reliably can. */
+#define SS_REPLY_DELAY_UUS (radioProfile()->ss_reply_uus)
+#define SS_FAST_REPLY_DELAY_UUS (radioProfile()->ss_fast_reply_uus)
+
+/* Response slots of a multi-target burst. The target at index i of the poll's
+ * list replies BURST_FIRST_SLOT_UUS + i*BURST_SLOT_UUS after receiving it.
+ * Over reply times that long, a few ppm of clock offset would add metres to
+ * the range, so bursts are single-sided exchanges corrected for the offset. */
+#define BURST_FIRST_SLOT_UUS (radioProfile()->burst_first_slot_uus)
+#define BURST_SLOT_UUS (radioProfile()->burst_slot_uus)
+#define BURST_WINDOW_UUS(n) (BURST_FIRST_SLOT_UUS + (n)*BURST_SLOT_UUS)
+
+/* Receiver ID of the frames addressed to all boards. Its destination address
+ * is UWB_BROADCAST_ADDR. */
+#define BROADCAST_ID (0xFF)
+
+/* Length of the common part of the message (the 802.15.4 header, up to and
+ * including the function code). */
+#define ALL_MSG_COMMON_LEN (UWB_FRAME_HEADER_LEN)
+/* Indexes to access some of the fields in the frames defined below. */
+#define ALL_MSG_SEQ_IDX (2)
+#define ALL_RX_BOARD_IDX (5) // Destination short address, the board ID in its low byte
+#define ALL_TX_BOARD_IDX (7) // Source short address, likewise
+#define ALL_MSG_TYPE_IDX (9)
+#define TX_POLL_TARG_MEAS_IDX (10) // the index associated with the target meas boolean
+#define TX_POLL_ds_twr_IDX (11) // the index associated with the ranging mode, TWR_MODE_
+#define TX_POLL_GET_CIR_IDX (12) // the index associated with the get-CIR boolean
+#define TX_POLL_SLOT_IDX (13) // TDMA slot of the poll, TDMA_NO_SLOT if not scheduled
+#define FINAL_SIGNAL1_TS_IDX (10) // Time-stamps are 40 bits, see final_msg_set_ts()
+#define FINAL_SIGNAL2_TS_IDX (15)
+#define FINAL_SIGNAL3_TS_IDX (20)
+#define FINAL_FPP_IDX (25) // First path power, as per Section 4.7.1 in the User Manual. Float.
+#define FINAL_SKEW_IDX (29) // Clock skew measurement from the carrier integrator,
                             // Section 5.86 in the DW software API guide.
+#define BURST_POLL_TARG_MEAS_IDX (10)
+#define BURST_POLL_NUM_IDX (11) // Number of targets, followed by their IDs
+#define BURST_POLL_TARGETS_IDX (12)
+#define BURST_FINAL_TX1_IDX (10)
+#define BURST_FINAL_NUM_IDX (15) // Number of entries, followed by the entries
+#define BURST_FINAL_ENTRIES_IDX (16)
+#define BURST_FINAL_ENTRY_LEN (14) // Target ID, rx2, fpp2 and skew2 of one response
+#define BURST_ENTRY_RX2_IDX (1)
+#define BURST_ENTRY_FPP_IDX (6)
+#define BURST_ENTRY_SKEW_IDX (10)
+
+/* Frames used in the ranging process. The last 2 bytes are left for the CRC,
+ * which the DW1000 appends. */
+static uint8 tx_poll_msg[16] = {UWB_FRAME_HEADER(0xA)};
+static uint8 tx_resp_msg[12] = {UWB_FRAME_HEADER(0xB)};
+static uint8 tx_final_msg[35] = {UWB_FRAME_HEADER(0xC)};
+static uint8 tx_burst_poll_msg[12 + BURST_MAX_TARGETS + 2] = {UWB_FRAME_HEADER(0xE)};
+static uint8 tx_burst_final_msg[16 + 14*BURST_MAX_TARGETS + 2] = {UWB_FRAME_HEADER(0xF)};
 
 /* Frame sequence number, incremented after each transmission. */
 static uint8 frame_seq_nb = 0;
 
-/* Speed of light in air, in metres per second. */
-#define SPEED_OF_LIGHT 299702547
-
-/* Hold copies of computed time of flight and distance here for reference so that it can be examined at a debug breakpoint. */
-static double tof;
-static double distance;
-
 /* Declaration of static functions. */
+static void uwb_isr(void);
 static void rx_ok_cb(const dwt_cb_data_t *cb_data);
+static void tx_done_cb(const dwt_cb_data_t *cb_data);
+static void rx_to_cb(const dwt_cb_data_t *cb_data);
+static void rx_err_cb(const dwt_cb_data_t *cb_data);
+static void twrHandleEvent(const UwbMsg *msg_ptr);
+static void twrFinish(int success);
+static void twrBurstComplete(void);
+static void twrStartInitiator(const TwrRequest *req);
+static uint32 twrSlotTime(const TdmaTiming *timing);
+static void twrPendingCheck(void);
+static void outputPassive(const PassiveRecord *rec);
+static void twrApplyRxConfig(void);
+static void twrApplyRadioProfile(void);
+static void twrRxEnable(void);
+static void twrRxStop(void);
+static void postEvent(uint8_t event, uint64 ts);
 
 /* Passive listening toggle */
 static bool passive_listening = 0;
 
-/* Second-response delay in DS-TWR */
-static uint16 tx3_delay = 1500;
+/* Receive buffering, RX_BUFFER_ */
+static uint8_t rx_buffering = RX_BUFFER_SINGLE;
+
+/* Radio profile requested, RADIO_PROFILE_. Applied by the UWB task. */
+static volatile uint8_t radio_profile_req = RADIO_PROFILE_DEFAULT;
 
-static osMailQDef(UwbMsgBox, USB_QUEUE_SIZE, UwbMsg); 
-static osMailQId UwbMsgBox;  
+/* Set by setAntennaDelay() for the UWB task. */
+static volatile bool antenna_delay_req = false;
+
+/* Whether the DW1000 rejects the frames addressed to other boards, and
+ * whether it is double buffered. Only written by the UWB task, and by
+ * ranging_init() before it starts. */
+static bool frame_filtering = false;
+static volatile bool rx_double_buffered = false;
+
+/* Set by rx_ok_cb() for uwb_isr(). */
+static bool rx_frame_read = false;
+
+/* What passive listeners output, PASSIVE_OUTPUT_ */
+static uint8_t passive_output = PASSIVE_OUTPUT_RAW;
+
+/* Second-response delay in DS-TWR */
+static uint32 tx3_delay = 1500;
+
+/* Exchange in progress. Only accessed by the UWB task, and by
+ * ensureRxEnabled() with the DW1000 interrupt masked. */
+static struct {
+    volatile TwrState state;
+    uint32_t deadline;       // osKernelSysTick() at which the current wait is abandoned.
+    bool is_initiator;
+    uint8_t request_seq;     // Initiator only, returned with the result. 0 if none is wanted.
+    uint8_t neighbour_id;    // Initiator or target only.
+    bool target_meas;
+    uint8_t ds_twr;
+    bool get_cir;
+    bool burst;              // Multi-target exchange.
+    RangeRecord range;       // Initiator or target.
+    PassiveRecord passive;   // Passive listener.
+    uint8_t num_targets;     // Burst initiator only, as are the fields below.
+    uint8_t targets[BURST_MAX_TARGETS];
+    uint8_t num_ranges;
+    uint8_t responded;       // Bit i is set once targets[i] has responded.
+    RangeRecord ranges[BURST_MAX_TARGETS];
+    bool has_pending;        // Scheduled request held until shortly before its slot.
+    TwrRequest pending;
+    uint32 pending_time;     // Time of its slot, high 32 bits of the DW1000 time.
+    uint32_t trace_start;    // traceCycles() at the start of the exchange.
+    bool trace_wait;         // Initiator, until the first frame of the target.
+} twr;
+
+osMailQStaticDef(UwbMsgBox, UWB_QUEUE_SIZE, UwbMsg);
+static osMailQId UwbMsgBox;
+
+/* Only written by the DW1000 call-backs. */
+static volatile UwbRxStats rx_stats;
+
+osMailQStaticDef(TwrResultBox, TWR_RESULT_QUEUE_SIZE, TwrResult);
+static osMailQId TwrResultBox;
 
 /**
  * @brief Initialization routine for UWB interrupt handling. This function is
  * called once on startup.
- * 
+ *
  */
 void ranging_init(){
 
     /* Load board IDs into ranging frames */
     tx_poll_msg[ALL_TX_BOARD_IDX]  = BOARD_ID();
-    rx_resp_msg[ALL_RX_BOARD_IDX]  = BOARD_ID();
+    tx_resp_msg[ALL_TX_BOARD_IDX]  = BOARD_ID();
     tx_final_msg[ALL_TX_BOARD_IDX] = BOARD_ID();
+    tx_burst_poll_msg[ALL_TX_BOARD_IDX] = BOARD_ID();
+    tx_burst_final_msg[ALL_TX_BOARD_IDX] = BOARD_ID();
 
-    rx_poll_msg[ALL_RX_BOARD_IDX]  = BOARD_ID();
-    tx_resp_msg[ALL_TX_BOARD_IDX]  = BOARD_ID();
-    rx_final_msg[ALL_RX_BOARD_IDX] = BOARD_ID();
+    /* Addresses the DW1000 accepts frames for, besides broadcasts */
+    dwt_setpanid(UWB_PAN_ID);
+    dwt_setaddress16(BOARD_ID());
 
     /* Install DW1000 IRQ handler. */
-    port_set_deca_isr(dwt_isr);
+    port_set_deca_isr(uwb_isr);
 
-    /* Register RX call-back. */
-    dwt_setcallbacks(NULL, &rx_ok_cb, NULL, NULL);
+    /* Register the call-backs, which all forward to the UWB task. */
+    dwt_setcallbacks(&tx_done_cb, &rx_ok_cb, &rx_to_cb, &rx_err_cb);
 
     // create msg queue for interrupt
-    UwbMsgBox = osMailCreate(osMailQ(UwbMsgBox), NULL);  
+    UwbMsgBox = osMailCreateStatic(osMailQ(UwbMsgBox), osMailQStatic(UwbMsgBox));
+    TwrResultBox = osMailCreateStatic(osMailQ(TwrResultBox), osMailQStatic(TwrResultBox));
 
     /* Enable wanted interrupts (TX confirmation, RX good frames, RX timeouts and RX errors). */
-    // dwt_setinterrupt(DWT_INT_RFCG | DWT_INT_RFTO | DWT_INT_RXPTO | DWT_INT_RPHE | DWT_INT_RFCE | DWT_INT_RFSL | DWT_INT_SFDT, 1);
-    dwt_setinterrupt(DWT_INT_RFCG, 1);
+    dwt_setinterrupt(DWT_INT_TFRS | DWT_INT_RFCG | DWT_INT_RFTO | DWT_INT_RXPTO | DWT_INT_RPHE | DWT_INT_RFCE | DWT_INT_RFSL | DWT_INT_SFDT, 1);
 
     /* Set delay to turn reception on after transmission of the frame. See NOTE 2 below. */
     dwt_setrxaftertxdelay(60);
@@ -121,1100 +272,1721 @@ void ranging_init(){
     /* Set response frame timeout. */
     dwt_setrxtimeout(0);
 
+    twrApplyRxConfig();
     dwt_rxenable(DWT_START_RX_IMMEDIATE);
 }
 
 /**
  * @brief The function gets call in an infinite loop, and consumes items from
- * a message queue that is populated by the interrupt.
- * 
+ * a message queue that is populated by the interrupt. Outside of a TWR
+ * exchange it blocks until the next event. During an exchange it blocks at
+ * most until the exchange times out.
+ *
  */
 void uwbFrameHandler(void){
 
     osEvent evt;
     UwbMsg *msg_ptr;
     decaIrqStatus_t stat;
+    uint32_t wait = osWaitForever;
+    int32_t remaining;
+    uint32_t start;
+
+    if (twr.state != TWR_IDLE){
+        remaining = (int32_t)(twr.deadline - osKernelSysTick());
+        wait = (remaining > 0) ? (uint32_t)remaining : 0;
+    }
+    else if (cirOutputPending()){
+        wait = 0;
+    }
 
+    evt = osMailGet(UwbMsgBox, wait);  // Get message on queue.
 
-    evt = osMailGet(UwbMsgBox, osWaitForever);  // Get message on queue. 
+    /* Output the CIR in between events, a chunk at a time. The receiver is
+       left as it is. */
+    if (evt.status != osEventMail && twr.state == TWR_IDLE && cirOutputPending()){
+        cirOutputStep();
+        return;
+    }
+
+    stat = decamutexon(); // disable dw1000 interrupts
     if (evt.status == osEventMail) {
         msg_ptr = evt.value.p;
+        start = traceCycles();
+        traceRecord(TRACE_EVENT_LATENCY, msg_ptr->posted, start);
+        twrHandleEvent(msg_ptr);
+        traceEnd(TRACE_EVENT, start);
+        osMailFree(UwbMsgBox, msg_ptr); // IMPORTANT: free message memory
+    }
 
-        uint8_t msg_type = msg_ptr->msg[ALL_MSG_TYPE_IDX];
-
-        switch (msg_type)
-        {
-            case 0xA:{
-                stat = decamutexon(); // disable dw1000 interrupts
-                twrReceiveCallback();
-                decamutexoff(stat);
-                break;
-            }
-            case 0xB:{
-                usb_print("WARNING 0xB: TWR message is firing an interrupt when it shouldn't be.\r\n");
-                break;
-            }
-            case 0xC:{
-                usb_print("WARNING 0xC: TWR message is firing an interrupt when it shouldn't be.\r\n");
-                break;
-            }
-            case 0xD:{
-                dataReceiveCallback(msg_ptr->msg);
-                break;
-            }
-            default:{
-                usb_print("Unrecognized UWB message type received.");
-            }
+    /* Abandon the exchange if the expected frame never came */
+    if (twr.state != TWR_IDLE && (int32_t)(osKernelSysTick() - twr.deadline) >= 0){
+        if (twr.state == TWR_BURST_WAIT_RESP){
+            /* Keep the responses received so far */
+            twrBurstComplete();
+        }
+        else if (twr.state == TWR_PASSIVE_WAIT_RESP){
+            /* Due to immediate response of Signal 2, this has highest chance of failure.
+               If failed, still communicate the ranging tags' IDs for scheduling purposes. */
+            twr.passive.flags |= RECORD_FLAG_INCOMPLETE;
+            outputPassive(&twr.passive);
+            dwt_forcetrxoff();
+            twrFinish(0);
+        }
+        else{
+            dwt_forcetrxoff();
+            twrFinish(0);
         }
-        osMailFree(UwbMsgBox, msg_ptr); // IMPORTANT: free message memory
     }
-}
 
+    /* Start the scheduled poll, or keep listening until it is due */
+    if (twr.state == TWR_IDLE && twr.has_pending){
+        twrPendingCheck();
+    }
 
-/* MAIN RANGING FUNCTIONS ---------------------------------------- */ 
-int twrInitiateInstance(uint8_t target_id, bool target_meas_bool, uint8_t ds_twr, bool get_cir){
-    int ret;
-    decaIrqStatus_t stat;
-    uint64 tx1_ts;
-    uint64 rx2_ts, rx3_ts;
+    /* Outside of an exchange, the receiver is always on */
+    if (twr.state == TWR_IDLE){
+        twrApplyRadioProfile();
+        twrApplyRxConfig();
+        twrRxEnable();
+    }
+    decamutexoff(stat);
+}
 
-    float fpp2 = 0; // Received signal power of Signal 1 and Signal 2
-    float skew2 = 0;
+/*! ----------------------------------------------------------------------------
+ * Function: ensureRxEnabled()
+ *
+ * @brief Re-enable the receiver if it was left off outside of a TWR exchange,
+ * e.g. after an event was dropped. Called periodically from another task.
+ */
+void ensureRxEnabled(void){
+    decaIrqStatus_t stat;
+    uint8_t reg_state;
 
     stat = decamutexon();
-    dwt_forcetrxoff();
+    if (twr.state == TWR_IDLE){
+        reg_state = dwt_read8bitoffsetreg(SYS_STATE_ID, 1); // read RX status
+        if (!reg_state){
+            twrRxEnable();
+        }
+    }
+    decamutexoff(stat);
+}
+
+/* MAIN RANGING FUNCTIONS ---------------------------------------- */
+/*! ----------------------------------------------------------------------------
+ * Function: twrSubmit()
+ *
+ * @brief Post a request to the UWB task, and sleep until it completes.
+ *
+ * @param msg_ptr (UwbMsg*) The request, allocated from UwbMsgBox.
+ * @param timeout (uint32_t) Time after which the request is given up on, in ms.
+ *
+ * @return (int) The result of the exchange.
+ */
+static int twrSubmit(UwbMsg *msg_ptr, uint32_t timeout){
+    static uint8_t request_seq = 0;
+    TwrResult *result;
+    osEvent evt;
+    bool matched;
+    int success;
 
-	/* Set expected response's delay and timeout.
-     * As this example only handles one incoming frame with always the same delay and
-       timeout, those values can be set here once for all. */
-    dwt_setrxaftertxdelay(40); //dwt_setrxaftertxdelay(POLL_TX_TO_RESP_RX_DLY_UUS);
-    dwt_setrxtimeout(800); // dwt_setrxtimeout(RESP_RX_TIMEOUT_UUS);
-    dwt_setpreambledetecttimeout(PRE_TIMEOUT*100);
+    /* Zero is reserved for the requests that want no result */
+    if (++request_seq == 0){
+        request_seq++;
+    }
+    msg_ptr->req.seq = request_seq;
+    msg_ptr->posted = traceCycles();
+    osMailPut(UwbMsgBox, msg_ptr);
+
+    /* Results of earlier requests that were given up on are discarded. */
+    do {
+        evt = osMailGet(TwrResultBox, timeout);
+        if (evt.status != osEventMail){
+            return 0;
+        }
+        result = evt.value.p;
+        matched = (result->seq == request_seq);
+        success = result->success;
+        osMailFree(TwrResultBox, result);
+    } while (!matched);
 
-    /* Include Target board in all communication messages. */
-    tx_poll_msg[ALL_RX_BOARD_IDX] = target_id;
-    rx_resp_msg[ALL_TX_BOARD_IDX] = target_id;
-    tx_final_msg[ALL_RX_BOARD_IDX] = target_id;
-    rx_final_msg[ALL_TX_BOARD_IDX] = target_id;
+    return success;
+}
 
-    /* Indicate whether the Target board will also compute the range measurement */
-    tx_poll_msg[TX_POLL_TARG_MEAS_IDX] = target_meas_bool;    
+/*! ----------------------------------------------------------------------------
+ * Function: twrInitiateInstance()
+ *
+ * @brief Request a TWR exchange with a target from the UWB task, and sleep
+ * until it completes.
+ *
+ * @return (int) 1 if the range measurement was obtained.
+ */
+int twrInitiateInstance(uint8_t target_id, bool target_meas_bool, uint8_t ds_twr, bool get_cir){
+    UwbMsg *msg_ptr;
 
-    /* Indicate whether DS-TWR will be used */
-    tx_poll_msg[TX_POLL_ds_twr_IDX] = ds_twr;    
+    msg_ptr = osMailCAlloc(UwbMsgBox, 0);
+    if (msg_ptr == NULL){
+        return 0;
+    }
 
-    /* Indicate whether the CIR will be output */
-    tx_poll_msg[TX_POLL_GET_CIR_IDX] = get_cir;    
+    msg_ptr->event = UWB_EVT_INITIATE;
+    msg_ptr->req.target_id = target_id;
+    msg_ptr->req.target_meas = target_meas_bool;
+    msg_ptr->req.ds_twr = ds_twr;
+    msg_ptr->req.get_cir = get_cir;
 
-    /* Write frame data to DW1000 and prepare transmission. See NOTE 8 below. */
-    tx_poll_msg[ALL_MSG_SEQ_IDX] = frame_seq_nb;
-    dwt_write32bitreg(SYS_STATUS_ID, SYS_STATUS_TXFRS);
-    dwt_writetxdata(sizeof(tx_poll_msg), tx_poll_msg, 0); /* Zero offset in TX buffer. */
-    dwt_writetxfctrl(sizeof(tx_poll_msg), 0, 1); /* Zero offset in TX buffer, ranging. */
+    /* At most three frames are awaited by the initiator. */
+    return twrSubmit(msg_ptr, 3*(TWR_WAIT_TIMEOUT_MS + tx3_delay/1000 + 1));
+}
 
-    /* Start transmission, indicating that a response is expected so that reception is 
-        enabled automatically after the frame is sent and the delay set by 
-        dwt_setrxaftertxdelay() has elapsed. */
-    dwt_starttx(DWT_START_TX_IMMEDIATE | DWT_RESPONSE_EXPECTED);
-    dwt_setrxtimeout(0);
-    
-    if (ds_twr){
-        /* We assume that the transmission is achieved correctly, poll for reception of a frame or error/timeout. See NOTE 9 below. */
-        while (!((status_reg = dwt_read32bitreg(SYS_STATUS_ID)) & (SYS_STATUS_RXFCG | SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR)))
-        { };
+/*! ----------------------------------------------------------------------------
+ * Function: twrBurstInstance()
+ *
+ * @brief Range with several targets at once. A single poll is answered by
+ * every target in its own time slot, and the ranges are output as one batched
+ * record. If target_meas_bool is set, a single final message then carries
+ * the time-stamps every target needs to compute its own range.
+ *
+ * @param targets (uint8_t*) IDs of the targets, in the order of their slots.
+ * @param num_targets (uint8_t) At most BURST_MAX_TARGETS.
+ *
+ * @return (int) 1 if at least one target responded.
+ */
+int twrBurstInstance(const uint8_t *targets, uint8_t num_targets, bool target_meas_bool){
+    UwbMsg *msg_ptr;
 
-        /* Increment frame sequence number after transmission of the poll message (modulo 256). */
-        frame_seq_nb++;
+    if (num_targets == 0 || num_targets > BURST_MAX_TARGETS){
+        return 0;
+    }
 
-        if (status_reg & SYS_STATUS_RXFCG)
-        {
-            uint32 frame_len;
+    msg_ptr = osMailCAlloc(UwbMsgBox, 0);
+    if (msg_ptr == NULL){
+        return 0;
+    }
 
-            /* Clear good RX frame event and TX frame sent in the DW1000 status register. */
-            dwt_write32bitreg(SYS_STATUS_ID, SYS_STATUS_RXFCG | SYS_STATUS_TXFRS);
+    msg_ptr->event = UWB_EVT_BURST;
+    msg_ptr->req.target_meas = target_meas_bool;
+    msg_ptr->req.num_targets = num_targets;
+    memcpy(msg_ptr->req.targets, targets, num_targets);
 
-            /* A frame has been received, read it into the local buffer. */
-            frame_len = dwt_read32bitreg(RX_FINFO_ID) & RX_FINFO_RXFLEN_MASK;
-            if (frame_len <= MAX_FRAME_LEN)
-            {
-                dwt_readrxdata(rx_buffer, frame_len, 0);
-            }
-        
-            /* Check that the frame is the expected response from the companion "DS TWR responder" example.
-                * As the sequence number field of the frame is not relevant, it is cleared to simplify the validation of the frame. */
-            // rx_buffer[ALL_RX_BOARD_IDX] = target_id;
-            rx_buffer[ALL_MSG_SEQ_IDX] = 0;
-            if (memcmp(rx_buffer, rx_resp_msg, ALL_MSG_COMMON_LEN) == 0)
-            {
-                /* Retrieve the transmission timestamp */
-                tx1_ts = get_tx_timestamp_u64();
-
-                /* Retrieve the reception timestamp */
-                rx2_ts = get_rx_timestamp_u64();
-
-                ret = rxTimestampsDS(tx1_ts, rx2_ts, target_id, &fpp2, &skew2, true, false);
-
-                /* Retrieve the reception timestamp */
-                rx3_ts = get_rx_timestamp_u64();
-            }
-            else{
-                ret = 0;
-            }
-        }
-        else
-        {
-            /* Clear RX error/timeout events in the DW1000 status register. */
-            dwt_write32bitreg(SYS_STATUS_ID, SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR);
+    return twrSubmit(msg_ptr, 3*(TWR_WAIT_TIMEOUT_MS + tx3_delay/1000 + 1)
+                              + BURST_WINDOW_UUS(BURST_MAX_TARGETS)/1000);
+}
 
-            /* Reset RX to properly reinitialise LDE operation. */
-            dwt_rxreset();
+/*! ----------------------------------------------------------------------------
+ * Function: twrScheduleInstance()
+ *
+ * @brief Request the exchange of a TDMA slot from the UWB task. The poll is
+ * sent at the start of the slot, and the result is only output.
+ *
+ * @return (int) 1 if the request was posted.
+ */
+int twrScheduleInstance(const TdmaSlot *slot, const TdmaTiming *timing){
+    UwbMsg *msg_ptr;
 
-            ret = 0;
-        }   
+    msg_ptr = osMailCAlloc(UwbMsgBox, 0);
+    if (msg_ptr == NULL){
+        return 0;
     }
-    else{
-        /* Await the return signal and compute the range measurement */
-        ret = rxTimestampsSS(0, target_id, &fpp2, &skew2, true, false);
 
-        /* Retrieve the transmission timestamp */
-        tx1_ts = get_tx_timestamp_u64();
+    msg_ptr->event = UWB_EVT_INITIATE;
+    msg_ptr->req.seq = 0;
+    msg_ptr->req.target_id = slot->target;
+    msg_ptr->req.target_meas = (slot->flags & TDMA_FLAG_TARG_MEAS) != 0;
+    msg_ptr->req.ds_twr = slot->ds_twr;
+    msg_ptr->req.get_cir = (slot->flags & TDMA_FLAG_GET_CIR) != 0;
+    msg_ptr->req.scheduled = true;
+    msg_ptr->req.timing = *timing;
+    msg_ptr->posted = traceCycles();
+    osMailPut(UwbMsgBox, msg_ptr);
+    return 1;
+}
 
-        /* Retrieve the reception timestamp */
-        rx2_ts = get_rx_timestamp_u64();
-    }
+/*! ----------------------------------------------------------------------------
+ * Function: twrWait()
+ *
+ * @brief Move to a state awaiting a radio event, and restart the timeout.
+ */
+static void twrWait(TwrState state){
+    twr.state = state;
+    twr.deadline = osKernelSysTick() + TWR_WAIT_TIMEOUT_MS + tx3_delay/1000 + 1;
+}
 
-    if (ret){
-        // check if an additional signal is expected
-        if (target_meas_bool){ 
-            // send the additional signal
-            if (ds_twr){
-                ret = txTimestampsDS(tx1_ts, rx2_ts, rx3_ts, &fpp2, &skew2, true);
-            }
-            else{
-                ret = txTimestampsSS(tx1_ts, rx2_ts, &fpp2, &skew2, true);
-            }
+/*! ----------------------------------------------------------------------------
+ * Function: twrPostResult()
+ *
+ * @brief Report the result of a request to twrInitiateInstance().
+ */
+static void twrPostResult(uint8_t seq, int success){
+    TwrResult *result = osMailAlloc(TwrResultBox, 0);
 
-            if (ret){ // TODO: allow additional signal with alternative double-sided TWR
-                dwt_setpreambledetecttimeout(0);
-                dwt_setrxtimeout(0);
-                if (get_cir){
-                    read_cir(BOARD_ID(), target_id);
-                }
-                dwt_rxenable(DWT_START_RX_IMMEDIATE);
-                decamutexoff(stat);
-                return 1;
-            }
-        }
-        else{
-            dwt_setpreambledetecttimeout(0);
-            dwt_setrxtimeout(0);
-            if (get_cir){
-                read_cir(BOARD_ID(), target_id);
-            }
-            dwt_rxenable(DWT_START_RX_IMMEDIATE);
-            decamutexoff(stat);
-            return 1;
-        }
+    if (result != NULL){
+        result->seq = seq;
+        result->success = success;
+        osMailPut(TwrResultBox, result);
     }
+}
 
+/*! ----------------------------------------------------------------------------
+ * Function: twrFinish()
+ *
+ * @brief End the current exchange, and report the result to the initiating
+ * task if there is one.
+ */
+static void twrFinish(int success){
+    traceEnd(TRACE_EXCHANGE, twr.trace_start);
     dwt_setpreambledetecttimeout(0);
     dwt_setrxtimeout(0);
-    dwt_rxenable(DWT_START_RX_IMMEDIATE);
-    decamutexoff(stat);
-    return 0;
-}
 
-int twrReceiveCallback(void){
-    uint64 tx2_ts;
-    uint64 rx1_ts;
+    /* A receiver that re-enabled itself still runs with the timeouts of the
+       exchange. It is restarted without them outside of the exchange. */
+    twrRxStop();
 
-    float fpp1 = 0;
-    float skew1 = 0;
+    if (twr.is_initiator && twr.request_seq != 0){
+        twrPostResult(twr.request_seq, success);
+    }
+    twr.state = TWR_IDLE;
+}
 
-    /* Set preamble timeout for expected frames. See NOTE 6 below. */
-    dwt_setpreambledetecttimeout(PRE_TIMEOUT*100);
+/*! ----------------------------------------------------------------------------
+ * Function: twrListening()
+ *
+ * @brief Whether the current state awaits a frame, as opposed to the end of
+ * a transmission.
+ */
+static bool twrListening(void){
+    return twr.state != TWR_IDLE
+        && twr.state != TWR_RESP_WAIT_RESP_TX
+        && twr.state != TWR_WAIT_FINAL_TX;
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: setFrameDest()
+ *
+ * @brief Address a frame to a board, or to all of them with BROADCAST_ID.
+ */
+static void setFrameDest(uint8_t *frame, uint8_t rx_id){
+    uint16_t addr = (rx_id == BROADCAST_ID) ? UWB_BROADCAST_ADDR : rx_id;
 
-    /* Clear reception timeout to start next ranging process. */
-    dwt_setrxtimeout(0); //dwt_setrxtimeout(2000*UUS_TO_DWT_TIME); /
+    frame[ALL_RX_BOARD_IDX] = (uint8_t)addr;
+    frame[ALL_RX_BOARD_IDX + 1] = (uint8_t)(addr >> 8);
+}
 
-    /* Retrieve the initiator's ID */
-    uint8_t initiator_id = rx_buffer[ALL_TX_BOARD_IDX];
-    
-    /* Update all the messages to incorporate the initiator's ID */
-    rx_poll_msg[ALL_TX_BOARD_IDX] = initiator_id;
-    tx_resp_msg[ALL_RX_BOARD_IDX] = initiator_id;
-    rx_final_msg[ALL_TX_BOARD_IDX] = initiator_id;
-    tx_final_msg[ALL_RX_BOARD_IDX] = initiator_id;
+/*! ----------------------------------------------------------------------------
+ * Function: twrApplyRxConfig()
+ *
+ * @brief Bring the frame filtering and the receive buffering in line with the
+ * settings. Called outside of an exchange only, as the receiver is turned off.
+ *
+ * Passive listeners follow the exchanges of other boards, and the TDMA task
+ * aligns on the polls of other boards, so both need every frame. Otherwise,
+ * the DW1000 drops the frames addressed to other boards. RXAUTR then has it
+ * re-enable its receiver by itself after a rejected frame, and also after a
+ * good one with double buffering, without waiting for the UWB task.
+ */
+static void twrApplyRxConfig(void){
+    bool filter = !passive_listening && !tdmaActive();
+    bool dbl = (rx_buffering == RX_BUFFER_DOUBLE);
+    uint32 sys_cfg;
 
-    /* Retrieve the boolean defining whether a 4th signal is expected */
-    bool target_meas_bool = rx_buffer[TX_POLL_TARG_MEAS_IDX];
+    if (filter == frame_filtering && dbl == rx_double_buffered){
+        return;
+    }
+    dwt_forcetrxoff();
+    dwt_setdblrxbuffmode(dbl);
 
-    /* Retrieve the boolean defining whether the CIR output is expected */
-    bool get_cir = rx_buffer[TX_POLL_GET_CIR_IDX];
+    /* dwt_enableframefilter() reads the register back into the copy the
+       driver keeps, so RXAUTR is not cleared by later driver calls. */
+    sys_cfg = dwt_read32bitreg(SYS_CFG_ID) & SYS_CFG_MASK;
+    if (filter || dbl){
+        sys_cfg |= SYS_CFG_RXAUTR;
+    }
+    else{
+        sys_cfg &= ~SYS_CFG_RXAUTR;
+    }
+    dwt_write32bitreg(SYS_CFG_ID, sys_cfg);
+    dwt_enableframefilter(filter ? DWT_FF_DATA_EN : DWT_FF_NOTYPE_EN);
+    frame_filtering = filter;
+    rx_double_buffered = dbl;
+}
 
-    /* Retrieve the boolean defining whether DS-TWR will be used */
-    uint8_t ds_twr = rx_buffer[TX_POLL_ds_twr_IDX];
+/*! ----------------------------------------------------------------------------
+ * Function: twrApplyRadioProfile()
+ *
+ * @brief Switch to the radio profile requested, or give the DW1000 new antenna
+ * delays. Called outside of an exchange only, with the DW1000 interrupt
+ * masked, so that every frame is handled with the constants of the profile it
+ * was received with.
+ */
+static void twrApplyRadioProfile(void){
+    uint8_t id = radio_profile_req;
 
-    /* Check that the frame is a poll sent by "DS TWR initiator" example. */
-    rx_buffer[ALL_MSG_SEQ_IDX] = 0;
-    if (memcmp(rx_buffer, rx_poll_msg, ALL_MSG_COMMON_LEN-1) == 0) // Not comparing expected target yet
-    {
-        int ret;
-
-        /* Retrieve the reception timestamp */
-        rx1_ts = get_rx_timestamp_u64();
-
-        // If the intended target does not match the ID, passively listen on all signals.
-        bool bool_target = (rx_buffer[ALL_RX_BOARD_IDX] != rx_poll_msg[ALL_RX_BOARD_IDX]);
-        bool bool_msg_type = (rx_buffer[ALL_MSG_TYPE_IDX] == rx_poll_msg[ALL_MSG_TYPE_IDX]);
-        if (bool_target && bool_msg_type && passive_listening){
-            
-            if (ds_twr){
-                ret = passivelyListenDS(rx1_ts, target_meas_bool, get_cir);
-            }
-            else{
-                ret = passivelyListenSS(rx1_ts, target_meas_bool, get_cir);
-            }
+    if (id != radioProfileId()){
+        dwt_forcetrxoff();
+        radioProfileConfigure(id);
+    }
+    else if (antenna_delay_req){
+        dwt_forcetrxoff();
+        antennaDelayConfigure();
+    }
+    antenna_delay_req = false;
+}
 
-            // Infinite timeout for interrupt receiver running in the background 
-            dwt_setrxtimeout(0);
-            dwt_setpreambledetecttimeout(0);
-            return ret;
-        }
-        else if(bool_target){
-            dwt_setrxtimeout(0);
-            dwt_setpreambledetecttimeout(0);
-            return 0;
-        }
+/*! ----------------------------------------------------------------------------
+ * Function: twrSingleBuffer()
+ *
+ * @brief Fall back to a single buffer for the rest of the exchange. The CIR
+ * and its first path index are not double buffered, so they would be
+ * overwritten by the next frame as soon as the receiver re-enables itself.
+ * twrApplyRxConfig() restores double buffering once the exchange is over.
+ */
+static void twrSingleBuffer(void){
+    if (!rx_double_buffered){
+        return;
+    }
+    dwt_forcetrxoff();
+    dwt_setdblrxbuffmode(0);
+    rx_double_buffered = false;
+}
 
-        if (ds_twr){
-            /* Write and send the response message. See NOTE 10 below.*/
-            tx_resp_msg[ALL_MSG_SEQ_IDX] = frame_seq_nb;
-            dwt_writetxdata(sizeof(tx_resp_msg), tx_resp_msg, 0); /* Zero offset in TX buffer. */
-            dwt_writetxfctrl(sizeof(tx_resp_msg), 0, 1); /* Zero offset in TX buffer, ranging. */
-            ret = dwt_starttx(DWT_START_TX_IMMEDIATE);
-
-            /* If dwt_starttx() returns an error, abandon this ranging exchange and proceed to the next one.*/
-            if (ret == DWT_ERROR)
-            {
-                dwt_setrxtimeout(0);
-                dwt_setpreambledetecttimeout(0);
-                return 0;
-            }
+/*! ----------------------------------------------------------------------------
+ * Function: twrRxEnable()
+ *
+ * @brief Turn the receiver on. With double buffering, it is left alone if it
+ * is already on, so that a frame being received or waiting in the other
+ * buffer is not lost.
+ */
+static void twrRxEnable(void){
+    if (!rx_double_buffered){
+        dwt_rxenable(DWT_START_RX_IMMEDIATE);
+    }
+    else if (!dwt_read8bitoffsetreg(SYS_STATE_ID, 1)){ // RX state, 0 if idle
+        dwt_rxenable(DWT_START_RX_IMMEDIATE | DWT_NO_SYNC_PTRS);
+    }
+}
 
-            /* Poll DW1000 until TX frame sent event set. See NOTE 9 below. */
-            while (!(dwt_read32bitreg(SYS_STATUS_ID) & SYS_STATUS_TXFRS))
-            { };
+/*! ----------------------------------------------------------------------------
+ * Function: twrRxStop()
+ *
+ * @brief Turn the receiver off before a transmission. Only needed with double
+ * buffering, where the receiver re-enables itself after each frame.
+ */
+static void twrRxStop(void){
+    if (rx_double_buffered){
+        dwt_forcetrxoff();
+    }
+}
 
-            /* Retrieve the transmission timestamp */
-            tx2_ts = get_tx_timestamp_u64();
+/*! ----------------------------------------------------------------------------
+ * Function: isFrame()
+ *
+ * @brief Check the type and the IDs of the boards of a received frame.
+ */
+static bool isFrame(const UwbMsg *msg_ptr, uint8_t msg_type, uint8_t tx_id, uint8_t rx_id){
+    uint32_t min_len = (msg_type == 0xC) ? sizeof(tx_final_msg) : ALL_MSG_COMMON_LEN;
 
-            /* Clear TXFRS event. */
-            dwt_write32bitreg(SYS_STATUS_ID, SYS_STATUS_TXFRS);
+    return msg_ptr->len >= min_len
+        && msg_ptr->msg[ALL_MSG_TYPE_IDX] == msg_type
+        && msg_ptr->msg[ALL_TX_BOARD_IDX] == tx_id
+        && msg_ptr->msg[ALL_RX_BOARD_IDX] == rx_id;
+}
 
-            /* Increment frame sequence number after transmission of the final message (modulo 256). */
-            frame_seq_nb++;
+static uint64 finalTs(const uint8_t *frame, uint8_t idx){
+    uint64 ts;
+    final_msg_get_ts(&frame[idx], &ts);
+    return ts;
+}
 
-            /* Transmit the delayed signal with the time-stamps */
-            ret = txTimestampsDS(rx1_ts, tx2_ts, 0, &fpp1, &skew1, 0);
-        }
-        else{
-            /* Transmit the delayed signal with the time-stamps */
-            ret = txTimestampsSS(rx1_ts, 0, &fpp1, &skew1, 0);
-        }
+static float finalFloat(const uint8_t *frame, uint8_t idx){
+    float val;
+    memcpy(&val, &frame[idx], sizeof(float));
+    return val;
+}
 
-        if (ret){
-            /* Check if an additional signal is expected to communicate the time-stamps to the target */
-            if (target_meas_bool){
-                /* Set expected delay and timeout for final message reception.*/
-                dwt_setrxaftertxdelay(RESP_TX_TO_FINAL_RX_DLY_UUS);
-                dwt_setrxtimeout(FINAL_RX_TIMEOUT_UUS);
-
-                /* Receive the additional signal and calculate the range measurement */
-                if (ds_twr){
-                    ret = rxTimestampsDS(rx1_ts, tx2_ts, initiator_id, &fpp1, &skew1, false, get_cir);
-                }
-                else{
-                    ret = rxTimestampsSS(rx1_ts, initiator_id, &fpp1, &skew1, false, get_cir);
-                }
-                if (ret){
-                    dwt_setpreambledetecttimeout(0);
-                    dwt_setrxtimeout(0);
-                    return 1;
-                }
-            }
-            else{
-                dwt_setpreambledetecttimeout(0);
-                dwt_setrxtimeout(0);
-                return 1;
-            }
-        }
+/*! ----------------------------------------------------------------------------
+ * Function: twrModeFlags()
+ *
+ * @brief Record flags of an exchange in the given TWR_MODE_.
+ */
+static uint8_t twrModeFlags(uint8_t mode){
+    if (mode == TWR_MODE_DS){
+        return RECORD_FLAG_DS_TWR;
+    }
+    if (mode == TWR_MODE_SS_CORRECTED){
+        return RECORD_FLAG_SKEW_CORR;
     }
-    
-    dwt_setrxtimeout(0);
-    dwt_setpreambledetecttimeout(0);
     return 0;
 }
 
-int txTimestampsSS(uint64 ts1, uint64 ts2, 
-                   float* fpp, float* skew,
-                   bool is_immediate){
-    /* Set-up delayed transmission to encode the transmission time-stamp in the final message */
-    int ret;
-    uint8_t tx_type;
-
-    if (is_immediate){
-         /* Write all timestamps in the final message.*/
-        final_msg_set_ts(&tx_final_msg[FINAL_SIGNAL1_TS_IDX], ts1); // tx1
-        final_msg_set_ts(&tx_final_msg[FINAL_SIGNAL2_TS_IDX], ts2); // rx2
-        
-        memcpy(&tx_final_msg[FINAL_FPP_IDX], fpp, sizeof(float)); // fpp2
-        memcpy(&tx_final_msg[FINAL_SKEW_IDX], skew, sizeof(float)); // skew2
-        
-        tx_type = DWT_START_TX_IMMEDIATE;
+/*! ----------------------------------------------------------------------------
+ * Function: computeRange()
+ *
+ * @brief Compute the distance from the time-stamps of a completed exchange.
+ */
+static void computeRange(RangeRecord *rec){
+    int32_t tof;
+    float distance;
+
+    /* Compute time of flight. tsDiff() gives correct answers even if clock has wrapped. See NOTE 12 below. */
+    if (rec->flags & RECORD_FLAG_DS_TWR){
+        tof = tofDS(tsDiff(rec->rx2, rec->tx1), tsDiff(rec->rx3, rec->rx2),
+                    tsDiff(rec->tx2, rec->rx1), tsDiff(rec->tx3, rec->tx2));
+    }
+    else if (rec->flags & RECORD_FLAG_SKEW_CORR){
+        /* skew2 is always the initiator's measurement of the target's clock */
+        tof = tofSSSkew(tsDiff(rec->rx2, rec->tx1), tsDiff(rec->tx2, rec->rx1), rec->skew2);
     }
     else{
-        uint32 final_tx_time;
-        uint64 final_tx_ts;
-
-        /* Retrieve fpp1 */
-        retrievePower(fpp);
-        retrieveSkew(skew);
-
-         /* Write all timestamps in the final message.*/
-        final_msg_set_ts(&tx_final_msg[FINAL_SIGNAL1_TS_IDX], ts1); // rx1
-        
-        memcpy(&tx_final_msg[FINAL_FPP_IDX], fpp, sizeof(float)); // fpp1
-        memcpy(&tx_final_msg[FINAL_SKEW_IDX], skew, sizeof(float)); // skew1
-
-        /* Compute final message transmission time. See NOTE 10 below. */
-        final_tx_time = (ts1 + (1500 * UUS_TO_DWT_TIME)) >> 8;
+        tof = tofSS(tsDiff(rec->rx2, rec->tx1), tsDiff(rec->tx2, rec->rx1));
+    }
+    distance = tofToDistance(tof);
 
-        dwt_setdelayedtrxtime(final_tx_time);
+    /* Range bias of the first path powers, if the radio profile has a table */
+    if (biasCorrectRange(&distance, rec->fpp1, rec->fpp2)){
+        rec->flags |= RECORD_FLAG_BIAS_CORR;
+    }
+    rec->distance = distance;
+}
 
-        /* Final TX timestamp is the transmission time we programmed plus the TX antenna delay. */
-        final_tx_ts = (((uint64)(final_tx_time & 0xFFFFFFFEUL)) << 8) + TX_ANT_DLY;
+/*! ----------------------------------------------------------------------------
+ * Function: outputRange()
+ *
+ * @brief Compute the distance from the time-stamps of a completed exchange and
+ * output the range record.
+ */
+static void outputRange(RangeRecord *rec){
+    computeRange(rec);
+    outputRangeRecord(rec);
+}
 
-        /* Write timestamp in the final message.*/
-        final_msg_set_ts(&tx_final_msg[FINAL_SIGNAL2_TS_IDX], final_tx_ts);
+/* INITIATOR ---------------------------------------------------------------- */
+/*! ----------------------------------------------------------------------------
+ * Function: twrPendingCheck()
+ *
+ * @brief Start the held scheduled poll if its slot is close. Otherwise, the
+ * receiver's timeout is set to expire when it is, so that the UWB task is
+ * woken up in time while still receiving.
+ */
+static void twrPendingCheck(void){
+    uint32 due = twr.pending_time - 2*TDMA_TX_LEAD_UUS*(UUS_TO_DWT_TIME >> 8);
+    int32 remaining = (int32)(due - dwt_readsystimestamphi32())/(int32)(UUS_TO_DWT_TIME >> 8);
 
-        tx_type = DWT_START_TX_DELAYED;
+    if (remaining <= 0){
+        twr.has_pending = false;
+        dwt_setrxtimeout(0);
+        twrStartInitiator(&twr.pending);
+        return;
     }
+    dwt_setrxtimeout(remaining > 0xFFFF ? 0xFFFF : remaining);
+}
 
-    /* Write and send final message. See NOTE 8 below. */
-    tx_final_msg[ALL_MSG_SEQ_IDX] = frame_seq_nb;
-    dwt_writetxdata(sizeof(tx_final_msg), tx_final_msg, 0); /* Zero offset in TX buffer. */
-    dwt_writetxfctrl(sizeof(tx_final_msg), 0, 1); /* Zero offset in TX buffer, ranging. */
-    ret = dwt_starttx(tx_type);
 
-    /* If dwt_starttx() returns an error, abandon this ranging exchange and proceed to the next one. See NOTE 12 below. */
-    if (ret == DWT_SUCCESS)
-    {
-        /* Clear TXFRS event. */
-        dwt_write32bitreg(SYS_STATUS_ID, SYS_STATUS_TXFRS);
+/*! ----------------------------------------------------------------------------
+ * Function: twrSlotTime()
+ *
+ * @brief Transmission time of a scheduled poll: the start of its slot in the
+ * first frame that can still be made, or as soon as possible if the schedule
+ * starts with this poll.
+ *
+ * @return (uint32) High 32 bits of the DW1000 time.
+ */
+static uint32 twrSlotTime(const TdmaTiming *timing){
+    uint32 earliest = dwt_readsystimestamphi32() + TDMA_TX_LEAD_UUS*(UUS_TO_DWT_TIME >> 8);
+    uint32 slot_time, late;
 
-        /* Increment frame sequence number after transmission of the final message (modulo 256). */
-        frame_seq_nb++;
+    if (!timing->ref_valid){
+        return earliest;
+    }
 
-        return 1;
+    slot_time = timing->frame_start + timing->slot*timing->slot_len;
+    late = earliest - slot_time;
+    if ((int32)late > 0){
+        slot_time += ((late + timing->frame_len - 1)/timing->frame_len)*timing->frame_len;
     }
-    
-    return 0;
+    return slot_time;
 }
 
-int txTimestampsDS(uint64 ts1, uint64 ts2, uint64 ts3,
-                   float* fpp, float* skew,
-                   bool is_immediate){
-    /* Set-up delayed transmission to encode the transmission time-stamp in the final message */
-    int ret;
-    uint8_t tx_type;
-
-    if (is_immediate){
-         /* Write all timestamps in the final message.*/
-        final_msg_set_ts(&tx_final_msg[FINAL_SIGNAL1_TS_IDX], ts1); // tx1 
-        final_msg_set_ts(&tx_final_msg[FINAL_SIGNAL2_TS_IDX], ts2); // rx2 
-        final_msg_set_ts(&tx_final_msg[FINAL_SIGNAL3_TS_IDX], ts3); // rx3
-        
-        memcpy(&tx_final_msg[FINAL_FPP_IDX], fpp, sizeof(float)); // fpp2
-        memcpy(&tx_final_msg[FINAL_SKEW_IDX], skew, sizeof(float)); // skew2
-        
-        tx_type = DWT_START_TX_IMMEDIATE;
+
+/*! ----------------------------------------------------------------------------
+ * Function: twrStartInitiator()
+ *
+ * @brief Send the poll of a requested exchange. The receiver is turned on
+ * automatically at the end of the transmission.
+ */
+static void twrStartInitiator(const TwrRequest *req){
+    uint8_t mode = DWT_START_TX_IMMEDIATE | DWT_RESPONSE_EXPECTED;
+    uint32 slot_time = 0;
+    uint32_t delay_ms = 0;
+
+    /* A scheduled poll waits for its slot, which is not a response delay */
+    twr.trace_start = traceCycles();
+    twr.trace_wait = !req->scheduled;
+
+    dwt_forcetrxoff();
+    if (req->get_cir){
+        twrSingleBuffer();
     }
-    else{
-        uint32 final_tx_time;
-        uint64 final_tx_ts;
 
-        /* Retrieve fpp1 */
-        retrievePower(fpp);
-        retrieveSkew(skew);
+    twr.is_initiator = true;
+    twr.burst = false;
+    twr.request_seq = req->seq;
+    twr.neighbour_id = req->target_id;
+    twr.target_meas = req->target_meas;
+    twr.ds_twr = req->ds_twr;
+    twr.get_cir = req->get_cir;
+    memset(&twr.range, 0, sizeof(twr.range));
+    twr.range.neighbour_id = req->target_id;
+    twr.range.flags = RECORD_FLAG_INITIATOR | twrModeFlags(req->ds_twr);
+
+    /* Set expected response's delay and timeout. */
+    dwt_setrxaftertxdelay(radioProfile()->rx_after_tx_uus);
+    dwt_setrxtimeout(0);
+    dwt_setpreambledetecttimeout(radioProfile()->pre_timeout);
 
-         /* Write all timestamps in the final message.*/
-        final_msg_set_ts(&tx_final_msg[FINAL_SIGNAL1_TS_IDX], ts1); // rx1
-        final_msg_set_ts(&tx_final_msg[FINAL_SIGNAL2_TS_IDX], ts2); // tx2
+    /* Include Target board in all communication messages. */
+    setFrameDest(tx_poll_msg, req->target_id);
+    setFrameDest(tx_final_msg, req->target_id);
 
-        memcpy(&tx_final_msg[FINAL_FPP_IDX], fpp, sizeof(float)); // fpp1
-        memcpy(&tx_final_msg[FINAL_SKEW_IDX], skew, sizeof(float)); // skew1
+    /* Indicate whether the Target board will also compute the range measurement */
+    tx_poll_msg[TX_POLL_TARG_MEAS_IDX] = req->target_meas;
 
-        /* Compute final message transmission time. See NOTE 10 below. */
-        final_tx_time = (ts2 + (tx3_delay * UUS_TO_DWT_TIME)) >> 8;
+    /* Indicate whether DS-TWR will be used */
+    tx_poll_msg[TX_POLL_ds_twr_IDX] = req->ds_twr;
 
-        dwt_setdelayedtrxtime(final_tx_time);
+    /* Indicate whether the CIR will be output */
+    tx_poll_msg[TX_POLL_GET_CIR_IDX] = req->get_cir;
 
-        /* Final TX timestamp is the transmission time we programmed plus the TX antenna delay. */
-        final_tx_ts = (((uint64)(final_tx_time & 0xFFFFFFFEUL)) << 8) + TX_ANT_DLY;
+    /* Indicate the TDMA slot, which the other boards align their schedule on */
+    tx_poll_msg[TX_POLL_SLOT_IDX] = req->scheduled ? req->timing.slot : TDMA_NO_SLOT;
 
-        /* Write timestamp in the final message.*/
-        final_msg_set_ts(&tx_final_msg[FINAL_SIGNAL3_TS_IDX], final_tx_ts);
+    /* Write frame data to DW1000 and prepare transmission. See NOTE 8 below. */
+    tx_poll_msg[ALL_MSG_SEQ_IDX] = frame_seq_nb;
+    dwt_writetxdata(sizeof(tx_poll_msg), tx_poll_msg, 0); /* Zero offset in TX buffer. */
+    dwt_writetxfctrl(sizeof(tx_poll_msg), 0, 1); /* Zero offset in TX buffer, ranging. */
 
-        tx_type = DWT_START_TX_DELAYED;
+    /* A scheduled poll is held by the DW1000 until the start of its slot. */
+    if (req->scheduled){
+        slot_time = twrSlotTime(&req->timing);
+        delay_ms = (slot_time - dwt_readsystimestamphi32())/((UUS_TO_DWT_TIME >> 8)*UUS_PER_MS);
+        dwt_setdelayedtrxtime(slot_time);
+        mode = DWT_START_TX_DELAYED | DWT_RESPONSE_EXPECTED;
     }
 
-    /* Write and send final message. See NOTE 8 below. */
-    tx_final_msg[ALL_MSG_SEQ_IDX] = frame_seq_nb;
-    dwt_writetxdata(sizeof(tx_final_msg), tx_final_msg, 0); /* Zero offset in TX buffer. */
-    dwt_writetxfctrl(sizeof(tx_final_msg), 0, 1); /* Zero offset in TX buffer, ranging. */
-    ret = dwt_starttx(tx_type);
-
-    /* If dwt_starttx() returns an error, abandon this ranging exchange and proceed to the next one. See NOTE 12 below. */
-    if (ret == DWT_SUCCESS)
-    {
-        /* Clear TXFRS event. */
-        dwt_write32bitreg(SYS_STATUS_ID, SYS_STATUS_TXFRS);
+    /* Start transmission, indicating that a response is expected so that reception is
+        enabled automatically after the frame is sent and the delay set by
+        dwt_setrxaftertxdelay() has elapsed. */
+    if (dwt_starttx(mode) == DWT_ERROR){
+        twrFinish(0);
+        return;
+    }
+    traceEnd(TRACE_POLL_START, twr.trace_start);
 
-        /* Increment frame sequence number after transmission of the final message (modulo 256). */
-        frame_seq_nb++;
+    /* Increment frame sequence number after transmission of the poll message (modulo 256). */
+    frame_seq_nb++;
 
-        return 1;
+    twrWait(req->ds_twr == TWR_MODE_DS ? TWR_INIT_WAIT_RESP : TWR_INIT_WAIT_FINAL);
+    if (req->scheduled){
+        twr.deadline += delay_ms;
+        tdmaPollTimestamp(BOARD_ID(), req->timing.slot, slot_time, osKernelSysTick() + delay_ms);
     }
-    
-    return 0;
 }
 
-int rxTimestampsSS(uint64 ts1, uint8_t neighbour_id, 
-                   float* fpp, float* skew,
-                   bool is_initiator, bool get_cir){
-    uint32 frame_len;
-    double Ra, Db;
-    uint32 rx1_ts, tx2_ts;
-    uint32 tx1_ts, rx2_ts;
-    int64 tof_dtu;
-    char fpp1_str[10] = {0};
-    char fpp2_str[10] = {0};
-    char skew1_str[10] = {0};
-    char skew2_str[10] = {0};
-    float fpp1, fpp2;
-    float skew1, skew2;
-
-    dwt_setrxtimeout(0);
-    // dwt_setpreambledetecttimeout(0);
-    dwt_rxenable(DWT_START_RX_IMMEDIATE);
+/*! ----------------------------------------------------------------------------
+ * Function: twrInitiatorFinal()
+ *
+ * @brief Compute the range from the target's final message, then send our own
+ * time-stamps if the target is to compute the range as well.
+ */
+static void twrInitiatorFinal(const UwbMsg *msg_ptr){
+    const uint8_t *frame = msg_ptr->msg;
+    RangeRecord *rec = &twr.range;
+    int ret;
 
-    /* Poll for reception of expected "final" frame or error/timeout. See NOTE 8 below. */
-    while (!((status_reg = dwt_read32bitreg(SYS_STATUS_ID)) & (SYS_STATUS_RXFCG | SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR)))
-    { };
+    /* Get timestamps embedded in the final message. */
+    rec->rx1 = finalTs(frame, FINAL_SIGNAL1_TS_IDX);
+    rec->tx2 = finalTs(frame, FINAL_SIGNAL2_TS_IDX);
+    rec->fpp1 = finalFloat(frame, FINAL_FPP_IDX);
+    rec->skew1 = finalFloat(frame, FINAL_SKEW_IDX);
 
-    /* Increment frame sequence number after transmission of the response message (modulo 256). */
-    frame_seq_nb++;
+    if (twr.ds_twr == TWR_MODE_DS){
+        /* Get the transmission time-stamp of the final signal from the neighbour */
+        rec->tx3 = finalTs(frame, FINAL_SIGNAL3_TS_IDX);
+        rec->rx3 = msg_ptr->ts;
+    }
+    else{
+        rec->tx1 = get_tx_timestamp_u64();
+        rec->rx2 = msg_ptr->ts;
+        rec->fpp2 = msg_ptr->fpp;
+        rec->skew2 = msg_ptr->skew;
+    }
+    outputRange(rec);
 
-    if (status_reg & SYS_STATUS_RXFCG)
-    {
-        /* Clear good RX frame event and TX frame sent in the DW1000 status register. */
-        dwt_write32bitreg(SYS_STATUS_ID, SYS_STATUS_RXFCG | SYS_STATUS_TXFRS);
-
-        /* A frame has been received, read it into the local buffer. */
-        frame_len = dwt_read32bitreg(RX_FINFO_ID) & RX_FINFO_RXFLEN_MASK;
-        // if (frame_len <= MAX_FRAME_LEN)
-        if (frame_len <= 1024)
-        {
-            dwt_readrxdata(rx_buffer, frame_len, 0);
+    /* Check if an additional signal is expected to communicate the time-stamps to the target */
+    if (twr.target_meas){
+        if (twr.ds_twr == TWR_MODE_DS){
+            ret = txTimestampsDS(rec->tx1, rec->rx2, rec->rx3, rec->fpp2, rec->skew2, DWT_START_TX_IMMEDIATE);
+        }
+        else{
+            ret = txTimestampsSS(rec->tx1, rec->rx2, rec->fpp2, rec->skew2, DWT_START_TX_IMMEDIATE, 0);
         }
 
-        if (get_cir){
-            if (is_initiator){
-                read_cir(BOARD_ID(), neighbour_id);
-            }
-            else{
-                read_cir(neighbour_id, BOARD_ID());
-            }
+        if (ret){
+            twrWait(TWR_WAIT_FINAL_TX);
         }
+        else{
+            twrFinish(0);
+        }
+        return;
+    }
 
-        /* Check that the frame is a final message sent by "DS TWR initiator" example.
-            * As the sequence number field of the frame is not used in this example, it can be zeroed to ease the validation of the frame. */
-        rx_buffer[ALL_MSG_SEQ_IDX] = 0;
-        if (memcmp(rx_buffer, rx_final_msg, ALL_MSG_COMMON_LEN) == 0)
-        {
-            if (is_initiator){
-                /* Get timestamps embedded in the final message. */
-                final_msg_get_ts(&rx_buffer[FINAL_SIGNAL1_TS_IDX], &rx1_ts);
-                final_msg_get_ts(&rx_buffer[FINAL_SIGNAL2_TS_IDX], &tx2_ts);
-                
-                memcpy(&fpp1, &rx_buffer[FINAL_FPP_IDX], sizeof(float));
-                memcpy(&skew1, &rx_buffer[FINAL_SKEW_IDX], sizeof(float));
-                
-                tx1_ts = (uint32)get_tx_timestamp_u64();
-                rx2_ts = (uint32)get_rx_timestamp_u64();
-
-                retrievePower(fpp);
-                retrieveSkew(skew);
-
-                fpp2 = *fpp;
-                skew2 = *skew;
-            }
-            else{
-                /* Get timestamps embedded in the final message. */
-                final_msg_get_ts(&rx_buffer[FINAL_SIGNAL1_TS_IDX], &tx1_ts);
-                final_msg_get_ts(&rx_buffer[FINAL_SIGNAL2_TS_IDX], &rx2_ts);
-
-                memcpy(&fpp2, &rx_buffer[FINAL_FPP_IDX], sizeof(float));
-                memcpy(&skew2, &rx_buffer[FINAL_SKEW_IDX], sizeof(float));
-            
-                rx1_ts = (uint32)ts1;
-                tx2_ts = (uint32)get_tx_timestamp_u64();  
-
-                fpp1 = *fpp;  
-                skew1 = *skew;            
-            }
-            
-            /* Compute time of flight. 32-bit subtractions give correct answers even if clock has wrapped. See NOTE 12 below. */            
-            Ra = (double)(rx2_ts - tx1_ts);
-            Db = (double)(tx2_ts - rx1_ts);
-            tof_dtu = (int64)((Ra - Db) / (2)); // Standard single-sided TWR
-            
-            tof = tof_dtu * DWT_TIME_UNITS;
-            distance = tof * SPEED_OF_LIGHT;
-
-            convert_float_to_string(fpp1_str,fpp1);
-            convert_float_to_string(fpp2_str,fpp2);
-            convert_float_to_string(skew1_str,skew1);
-            convert_float_to_string(skew2_str,skew2);
-
-            /* Display computed distance. */
-            char dist_str[10] = {0};
-            convert_float_to_string(dist_str,distance);
-            char response[120];
-            
-            char* prefix[4];
-            if (is_initiator){
-                *prefix = "R05";
-            }
-            else{
-                *prefix = "S05";
-            }
+    if (twr.get_cir){
+        read_cir(BOARD_ID(), twr.neighbour_id);
+    }
+    twrFinish(1);
+}
 
-            sprintf(response, "%s|%d|%s|%lu|%lu|%lu|%lu|0|0|%s|%s|%s|%s\r\n",
-                    *prefix,
-                    neighbour_id, dist_str,
-                    tx1_ts, rx1_ts,
-                    tx2_ts, rx2_ts,
-                    fpp1_str, fpp2_str,
-                    skew1_str, skew2_str);
-            usb_print(response);
-            
-            dwt_setrxtimeout(0);
-            dwt_setpreambledetecttimeout(0);
-            return 1;
-        }
+/* TARGET ------------------------------------------------------------------- */
+/*! ----------------------------------------------------------------------------
+ * Function: twrTargetSendFinal()
+ *
+ * @brief Schedule the target's final message, which embeds its time-stamps.
+ *
+ * @param ts (uint64) Time-stamp the final message is delayed from: the poll's
+ * reception in SS-TWR, the response's transmission in DS-TWR.
+ * @param delay (uint32) Delay from ts in SS-TWR, in UUS. The
+ * second-response delay is used in DS-TWR.
+ */
+static void twrTargetSendFinal(uint64 ts, uint32 delay){
+    uint8_t mode = DWT_START_TX_DELAYED;
+    int ret;
+
+    /* Have the receiver turned on after the final message if the initiator
+       will send its own time-stamps. */
+    if (twr.target_meas){
+        dwt_setrxaftertxdelay(radioProfile()->rx_after_tx_uus);
+        mode |= DWT_RESPONSE_EXPECTED;
     }
-    else
-    {
-        /* Clear RX error/timeout events in the DW1000 status register. */
-        dwt_write32bitreg(SYS_STATUS_ID, SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR);
 
-        /* Reset RX to properly reinitialise LDE operation. */
-        dwt_rxreset();
+    if (twr.ds_twr == TWR_MODE_DS){
+        ret = txTimestampsDS(twr.range.rx1, ts, 0, twr.range.fpp1, twr.range.skew1, mode);
+    }
+    else{
+        ret = txTimestampsSS(ts, 0, twr.range.fpp1, twr.range.skew1, mode, delay);
     }
 
-    return 0;
+    /* If the final message is late, abandon this ranging exchange. */
+    if (!ret){
+        twrFinish(0);
+        return;
+    }
+    twrWait(twr.target_meas ? TWR_RESP_WAIT_FINAL : TWR_WAIT_FINAL_TX);
 }
 
-int rxTimestampsDS(uint64 ts1, uint64 ts2, uint8_t neighbour_id, 
-                   float* fpp, float* skew,
-                   bool is_initiator, bool get_cir){
-    uint32 frame_len;
-    double Ra1, Ra2, Db1, Db2;
-    uint32 rx1_ts, tx2_ts, tx3_ts;
-    uint32 tx1_ts, rx2_ts, rx3_ts;
-    double tof_dtu;
-    char fpp1_str[10] = {0};
-    char fpp2_str[10] = {0};
-    char skew1_str[10] = {0};
-    char skew2_str[10] = {0};
-    float fpp1, fpp2;
-    float skew1, skew2;
-    
-    retrievePower(fpp);
-    retrieveSkew(skew);
+/*! ----------------------------------------------------------------------------
+ * Function: twrStartTarget()
+ *
+ * @brief Answer a poll addressed to this board.
+ */
+static void twrStartTarget(const UwbMsg *msg_ptr){
+    const uint8_t *frame = msg_ptr->msg;
+    uint8_t initiator_id = frame[ALL_TX_BOARD_IDX];
+
+    twr.is_initiator = false;
+    twr.burst = false;
+    twr.trace_start = msg_ptr->posted;
+    twr.trace_wait = false;
+    twr.neighbour_id = initiator_id;
+    twr.target_meas = frame[TX_POLL_TARG_MEAS_IDX];
+    twr.ds_twr = frame[TX_POLL_ds_twr_IDX];
+    twr.get_cir = frame[TX_POLL_GET_CIR_IDX];
+    memset(&twr.range, 0, sizeof(twr.range));
+    twr.range.neighbour_id = initiator_id;
+    twr.range.flags = twrModeFlags(twr.ds_twr);
+    twr.range.rx1 = msg_ptr->ts;
+    twr.range.fpp1 = msg_ptr->fpp;
+    twr.range.skew1 = msg_ptr->skew;
+    if (twr.get_cir){
+        twrSingleBuffer();
+    }
 
+    /* Set preamble timeout for expected frames. See NOTE 6 below. */
+    dwt_setpreambledetecttimeout(radioProfile()->pre_timeout);
     dwt_setrxtimeout(0);
-    // dwt_setpreambledetecttimeout(0);
-    dwt_rxenable(DWT_START_RX_IMMEDIATE);
 
-    /* Poll for reception of expected "final" frame or error/timeout. See NOTE 8 below. */
-    while (!((status_reg = dwt_read32bitreg(SYS_STATUS_ID)) & (SYS_STATUS_RXFCG | SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR)))
-    { };
+    /* Update all the messages to incorporate the initiator's ID */
+    setFrameDest(tx_resp_msg, initiator_id);
+    setFrameDest(tx_final_msg, initiator_id);
+
+    if (twr.ds_twr == TWR_MODE_SS_CORRECTED){
+        twrTargetSendFinal(msg_ptr->ts, SS_FAST_REPLY_DELAY_UUS);
+        return;
+    }
+    if (twr.ds_twr != TWR_MODE_DS){
+        twrTargetSendFinal(msg_ptr->ts, SS_REPLY_DELAY_UUS);
+        return;
+    }
+
+    /* Write and send the response message. See NOTE 10 below.*/
+    tx_resp_msg[ALL_MSG_SEQ_IDX] = frame_seq_nb;
+    dwt_writetxdata(sizeof(tx_resp_msg), tx_resp_msg, 0); /* Zero offset in TX buffer. */
+    dwt_writetxfctrl(sizeof(tx_resp_msg), 0, 1); /* Zero offset in TX buffer, ranging. */
+
+    /* If dwt_starttx() returns an error, abandon this ranging exchange and proceed to the next one.*/
+    twrRxStop();
+    if (dwt_starttx(DWT_START_TX_IMMEDIATE) == DWT_ERROR){
+        twrFinish(0);
+        return;
+    }
 
     /* Increment frame sequence number after transmission of the response message (modulo 256). */
     frame_seq_nb++;
 
-    if (status_reg & SYS_STATUS_RXFCG)
-    {
-        /* Clear good RX frame event and TX frame sent in the DW1000 status register. */
-        dwt_write32bitreg(SYS_STATUS_ID, SYS_STATUS_RXFCG | SYS_STATUS_TXFRS);
-
-        /* A frame has been received, read it into the local buffer. */
-        frame_len = dwt_read32bitreg(RX_FINFO_ID) & RX_FINFO_RXFLEN_MASK;
-        // if (frame_len <= MAX_FRAME_LEN)
-        if (frame_len <= 1024)
-        {
-            dwt_readrxdata(rx_buffer, frame_len, 0);
-        }
+    /* The final message is scheduled once the response's TX time-stamp is known */
+    twrWait(TWR_RESP_WAIT_RESP_TX);
+}
 
-        if (get_cir){
-            if (is_initiator){
-                read_cir(BOARD_ID(), neighbour_id);
-            }
-            else{
-                read_cir(neighbour_id, BOARD_ID());
-            }
-        }
+/*! ----------------------------------------------------------------------------
+ * Function: twrTargetFinal()
+ *
+ * @brief Compute the range from the initiator's final message.
+ */
+static void twrTargetFinal(const UwbMsg *msg_ptr){
+    const uint8_t *frame = msg_ptr->msg;
+    RangeRecord *rec = &twr.range;
 
-        /* Check that the frame is a final message sent by "DS TWR initiator" example.
-            * As the sequence number field of the frame is not used in this example, it can be zeroed to ease the validation of the frame. */
-        rx_buffer[ALL_MSG_SEQ_IDX] = 0;
-        if (memcmp(rx_buffer, rx_final_msg, ALL_MSG_COMMON_LEN) == 0)
-        {
-            if (is_initiator){
-                /* Get timestamps embedded in the final message. */
-                final_msg_get_ts(&rx_buffer[FINAL_SIGNAL1_TS_IDX], &rx1_ts);
-                final_msg_get_ts(&rx_buffer[FINAL_SIGNAL2_TS_IDX], &tx2_ts);
-                
-                /* Get the transmission time-stamp of the final signal from the neighbour */
-                final_msg_get_ts(&rx_buffer[FINAL_SIGNAL3_TS_IDX], &tx3_ts);
-
-                memcpy(&fpp1, &rx_buffer[FINAL_FPP_IDX], sizeof(float));
-                memcpy(&skew1, &rx_buffer[FINAL_SKEW_IDX], sizeof(float));
-
-                fpp2 = *fpp;
-                skew2 = *skew;
-
-                tx1_ts = (uint32)ts1;
-                rx2_ts = (uint32)ts2;
-
-                /* Get the reception time-stamp of the final signal */
-                rx3_ts = (uint32)get_rx_timestamp_u64();    
-            }
-            else{
-                /* Get timestamps embedded in the final message. */
-                final_msg_get_ts(&rx_buffer[FINAL_SIGNAL1_TS_IDX], &tx1_ts);
-                final_msg_get_ts(&rx_buffer[FINAL_SIGNAL2_TS_IDX], &rx2_ts);
-                
-                /* Get the transmission time-stamp of the final signal from the neighbour */
-                final_msg_get_ts(&rx_buffer[FINAL_SIGNAL3_TS_IDX], &rx3_ts);
-
-                memcpy(&fpp2, &rx_buffer[FINAL_FPP_IDX], sizeof(float));
-                memcpy(&skew2, &rx_buffer[FINAL_SKEW_IDX], sizeof(float));
-
-                fpp1 = *fpp;
-                skew1 = *skew;
-
-                rx1_ts = (uint32)ts1;
-                tx2_ts = (uint32)ts2;
-
-                /* Get the transmission time-stamp of the final signal */
-                tx3_ts = (uint32)get_tx_timestamp_u64();      
-            }            
-
-            /* Compute time of flight. 32-bit subtractions give correct answers even if clock has wrapped. See NOTE 12 below. */            
-            Ra1 = (double)(rx2_ts - tx1_ts);
-            Ra2 = (double)(rx3_ts - rx2_ts);
-            Db1 = (double)(tx2_ts - rx1_ts);
-            Db2 = (double)(tx3_ts - tx2_ts);
-            // tof_dtu = (int64)((Ra1*Db2 - Ra2*Db1) / (Ra2 + Db2)); // Reversed alternative double-sided TWR
-            tof_dtu = (double)(0.5*(Ra1 - Ra2/Db2*Db1)); // Reversed alternative double-sided TWR
-           
-            tof = tof_dtu * DWT_TIME_UNITS;
-            distance = tof * SPEED_OF_LIGHT;
-
-            /* Display computed distance. */
-            char dist_str[10] = {0};
-            convert_float_to_string(dist_str,distance);
-            char response[150];
-
-            char* prefix[4];
-            if (is_initiator){
-                *prefix = "R05";
-            }
-            else{
-                *prefix = "S05";
-            }
+    /* Get timestamps embedded in the final message. */
+    rec->tx1 = finalTs(frame, FINAL_SIGNAL1_TS_IDX);
+    rec->rx2 = finalTs(frame, FINAL_SIGNAL2_TS_IDX);
+    rec->fpp2 = finalFloat(frame, FINAL_FPP_IDX);
+    rec->skew2 = finalFloat(frame, FINAL_SKEW_IDX);
 
-            convert_float_to_string(fpp1_str,fpp1);
-            convert_float_to_string(fpp2_str,fpp2);
-            convert_float_to_string(skew1_str,skew1);
-            convert_float_to_string(skew2_str,skew2);
-
-            sprintf(response, "%s|%d|%s|%lu|%lu|%lu|%lu|%lu|%lu|%s|%s|%s|%s\r\n",
-                    *prefix,
-                    neighbour_id, dist_str,
-                    tx1_ts, rx1_ts,
-                    tx2_ts, rx2_ts,
-                    tx3_ts, rx3_ts,
-                    fpp1_str, fpp2_str,
-                    skew1_str, skew2_str);
-            usb_print(response); // TODO: will this response ever be sent without a USB command?
-            
-            dwt_setrxtimeout(0);
-            dwt_setpreambledetecttimeout(0);
-            return 1;
-        }
-    }
-    else
-    {
-        /* Clear RX error/timeout events in the DW1000 status register. */
-        dwt_write32bitreg(SYS_STATUS_ID, SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR);
+    if (twr.ds_twr == TWR_MODE_DS){
+        rec->rx3 = finalTs(frame, FINAL_SIGNAL3_TS_IDX);
 
-        /* Reset RX to properly reinitialise LDE operation. */
-        dwt_rxreset();
+        /* Get the transmission time-stamp of our final signal */
+        rec->tx3 = get_tx_timestamp_u64();
     }
+    else{
+        rec->tx2 = get_tx_timestamp_u64();
+    }
+    outputRange(rec);
 
-    return 0;
+    if (twr.get_cir){
+        read_cir(twr.neighbour_id, BOARD_ID());
+    }
+    twrFinish(1);
 }
 
+/* PASSIVE LISTENER --------------------------------------------------------- */
 /*! ----------------------------------------------------------------------------
- * Function: passivelyListenSS()
- *
- * @brief Listen passively to other TWR tags and record all timestamps. 
- * Single-sided version.
- * 
- * @param rx_ts1 (uint32_t) The time of reception of the already detected signal 
- * through interrupt.
- * @param target_meas_bool (bool) Whether or not a third signal is expected.
- * 
- * @return (bool) Success boolean.
+ * Function: twrStartPassive()
+ *
+ * @brief Listen passively to a TWR exchange between two other tags, starting
+ * from its poll, and record all timestamps.
  */
-int passivelyListenSS(uint32_t rx_ts1, bool target_meas_bool, bool get_cir){
-    /* Have received first signal in a TWR transaction. 1 or 2 more signals expected. */
-    bool success;
-    uint8_t initiator_id, target_id;
-    uint32_t rx_ts2 = 0; // reception timestamps at current tag
-    uint32_t tx_ts1_n = 0, tx_ts2_n = 0; // transmission timestamps at neighbouring tags
-    uint32_t rx_ts1_n = 0, rx_ts2_n = 0; // reception timestamps at neighbouring tags
-    float fpp1 = 0, fpp2 = 0; // received signal power at current tag 
-    float skew1 = 0, skew2 = 0;    
-    float fpp1_n = 0, fpp2_n = 0; // received signal power at neighbouring tags 
-    float skew1_n = 0, skew2_n = 0;
-    char fpp1_str[10] = {0};
-    char fpp2_str[10] = {0};
-    char skew1_str[10] = {0};
-    char skew2_str[10] = {0};
-    char fpp1_n_str[10] = {0};
-    char fpp2_n_str[10] = {0};
-    char skew1_n_str[10] = {0};
-    char skew2_n_str[10] = {0};
+static void twrStartPassive(const UwbMsg *msg_ptr){
+    const uint8_t *frame = msg_ptr->msg;
+    PassiveRecord *rec = &twr.passive;
+
+    twr.is_initiator = false;
+    twr.burst = false;
+    twr.trace_start = msg_ptr->posted;
+    twr.trace_wait = false;
+    twr.target_meas = frame[TX_POLL_TARG_MEAS_IDX];
+    twr.ds_twr = frame[TX_POLL_ds_twr_IDX];
+    twr.get_cir = frame[TX_POLL_GET_CIR_IDX];
 
     // Retrieve IDs of tags involved in the TWR transaction
-    initiator_id = rx_buffer[ALL_TX_BOARD_IDX];
-    target_id = rx_buffer[ALL_RX_BOARD_IDX];
-
-    /* Retrieve received signal power and skew */
-    retrievePower(&fpp1);
-    retrieveSkew(&skew1);
-
-    /* --------------------- SIGNAL 2: Target to Initiator --------------------- */
-    success = checkReceivedFrame(ALL_RX_BOARD_IDX, initiator_id, ALL_TX_BOARD_IDX, target_id, 0xC);
-    if (success){
-        if (get_cir && !target_meas_bool){
-            read_cir(initiator_id, target_id);
-        }
+    memset(rec, 0, sizeof(*rec));
+    rec->initiator_id = frame[ALL_TX_BOARD_IDX];
+    rec->target_id = frame[ALL_RX_BOARD_IDX];
+    rec->flags = (twr.ds_twr == TWR_MODE_DS) ? RECORD_FLAG_DS_TWR : 0;
+
+    /* Time-stamp, received signal power and skew of Signal 1 */
+    rec->rx1 = msg_ptr->ts;
+    rec->fpp1 = msg_ptr->fpp;
+    rec->skew1 = msg_ptr->skew;
+    if (twr.get_cir){
+        twrSingleBuffer();
+    }
 
-        /* Extract all the embedded information in the received signal */
-        final_msg_get_ts(&rx_buffer[FINAL_SIGNAL1_TS_IDX], &rx_ts1_n);
-        final_msg_get_ts(&rx_buffer[FINAL_SIGNAL2_TS_IDX], &tx_ts2_n);
+    dwt_setpreambledetecttimeout(radioProfile()->pre_timeout);
+    dwt_setrxtimeout(0);
+    twrRxEnable();
+    twrWait(twr.ds_twr == TWR_MODE_DS ? TWR_PASSIVE_WAIT_RESP : TWR_PASSIVE_WAIT_FINAL);
+}
 
-        memcpy(&fpp1_n, &rx_buffer[FINAL_FPP_IDX], sizeof(float)); 
-        memcpy(&skew1_n, &rx_buffer[FINAL_SKEW_IDX], sizeof(float)); 
+/*! ----------------------------------------------------------------------------
+ * Function: twrPassiveFinal()
+ *
+ * @brief Record the target's final message (Signal 2 in SS-TWR, Signal 3 in
+ * DS-TWR).
+ */
+static void twrPassiveFinal(const UwbMsg *msg_ptr){
+    const uint8_t *frame = msg_ptr->msg;
+    PassiveRecord *rec = &twr.passive;
+
+    /* Extract all the embedded information in the received signal */
+    rec->rx1_n = finalTs(frame, FINAL_SIGNAL1_TS_IDX);
+    rec->tx2_n = finalTs(frame, FINAL_SIGNAL2_TS_IDX);
+    rec->fpp1_n = finalFloat(frame, FINAL_FPP_IDX);
+    rec->skew1_n = finalFloat(frame, FINAL_SKEW_IDX);
+
+    /* Retrieve reception timestamp, received signal power and skew */
+    if (twr.ds_twr == TWR_MODE_DS){
+        rec->tx3_n = finalTs(frame, FINAL_SIGNAL3_TS_IDX);
+        rec->rx3 = msg_ptr->ts;
+        rec->fpp3 = msg_ptr->fpp;
+        rec->skew3 = msg_ptr->skew;
+    }
+    else{
+        rec->rx2 = msg_ptr->ts;
+        rec->fpp2 = msg_ptr->fpp;
+        rec->skew2 = msg_ptr->skew;
+    }
 
-        /* Retrieve reception timestamp */
-        rx_ts2 = get_rx_timestamp_u64();
+    if (twr.get_cir && !twr.target_meas){
+        read_cir(rec->initiator_id, rec->target_id);
+    }
 
-        /* Retrieve received signal power and skew */
-        retrievePower(&fpp2);
-        retrieveSkew(&skew2);
+    // Check if the initiator's final signal is expected.
+    if (twr.target_meas){
+        twrRxEnable();
+        twrWait(TWR_PASSIVE_WAIT_TARG_FINAL);
+        return;
     }
-    else{
-        return 0;
+
+    outputPassive(rec);
+    twrFinish(1);
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: twrPassiveTargFinal()
+ *
+ * @brief Record the initiator's final message. The transmission time-stamp of
+ * Signal 1 is embedded in it.
+ */
+static void twrPassiveTargFinal(const UwbMsg *msg_ptr){
+    const uint8_t *frame = msg_ptr->msg;
+    PassiveRecord *rec = &twr.passive;
+
+    /* Extract all the embedded information in the received signal */
+    rec->tx1_n = finalTs(frame, FINAL_SIGNAL1_TS_IDX);
+    rec->rx2_n = finalTs(frame, FINAL_SIGNAL2_TS_IDX);
+    if (twr.ds_twr == TWR_MODE_DS){
+        rec->rx3_n = finalTs(frame, FINAL_SIGNAL3_TS_IDX);
     }
+    rec->fpp2_n = finalFloat(frame, FINAL_FPP_IDX);
+    rec->skew2_n = finalFloat(frame, FINAL_SKEW_IDX);
 
-    /* --------------------- SIGNAL 3: Initiator to Target --------------------- 
-    The transmission time-stamp of Signal 1 is embedded in the received frame */
-    // Check if fourth signal is expected.
-    if (target_meas_bool){
-        dwt_setpreambledetecttimeout(0);
-        dwt_setrxtimeout(0);
-        success = checkReceivedFrame(ALL_TX_BOARD_IDX, initiator_id, ALL_RX_BOARD_IDX, target_id, 0xC);
-        if (success){
-            if (get_cir){
-                read_cir(initiator_id, target_id);
-            }
-            
-            /* Extract all the embedded information in the received signal */
-            final_msg_get_ts(&rx_buffer[FINAL_SIGNAL1_TS_IDX], &tx_ts1_n);
-            final_msg_get_ts(&rx_buffer[FINAL_SIGNAL2_TS_IDX], &rx_ts2_n);
+    if (twr.get_cir){
+        read_cir(rec->initiator_id, rec->target_id);
+    }
 
-            memcpy(&fpp2_n, &rx_buffer[FINAL_FPP_IDX], sizeof(float)); 
-            memcpy(&skew2_n, &rx_buffer[FINAL_SKEW_IDX], sizeof(float)); 
+    outputPassive(rec);
+    twrFinish(1);
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: outputPassive()
+ *
+ * @brief Output an overheard exchange, either as the raw timestamps or as the
+ * pseudo-range computed from them.
+ *
+ * The response reaches the listener tdoa + tof(I,T) after the poll, plus the
+ * reply time of the target converted to the clock of the listener. If the
+ * initiator sent its own final message, tof(I,T) is computed as the initiator
+ * would have, and removed.
+ */
+static void outputPassive(const PassiveRecord *rec){
+    TdoaRecord tdoa_rec;
+    int32_t pseudo, tof = 0;
+
+    if (passive_output != PASSIVE_OUTPUT_TDOA){
+        outputPassiveRecord(rec);
+        return;
+    }
+
+    memset(&tdoa_rec, 0, sizeof(tdoa_rec));
+    tdoa_rec.initiator_id = rec->initiator_id;
+    tdoa_rec.target_id = rec->target_id;
+    tdoa_rec.flags = rec->flags & (RECORD_FLAG_DS_TWR | RECORD_FLAG_INCOMPLETE);
+    if (rec->flags & RECORD_FLAG_INCOMPLETE){
+        outputTdoaRecord(&tdoa_rec);
+        return;
+    }
+
+    if (rec->flags & RECORD_FLAG_DS_TWR){
+        pseudo = tdoaDS(tsDiff(rec->rx2, rec->rx1), tsDiff(rec->rx3, rec->rx2),
+                        tsDiff(rec->tx2_n, rec->rx1_n), tsDiff(rec->tx3_n, rec->tx2_n));
+        if (twr.target_meas){
+            tof = tofDS(tsDiff(rec->rx2_n, rec->tx1_n), tsDiff(rec->rx3_n, rec->rx2_n),
+                        tsDiff(rec->tx2_n, rec->rx1_n), tsDiff(rec->tx3_n, rec->tx2_n));
         }
-        else{
-            return 0;
+    }
+    else{
+        /* skew2 is measured on the response, by the listener and by the initiator */
+        pseudo = tdoaSS(tsDiff(rec->rx2, rec->rx1), tsDiff(rec->tx2_n, rec->rx1_n), rec->skew2);
+        if (twr.target_meas){
+            tof = tofSSSkew(tsDiff(rec->rx2_n, rec->tx1_n), tsDiff(rec->tx2_n, rec->rx1_n), rec->skew2_n);
         }
     }
+    if (twr.target_meas){
+        tdoa_rec.flags |= RECORD_FLAG_HAS_RANGE;
+    }
 
-    /* --------------------- Output Time-stamps --------------------- */
-    convert_float_to_string(fpp1_str,fpp1);
-    convert_float_to_string(fpp2_str,fpp2);
-    convert_float_to_string(skew1_str,skew1);
-    convert_float_to_string(skew2_str,skew2);
-    convert_float_to_string(fpp1_n_str,fpp1_n);
-    convert_float_to_string(fpp2_n_str,fpp2_n);
-    convert_float_to_string(skew1_n_str,skew1_n);
-    convert_float_to_string(skew2_n_str,skew2_n);
-
-    char output[200];
-    sprintf(output,"S01|%d|%d|%lu|%lu|0|%lu|%lu|%lu|%lu|0|0|%s|%s|0|%s|%s|0|%s|%s|%s|%s\r\n",
-            initiator_id, target_id,
-            rx_ts1,rx_ts2,
-            tx_ts1_n,rx_ts1_n,
-            tx_ts2_n,rx_ts2_n,
-            fpp1_str,fpp2_str,
-            skew1_str,skew2_str,
-            fpp1_n_str,fpp2_n_str,
-            skew1_n_str,skew2_n_str);
-    usb_print(output);
-    return 1;
+    tdoa_rec.tdoa = tofToDistance(pseudo - tof);
+    tdoa_rec.range = tofToDistance(tof);
+    tdoa_rec.fpp1 = rec->fpp1;
+    tdoa_rec.fpp2 = rec->fpp2;
+    outputTdoaRecord(&tdoa_rec);
 }
 
+/* MULTI-TARGET BURST ------------------------------------------------------- */
 /*! ----------------------------------------------------------------------------
- * Function: passivelyListenDS()
- *
- * @brief Listen passively to other TWR tags and record all timestamps. 
- * Double-sided version.
- * 
- * @param rx_ts1 (uint32_t) The time of reception of the already detected signal 
- * through interrupt.
- * @param target_meas_bool (bool) Whether or not a fourth signal is expected.
- * 
- * @return (bool) Success boolean.
+ * Function: twrStartBurst()
+ *
+ * @brief Send the poll of a multi-target burst. The receiver is turned on
+ * automatically at the end of the transmission, and kept on until every
+ * target has responded in its slot or the window is over.
  */
-int passivelyListenDS(uint32_t rx_ts1, bool target_meas_bool, bool get_cir){
-    /* Have received first signal in a TWR transaction. 1 or 2 more signals expected. */
-    bool success;
-    uint8_t initiator_id, target_id;
-    uint32_t rx_ts2 = 0, rx_ts3 = 0; // reception timestamps at current tag
-    uint32_t tx_ts1_n = 0, tx_ts2_n = 0, tx_ts3_n = 0; // transmission timestamps at neighbouring tags
-    uint32_t rx_ts1_n = 0, rx_ts2_n = 0, rx_ts3_n = 0; // reception timestamps at neighbouring tags
-    float fpp1 = 0, fpp2 = 0, fpp3 = 0; // received signal power at current tag 
-    float skew1 = 0, skew2 = 0, skew3 = 0;
-    float fpp1_n = 0, fpp2_n = 0; // received signal power at neighbouring tags 
-    float skew1_n = 0, skew2_n = 0;
-    char fpp1_str[10] = {0};
-    char fpp2_str[10] = {0};
-    char fpp3_str[10] = {0};
-    char skew1_str[10] = {0};
-    char skew2_str[10] = {0};
-    char skew3_str[10] = {0};
-    char fpp1_n_str[10] = {0};
-    char fpp2_n_str[10] = {0};
-    char skew1_n_str[10] = {0};
-    char skew2_n_str[10] = {0};
+static void twrStartBurst(const TwrRequest *req){
+    uint8_t len = BURST_POLL_TARGETS_IDX + req->num_targets + 2;
 
-    // Retrieve IDs of tags involved in the TWR transaction
-    initiator_id = rx_buffer[ALL_TX_BOARD_IDX];
-    target_id = rx_buffer[ALL_RX_BOARD_IDX];
+    twr.trace_start = traceCycles();
+    twr.trace_wait = true;
 
-    /* Retrieve received signal power and skew */
-    retrievePower(&fpp1);
-    retrieveSkew(&skew1);
+    dwt_forcetrxoff();
 
-    /* --------------------- SIGNAL 2: Target to Initiator --------------------- */
-    success = checkReceivedFrame(ALL_RX_BOARD_IDX, initiator_id, ALL_TX_BOARD_IDX, target_id, 0xB);
-    if (success){
-        /* Retrieve reception timestamp */
-        rx_ts2 = get_rx_timestamp_u64();
+    twr.is_initiator = true;
+    twr.burst = true;
+    twr.request_seq = req->seq;
+    twr.target_meas = req->target_meas;
+    twr.ds_twr = TWR_MODE_SS_CORRECTED;
+    twr.get_cir = false;
+    twr.num_targets = req->num_targets;
+    memcpy(twr.targets, req->targets, req->num_targets);
+    twr.num_ranges = 0;
+    twr.responded = 0;
+
+    /* The responses are spread over the window, so only the exchange's own
+       timeout applies. */
+    dwt_setrxaftertxdelay(radioProfile()->rx_after_tx_uus);
+    dwt_setrxtimeout(0);
+    dwt_setpreambledetecttimeout(0);
 
-        /* Retrieve received signal power and skew */
-        retrievePower(&fpp2);
-        retrieveSkew(&skew2);
+    setFrameDest(tx_burst_poll_msg, BROADCAST_ID);
+    tx_burst_poll_msg[BURST_POLL_TARG_MEAS_IDX] = req->target_meas;
+    tx_burst_poll_msg[BURST_POLL_NUM_IDX] = req->num_targets;
+    memcpy(&tx_burst_poll_msg[BURST_POLL_TARGETS_IDX], req->targets, req->num_targets);
+
+    tx_burst_poll_msg[ALL_MSG_SEQ_IDX] = frame_seq_nb;
+    dwt_writetxdata(len, tx_burst_poll_msg, 0); /* Zero offset in TX buffer. */
+    dwt_writetxfctrl(len, 0, 1); /* Zero offset in TX buffer, ranging. */
+
+    if (dwt_starttx(DWT_START_TX_IMMEDIATE | DWT_RESPONSE_EXPECTED) == DWT_ERROR){
+        twrFinish(0);
+        return;
+    }
+    frame_seq_nb++;
+
+    twrWait(TWR_BURST_WAIT_RESP);
+    twr.deadline += BURST_WINDOW_UUS(req->num_targets)/1000;
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: twrBurstResponse()
+ *
+ * @brief Record the response of one of the targets of a burst.
+ *
+ * @return (bool) Whether the frame was an awaited response.
+ */
+static bool twrBurstResponse(const UwbMsg *msg_ptr){
+    const uint8_t *frame = msg_ptr->msg;
+    RangeRecord *rec;
+    uint8_t i;
+
+    for (i = 0; i < twr.num_targets; i++){
+        if (isFrame(msg_ptr, 0xC, twr.targets[i], BOARD_ID())){
+            break;
+        }
+    }
+    if (i == twr.num_targets || (twr.responded & (1 << i))){
+        return false;
+    }
+    twr.responded |= (1 << i);
+
+    rec = &twr.ranges[twr.num_ranges++];
+    memset(rec, 0, sizeof(*rec));
+    rec->neighbour_id = twr.targets[i];
+    rec->flags = RECORD_FLAG_INITIATOR | twrModeFlags(twr.ds_twr);
+    rec->tx1 = get_tx_timestamp_u64();
+    rec->rx1 = finalTs(frame, FINAL_SIGNAL1_TS_IDX);
+    rec->tx2 = finalTs(frame, FINAL_SIGNAL2_TS_IDX);
+    rec->rx2 = msg_ptr->ts;
+    rec->fpp1 = finalFloat(frame, FINAL_FPP_IDX);
+    rec->skew1 = finalFloat(frame, FINAL_SKEW_IDX);
+    rec->fpp2 = msg_ptr->fpp;
+    rec->skew2 = msg_ptr->skew;
+    computeRange(rec);
+
+    if (twr.num_ranges == twr.num_targets){
+        twrBurstComplete();
     }
     else{
-        /* Due to immediate response of Signal 2, this has highest chance of failure.
-           If failed, still communicate the ranging tags' IDs for scheduling purposes. */
-        char output[155];
-        sprintf(output,"S01|%d|%d|0|0|0|0|0|0|0|0|0|0|0|0|0|0|0|0|0|0|0|0|0|0|0|0\r\n",
-                initiator_id,target_id);
-        usb_print(output);
-        return 0;
+        twrRxEnable();
     }
+    return true;
+}
 
-    /* --------------------- SIGNAL 3: Target to Initiator --------------------- */
-    success = checkReceivedFrame(ALL_RX_BOARD_IDX, initiator_id, ALL_TX_BOARD_IDX, target_id, 0xC);
-    if (success){
-        /* Extract all the embedded information in the received signal */
-        final_msg_get_ts(&rx_buffer[FINAL_SIGNAL1_TS_IDX], &rx_ts1_n);
-        final_msg_get_ts(&rx_buffer[FINAL_SIGNAL2_TS_IDX], &tx_ts2_n);
-        final_msg_get_ts(&rx_buffer[FINAL_SIGNAL3_TS_IDX], &tx_ts3_n);
+/*! ----------------------------------------------------------------------------
+ * Function: txBurstFinal()
+ *
+ * @brief Broadcast the time-stamps of all the responses of a burst, so that
+ * each target can compute its own range.
+ *
+ * @return (int) 1 if the transmission was started.
+ */
+static int txBurstFinal(void){
+    uint8_t *entry = &tx_burst_final_msg[BURST_FINAL_ENTRIES_IDX];
+    uint8_t len = BURST_FINAL_ENTRIES_IDX + twr.num_ranges*BURST_FINAL_ENTRY_LEN + 2;
+    uint8_t i;
+
+    setFrameDest(tx_burst_final_msg, BROADCAST_ID);
+    final_msg_set_ts(&tx_burst_final_msg[BURST_FINAL_TX1_IDX], twr.ranges[0].tx1);
+    tx_burst_final_msg[BURST_FINAL_NUM_IDX] = twr.num_ranges;
+
+    for (i = 0; i < twr.num_ranges; i++, entry += BURST_FINAL_ENTRY_LEN){
+        entry[0] = twr.ranges[i].neighbour_id;
+        final_msg_set_ts(&entry[BURST_ENTRY_RX2_IDX], twr.ranges[i].rx2);
+        memcpy(&entry[BURST_ENTRY_FPP_IDX], &twr.ranges[i].fpp2, sizeof(float));
+        memcpy(&entry[BURST_ENTRY_SKEW_IDX], &twr.ranges[i].skew2, sizeof(float));
+    }
+
+    tx_burst_final_msg[ALL_MSG_SEQ_IDX] = frame_seq_nb;
+    dwt_writetxdata(len, tx_burst_final_msg, 0); /* Zero offset in TX buffer. */
+    dwt_writetxfctrl(len, 0, 1); /* Zero offset in TX buffer, ranging. */
 
-        memcpy(&fpp1_n, &rx_buffer[FINAL_FPP_IDX], sizeof(float)); 
-        memcpy(&skew1_n, &rx_buffer[FINAL_SKEW_IDX], sizeof(float)); 
-        // memcpy(&std1_n, &rx_buffer[FINAL_STD_IDX], sizeof(uint16_t)); 
+    if (dwt_starttx(DWT_START_TX_IMMEDIATE) == DWT_SUCCESS){
+        frame_seq_nb++;
+        return 1;
+    }
+    return 0;
+}
 
-        /* Retrieve reception timestamp */
-        rx_ts3 = get_rx_timestamp_u64();
+/*! ----------------------------------------------------------------------------
+ * Function: twrBurstComplete()
+ *
+ * @brief End the response window of a burst: output the ranges obtained, then
+ * send the burst final message if the targets are to compute them as well.
+ */
+static void twrBurstComplete(void){
+    dwt_forcetrxoff();
+
+    if (twr.num_ranges == 0){
+        twrFinish(0);
+        return;
+    }
+    outputBurstRecord(twr.ranges, twr.num_ranges);
 
-        /* Retrieve received signal power and skew */
-        retrievePower(&fpp3);
-        retrieveSkew(&skew3);
+    if (twr.target_meas && txBurstFinal()){
+        twrWait(TWR_WAIT_FINAL_TX);
+        return;
+    }
+    twrFinish(1);
+}
 
-        if (get_cir && !target_meas_bool){
-            read_cir(initiator_id, target_id);
+/*! ----------------------------------------------------------------------------
+ * Function: twrStartBurstTarget()
+ *
+ * @brief Answer a burst poll listing this board, in the slot given by its
+ * position in the list.
+ *
+ * @return (bool) Whether this board is one of the targets.
+ */
+static bool twrStartBurstTarget(const UwbMsg *msg_ptr){
+    const uint8_t *frame = msg_ptr->msg;
+    uint8_t num_targets = frame[BURST_POLL_NUM_IDX];
+    uint8_t initiator_id = frame[ALL_TX_BOARD_IDX];
+    uint8_t i;
+
+    if (num_targets > BURST_MAX_TARGETS
+        || msg_ptr->len < (uint32_t)(BURST_POLL_TARGETS_IDX + num_targets + 2)){
+        return false;
+    }
+    for (i = 0; i < num_targets; i++){
+        if (frame[BURST_POLL_TARGETS_IDX + i] == BOARD_ID()){
+            break;
         }
     }
-    else{
-        return 0;
+    if (i == num_targets){
+        return false;
     }
 
-    /* --------------------- SIGNAL 4: Initiator to Target --------------------- 
-    The transmission time-stamp of Signal 1 is embedded in the received frame */
-    // Check if fourth signal is expected.
-    if (target_meas_bool){
-        dwt_setpreambledetecttimeout(0);
-        dwt_setrxtimeout(0);
+    twr.is_initiator = false;
+    twr.burst = true;
+    twr.neighbour_id = initiator_id;
+    twr.target_meas = frame[BURST_POLL_TARG_MEAS_IDX];
+    twr.ds_twr = TWR_MODE_SS_CORRECTED;
+    twr.get_cir = false;
+    memset(&twr.range, 0, sizeof(twr.range));
+    twr.range.neighbour_id = initiator_id;
+    twr.range.flags = twrModeFlags(twr.ds_twr);
+    twr.range.rx1 = msg_ptr->ts;
+    twr.range.fpp1 = msg_ptr->fpp;
+    twr.range.skew1 = msg_ptr->skew;
 
-        success = checkReceivedFrame(ALL_TX_BOARD_IDX, initiator_id, ALL_RX_BOARD_IDX, target_id, 0xC);
-        if (success){
-            /* Extract all the embedded information in the received signal */
-            final_msg_get_ts(&rx_buffer[FINAL_SIGNAL1_TS_IDX], &tx_ts1_n);
-            final_msg_get_ts(&rx_buffer[FINAL_SIGNAL2_TS_IDX], &rx_ts2_n);
-            final_msg_get_ts(&rx_buffer[FINAL_SIGNAL3_TS_IDX], &rx_ts3_n);
+    dwt_setpreambledetecttimeout(0);
+    dwt_setrxtimeout(0);
+    setFrameDest(tx_final_msg, initiator_id);
 
-            memcpy(&fpp2_n, &rx_buffer[FINAL_FPP_IDX], sizeof(float)); 
-            memcpy(&skew2_n, &rx_buffer[FINAL_SKEW_IDX], sizeof(float)); 
+    twrTargetSendFinal(msg_ptr->ts, BURST_FIRST_SLOT_UUS + i*BURST_SLOT_UUS);
 
-            if (get_cir){
-                read_cir(initiator_id, target_id);
-            }
-        }
-        else{
-            return 0;
+    /* The burst final message only comes after the last slot */
+    if (twr.state != TWR_IDLE){
+        twr.deadline += BURST_WINDOW_UUS(num_targets)/1000;
+    }
+    return true;
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: twrBurstTargetFinal()
+ *
+ * @brief Compute the range from this board's entry in the burst final message.
+ *
+ * @return (bool) Whether the frame was the awaited burst final message.
+ */
+static bool twrBurstTargetFinal(const UwbMsg *msg_ptr){
+    const uint8_t *frame = msg_ptr->msg;
+    const uint8_t *entry = &frame[BURST_FINAL_ENTRIES_IDX];
+    RangeRecord *rec = &twr.range;
+    uint8_t num_entries = frame[BURST_FINAL_NUM_IDX];
+    uint8_t i;
+
+    if (!isFrame(msg_ptr, 0xF, twr.neighbour_id, BROADCAST_ID)
+        || num_entries > BURST_MAX_TARGETS
+        || msg_ptr->len < (uint32_t)(BURST_FINAL_ENTRIES_IDX + num_entries*BURST_FINAL_ENTRY_LEN + 2)){
+        return false;
+    }
+
+    for (i = 0; i < num_entries; i++, entry += BURST_FINAL_ENTRY_LEN){
+        if (entry[0] == BOARD_ID()){
+            break;
         }
     }
+    /* Our response was not received by the initiator */
+    if (i == num_entries){
+        twrFinish(0);
+        return true;
+    }
 
-    /* --------------------- Output Time-stamps --------------------- */
-    convert_float_to_string(fpp1_str,fpp1);
-    convert_float_to_string(fpp2_str,fpp2);
-    convert_float_to_string(fpp3_str,fpp3);
-    convert_float_to_string(skew1_str,skew1);
-    convert_float_to_string(skew2_str,skew2);
-    convert_float_to_string(skew3_str,skew3);
-    convert_float_to_string(fpp1_n_str,fpp1_n);
-    convert_float_to_string(fpp2_n_str,fpp2_n);
-    convert_float_to_string(skew1_n_str,skew1_n);
-    convert_float_to_string(skew2_n_str,skew2_n);
-
-    char output[200];
-    sprintf(output,"S01|%d|%d|%lu|%lu|%lu|%lu|%lu|%lu|%lu|%lu|%lu|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s\r\n",
-            initiator_id, target_id,
-            rx_ts1,rx_ts2,rx_ts3,
-            tx_ts1_n,rx_ts1_n,
-            tx_ts2_n,rx_ts2_n,
-            tx_ts3_n,rx_ts3_n,
-            fpp1_str,fpp2_str,fpp3_str,
-            skew1_str,skew2_str,skew3_str,
-            fpp1_n_str,fpp2_n_str,
-            skew1_n_str,skew2_n_str);
-    usb_print(output);
-    return 1;
+    rec->tx1 = finalTs(frame, BURST_FINAL_TX1_IDX);
+    rec->rx2 = finalTs(entry, BURST_ENTRY_RX2_IDX);
+    rec->fpp2 = finalFloat(entry, BURST_ENTRY_FPP_IDX);
+    rec->skew2 = finalFloat(entry, BURST_ENTRY_SKEW_IDX);
+    rec->tx2 = get_tx_timestamp_u64();
+    outputRange(rec);
+    twrFinish(1);
+    return true;
 }
 
+/* EVENT DISPATCH ----------------------------------------------------------- */
 /*! ----------------------------------------------------------------------------
- * Function: checkReceivedFrame()
- *
- * @brief This function checks if the received frame is the expected one. 
- * 
- * @param initator_idx (uint8_t) The index of the initator ID in the received message.
- * @param initator_id (uint8_t) The ID of the initator board in this TWR transaction. 
- * @param target_idx (uint8_t) The index of the target ID in the received message.
- * @param target_id (uint8_t) The ID of the target board in this TWR transaction.
- * @param msg_type (uint8_t) The type of message expected.
- * 
- * @return (bool) Success boolean.
+ * Function: twrReceiveFrame()
+ *
+ * @brief Pass a received frame to the exchange in progress.
+ *
+ * @return (bool) Whether the frame was the one awaited.
  */
-bool checkReceivedFrame(uint8_t initiator_idx, uint8_t initiator_id,
-                        uint8_t target_idx, uint8_t target_id,
-                        uint8_t msg_type){
-    uint32 frame_len;
-    bool bool_type, bool_initiator, bool_target;
-    
-    // Re-enable RX
-    dwt_rxenable(DWT_START_RX_IMMEDIATE);
+static bool twrReceiveFrame(const UwbMsg *msg_ptr){
+    uint8_t me = BOARD_ID();
+
+    switch (twr.state){
+        case TWR_INIT_WAIT_RESP:{
+            if (!isFrame(msg_ptr, 0xB, twr.neighbour_id, me)){
+                return false;
+            }
+            /* Time-stamps, received signal power and skew of Signal 2 */
+            twr.range.tx1 = get_tx_timestamp_u64();
+            twr.range.rx2 = msg_ptr->ts;
+            twr.range.fpp2 = msg_ptr->fpp;
+            twr.range.skew2 = msg_ptr->skew;
+
+            twrRxEnable();
+            twrWait(TWR_INIT_WAIT_FINAL);
+            return true;
+        }
+        case TWR_INIT_WAIT_FINAL:{
+            if (!isFrame(msg_ptr, 0xC, twr.neighbour_id, me)){
+                return false;
+            }
+            twrInitiatorFinal(msg_ptr);
+            return true;
+        }
+        case TWR_BURST_WAIT_RESP:{
+            return twrBurstResponse(msg_ptr);
+        }
+        case TWR_RESP_WAIT_FINAL:{
+            if (twr.burst){
+                return twrBurstTargetFinal(msg_ptr);
+            }
+            if (!isFrame(msg_ptr, 0xC, twr.neighbour_id, me)){
+                return false;
+            }
+            twrTargetFinal(msg_ptr);
+            return true;
+        }
+        case TWR_PASSIVE_WAIT_RESP:{
+            if (!isFrame(msg_ptr, 0xB, twr.passive.target_id, twr.passive.initiator_id)){
+                return false;
+            }
+            /* Retrieve reception timestamp, received signal power and skew */
+            twr.passive.rx2 = msg_ptr->ts;
+            twr.passive.fpp2 = msg_ptr->fpp;
+            twr.passive.skew2 = msg_ptr->skew;
+
+            twrRxEnable();
+            twrWait(TWR_PASSIVE_WAIT_FINAL);
+            return true;
+        }
+        case TWR_PASSIVE_WAIT_FINAL:{
+            if (!isFrame(msg_ptr, 0xC, twr.passive.target_id, twr.passive.initiator_id)){
+                return false;
+            }
+            twrPassiveFinal(msg_ptr);
+            return true;
+        }
+        case TWR_PASSIVE_WAIT_TARG_FINAL:{
+            if (!isFrame(msg_ptr, 0xC, twr.passive.initiator_id, twr.passive.target_id)){
+                return false;
+            }
+            twrPassiveTargFinal(msg_ptr);
+            return true;
+        }
+        default:{
+            return false;
+        }
+    }
+}
 
-    /* Poll for reception of expected frame or error/timeout. */
-    while (!((status_reg = dwt_read32bitreg(SYS_STATUS_ID)) & (SYS_STATUS_RXFCG | SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR)))
-    { };
+/*! ----------------------------------------------------------------------------
+ * Function: twrHandleEvent()
+ *
+ * @brief Advance the state machine with one event from the queue.
+ */
+static void twrHandleEvent(const UwbMsg *msg_ptr){
+    uint8_t msg_type;
 
-    if (status_reg & SYS_STATUS_RXFCG)
+    switch (msg_ptr->event)
     {
-        /* Clear good RX frame event and TX frame sent in the DW1000 status register. */
-        dwt_write32bitreg(SYS_STATUS_ID, SYS_STATUS_RXFCG | SYS_STATUS_TXFRS);
-
-        /* A frame has been received, read it into the local buffer. */
-        frame_len = dwt_read32bitreg(RX_FINFO_ID) & RX_FINFO_RXFLEN_MASK;
-        if (frame_len <= MAX_FRAME_LEN)
-        {
-            dwt_readrxdata(rx_buffer, frame_len, 0);
+        case UWB_EVT_INITIATE:{
+            if (msg_ptr->req.scheduled){
+                /* The receiver must stay on until the previous slot is over,
+                   in case this board is its target. */
+                if (!twr.has_pending){
+                    twr.pending = msg_ptr->req;
+                    twr.pending_time = twrSlotTime(&msg_ptr->req.timing);
+                    twr.has_pending = true;
+                }
+            }
+            else if (twr.state == TWR_IDLE){
+                twrStartInitiator(&msg_ptr->req);
+            }
+            else{
+                /* Busy with another exchange */
+                twrPostResult(msg_ptr->req.seq, 0);
+            }
+            break;
         }
-    
-        /* Check that the frame is the expected response. */
-        bool_type = rx_buffer[ALL_MSG_TYPE_IDX] == msg_type;
-        bool_initiator = rx_buffer[initiator_idx] == initiator_id;
-        bool_target = rx_buffer[target_idx] == target_id;
-        if (bool_type && bool_initiator && bool_target){
-            return 1;
+        case UWB_EVT_BURST:{
+            if (twr.state == TWR_IDLE){
+                twrStartBurst(&msg_ptr->req);
+            }
+            else{
+                twrPostResult(msg_ptr->req.seq, 0);
+            }
+            break;
         }
-        else{
-            return 0;
+        case UWB_EVT_TX_DONE:{
+            if (twr.state == TWR_RESP_WAIT_RESP_TX){
+                twr.range.tx2 = msg_ptr->ts;
+                twrTargetSendFinal(msg_ptr->ts, 0);
+            }
+            else if (twr.state == TWR_WAIT_FINAL_TX){
+                if (twr.is_initiator && twr.get_cir){
+                    read_cir(BOARD_ID(), twr.neighbour_id);
+                }
+                twrFinish(1);
+            }
+            break;
+        }
+        case UWB_EVT_RX_TIMEOUT:
+        case UWB_EVT_RX_ERROR:{
+            /* The driver has already reset the receiver. Keep listening until
+               the exchange times out. */
+            if (twrListening()){
+                twrRxEnable();
+            }
+            break;
+        }
+        case UWB_EVT_RX_OK:{
+            /* Too short to be one of our frames. The mail block is not
+               cleared, so nothing past len may be read. */
+            if (msg_ptr->len < ALL_MSG_COMMON_LEN){
+                if (twrListening()){
+                    twrRxEnable();
+                }
+                break;
+            }
+            msg_type = msg_ptr->msg[ALL_MSG_TYPE_IDX];
+
+            /* Scheduled polls keep the TDMA task aligned on the other boards */
+            if (msg_type == 0xA && msg_ptr->len >= sizeof(tx_poll_msg)
+                && msg_ptr->msg[TX_POLL_SLOT_IDX] != TDMA_NO_SLOT){
+                tdmaPollTimestamp(msg_ptr->msg[ALL_TX_BOARD_IDX], msg_ptr->msg[TX_POLL_SLOT_IDX],
+                                  (uint32)(msg_ptr->ts >> 8), osKernelSysTick());
+            }
+
+            if (msg_type == 0xD){
+                dataReceiveCallback((uint8_t*)msg_ptr->msg, msg_ptr->len);
+            }
+            else if (twr.state != TWR_IDLE){
+                if (twrReceiveFrame(msg_ptr)){
+                    if (twr.trace_wait){
+                        traceRecord(TRACE_RESPONSE_WAIT, twr.trace_start, msg_ptr->posted);
+                        twr.trace_wait = false;
+                    }
+                    break;
+                }
+            }
+            else if (msg_type == 0xA && msg_ptr->len >= ALL_MSG_COMMON_LEN + 3){
+                // If the intended target does not match the ID, passively listen on all signals.
+                if (msg_ptr->msg[ALL_RX_BOARD_IDX] == BOARD_ID()){
+                    twrStartTarget(msg_ptr);
+                }
+                else if (passive_listening){
+                    twrStartPassive(msg_ptr);
+                }
+                break;
+            }
+            else if (msg_type == 0xE && msg_ptr->len > BURST_POLL_NUM_IDX){
+                /* Bursts are not followed by passive listeners */
+                if (twrStartBurstTarget(msg_ptr)){
+                    break;
+                }
+            }
+            else if (msg_type == 0xF
+                     || ((msg_type == 0xB || msg_type == 0xC)
+                         && msg_ptr->msg[ALL_RX_BOARD_IDX] != BOARD_ID())){
+                /* Overheard frames of an exchange this board took no part in */
+            }
+            else if (msg_type == 0xB){
+                usb_print("WARNING 0xB: TWR message is firing an interrupt when it shouldn't be.\r\n");
+            }
+            else if (msg_type == 0xC){
+                usb_print("WARNING 0xC: TWR message is firing an interrupt when it shouldn't be.\r\n");
+            }
+            else{
+                usb_print("Unrecognized UWB message type received.");
+            }
+
+            /* Not the awaited frame, keep listening */
+            if (twrListening()){
+                twrRxEnable();
+            }
+            break;
+        }
+        default:{
+            break;
         }
     }
-    else{
-        return 0;
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: txTimestampsSS()
+ *
+ * @brief Send a final message of SS-TWR with the time-stamps of this board.
+ *
+ * @param ts1 (uint64) Signal 1 time-stamp, tx1 at the initiator, rx1 at the
+ * target.
+ * @param ts2 (uint64) rx2 at the initiator, ignored for a delayed message.
+ * @param mode (uint8_t) dwt_starttx() mode.
+ * @param delay (uint32) Delay of a delayed message from ts1, in UUS.
+ *
+ * @return (int) 1 if the transmission was started.
+ */
+int txTimestampsSS(uint64 ts1, uint64 ts2,
+                   float fpp, float skew,
+                   uint8_t mode, uint32 delay){
+    if (mode & DWT_START_TX_DELAYED){
+        uint32 final_tx_time;
+
+        /* Compute final message transmission time. See NOTE 10 below. */
+        final_tx_time = (ts1 + ((uint64)delay * UUS_TO_DWT_TIME)) >> 8;
+
+        dwt_setdelayedtrxtime(final_tx_time);
+
+        /* Final TX timestamp is the transmission time we programmed plus the TX antenna delay. */
+        ts2 = (((uint64)(final_tx_time & 0xFFFFFFFEUL)) << 8) + txAntennaDelay();
     }
+
+    /* Write all timestamps in the final message.*/
+    final_msg_set_ts(&tx_final_msg[FINAL_SIGNAL1_TS_IDX], ts1); // tx1 or rx1
+    final_msg_set_ts(&tx_final_msg[FINAL_SIGNAL2_TS_IDX], ts2); // rx2 or tx2
+
+    memcpy(&tx_final_msg[FINAL_FPP_IDX], &fpp, sizeof(float));
+    memcpy(&tx_final_msg[FINAL_SKEW_IDX], &skew, sizeof(float));
+
+    /* Write and send final message. See NOTE 8 below. */
+    tx_final_msg[ALL_MSG_SEQ_IDX] = frame_seq_nb;
+    dwt_writetxdata(sizeof(tx_final_msg), tx_final_msg, 0); /* Zero offset in TX buffer. */
+    dwt_writetxfctrl(sizeof(tx_final_msg), 0, 1); /* Zero offset in TX buffer, ranging. */
+
+    /* If dwt_starttx() returns an error, abandon this ranging exchange and proceed to the next one. See NOTE 12 below. */
+    twrRxStop();
+    if (dwt_starttx(mode) == DWT_SUCCESS)
+    {
+        /* Increment frame sequence number after transmission of the final message (modulo 256). */
+        frame_seq_nb++;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: txTimestampsDS()
+ *
+ * @brief Send a final message of DS-TWR with the time-stamps of this board.
+ *
+ * @param ts1 (uint64) tx1 at the initiator, rx1 at the target.
+ * @param ts2 (uint64) rx2 at the initiator, tx2 at the target. A delayed final
+ * message is scheduled the second-response delay after it.
+ * @param ts3 (uint64) rx3 at the initiator, ignored for a delayed message.
+ * @param mode (uint8_t) dwt_starttx() mode.
+ *
+ * @return (int) 1 if the transmission was started.
+ */
+int txTimestampsDS(uint64 ts1, uint64 ts2, uint64 ts3,
+                   float fpp, float skew,
+                   uint8_t mode){
+    if (mode & DWT_START_TX_DELAYED){
+        uint32 final_tx_time;
+
+        /* Compute final message transmission time. See NOTE 10 below. */
+        final_tx_time = (ts2 + ((uint64)tx3_delay * UUS_TO_DWT_TIME)) >> 8;
+
+        dwt_setdelayedtrxtime(final_tx_time);
+
+        /* Final TX timestamp is the transmission time we programmed plus the TX antenna delay. */
+        ts3 = (((uint64)(final_tx_time & 0xFFFFFFFEUL)) << 8) + txAntennaDelay();
+    }
+
+    /* Write all timestamps in the final message.*/
+    final_msg_set_ts(&tx_final_msg[FINAL_SIGNAL1_TS_IDX], ts1); // tx1 or rx1
+    final_msg_set_ts(&tx_final_msg[FINAL_SIGNAL2_TS_IDX], ts2); // rx2 or tx2
+    final_msg_set_ts(&tx_final_msg[FINAL_SIGNAL3_TS_IDX], ts3); // rx3 or tx3
+
+    memcpy(&tx_final_msg[FINAL_FPP_IDX], &fpp, sizeof(float));
+    memcpy(&tx_final_msg[FINAL_SKEW_IDX], &skew, sizeof(float));
+
+    /* Write and send final message. See NOTE 8 below. */
+    tx_final_msg[ALL_MSG_SEQ_IDX] = frame_seq_nb;
+    dwt_writetxdata(sizeof(tx_final_msg), tx_final_msg, 0); /* Zero offset in TX buffer. */
+    dwt_writetxfctrl(sizeof(tx_final_msg), 0, 1); /* Zero offset in TX buffer, ranging. */
+
+    /* If dwt_starttx() returns an error, abandon this ranging exchange and proceed to the next one. See NOTE 12 below. */
+    twrRxStop();
+    if (dwt_starttx(mode) == DWT_SUCCESS)
+    {
+        /* Increment frame sequence number after transmission of the final message (modulo 256). */
+        frame_seq_nb++;
+
+        return 1;
+    }
+
+    return 0;
 }
 
 /*! ----------------------------------------------------------------------------
  * Function: setPassiveToggle()
- * 
+ *
  * @brief This function sets the passive toggle.
- * 
+ *
  * @param toggle (bool) 1 if passive toggle is to be turned on, 0 otherwise.
  */
 void setPassiveToggle(bool toggle){
     passive_listening = toggle;
+    uwbRxConfigUpdate();
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: setPassiveOutput()
+ *
+ * @brief This function sets what the passive listeners output.
+ *
+ * @param mode (uint8_t) PASSIVE_OUTPUT_RAW or PASSIVE_OUTPUT_TDOA.
+ */
+void setPassiveOutput(uint8_t mode){
+    passive_output = mode;
 }
 
 /*! ----------------------------------------------------------------------------
  * Function: setResponseDelay()
- * 
+ *
  * @brief This function sets the tx3 response delay.
- * 
- * @param delay (uint16) the delay in microseconds between tx2 and tx3.
+ *
+ * @param delay (uint32) the delay in microseconds between tx2 and tx3, at
+ * most MAX_RESPONSE_DELAY_UUS.
  */
-void setResponseDelay(uint16 delay){
+void setResponseDelay(uint32 delay){
     tx3_delay = delay;
 }
 
+/*! ----------------------------------------------------------------------------
+ * Function: uwbRxStats()
+ *
+ * @brief Copy the counters of the RX path.
+ */
+void uwbRxStats(UwbRxStats *stats){
+    stats->frames = rx_stats.frames;
+    stats->dropped = rx_stats.dropped;
+    stats->events_dropped = rx_stats.events_dropped;
+    stats->oversized = rx_stats.oversized;
+    stats->overruns = rx_stats.overruns;
+    stats->buffer_frames[0] = rx_stats.buffer_frames[0];
+    stats->buffer_frames[1] = rx_stats.buffer_frames[1];
+    stats->back_to_back = rx_stats.back_to_back;
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: uwbMailQId()
+ *
+ * @brief Queue of the events of the UWB task, for its statistics.
+ */
+osMailQId uwbMailQId(void){
+    return UwbMsgBox;
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: setRxBuffering()
+ *
+ * @brief This function sets how frames are received. With RX_BUFFER_DOUBLE,
+ * the DW1000 re-enables its receiver into its second buffer as soon as a frame
+ * is received, so frames following each other closely, such as a poll and its
+ * response overheard by a passive listener, are not lost while the first one
+ * is read. The carrier integrator is not double buffered: the skew of a frame
+ * is only right if it is read before the next frame comes in, which the
+ * interrupt does unless both buffers are in use.
+ *
+ * @param mode (uint8_t) RX_BUFFER_SINGLE or RX_BUFFER_DOUBLE.
+ */
+void setRxBuffering(uint8_t mode){
+    rx_buffering = mode;
+    uwbRxConfigUpdate();
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: setRadioProfile()
+ *
+ * @brief This function switches the radio configuration of the board, with
+ * the reply delays, timeouts and bias constants that go with it. The switch
+ * happens once the current exchange is over. Boards on different profiles do
+ * not hear each other. The second-response delay is reset to the default of
+ * the profile, and can be set again with setResponseDelay() afterwards.
+ *
+ * @param id (uint8_t) RADIO_PROFILE_, below NUM_RADIO_PROFILES.
+ */
+void setRadioProfile(uint8_t id){
+    tx3_delay = radioProfileById(id)->ds_reply_uus;
+    radio_profile_req = id;
+    uwbRxConfigUpdate();
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: setAntennaDelay()
+ *
+ * @brief Set the antenna delays of this board for a radio profile. If it is
+ * the profile in use, they are given to the DW1000 once the current exchange
+ * is over.
+ *
+ * @param profile (uint8_t) RADIO_PROFILE_, below NUM_RADIO_PROFILES.
+ * @param tx (uint16_t) TX antenna delay, in DW1000 time units.
+ * @param rx (uint16_t) RX antenna delay, in DW1000 time units.
+ */
+void setAntennaDelay(uint8_t profile, uint16_t tx, uint16_t rx){
+    antennaDelaySet(profile, tx, rx);
+    antenna_delay_req = true;
+    uwbRxConfigUpdate();
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: uwbRxConfigUpdate()
+ *
+ * @brief Wake the UWB task up to change the frame filtering, the receive
+ * buffering, the radio profile or the antenna delays, once the current
+ * exchange is over. Called whenever the passive listening, the TDMA schedule,
+ * the buffering mode, the profile or the antenna delays change.
+ */
+void uwbRxConfigUpdate(void){
+    postEvent(UWB_EVT_RX_CONFIG, 0);
+}
+
+/* DW1000 CALL-BACKS -------------------------------------------------------- */
+/*! ----------------------------------------------------------------------------
+ * @fn postEvent()
+ *
+ * @brief Post an event without frame data to the UWB task. Called from the
+ * DW1000 interrupt, and by uwbRxConfigUpdate(). The event is dropped if the
+ * queue is full.
+ */
+static void postEvent(uint8_t event, uint64 ts)
+{
+    UwbMsg *msg_ptr = osMailAlloc(UwbMsgBox, 0);
+    if (msg_ptr == NULL)
+    {
+        rx_stats.events_dropped++;
+        return;
+    }
+    msg_ptr->event = event;
+    msg_ptr->len = 0;
+    msg_ptr->ts = ts;
+    msg_ptr->posted = traceCycles();
+    osMailPut(UwbMsgBox, msg_ptr);
+}
+
+/*! ----------------------------------------------------------------------------
+ * @fn uwb_isr()
+ *
+ * @brief DW1000 interrupt handler. With double buffering, the driver hands
+ * the buffer just read back to the DW1000 after rx_ok_cb(). If a frame was
+ * already waiting in the other one, its events show up at once, and the
+ * interrupt line stays asserted until it is read as well.
+ */
+static void uwb_isr(void)
+{
+    uint32_t start = traceCycles();
+
+    rx_frame_read = false;
+    dwt_isr();
+
+    if (rx_frame_read
+        && (dwt_read16bitoffsetreg(SYS_STATUS_ID, 0) & SYS_STATUS_RXFCG))
+    {
+        rx_stats.back_to_back++;
+    }
+    traceEnd(TRACE_ISR, start);
+}
+
 /*! ----------------------------------------------------------------------------
  * @fn rx_ok_cb()
  *
- * @brief Callback to process RX good frame events
+ * @brief Callback to process RX good frame events. The frame is read once,
+ * straight into a block of the UWB task's queue, along with its time-stamp,
+ * power and skew, as the receiver may be re-enabled before the task gets to
+ * it. The block then belongs to the task, which frees it.
  *
  * @param  cb_data  callback data
  *
@@ -1222,34 +1994,84 @@ void setResponseDelay(uint16 delay){
  */
 static void rx_ok_cb(const dwt_cb_data_t *cb_data)
 {
-    
-    /* Clear local RX buffer to avoid having leftovers from previous receptions. 
-    This is not necessary but is included here to aid reading the RX
-    buffer. */  
-    int i;
-    for (i = 0 ; i < MAX_FRAME_LEN; i++ )
+    UwbMsg *msg_ptr;
+    uint32_t start, power, skew;
+
+    if (cb_data->status & SYS_STATUS_RXOVRR)
     {
-        rx_buffer[i] = 0;
+        rx_stats.overruns++;
     }
 
-    /* A frame has been received, copy it to our local buffer. */
-    if (cb_data->datalength <= MAX_FRAME_LEN)
+    if (rx_double_buffered)
     {
-        // Load data directly into a static buffer.
-        dwt_readrxdata(rx_buffer, cb_data->datalength, 0);
+        rx_stats.buffer_frames[(cb_data->status & SYS_STATUS_HSRBP) ? 1 : 0]++;
+        rx_frame_read = true;
+    }
 
-        // Allocate memory for message struct 
-        UwbMsg *msg_ptr;
-        msg_ptr = osMailCAlloc(UwbMsgBox, 0);   // Allocate memory for the Mail
+    if (cb_data->datalength > MAX_FRAME_LEN)
+    {
+        rx_stats.oversized++;
+        postEvent(UWB_EVT_RX_ERROR, 0);
+        return;
+    }
 
-        // Load data into the message 
-        msg_ptr->len = cb_data->datalength;
-        dwt_readrxdata(msg_ptr->msg, cb_data->datalength, 0);
+    /* Not cleared: every field the task reads is written below */
+    msg_ptr = osMailAlloc(UwbMsgBox, 0);
+    if (msg_ptr == NULL)
+    {
+        rx_stats.dropped++;
+        return;
+    }
 
-        // Send message to the queue
-        osMailPut(UwbMsgBox, msg_ptr);
+    // Load data into the message
+    msg_ptr->event = UWB_EVT_RX_OK;
+    msg_ptr->len = cb_data->datalength;
+    start = traceCycles();
+    dwt_readrxdata(msg_ptr->msg, cb_data->datalength, 0);
+    msg_ptr->ts = get_rx_timestamp_u64();
+    power = traceCycles();
+    traceRecord(TRACE_RX_READ, start, power);
+    retrievePower(&msg_ptr->fpp);
+    skew = traceCycles();
+    traceRecord(TRACE_RX_POWER, power, skew);
+    retrieveSkew(&msg_ptr->skew);
+    msg_ptr->posted = traceCycles();
+    traceRecord(TRACE_RX_SKEW, skew, msg_ptr->posted);
+
+    // Send message to the queue
+    osMailPut(UwbMsgBox, msg_ptr);
+    rx_stats.frames++;
+}
 
-        //CDC_Transmit_FS(rx_buffer, cb_data->datalength); // for debugging
-    }
+/*! ----------------------------------------------------------------------------
+ * @fn tx_done_cb()
+ *
+ * @brief Callback to process TX confirmation events
+ */
+static void tx_done_cb(const dwt_cb_data_t *cb_data)
+{
+    (void)cb_data;
+    postEvent(UWB_EVT_TX_DONE, get_tx_timestamp_u64());
 }
 
+/*! ----------------------------------------------------------------------------
+ * @fn rx_to_cb()
+ *
+ * @brief Callback to process RX timeout events
+ */
+static void rx_to_cb(const dwt_cb_data_t *cb_data)
+{
+    (void)cb_data;
+    postEvent(UWB_EVT_RX_TIMEOUT, 0);
+}
+
+/*! ----------------------------------------------------------------------------
+ * @fn rx_err_cb()
+ *
+ * @brief Callback to process RX error events
+ */
+static void rx_err_cb(const dwt_cb_data_t *cb_data)
+{
+    (void)cb_data;
+    postEvent(UWB_EVT_RX_ERROR, 0);
+}
@@ -0,0 +1,180 @@
+/**
+  ******************************************************************************
+  * @file    ranging_math.c
+  * @brief   Time-of-flight kernels of the TWR exchanges.
+  *
+  *          The Cortex-M4F only has a single-precision FPU, so double
+  *          arithmetic is emulated in software. The kernels below work on the
+  *          40-bit time-stamp differences with 64-bit integer arithmetic,
+  *          and only use single precision for small correction terms and for
+  *          the final conversion to metres.
+  *
+  *          All durations are in DW1000 time units, taken with tsDiff() so
+  *          that they stay correct across the wrap-around of the clock, and
+  *          may be up to half of it, 8.6 s, long. "Ra" durations are
+  *          round trips and "Db" durations reply times. "Rp" durations are
+  *          measured by a passive listener between two frames it overheard.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "ranging_math.h"
+
+/* Defines -------------------------------------------------------------------*/
+/* Metres per fixed-point time unit, DWT_TIME_UNITS*SPEED_OF_LIGHT/2^6. */
+#define TOF_TO_METRES (7.3286826e-5f)
+
+/* Private functions ---------------------------------------------------------*/
+/*! ----------------------------------------------------------------------------
+ * Function: divRound()
+ *
+ * @brief Signed 64-bit division, rounded to the nearest integer.
+ */
+static int64_t divRound(int64_t num, int64_t den){
+    if ((num < 0) != (den < 0)){
+        return (num - den/2)/den;
+    }
+    return (num + den/2)/den;
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: crossDiff()
+ *
+ * @brief Ra1*Db2 - Ra2*Db1. Both products may take up to 80 bits, but their
+ * difference is about the time of flight times the reply time, so it is
+ * taken modulo 2^64 before going signed. This holds for reply times up to
+ * the 40-bit wrap-around and ranges of a few hundred metres.
+ */
+static int64_t crossDiff(uint64_t Ra1, uint64_t Ra2, uint64_t Db1, uint64_t Db2){
+    return (int64_t)((uint64_t)Ra1*Db2 - (uint64_t)Ra2*Db1);
+}
+
+/* Public functions ----------------------------------------------------------*/
+/*! ----------------------------------------------------------------------------
+ * Function: tsDiff()
+ *
+ * @brief Duration between two 40-bit time-stamps, later - earlier, modulo the
+ * wrap-around of the DW1000 clock.
+ */
+uint64_t tsDiff(uint64_t later, uint64_t earlier){
+    return (later - earlier) & DWT_TS_MASK;
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: tofSS()
+ *
+ * @brief Standard single-sided TWR, (Ra - Db)/2, with Ra = rx2 - tx1 measured
+ * by the initiator and Db = tx2 - rx1 by the target.
+ *
+ * @return (int32_t) Time of flight, TOF_FRAC_BITS fixed point.
+ */
+int32_t tofSS(uint64_t Ra, uint64_t Db){
+    return (int32_t)(((int64_t)Ra - Db)*(1 << TOF_FRAC_BITS)/2);
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: tofSSSkew()
+ *
+ * @brief Single-sided TWR with the reply time converted to the clock of the
+ * initiator, (Ra - Db*(1 + skew))/2.
+ *
+ * @param skew (float) Clock offset of the target relative to the initiator,
+ * in ppm, as measured by the initiator on the response (see retrieveSkew()).
+ *
+ * @return (int32_t) Time of flight, TOF_FRAC_BITS fixed point.
+ */
+int32_t tofSSSkew(uint64_t Ra, uint64_t Db, float skew){
+    /* Exact for millisecond reply times. For longer ones, the rounding of
+       single precision stays far below the error of the skew itself */
+    float corr = (float)Db * skew * (1e-6f * (1 << TOF_FRAC_BITS));
+    int64_t diff = ((int64_t)Ra - Db)*(1 << TOF_FRAC_BITS);
+
+    return (int32_t)((diff - (int64_t)(corr + (corr < 0 ? -0.5f : 0.5f)))/2);
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: tofDS()
+ *
+ * @brief Reversed alternative double-sided TWR, (Ra1 - Db1*Ra2/Db2)/2, for the
+ * exchanges of this firmware, where the target sends both responses. Ra1 =
+ * rx2 - tx1 and Ra2 = rx3 - rx2 are measured by the initiator, Db1 = tx2 -
+ * rx1 and Db2 = tx3 - tx2 by the target. Ra2/Db2 converts Db1 to the clock
+ * of the initiator.
+ *
+ * @return (int32_t) Time of flight, TOF_FRAC_BITS fixed point.
+ */
+int32_t tofDS(uint64_t Ra1, uint64_t Ra2, uint64_t Db1, uint64_t Db2){
+    if (Db2 == 0){
+        return 0;
+    }
+    return (int32_t)divRound(crossDiff(Ra1, Ra2, Db1, Db2)*(1 << TOF_FRAC_BITS),
+                             2*(int64_t)Db2);
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: tofDSAsym()
+ *
+ * @brief Asymmetric double-sided TWR,
+ * (Ra1*Db2 - Ra2*Db1)/(Ra1 + Ra2 + Db1 + Db2), for the classic exchange
+ * where the initiator answers the response with a final message. Ra1 and Db2
+ * are the round trip and the reply time of the initiator, Db1 and Ra2 those
+ * of the target. Does not need equal reply times, and cancels the clock
+ * offsets to first order.
+ *
+ * @return (int32_t) Time of flight, TOF_FRAC_BITS fixed point.
+ */
+int32_t tofDSAsym(uint64_t Ra1, uint64_t Ra2, uint64_t Db1, uint64_t Db2){
+    int64_t den = (int64_t)Ra1 + Ra2 + Db1 + Db2;
+
+    if (den == 0){
+        return 0;
+    }
+    return (int32_t)divRound(crossDiff(Ra1, Ra2, Db1, Db2)*(1 << TOF_FRAC_BITS), den);
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: tdoaSS()
+ *
+ * @brief Pseudo-range of a single-sided exchange at a passive listener,
+ * Rp - Db*(1 + skew), with Rp = rx2 - rx1 between the poll and the response
+ * at the listener and Db = tx2 - rx1 the reply time of the target. This is
+ * tof(I,T) + tof(T,L) - tof(I,L) for initiator I, target T and listener L.
+ *
+ * @param skew (float) Clock offset of the target relative to the listener,
+ * in ppm, as measured by the listener on the response.
+ *
+ * @return (int32_t) Time difference, TOF_FRAC_BITS fixed point.
+ */
+int32_t tdoaSS(uint64_t Rp, uint64_t Db, float skew){
+    float corr = (float)Db * skew * (1e-6f * (1 << TOF_FRAC_BITS));
+    int64_t diff = ((int64_t)Rp - Db)*(1 << TOF_FRAC_BITS);
+
+    return (int32_t)(diff - (int64_t)(corr + (corr < 0 ? -0.5f : 0.5f)));
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: tdoaDS()
+ *
+ * @brief Pseudo-range of a double-sided exchange at a passive listener,
+ * Rp1 - Db1*Rp2/Db2, as tofDS() but without the halving. Rp1 = rx2 - rx1 and
+ * Rp2 = rx3 - rx2 are measured by the listener, Db1 = tx2 - rx1 and Db2 =
+ * tx3 - tx2 by the target.
+ *
+ * @return (int32_t) Time difference, TOF_FRAC_BITS fixed point.
+ */
+int32_t tdoaDS(uint64_t Rp1, uint64_t Rp2, uint64_t Db1, uint64_t Db2){
+    if (Db2 == 0){
+        return 0;
+    }
+    return (int32_t)divRound(crossDiff(Rp1, Rp2, Db1, Db2)*(1 << TOF_FRAC_BITS),
+                             (int64_t)Db2);
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: tofToDistance()
+ *
+ * @brief Convert a time of flight returned by the kernels above to metres.
+ */
+float tofToDistance(int32_t tof){
+    return (float)tof * TOF_TO_METRES;
+}
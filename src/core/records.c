@@ -0,0 +1,623 @@
+/**
+  ******************************************************************************
+  * @file    records.c
+  * @brief   This file provides code for outputting ranging results over USB,
+  *          either as the legacy pipe-delimited ASCII strings or as framed
+  *          binary records.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "records.h"
+#include "common.h"
+#include "trace.h"
+#include "cmsis_os.h"
+#include <stdio.h>
+#include <string.h>
+
+/* Largest payload we ever send. Sized for a windowed CIR record of complex
+taps, slightly longer than a full CIR record of magnitudes. */
+#define NUM_CIR_POINTS_MAX 1016
+#define RECORD_MAX_PAYLOAD_LEN (sizeof(CirWindowHeader) + 4*RECORD_CIR_MAX_IQ_TAPS)
+
+/* Digits of a 40-bit time-stamp, plus the string terminator. */
+#define TS_STR_LEN 14
+
+/* Number of CIR taps per ASCII USB transmission. */
+#define CIR_ASCII_CHUNK 50
+
+/* Output mode of the current session. ASCII by default, for compatibility 
+with existing host scripts. */
+static OutputMode output_mode = OUTPUT_ASCII;
+
+/* Sequence number of the binary frames, incremented after each frame. Allows
+the host to detect dropped records. */
+static uint8_t record_seq = 0;
+
+/* Records are sent by the UWB task and by the USB task (C18). The lock keeps
+the sequence number and the frame buffer to one frame at a time. */
+static osStaticMutexDef_t records_mutex_cb;
+osMutexStaticDef(records, &records_mutex_cb);
+static osMutexId records_mutex = NULL;
+
+/* Too large for the task stacks. */
+static uint8_t frame_buffer[RECORD_HEADER_LEN + RECORD_MAX_PAYLOAD_LEN + RECORD_CRC_LEN];
+
+/* Buffer for the ASCII CIR strings. */
+static char cir_buffer[CIR_ASCII_CHUNK*12 + 30];
+
+/* CRC-16/CCITT-FALSE lookup table (polynomial 0x1021). */
+static const uint16_t crc16_table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+    0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+    0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+    0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+    0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+    0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+    0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+    0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+    0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+    0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+    0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+    0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+    0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+    0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+    0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+    0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+    0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+    0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+    0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+    0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+    0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+    0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0,
+};
+
+/*! ----------------------------------------------------------------------------
+ * Function: tsToString()
+ *
+ * @brief Print a 40-bit time-stamp in decimal. The printf of newlib-nano has
+ * no 64-bit conversions, so it is split in two.
+ *
+ * @return (char*) buf, for use as a printf argument.
+ */
+static char *tsToString(char *buf, uint64_t ts){
+    uint32_t hi = (uint32_t)(ts / 1000000000);
+    uint32_t lo = (uint32_t)(ts % 1000000000);
+
+    if (hi > 0){
+        sprintf(buf, "%lu%09lu", hi, lo);
+    }
+    else{
+        sprintf(buf, "%lu", lo);
+    }
+    return buf;
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: packTs()
+ *
+ * @brief Copies the low RECORD_TS_LEN bytes of a time-stamp, little-endian,
+ * as the upper 3 bytes of a 40-bit time are always zero.
+ *
+ * @return (uint8_t*) The byte after the packed time-stamp.
+ */
+static uint8_t *packTs(uint8_t *buf, uint64_t ts){
+    for (int i=0; i<RECORD_TS_LEN; i++){
+        *buf++ = (uint8_t)(ts >> (8*i));
+    }
+    return buf;
+}
+
+static uint8_t *packFloat(uint8_t *buf, float value){
+    memcpy(buf, &value, 4);
+    return buf + 4;
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: packRange()
+ *
+ * @brief Writes the RECORD_RANGE_LEN bytes of the payload of a range record.
+ *
+ * @return (uint8_t*) The byte after the payload.
+ */
+static uint8_t *packRange(uint8_t *buf, const RangeRecord *rec){
+    *buf++ = rec->neighbour_id;
+    *buf++ = rec->flags;
+    buf = packFloat(buf, rec->distance);
+    buf = packTs(buf, rec->tx1);
+    buf = packTs(buf, rec->rx1);
+    buf = packTs(buf, rec->tx2);
+    buf = packTs(buf, rec->rx2);
+    buf = packTs(buf, rec->tx3);
+    buf = packTs(buf, rec->rx3);
+    buf = packFloat(buf, rec->fpp1);
+    buf = packFloat(buf, rec->fpp2);
+    buf = packFloat(buf, rec->skew1);
+    return packFloat(buf, rec->skew2);
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: packPassive()
+ *
+ * @brief Writes the RECORD_PASSIVE_LEN bytes of the payload of a passive
+ * record.
+ *
+ * @return (uint8_t*) The byte after the payload.
+ */
+static uint8_t *packPassive(uint8_t *buf, const PassiveRecord *rec){
+    *buf++ = rec->initiator_id;
+    *buf++ = rec->target_id;
+    *buf++ = rec->flags;
+    buf = packTs(buf, rec->rx1);
+    buf = packTs(buf, rec->rx2);
+    buf = packTs(buf, rec->rx3);
+    buf = packTs(buf, rec->tx1_n);
+    buf = packTs(buf, rec->rx1_n);
+    buf = packTs(buf, rec->tx2_n);
+    buf = packTs(buf, rec->rx2_n);
+    buf = packTs(buf, rec->tx3_n);
+    buf = packTs(buf, rec->rx3_n);
+    buf = packFloat(buf, rec->fpp1);
+    buf = packFloat(buf, rec->fpp2);
+    buf = packFloat(buf, rec->fpp3);
+    buf = packFloat(buf, rec->skew1);
+    buf = packFloat(buf, rec->skew2);
+    buf = packFloat(buf, rec->skew3);
+    buf = packFloat(buf, rec->fpp1_n);
+    buf = packFloat(buf, rec->fpp2_n);
+    buf = packFloat(buf, rec->skew1_n);
+    return packFloat(buf, rec->skew2_n);
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: recordsInit()
+ *
+ * @brief Creates the lock of sendRecord(). Called once, before the scheduler
+ * is started.
+ */
+void recordsInit(void){
+    if (records_mutex == NULL){
+        records_mutex = osMutexCreate(osMutex(records));
+    }
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: setOutputMode()
+ * 
+ * @brief Selects how ranging results are sent to the host for the rest of 
+ * the session.
+ * 
+ * @param mode (OutputMode) OUTPUT_ASCII or OUTPUT_BINARY.
+ */
+void setOutputMode(OutputMode mode){
+    output_mode = mode;
+}
+
+OutputMode getOutputMode(void){
+    return output_mode;
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: recordsCrc16()
+ * 
+ * @brief CRC-16/CCITT-FALSE (initial value 0xFFFF, no reflection, no final 
+ * XOR) of a byte array.
+ */
+uint16_t recordsCrc16(const uint8_t *data, uint16_t len){
+    uint16_t crc = 0xFFFF;
+    while (len--){
+        crc = (crc << 8) ^ crc16_table[((crc >> 8) ^ *data++) & 0xFF];
+    }
+    return crc;
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: sendRecord()
+ * 
+ * @brief Wraps a payload into a binary frame and sends it over USB. May be
+ * called from any task, not from an interrupt.
+ * 
+ * @param type (uint8_t) One of the RECORD_TYPE_ values.
+ * @param payload (void*) Pointer to the little-endian payload.
+ * @param len (uint16_t) Length of the payload, in bytes.
+ * 
+ * @return (int) 1 if the frame was handed to the USB driver.
+ */
+int sendRecord(uint8_t type, const void *payload, uint16_t len){
+    uint16_t crc;
+    int sent;
+
+    if (len > RECORD_MAX_PAYLOAD_LEN){
+        return 0;
+    }
+
+    osMutexWait(records_mutex, osWaitForever);
+    frame_buffer[0] = RECORD_SYNC_BYTE;
+    frame_buffer[1] = RECORD_VERSION;
+    frame_buffer[2] = type;
+    frame_buffer[3] = record_seq++;
+    memcpy(&frame_buffer[4], &len, 2);
+    memcpy(&frame_buffer[RECORD_HEADER_LEN], payload, len);
+
+    crc = recordsCrc16(&frame_buffer[1], RECORD_HEADER_LEN - 1 + len);
+    memcpy(&frame_buffer[RECORD_HEADER_LEN + len], &crc, RECORD_CRC_LEN);
+
+    sent = usb_write(frame_buffer, RECORD_HEADER_LEN + len + RECORD_CRC_LEN);
+    osMutexRelease(records_mutex);
+    return sent;
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: outputRangeRecord()
+ * 
+ * @brief Outputs the result of a TWR exchange. In ASCII mode, this is the 
+ * R05 (initiator) or S05 (target) string.
+ */
+void outputRangeRecord(const RangeRecord *rec){
+    if (output_mode == OUTPUT_BINARY){
+        uint8_t payload[RECORD_RANGE_LEN];
+
+        packRange(payload, rec);
+        sendRecord(RECORD_TYPE_RANGE, payload, RECORD_RANGE_LEN);
+        return;
+    }
+
+    uint32_t start = traceCycles();
+    char dist_str[10] = {0};
+    char fpp1_str[10] = {0};
+    char fpp2_str[10] = {0};
+    char skew1_str[10] = {0};
+    char skew2_str[10] = {0};
+    char ts_str[6][TS_STR_LEN];
+    char response[200];
+    char *prefix;
+
+    convert_float_to_string(dist_str, rec->distance);
+    convert_float_to_string(fpp1_str, rec->fpp1);
+    convert_float_to_string(fpp2_str, rec->fpp2);
+    convert_float_to_string(skew1_str, rec->skew1);
+    convert_float_to_string(skew2_str, rec->skew2);
+
+    if (rec->flags & RECORD_FLAG_INITIATOR){
+        prefix = "R05";
+    }
+    else{
+        prefix = "S05";
+    }
+
+    if (rec->flags & RECORD_FLAG_DS_TWR){
+        sprintf(response, "%s|%d|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s\r\n",
+                prefix,
+                rec->neighbour_id, dist_str,
+                tsToString(ts_str[0], rec->tx1), tsToString(ts_str[1], rec->rx1),
+                tsToString(ts_str[2], rec->tx2), tsToString(ts_str[3], rec->rx2),
+                tsToString(ts_str[4], rec->tx3), tsToString(ts_str[5], rec->rx3),
+                fpp1_str, fpp2_str,
+                skew1_str, skew2_str);
+    }
+    else{
+        sprintf(response, "%s|%d|%s|%s|%s|%s|%s|0|0|%s|%s|%s|%s\r\n",
+                prefix,
+                rec->neighbour_id, dist_str,
+                tsToString(ts_str[0], rec->tx1), tsToString(ts_str[1], rec->rx1),
+                tsToString(ts_str[2], rec->tx2), tsToString(ts_str[3], rec->rx2),
+                fpp1_str, fpp2_str,
+                skew1_str, skew2_str);
+    }
+    traceEnd(TRACE_RECORD_FORMAT, start);
+    usb_print(response);
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: outputPassiveRecord()
+ * 
+ * @brief Outputs the timestamps overheard by a passive listener. In ASCII 
+ * mode, this is the S01 string.
+ */
+void outputPassiveRecord(const PassiveRecord *rec){
+    if (output_mode == OUTPUT_BINARY){
+        uint8_t payload[RECORD_PASSIVE_LEN];
+
+        packPassive(payload, rec);
+        sendRecord(RECORD_TYPE_PASSIVE, payload, RECORD_PASSIVE_LEN);
+        return;
+    }
+
+    uint32_t start = traceCycles();
+    char output[300];
+
+    if (rec->flags & RECORD_FLAG_INCOMPLETE){
+        /* Still communicate the ranging tags' IDs for scheduling purposes. */
+        sprintf(output,"S01|%d|%d|0|0|0|0|0|0|0|0|0|0|0|0|0|0|0|0|0|0|0|0|0|0|0|0\r\n",
+                rec->initiator_id, rec->target_id);
+        usb_print(output);
+        return;
+    }
+
+    char fpp1_str[10] = {0};
+    char fpp2_str[10] = {0};
+    char fpp3_str[10] = {0};
+    char skew1_str[10] = {0};
+    char skew2_str[10] = {0};
+    char skew3_str[10] = {0};
+    char fpp1_n_str[10] = {0};
+    char fpp2_n_str[10] = {0};
+    char skew1_n_str[10] = {0};
+    char skew2_n_str[10] = {0};
+    char ts_str[9][TS_STR_LEN];
+
+    convert_float_to_string(fpp1_str, rec->fpp1);
+    convert_float_to_string(fpp2_str, rec->fpp2);
+    convert_float_to_string(skew1_str, rec->skew1);
+    convert_float_to_string(skew2_str, rec->skew2);
+    convert_float_to_string(fpp1_n_str, rec->fpp1_n);
+    convert_float_to_string(fpp2_n_str, rec->fpp2_n);
+    convert_float_to_string(skew1_n_str, rec->skew1_n);
+    convert_float_to_string(skew2_n_str, rec->skew2_n);
+
+    if (rec->flags & RECORD_FLAG_DS_TWR){
+        convert_float_to_string(fpp3_str, rec->fpp3);
+        convert_float_to_string(skew3_str, rec->skew3);
+
+        sprintf(output,"S01|%d|%d|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s|%s\r\n",
+                rec->initiator_id, rec->target_id,
+                tsToString(ts_str[0], rec->rx1), tsToString(ts_str[1], rec->rx2),
+                tsToString(ts_str[2], rec->rx3),
+                tsToString(ts_str[3], rec->tx1_n), tsToString(ts_str[4], rec->rx1_n),
+                tsToString(ts_str[5], rec->tx2_n), tsToString(ts_str[6], rec->rx2_n),
+                tsToString(ts_str[7], rec->tx3_n), tsToString(ts_str[8], rec->rx3_n),
+                fpp1_str, fpp2_str, fpp3_str,
+                skew1_str, skew2_str, skew3_str,
+                fpp1_n_str, fpp2_n_str,
+                skew1_n_str, skew2_n_str);
+    }
+    else{
+        sprintf(output,"S01|%d|%d|%s|%s|0|%s|%s|%s|%s|0|0|%s|%s|0|%s|%s|0|%s|%s|%s|%s\r\n",
+                rec->initiator_id, rec->target_id,
+                tsToString(ts_str[0], rec->rx1), tsToString(ts_str[1], rec->rx2),
+                tsToString(ts_str[3], rec->tx1_n), tsToString(ts_str[4], rec->rx1_n),
+                tsToString(ts_str[5], rec->tx2_n), tsToString(ts_str[6], rec->rx2_n),
+                fpp1_str, fpp2_str,
+                skew1_str, skew2_str,
+                fpp1_n_str, fpp2_n_str,
+                skew1_n_str, skew2_n_str);
+    }
+    traceEnd(TRACE_RECORD_FORMAT, start);
+    usb_print(output);
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: outputTdoaRecord()
+ *
+ * @brief Outputs the pseudo-range computed by a passive listener. In ASCII
+ * mode, this is the S14 string.
+ */
+void outputTdoaRecord(const TdoaRecord *rec){
+    if (output_mode == OUTPUT_BINARY){
+        sendRecord(RECORD_TYPE_TDOA, rec, sizeof(TdoaRecord));
+        return;
+    }
+
+    uint32_t start = traceCycles();
+    char output[80];
+
+    if (rec->flags & RECORD_FLAG_INCOMPLETE){
+        sprintf(output, "S14|%d|%d|0|0|0|0\r\n", rec->initiator_id, rec->target_id);
+        usb_print(output);
+        return;
+    }
+
+    char tdoa_str[10] = {0};
+    char range_str[10] = {0};
+    char fpp1_str[10] = {0};
+    char fpp2_str[10] = {0};
+
+    convert_float_to_string(tdoa_str, rec->tdoa);
+    convert_float_to_string(range_str, rec->range);
+    convert_float_to_string(fpp1_str, rec->fpp1);
+    convert_float_to_string(fpp2_str, rec->fpp2);
+
+    sprintf(output, "S14|%d|%d|%s|%s|%s|%s\r\n",
+            rec->initiator_id, rec->target_id,
+            tdoa_str, range_str, fpp1_str, fpp2_str);
+    traceEnd(TRACE_RECORD_FORMAT, start);
+    usb_print(output);
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: outputBurstRecord()
+ * 
+ * @brief Outputs the ranges of a multi-target burst at the initiator. In 
+ * ASCII mode, this is the R11 string: the number of ranges, followed by the
+ * R05 fields of each one, third signal excluded. In binary mode, the payload
+ * is the number of ranges followed by as many range records.
+ */
+void outputBurstRecord(const RangeRecord *recs, uint8_t count){
+    if (output_mode == OUTPUT_BINARY){
+        static uint8_t payload[1 + RECORD_BURST_MAX_RANGES*RECORD_RANGE_LEN];
+        uint8_t *ptr = &payload[1];
+
+        if (count > RECORD_BURST_MAX_RANGES){
+            count = RECORD_BURST_MAX_RANGES;
+        }
+        payload[0] = count;
+        for (int i=0; i<count; i++){
+            ptr = packRange(ptr, &recs[i]);
+        }
+        sendRecord(RECORD_TYPE_BURST, payload, 1 + count*RECORD_RANGE_LEN);
+        return;
+    }
+
+    static char output[20 + RECORD_BURST_MAX_RANGES*140];
+    uint32_t start = traceCycles();
+    char dist_str[10] = {0};
+    char fpp1_str[10] = {0};
+    char fpp2_str[10] = {0};
+    char skew1_str[10] = {0};
+    char skew2_str[10] = {0};
+    char ts_str[4][TS_STR_LEN];
+    char *ptr = output;
+
+    ptr += sprintf(ptr, "R11|%d", count);
+    for (int i=0; i<count && i<RECORD_BURST_MAX_RANGES; i++){
+        convert_float_to_string(dist_str, recs[i].distance);
+        convert_float_to_string(fpp1_str, recs[i].fpp1);
+        convert_float_to_string(fpp2_str, recs[i].fpp2);
+        convert_float_to_string(skew1_str, recs[i].skew1);
+        convert_float_to_string(skew2_str, recs[i].skew2);
+
+        ptr += sprintf(ptr, "|%d|%s|%s|%s|%s|%s|%s|%s|%s|%s",
+                       recs[i].neighbour_id, dist_str,
+                       tsToString(ts_str[0], recs[i].tx1), tsToString(ts_str[1], recs[i].rx1),
+                       tsToString(ts_str[2], recs[i].tx2), tsToString(ts_str[3], recs[i].rx2),
+                       fpp1_str, fpp2_str,
+                       skew1_str, skew2_str);
+    }
+    sprintf(ptr, "\r\n");
+    traceEnd(TRACE_RECORD_FORMAT, start);
+    usb_print(output);
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: outputCirRecord()
+ * 
+ * @brief Outputs the channel impulse response. In ASCII mode, this is the S10
+ * string, sent in chunks of CIR_ASCII_CHUNK taps so that the caller can do
+ * other work in between. In binary mode, the taps are sent at once as a single
+ * record of uint16 magnitudes.
+ * 
+ * @param first_path_idx (uint16_t) The raw first path index, 10.6 fixed point.
+ * @param from (uint16_t) First tap to output, 0 on the first call.
+ * 
+ * @return (uint16_t) The first tap of the next call, num_taps once done.
+ */
+uint16_t outputCirRecord(uint8_t initiator_id, uint8_t target_id,
+                         uint16_t first_path_idx,
+                         const uint32_t *taps, uint16_t num_taps,
+                         uint16_t from){
+    if (num_taps > NUM_CIR_POINTS_MAX){
+        num_taps = NUM_CIR_POINTS_MAX;
+    }
+
+    if (output_mode == OUTPUT_BINARY){
+        static uint8_t payload[RECORD_MAX_PAYLOAD_LEN];
+        CirRecordHeader header = {
+            .initiator_id = initiator_id,
+            .target_id = target_id,
+            .first_path_idx = first_path_idx,
+            .num_taps = num_taps,
+        };
+        uint16_t len = sizeof(CirRecordHeader);
+        uint16_t tap;
+
+        memcpy(payload, &header, sizeof(CirRecordHeader));
+        for (int i=0; i<num_taps; i++){
+            // Magnitudes never exceed 16 bits, see cir.c.
+            tap = (taps[i] > 0xFFFF) ? 0xFFFF : taps[i];
+            memcpy(&payload[len], &tap, 2);
+            len += 2;
+        }
+        sendRecord(RECORD_TYPE_CIR, payload, len);
+        return num_taps;
+    }
+
+    char* ptr = cir_buffer;
+    uint16_t to = from + CIR_ASCII_CHUNK;
+
+    if (to > num_taps){
+        to = num_taps;
+    }
+    if (from == 0){
+        ptr += sprintf(
+            ptr, "%s|%d|%d|%u|%u",
+            "S10", initiator_id, target_id, 
+            first_path_idx/64, (first_path_idx%64)*1000/64
+        );
+    }
+    for (int lv1=from; lv1<to; ++lv1){
+        ptr += sprintf(ptr, "|%lu", taps[lv1]);
+    }
+    if (to == num_taps){
+        sprintf(ptr, "\r\n");
+    }
+
+    usb_print(cir_buffer);
+    return to;
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: outputCirWindowRecord()
+ * 
+ * @brief Outputs the taps of the CIR around the first path. In ASCII mode,
+ * this is the S13 string: the IDs, the first path index, the index of the
+ * first tap and the IQ flag, followed by a magnitude or a real|imaginary pair
+ * per tap. It is sent in chunks, like the S10 string. In binary mode, the
+ * taps are sent at once as a single record.
+ * 
+ * @param taps (void*) num_taps uint16 magnitudes, or num_taps int16 (real,
+ * imaginary) pairs if header->flags has RECORD_CIR_FLAG_IQ.
+ * @param from (uint16_t) First tap to output, 0 on the first call.
+ * 
+ * @return (uint16_t) The first tap of the next call, num_taps once done.
+ */
+uint16_t outputCirWindowRecord(const CirWindowHeader *header,
+                               const void *taps, uint16_t from){
+    bool iq = (header->flags & RECORD_CIR_FLAG_IQ) != 0;
+    uint16_t num_taps = header->num_taps;
+
+    if (num_taps > (iq ? RECORD_CIR_MAX_IQ_TAPS : NUM_CIR_POINTS_MAX)){
+        num_taps = iq ? RECORD_CIR_MAX_IQ_TAPS : NUM_CIR_POINTS_MAX;
+    }
+
+    if (output_mode == OUTPUT_BINARY){
+        static uint8_t payload[RECORD_MAX_PAYLOAD_LEN];
+        uint16_t len = num_taps*(iq ? 4 : 2);
+
+        memcpy(payload, header, sizeof(CirWindowHeader));
+        ((CirWindowHeader*)payload)->num_taps = num_taps;
+        memcpy(&payload[sizeof(CirWindowHeader)], taps, len);
+        sendRecord(RECORD_TYPE_CIR_WINDOW, payload, sizeof(CirWindowHeader) + len);
+        return num_taps;
+    }
+
+    const uint16_t *mag = taps;
+    const int16_t *pair = taps;
+    char* ptr = cir_buffer;
+    uint16_t to = from + (iq ? CIR_ASCII_CHUNK/2 : CIR_ASCII_CHUNK);
+
+    if (to > num_taps){
+        to = num_taps;
+    }
+    if (from == 0){
+        ptr += sprintf(
+            ptr, "S13|%d|%d|%u|%u|%u|%d",
+            header->initiator_id, header->target_id,
+            header->first_path_idx/64, (header->first_path_idx%64)*1000/64,
+            header->first_tap, iq
+        );
+    }
+    for (int i=from; i<to; i++){
+        if (iq){
+            ptr += sprintf(ptr, "|%d|%d", pair[2*i], pair[2*i+1]);
+        }
+        else{
+            ptr += sprintf(ptr, "|%u", mag[i]);
+        }
+    }
+    if (to == num_taps){
+        sprintf(ptr, "\r\n");
+    }
+
+    usb_print(cir_buffer);
+    return to;
+}
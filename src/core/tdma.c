@@ -0,0 +1,316 @@
+/**
+  ******************************************************************************
+  * @file    tdma.c
+  * @brief   On-board TDMA scheduler. The task owns a table of TWR exchanges
+  *          shared by all boards, and initiates the ones of this board in
+  *          their slots without any involvement of the host.
+  *
+  *          The initiator of slot 0 is the time master: its frames are
+  *          aligned on its own polls. Every other board aligns its frames
+  *          on the polls it hears, which carry their slot index, and stays
+  *          silent until it has heard one. Polls are sent with the delayed
+  *          transmission of the DW1000, so slot boundaries are accurate to
+  *          the DW1000 clock rather than to the RTOS tick.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "tdma.h"
+#include "ranging.h"
+#include "cmsis_os.h"
+#include "rtos_static.h"
+#include <string.h>
+
+/* Defines -------------------------------------------------------------------*/
+#define UUS_TO_HI32 (UUS_TO_DWT_TIME >> 8)
+
+/* The frame must be much shorter than the wrap-around of the high 32 bits of
+ * the DW1000 clock, 17.2 s, for slot times to be unambiguous. */
+#define TDMA_MAX_FRAME_UUS (2000000)
+
+/* The request for a slot is posted to the UWB task this early, in ms. The
+ * DW1000 then holds the poll until the exact start of the slot. */
+#define TDMA_WAKE_MS (2)
+
+/* Frames without hearing the schedule after which a board stops transmitting,
+ * or the master restarts it. */
+#define TDMA_SYNC_FRAMES (3)
+
+/* Typedefs ------------------------------------------------------------------*/
+typedef enum {
+    TDMA_EVT_CONFIG, // New table from tdmaConfigure(), empty to stop.
+    TDMA_EVT_SYNC,   // Scheduled poll sent or heard by the UWB task.
+} TdmaEvent;
+
+typedef struct {
+    uint8_t event;
+    TdmaSlot slots[TDMA_MAX_SLOTS];  // TDMA_EVT_CONFIG only, as are the next two
+    uint8_t num_slots;
+    uint32_t slot_uus;
+    uint8_t initiator_id;            // TDMA_EVT_SYNC only, as are the next three
+    uint8_t slot;
+    uint32_t ts;                     // Poll time-stamp, high 32 bits
+    uint32_t tick;                   // Same instant, osKernelSysTick()
+} TdmaMsg;
+
+/* Private variables ---------------------------------------------------------*/
+osMailQStaticDef(TdmaBox, TDMA_QUEUE_SIZE, TdmaMsg);
+static osMailQId TdmaBox;
+
+/* Whether a schedule is running. Lets the UWB task skip posting time-stamps,
+ * and filter out the frames of other boards, otherwise. */
+static volatile bool tdma_active = false;
+
+/* Only accessed by the TDMA task. */
+static struct {
+    TdmaSlot slots[TDMA_MAX_SLOTS];
+    uint8_t num_slots;
+    uint32_t slot_uus;
+    uint32_t frame_uus;
+    bool master;
+    bool synced;
+    uint32_t frame_start;  // Start of a recent frame, DW1000 time
+    uint32_t frame_tick;   // Same instant, osKernelSysTick()
+    uint32_t sync_tick;    // Last time the schedule was heard
+    uint32_t last_wake;    // Wake-up of the last slot initiated
+} tdma;
+
+/* Private functions ---------------------------------------------------------*/
+/*! ----------------------------------------------------------------------------
+ * Function: tdmaConfig()
+ *
+ * @brief Install a new table. Frames are realigned from scratch.
+ */
+static void tdmaConfig(const TdmaMsg *msg){
+    memcpy(tdma.slots, msg->slots, msg->num_slots*sizeof(TdmaSlot));
+    tdma.num_slots = msg->num_slots;
+    tdma.slot_uus = msg->slot_uus;
+    tdma.frame_uus = msg->num_slots*msg->slot_uus;
+    tdma.master = (msg->num_slots > 0 && msg->slots[0].initiator == BOARD_ID());
+    tdma.synced = false;
+    tdma.last_wake = osKernelSysTick() - tdma.frame_uus/UUS_PER_MS - 1;
+    if (tdma_active != (msg->num_slots > 0)){
+        tdma_active = (msg->num_slots > 0);
+        uwbRxConfigUpdate();  // The polls of every board must be heard
+    }
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: tdmaSync()
+ *
+ * @brief Realign the frames on a scheduled poll. The master only follows its
+ * own polls, and the other boards only the polls of others, so that a board
+ * never keeps transmitting on its own once the master is gone.
+ */
+static void tdmaSync(const TdmaMsg *msg){
+    if (msg->slot >= tdma.num_slots
+        || tdma.slots[msg->slot].initiator != msg->initiator_id
+        || tdma.master != (msg->initiator_id == BOARD_ID())){
+        return;
+    }
+
+    tdma.frame_start = msg->ts - msg->slot*tdma.slot_uus*UUS_TO_HI32;
+    tdma.frame_tick = msg->tick - msg->slot*tdma.slot_uus/UUS_PER_MS;
+    tdma.sync_tick = msg->tick;
+    tdma.synced = true;
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: tdmaNextSlot()
+ *
+ * @brief Find the next slot of this board.
+ *
+ * @param wake (uint32_t*) Output, tick at which the slot must be requested.
+ *
+ * @return (int) Index of the slot, -1 if there is none.
+ */
+static int tdmaNextSlot(uint32_t now, uint32_t *wake){
+    uint64_t elapsed, start;
+    uint32_t slot_wake;
+    int next = -1;
+
+    /* Each slot is only requested once */
+    if ((int32_t)(now - tdma.last_wake) <= 0){
+        now = tdma.last_wake + 1;
+    }
+
+    /* Until the master has sent its first poll, there is no frame to align on */
+    if (!tdma.synced){
+        if (tdma.master){
+            *wake = tdma.last_wake + tdma.frame_uus/UUS_PER_MS + 1;
+            return 0;
+        }
+        return -1;
+    }
+
+    elapsed = (uint64_t)(now - tdma.frame_tick + TDMA_WAKE_MS)*UUS_PER_MS;
+    for (int i=0; i<tdma.num_slots; i++){
+        if (tdma.slots[i].initiator != BOARD_ID()){
+            continue;
+        }
+        start = (uint64_t)i*tdma.slot_uus;
+        if (start < elapsed){
+            start += ((elapsed - start + tdma.frame_uus - 1)/tdma.frame_uus)*tdma.frame_uus;
+        }
+        slot_wake = tdma.frame_tick + start/UUS_PER_MS - TDMA_WAKE_MS;
+        if (next < 0 || (int32_t)(slot_wake - *wake) < 0){
+            next = i;
+            *wake = slot_wake;
+        }
+    }
+    return next;
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: tdmaInitiate()
+ *
+ * @brief Hand a slot over to the UWB task, which sends its poll at the exact
+ * start of the slot.
+ */
+static void tdmaInitiate(uint8_t slot){
+    TdmaTiming timing = {
+        .slot = slot,
+        .ref_valid = tdma.synced,
+        .frame_start = tdma.frame_start,
+        .frame_len = tdma.frame_uus*UUS_TO_HI32,
+        .slot_len = tdma.slot_uus*UUS_TO_HI32,
+    };
+
+    twrScheduleInstance(&tdma.slots[slot], &timing);
+}
+
+/* Public functions ----------------------------------------------------------*/
+/**
+ * @brief Creates the queue of the TDMA task. Called once on startup, before
+ * the tasks are started.
+ */
+void tdma_init(void){
+    TdmaBox = osMailCreateStatic(osMailQ(TdmaBox), osMailQStatic(TdmaBox));
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: tdmaConfigure()
+ *
+ * @brief Replace the schedule of the TDMA task. All boards must be given the
+ * same table.
+ *
+ * @param slots (TdmaSlot*) The exchanges, in the order of their slots.
+ * @param num_slots (uint8_t) At most TDMA_MAX_SLOTS, 0 to stop.
+ * @param slot_uus (uint32_t) Length of every slot, in UUS.
+ *
+ * @return (int) 1 if the schedule was accepted.
+ */
+int tdmaConfigure(const TdmaSlot *slots, uint8_t num_slots, uint32_t slot_uus){
+    TdmaMsg *msg;
+
+    if (num_slots > TDMA_MAX_SLOTS){
+        return 0;
+    }
+    if (num_slots > 0 && (slot_uus < radioProfile()->min_slot_uus || slot_uus > TDMA_MAX_FRAME_UUS/num_slots)){
+        return 0;
+    }
+
+    msg = osMailCAlloc(TdmaBox, 0);
+    if (msg == NULL){
+        return 0;
+    }
+    msg->event = TDMA_EVT_CONFIG;
+    memcpy(msg->slots, slots, num_slots*sizeof(TdmaSlot));
+    msg->num_slots = num_slots;
+    msg->slot_uus = slot_uus;
+    osMailPut(TdmaBox, msg);
+    return 1;
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: tdmaPollTimestamp()
+ *
+ * @brief Report a scheduled poll sent or received by the UWB task.
+ *
+ * @param slot (uint8_t) Slot index carried by the poll.
+ * @param ts_hi32 (uint32_t) Time of the poll, high 32 bits of the DW1000 time.
+ * @param tick (uint32_t) Time of the poll, osKernelSysTick().
+ */
+void tdmaPollTimestamp(uint8_t initiator_id, uint8_t slot, uint32_t ts_hi32, uint32_t tick){
+    TdmaMsg *msg;
+
+    if (!tdma_active){
+        return;
+    }
+
+    msg = osMailAlloc(TdmaBox, 0);
+    if (msg == NULL){
+        return;
+    }
+    msg->event = TDMA_EVT_SYNC;
+    msg->initiator_id = initiator_id;
+    msg->slot = slot;
+    msg->ts = ts_hi32;
+    msg->tick = tick;
+    osMailPut(TdmaBox, msg);
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: tdmaActive()
+ *
+ * @brief Whether a schedule is running.
+ */
+bool tdmaActive(void){
+    return tdma_active;
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: tdmaMailQId()
+ *
+ * @brief Queue of the TDMA task, for its statistics.
+ */
+osMailQId tdmaMailQId(void){
+    return TdmaBox;
+}
+
+/**
+ * @brief Body of the TDMA task. Sleeps until the next slot of this board, or
+ * until a new table or time-stamp comes in.
+ */
+void tdmaTask(void const *argument){
+    osEvent evt;
+    TdmaMsg *msg;
+    uint32_t now, wake = 0, wait;
+    int slot;
+
+    while (1){
+        now = osKernelSysTick();
+        slot = -1;
+        wait = osWaitForever;
+
+        /* Lost the schedule */
+        if (tdma.synced && now - tdma.sync_tick > TDMA_SYNC_FRAMES*tdma.frame_uus/UUS_PER_MS){
+            tdma.synced = false;
+        }
+
+        if (tdma.num_slots > 0){
+            slot = tdmaNextSlot(now, &wake);
+            if (slot >= 0){
+                wait = ((int32_t)(wake - now) > 0) ? wake - now : 0;
+            }
+        }
+
+        evt = osMailGet(TdmaBox, wait);
+        if (evt.status == osEventMail){
+            msg = evt.value.p;
+            if (msg->event == TDMA_EVT_CONFIG){
+                tdmaConfig(msg);
+            }
+            else{
+                tdmaSync(msg);
+            }
+            osMailFree(TdmaBox, msg);
+            continue;
+        }
+
+        if (slot >= 0){
+            tdmaInitiate(slot);
+            tdma.last_wake = wake;
+        }
+    }
+}
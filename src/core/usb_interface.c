@@ -16,134 +16,179 @@
 #include "commands.h"
 #include "dwt_iqr.h"
 #include "cmsis_os.h"
+#include "rtos_static.h"
 #include "usb_device.h"
+#include <stddef.h>
 /* Typedefs ------------------------------------------------------------------*/
 typedef enum {INT=1, STR=2, BOOL=3, FLOAT=4, BYTES=5} FieldTypes;
 
+/* Where and how a field of a USB message is decoded into CommandParams. */
+typedef struct {
+    FieldTypes type;
+    uint16_t offset;  // offset of the destination in CommandParams
+    uint16_t size;    // size of the destination in bytes
+} FieldSchema;
+
+/* Outcome of parsing a message. */
+typedef enum {PARSE_OK=0, PARSE_INCOMPLETE=1, PARSE_ERROR=2} ParseStatus;
+
+/* Everything needed to decode and execute a command. */
+typedef struct {
+    const FieldSchema *fields;
+    uint8_t num_fields;
+    int (*func)(const CommandParams*);
+} CommandSchema;
+
+/* Defines -------------------------------------------------------------------*/
+#define FIELD(cmd, type, name) \
+    {type, offsetof(CommandParams, cmd.name), sizeof(((CommandParams*)0)->cmd.name)}
+
 /* Variables -----------------------------------------------------------------*/
-// VARIABLE FIELD NAMES MUST BE LESS THAN 10 CHARACTERS
 static int command_number = -1;
 static uint8_t retry_count = 0;
 
-static const char *c00_fields[1];             // No fields. Empty array of size 1
-static const FieldTypes c00_types[1];         // No fields. Empty array of size 1
-static const int c00_num_fields = 0;
-
-static const char *c01_fields[1];             // No fields. Empty array of size 1
-static const FieldTypes c01_types[1];         // No fields. Empty array of size 1
-static const int c01_num_fields = 0;
-
-static const char *c02_fields[1];             // No fields. Empty array of size 1
-static const FieldTypes c02_types[1];         // No fields. Empty array of size 1
-static const int c02_num_fields = 0;
-
-static const char *c03_fields[] = {"test_int", "test_str", "test_bool","test_flt", "test_byte"};          
-static const FieldTypes c03_types[] = {INT, STR, BOOL, FLOAT, BYTES};       
-static const int c03_num_fields = 5;
-
-static const char *c04_fields[] = {"toggle"}; 
-static const FieldTypes c04_types[] = {BOOL};
-static const int c04_num_fields = 1;
-
-static const char *c05_fields[] = {"target", "targ_meas", "ds_twr", "get_cir"}; 
-static const FieldTypes c05_types[] = {INT, BOOL, INT, BOOL};
-static const int c05_num_fields = 4;
-
-static const char *c06_fields[] = {"data"}; 
-static const FieldTypes c06_types[] = {BYTES};
-static const int c06_num_fields = 1;
-
-static const char *c07_fields[1];     // No fields. Empty array of size 1
-static const FieldTypes c07_types[1]; // No fields. Empty array of size 1
-static const int c07_num_fields = 0;
-
-static const char *c08_fields[] = {"delay"};
-static const FieldTypes c08_types[] = {INT};
-static const int c08_num_fields = 1;
-
-static const char *c09_fields[1];     // No fields. Empty array of size 1
-static const FieldTypes c09_types[1]; // No fields. Empty array of size 1
-static const int c09_num_fields = 0;
-
-// TODO: would be cleaner to use a struct to represent all the relevant info 
-// about a command.
-static const char **all_command_fields[] = {
-    c00_fields,
-    c01_fields,
-    c02_fields,
-    c03_fields,
-    c04_fields,
-    c05_fields,
-    c06_fields,
-    c07_fields,
-    c08_fields,
-    c09_fields,
+/* Decoded fields of the current command. Only valid while command_number is
+not -1, and only the member of the current command. */
+static CommandParams params;
+
+static const FieldSchema c03_fields[] = {
+    FIELD(c03, INT, test_int),
+    FIELD(c03, STR, test_str),
+    FIELD(c03, BOOL, test_bool),
+    FIELD(c03, FLOAT, test_flt),
+    FIELD(c03, BYTES, test_byte),
 };
 
-static const FieldTypes *all_command_types[] = {
-    c00_types,
-    c01_types,
-    c02_types,
-    c03_types,
-    c04_types,
-    c05_types,
-    c06_types,
-    c07_types,
-    c08_types,
-    c09_types,
+static const FieldSchema c04_fields[] = {
+    FIELD(c04, BOOL, toggle),
 };
 
-static const int (*all_command_funcs[])(IntParams *, FloatParams *, BoolParams *, StrParams *, ByteParams *) = {
-    c00_set_idle,
-    c01_get_id,
-    c02_reset,
-    c03_do_tests,
-    c04_toggle_passive,
-    c05_initiate_twr,
-    c06_broadcast,
-    c07_get_max_frame_len,
-    c08_set_response_delay,
-    c09_jump_to_bootloader,
+static const FieldSchema c05_fields[] = {
+    FIELD(c05, INT, target),
+    FIELD(c05, BOOL, targ_meas),
+    FIELD(c05, INT, ds_twr),
+    FIELD(c05, BOOL, get_cir),
 };
 
-static const int all_command_num_fields[] = {
-    c00_num_fields,
-    c01_num_fields,
-    c02_num_fields,
-    c03_num_fields,
-    c04_num_fields,
-    c05_num_fields,
-    c06_num_fields,
-    c07_num_fields,
-    c08_num_fields,
-    c09_num_fields,
+static const FieldSchema c06_fields[] = {
+    FIELD(c06, BYTES, data),
 };
 
+static const FieldSchema c08_fields[] = {
+    FIELD(c08, INT, delay),
+};
+
+static const FieldSchema c10_fields[] = {
+    FIELD(c10, INT, mode),
+};
 
-/* TODO: can below be made local variables if defined in
- parseMessageIntoHashTables and passed to deleteOldParams() ? Or would we lose
- the handle to these variables after the function exits, and they would exist in 
- the hash tables without any way for us to free the memory. 
-*/
-static IntParams *msg_ints; 
-static FloatParams *msg_floats;
-static BoolParams *msg_bools;
-static StrParams *msg_strs;
-static ByteParams *msg_bytes;
+static const FieldSchema c11_fields[] = {
+    FIELD(c11, BYTES, targets),
+    FIELD(c11, BOOL, targ_meas),
+};
+
+static const FieldSchema c12_fields[] = {
+    FIELD(c12, INT, slot_len),
+    FIELD(c12, BYTES, slots),
+};
 
-static osMailQDef(MsgBox, USB_QUEUE_SIZE, UsbMsg); // Define message queue
+static const FieldSchema c13_fields[] = {
+    FIELD(c13, INT, half_window),
+    FIELD(c13, BOOL, iq),
+};
+
+static const FieldSchema c14_fields[] = {
+    FIELD(c14, INT, mode),
+};
+
+static const FieldSchema c15_fields[] = {
+    FIELD(c15, INT, mode),
+};
+
+static const FieldSchema c16_fields[] = {
+    FIELD(c16, INT, profile),
+};
+
+static const FieldSchema c17_fields[] = {
+    FIELD(c17, INT, report),
+};
+
+static const FieldSchema c18_fields[] = {
+    FIELD(c18, INT, reset),
+};
+
+static const FieldSchema c19_fields[] = {
+    FIELD(c19, INT, profile),
+    FIELD(c19, FLOAT, fpp_start),
+    FIELD(c19, FLOAT, fpp_step),
+    FIELD(c19, BYTES, bias),
+};
+
+static const FieldSchema c20_fields[] = {
+    FIELD(c20, INT, profile),
+    FIELD(c20, INT, tx),
+    FIELD(c20, INT, rx),
+};
+
+static const FieldSchema c21_fields[] = {
+    FIELD(c21, INT, benchmark),
+};
+
+#define NUM_FIELDS(fields) (sizeof(fields)/sizeof(fields[0]))
+
+/* Indexed by command number. Fields are listed in the order they appear in 
+the USB message. */
+static const CommandSchema all_commands[] = {
+    {NULL, 0, c00_set_idle},
+    {NULL, 0, c01_get_id},
+    {NULL, 0, c02_reset},
+    {c03_fields, NUM_FIELDS(c03_fields), c03_do_tests},
+    {c04_fields, NUM_FIELDS(c04_fields), c04_toggle_passive},
+    {c05_fields, NUM_FIELDS(c05_fields), c05_initiate_twr},
+    {c06_fields, NUM_FIELDS(c06_fields), c06_broadcast},
+    {NULL, 0, c07_get_max_frame_len},
+    {c08_fields, NUM_FIELDS(c08_fields), c08_set_response_delay},
+    {NULL, 0, c09_jump_to_bootloader},
+    {c10_fields, NUM_FIELDS(c10_fields), c10_set_output_mode},
+    {c11_fields, NUM_FIELDS(c11_fields), c11_initiate_burst},
+    {c12_fields, NUM_FIELDS(c12_fields), c12_set_schedule},
+    {c13_fields, NUM_FIELDS(c13_fields), c13_set_cir_window},
+    {c14_fields, NUM_FIELDS(c14_fields), c14_set_passive_output},
+    {c15_fields, NUM_FIELDS(c15_fields), c15_set_rx_buffering},
+    {c16_fields, NUM_FIELDS(c16_fields), c16_set_radio_profile},
+    {c17_fields, NUM_FIELDS(c17_fields), c17_get_trace},
+    {c18_fields, NUM_FIELDS(c18_fields), c18_get_rtos_stats},
+    {c19_fields, NUM_FIELDS(c19_fields), c19_set_bias_table},
+    {c20_fields, NUM_FIELDS(c20_fields), c20_set_antenna_delay},
+    {c21_fields, NUM_FIELDS(c21_fields), c21_run_benchmark},
+};
+
+static const int num_commands = sizeof(all_commands) / sizeof(all_commands[0]);
+
+osMailQStaticDef(MsgBox, USB_QUEUE_SIZE, UsbMsg); // Define message queue
 static osMailQId MsgBox;             
 
+/* Circular buffer assembling the USB messages. rx_len bytes are valid,
+starting at rx_tail. Positions passed around below are offsets from rx_tail,
+so that parsing works the same way whether or not a message wraps around. */
 static uint8_t usb_rx_buffer[USB_BUFFER_SIZE]; 
-static uint32_t buffer_len;
-static uint8_t temp_buffer[USB_BUFFER_SIZE];
+static uint32_t rx_tail;
+static uint32_t rx_len;
+
+/* Set when loadBuffer() had to reject input. The message being assembled
+has lost bytes and can no longer complete. */
+static bool rx_rejected;
 
 /* Private Functions ----------------------------------------------------------*/
-static char* parseMessageIntoHashTables(char *msg);
-static void deleteOldParams();
-static char* getNextKeyChar(char*);
+static ParseStatus parseMessage(uint32_t start, uint32_t *end, CommandParams *out);
 static void loadBuffer(void);
-static void slideBuffer(uint8_t*);
+static uint8_t rxByte(uint32_t pos);
+static bool rxFind(uint32_t from, uint8_t c, uint32_t *pos);
+static bool rxFindKeyChar(uint32_t from, uint32_t *pos);
+static void rxCopy(uint32_t pos, void *dest, uint32_t len);
+static int rxParseInt(uint32_t from, uint32_t to);
+static void rxConsume(uint32_t len);
+static bool nextCommand(void);
 
 /**
  * @brief USB interface initialization procedure. Gets called once on startup. 
@@ -151,9 +196,10 @@ static void slideBuffer(uint8_t*);
  * 
  */
 void interfaceInit(void){
-  MsgBox = osMailCreate(osMailQ(MsgBox), NULL);  // create msg queue
-  memset(usb_rx_buffer, 0, USB_BUFFER_SIZE); 
-  buffer_len = 0;
+  MsgBox = osMailCreateStatic(osMailQ(MsgBox), osMailQStatic(MsgBox));  // create msg queue
+  rx_tail = 0;
+  rx_len = 0;
+  rx_rejected = false;
 }
 
 /**
@@ -168,7 +214,7 @@ osMailQId getMailQId(void){
 
 /**
  * @brief Consumes all items on the USB message interrupt queue, and 
- * concats them to a large USB message buffer, which also acts like a queue.
+ * appends them to the circular USB message buffer.
  * 
  */
 void loadBuffer(void){
@@ -180,243 +226,393 @@ void loadBuffer(void){
     while (evt.status == osEventMail) {
         msg_ptr = evt.value.p;
 
-        if (buffer_len + msg_ptr-> len > USB_BUFFER_SIZE){
+        if (rx_len + msg_ptr->len > USB_BUFFER_SIZE){
             usb_print("USB Buffer full! Message rejected to prevent overflow.");
             osMailFree(MsgBox, msg_ptr); // IMPORTANT: free message memory
+            rx_rejected = true;
             break;
         }
         else{
-            memcpy(usb_rx_buffer + buffer_len, msg_ptr->msg, msg_ptr->len);
-            buffer_len += msg_ptr->len;
+            // Copy in at most two pieces, wrapping around the end.
+            uint32_t head = rx_tail + rx_len;
+            if (head >= USB_BUFFER_SIZE){
+                head -= USB_BUFFER_SIZE;
+            }
+            uint32_t first = USB_BUFFER_SIZE - head;
+            if (first > msg_ptr->len){
+                first = msg_ptr->len;
+            }
+            memcpy(usb_rx_buffer + head, msg_ptr->msg, first);
+            memcpy(usb_rx_buffer, msg_ptr->msg + first, msg_ptr->len - first);
+            rx_len += msg_ptr->len;
+
             osMailFree(MsgBox, msg_ptr); // IMPORTANT: free message memory
             evt = osMailGet(MsgBox, 0); 
         }
     }
 
 }
+
 /**
- * @brief Consumes part of the buffer and slides the remaining contents up.
+ * @brief Returns the byte at a given position of the buffer.
  * 
- * @param idx Final index of chunk of buffer that is to be consumed.
+ * @param pos position, relative to the oldest valid byte.
  */
-void slideBuffer(uint8_t* idx){
-    uint8_t len = idx - &usb_rx_buffer[0] + 1;
+uint8_t rxByte(uint32_t pos){
+    uint32_t idx = rx_tail + pos;
+    if (idx >= USB_BUFFER_SIZE){
+        idx -= USB_BUFFER_SIZE;
+    }
+    return usb_rx_buffer[idx];
+}
 
-    // copy REMAINING content into temp buffer
-    memcpy(temp_buffer, usb_rx_buffer + len, buffer_len - len);
+/**
+ * @brief Searches the valid bytes of the buffer for a given character.
+ * 
+ * @param from position to start searching at.
+ * @param c character to look for.
+ * @param pos position of the character, if found.
+ * @return true if the character was found.
+ */
+bool rxFind(uint32_t from, uint8_t c, uint32_t *pos){
+    uint8_t *found;
+    uint32_t idx, len;
 
-    // zero-out contents of the buffer
-    memset(usb_rx_buffer, 0, buffer_len);
-    
-    // load remaining contents back in
-    memcpy(usb_rx_buffer, temp_buffer, buffer_len - len); 
+    if (from >= rx_len){
+        return false;
+    }
 
-    buffer_len -= len;
-}
+    // Search at most two contiguous pieces, before and after the wrap.
+    idx = rx_tail + from;
+    if (idx >= USB_BUFFER_SIZE){
+        idx -= USB_BUFFER_SIZE;
+    }
+    len = USB_BUFFER_SIZE - idx;
+    if (len > rx_len - from){
+        len = rx_len - from;
+    }
+
+    found = memchr(usb_rx_buffer + idx, c, len);
+    if (found != NULL){
+        *pos = from + (found - (usb_rx_buffer + idx));
+        return true;
+    }
 
+    from += len;
+    if (from >= rx_len){
+        return false;
+    }
+    found = memchr(usb_rx_buffer, c, rx_len - from);
+    if (found != NULL){
+        *pos = from + (found - usb_rx_buffer);
+        return true;
+    }
+    return false;
+}
 
 /**
- * @brief  The core USB message processing function and command executor.
+ * @brief Get the next key character (either | or \r) at or after a given
+ * position of the buffer.
  * 
+ * @param from position to start searching at.
+ * @param pos position of the next key character, if found.
+ * @return true if a key character was found among the valid bytes.
  */
-void readUsb(){
-  
-    decaIrqStatus_t stat;
-    stat = decamutexon();
-
-    uint8_t* msg_start;
-    char* msg_end; // TODO: to be consistent, change everything to uint8_t?
+bool rxFindKeyChar(uint32_t from, uint32_t *pos){
+    uint8_t c;
+
+    // Fields delimited this way are short, a byte-wise scan is enough.
+    for (; from < rx_len; ++from){
+        c = rxByte(from);
+        if (c == '|' || c == '\r'){
+            *pos = from;
+            return true;
+        }
+    }
+    return false;
+}
 
-    // Load buffer from interrupt message queue.
-    loadBuffer();
+/**
+ * @brief Copies bytes out of the buffer, across the wrap if needed.
+ * 
+ * @param pos position of the first byte to copy.
+ * @param dest destination.
+ * @param len number of bytes to copy. Must all be valid.
+ */
+void rxCopy(uint32_t pos, void *dest, uint32_t len){
+    uint32_t idx = rx_tail + pos;
+    if (idx >= USB_BUFFER_SIZE){
+        idx -= USB_BUFFER_SIZE;
+    }
+    uint32_t first = USB_BUFFER_SIZE - idx;
+    if (first > len){
+        first = len;
+    }
+    memcpy(dest, usb_rx_buffer + idx, first);
+    memcpy((uint8_t*) dest + first, usb_rx_buffer, len - first);
+}
 
-    /* address where to start reading the message. Search for 'C' char as
-    beginning of official message */
-    msg_start =  memchr(usb_rx_buffer, 'C', USB_BUFFER_SIZE); 
+/**
+ * @brief Decodes a signed decimal integer stored in the buffer. Like atoi(),
+ * stops at the first character that is not a digit.
+ * 
+ * @param from position of the first character.
+ * @param to position one past the last character.
+ * @return int the decoded integer.
+ */
+int rxParseInt(uint32_t from, uint32_t to){
+    int value = 0;
+    bool negative = false;
+    uint8_t c;
+
+    if (from < to && (rxByte(from) == '-' || rxByte(from) == '+')){
+        negative = (rxByte(from) == '-');
+        from++;
+    }
+    for (; from < to; ++from){
+        c = rxByte(from);
+        if (c < '0' || c > '9'){
+            break;
+        }
+        value = 10*value + (c - '0');
+    }
+    return negative ? -value : value;
+}
 
-    while (msg_start != NULL){
+/**
+ * @brief Releases the oldest bytes of the buffer.
+ * 
+ * @param len number of bytes to release.
+ */
+void rxConsume(uint32_t len){
+    if (len > rx_len){
+        len = rx_len;
+    }
+    rx_tail += len;
+    if (rx_tail >= USB_BUFFER_SIZE){
+        rx_tail -= USB_BUFFER_SIZE;
+    }
+    rx_len -= len;
+}
 
-        msg_end = parseMessageIntoHashTables((char*) msg_start); 
+/**
+ * @brief Decodes the oldest complete message of the buffer into params and 
+ * command_number. Garbage and invalid messages before it are discarded.
+ * 
+ * @return true if a command is ready to be executed.
+ */
+bool nextCommand(void){
+    uint32_t msg_start;
+    uint32_t msg_end;
+    ParseStatus status;
 
-        if (*msg_end != '\r'){
-            slideBuffer((uint8_t*) msg_end);
-            command_number = -1; // Dont attempt executing a command.
-            break;
+    /* address where to start reading the message. Search for 'C' char as
+    beginning of official message. Anything before it is garbage. */
+    while (true){
+        if (!rxFind(0, 'C', &msg_start)){
+            rxConsume(rx_len); // No message start, nothing worth keeping.
+            rx_rejected = false;
+            return false;
+        }
+        rxConsume(msg_start);
+
+        /* Check the whole message has arrived before decoding it, so that 
+        an incomplete message does not overwrite the parameters of the 
+        previous one. */
+        status = parseMessage(0, &msg_end, NULL);
+
+        if (status == PARSE_INCOMPLETE){
+            if (rx_len == USB_BUFFER_SIZE || rx_rejected){
+                /* Can never complete, or part of it was rejected. What 
+                follows is the rest of it, make room for new messages. */
+                usb_print("USB Buffer full! Discarding incomplete message.");
+                rxConsume(rx_len);
+                rx_rejected = false;
+            }
+            return false; // Wait for the rest of the message.
+        }
+        if (status == PARSE_ERROR){
+            rxConsume(msg_end + 1);
+            continue; // Try the message after it.
         }
 
-        slideBuffer((uint8_t*) msg_end);
-        // Go to next message. Dont search past end of buffer.
-        msg_start = memchr(usb_rx_buffer, 'C', USB_BUFFER_SIZE); 
+        parseMessage(0, &msg_end, &params);
+        rxConsume(msg_end + 1);
+        return true;
     }
+}
+
+/**
+ * @brief  The core USB message processing function and command executor.
+ * 
+ * Commands are executed one at a time, in the order they were received, so 
+ * that a host can send several of them without waiting for each reply. The 
+ * next message is only decoded once the current command has succeeded or 
+ * been given up on.
+ */
+void readUsb(){
+  
+    decaIrqStatus_t stat;
+    bool ready;
 
+    // Load buffer from interrupt message queue.
+    stat = decamutexon();
+    loadBuffer();
     decamutexoff(stat);
 
     /* 
-    NOTE: currently ALL commands are endlessly retried until they return a 
-    value of 1, or until a new command sent over USB overwrites. This might not 
-    be the desired behavior for some future functions, where they might just 
-    want to report a failure and not retry. 
+    NOTE: currently ALL commands are retried until they return a value of 1, 
+    or until MAX_COMMAND_RETRIES is reached, and hold back the commands 
+    queued behind them in the meantime. This might not be the desired 
+    behavior for some future functions, where they might just want to report
+    a failure and not retry. 
 
     A simple solution is to extend the possible return values of the commands:
     -1: Fail, retry me.
     0: Fail
     1: success
     */
+    while (true){
+        if (command_number < 0){
+            stat = decamutexon();
+            ready = nextCommand();
+            decamutexoff(stat);
+            if (!ready){
+                break;
+            }
+        }
 
-    // Call if a valid command number was detected
-    int num_commands = sizeof(all_command_funcs) / sizeof(all_command_funcs[0]);
-    if (retry_count > MAX_COMMAND_RETRIES){
-        // Give up re-trying after 5 attempts.
-        usb_print("COMMANDED TASK FAILED AFTER 5 ATTEMPTS.\r\n");
-        command_number = -1;
-        retry_count = 0;
-    }
-    else if (command_number >= 0 && command_number <= num_commands){
-        bool success;
-        success = (*all_command_funcs[command_number])(
-            msg_ints,
-            msg_floats,
-            msg_bools,
-            msg_strs,
-            msg_bytes); // Call the command function
-
-        if (success){
-            command_number = -1; // stops entering the above if statement
+        if (retry_count > MAX_COMMAND_RETRIES){
+            // Give up re-trying after 5 attempts.
+            usb_print("COMMANDED TASK FAILED AFTER 5 ATTEMPTS.\r\n");
+            command_number = -1;
             retry_count = 0;
+            continue;
         }
-        else{
-            retry_count += 1; 
+
+        bool success;
+        success = (*all_commands[command_number].func)(&params); // Call the command function
+
+        if (!success){
+            retry_count += 1;
+            break; // Try again on the next call.
         }
+        command_number = -1;
+        retry_count = 0;
     }
 } // end readUsb()
 
 
 /**
- * @brief This is the main message parsing function where the message is split into 
- * its corresponding datatypes.
+ * @brief This is the main message parsing function where the message is 
+ * decoded, field by field, according to the schema of the command. No memory
+ * is allocated and nothing is copied out of the buffer except the decoded
+ * values.
  * 
- * @param msg a pointer to the very beginning of the message, 
- * so it should point to a 'C' 
- * @return char* a pointer to the last character of the message that was just 
- * parsed.
+ * @param start position of the very beginning of the message, so it should 
+ * point to a 'C'.
+ * @param end position of the last character of the message that was just
+ * parsed. On error, of the last character that should be discarded.
+ * @param out where to decode the fields. If NULL, the message is only checked
+ * for completeness and command_number is left untouched.
+ * @return ParseStatus PARSE_INCOMPLETE if the valid bytes end before the 
+ * message does.
  */
-char * parseMessageIntoHashTables(char *msg)
+ParseStatus parseMessage(uint32_t start, uint32_t *end, CommandParams *out)
 {
-
-    const FieldTypes *msg_types; // Pointer to array
-    const char **msg_fields;     // Pointer to array of pointers
-    int num_fields;
+    const CommandSchema *schema;
+    uint8_t c1, c2;
+    int number;
     
-    // Current pointer. will be used as working variable throughout parsing.
-    char *current_pt = msg ;
-
-    // delete (free memory) of all old params in the hash tables
-    deleteOldParams();
+    // Current position. will be used as working variable throughout parsing.
+    uint32_t current = start;
 
-    // the first 3 bytes of "msg" should always be of the form "Cxx"
+    // the first 3 bytes of the message should always be of the form "Cxx"
     // Hence read them directly and convert to actual integer.
-    char command_number_str[] = {*(current_pt+1), *(current_pt+2), '\0'};
-    command_number = atoi(command_number_str);
+    if (start + 3 > rx_len){
+        return PARSE_INCOMPLETE;
+    }
+    c1 = rxByte(start + 1);
+    c2 = rxByte(start + 2);
+    if (c1 < '0' || c1 > '9' || c2 < '0' || c2 > '9'){
+        *end = start;
+        return PARSE_ERROR;
+    }
+    number = (c1 - '0')*10 + (c2 - '0');
+
+    if (number >= num_commands){
+        usb_print("Unknown command number.\r\n");
+        *end = start + 2;
+        return PARSE_ERROR;
+    }
 
     // Get the relevant info about the command.
-    msg_types = all_command_types[command_number];
-    msg_fields = all_command_fields[command_number];
-    num_fields = all_command_num_fields[command_number];
-    current_pt += 3; // Move to the first field.
-
-    // Get anything that has shown up on the queue and put into buffer.
-    // Just in case some chunks of a long USB message took some time to arrive.
-    loadBuffer(); 
+    schema = &all_commands[number];
+    current += 3; // Move to the first field.
+
     int i;
-    FieldTypes type;
-    char *next_pt;
-    for (i=0; i<num_fields; ++i)
+    uint32_t next;
+    uint8_t *dest = NULL;
+    for (i=0; i<schema->num_fields; ++i)
     {     
-        type = msg_types[i];    
+        if (out != NULL){
+            dest = (uint8_t*) out + schema->fields[i].offset;
+        }
         
-        /* At this point, current pointer will be at a '|', so move forward by
-        1 to be at the first char of the field.*/
-        current_pt += 1; 
+        /* At this point, current position will be at a '|', so move forward 
+        by 1 to be at the first char of the field. Anything else, such as a 
+        '\r', means fields are missing. */
+        if (current >= rx_len){
+            return PARSE_INCOMPLETE;
+        }
+        if (rxByte(current) != '|'){
+            *end = current;
+            return PARSE_ERROR;
+        }
+        current += 1; 
         
-        /* Each case of this switch statement must move the pointer to the next
-        delimiter */
-        switch (type)
+        /* Each case of this switch statement must move the position to the 
+        next delimiter */
+        switch (schema->fields[i].type)
         {
         case INT:
         {
-            IntParams *param_temp;
-
-            param_temp = malloc(sizeof(IntParams));
-            if (param_temp == NULL)
-            {
-                MemManage_Handler(); /* TODO: should handle this in a better way,
-                                              as well as in other cases. */
-            } // if the memory has not been allocated, interrupt operations
-
-            strcpy(param_temp->key, msg_fields[i]);
-
-            // Get length of field
-            next_pt = getNextKeyChar(current_pt);
-            uint8_t len = next_pt - current_pt;
-
-            // Extract into struct
-            char *int_as_string = calloc(len + 1, sizeof(char));
-            memcpy(int_as_string, current_pt, len * sizeof(char));
-            param_temp->value = atoi(int_as_string);
-
-            HASH_ADD_STR(msg_ints, key, param_temp);
-            current_pt = next_pt;
-            free(int_as_string);
+            if (!rxFindKeyChar(current, &next)){
+                return PARSE_INCOMPLETE;
+            }
+            if (dest != NULL){
+                *(int*) dest = rxParseInt(current, next);
+            }
+            current = next;
             break;
         }
         case STR:
         {
             /* Strings cannot contain '|' or '\r', or this will cause an 
-            error. */
-            StrParams *param_temp;
-
-            param_temp = calloc(1, sizeof(StrParams));
-            if (param_temp == NULL)
-            {
-                MemManage_Handler();
-            } // if the memory has not been allocated, interrupt operations
-
-            strcpy(param_temp->key, msg_fields[i]);
-
-            // Get length of field
-            next_pt = getNextKeyChar(current_pt);
-            uint16_t len = next_pt - current_pt;
-
-            memcpy(param_temp->value, current_pt, len * sizeof(char));
-
-            HASH_ADD_STR(msg_strs, key, param_temp);
-            current_pt = next_pt;
+            error. Strings too long for the destination are truncated. */
+            if (!rxFindKeyChar(current, &next)){
+                return PARSE_INCOMPLETE;
+            }
+            if (dest != NULL){
+                uint32_t len = next - current;
+                if (len > schema->fields[i].size - 1u){
+                    len = schema->fields[i].size - 1u;
+                }
+                rxCopy(current, dest, len);
+                dest[len] = '\0';
+            }
+            current = next;
             break;
         }
         case BOOL:
         {
-            BoolParams *param_temp;
-
-            param_temp = malloc(sizeof(BoolParams));
-            if (param_temp == NULL)
-            {
-                MemManage_Handler();
-            } // if the memory has not been allocated, interrupt operations
-
-            strcpy(param_temp->key, msg_fields[i]);
-
-            // Get length of field
-            next_pt = getNextKeyChar(current_pt);
-            uint8_t len = next_pt - current_pt; // Should ALWAYS be 1.
-
-            // Extract into struct
-            char *bool_as_string = calloc(len + 1,  sizeof(char));
-            memcpy(bool_as_string, current_pt, len * sizeof(char));
-            param_temp->value = atoi(bool_as_string);
-
-            HASH_ADD_STR(msg_bools, key, param_temp);
-            free(bool_as_string);
-            current_pt = next_pt;
+            if (!rxFindKeyChar(current, &next)){
+                return PARSE_INCOMPLETE;
+            }
+            if (dest != NULL){
+                *(bool*) dest = rxParseInt(current, next) != 0; // Should ALWAYS be 1 char.
+            }
+            current = next;
             break;
         }
         case FLOAT:
@@ -429,26 +625,13 @@ char * parseMessageIntoHashTables(char *msg)
 
             A single-precision float requires 4 bytes.
             */
-
-            FloatParams *param_temp;
-
-            param_temp = malloc(sizeof(FloatParams));
-            if (param_temp == NULL)
-            {
-                MemManage_Handler();
-            } // if the memory has not been allocated, interrupt operations
-
-            strcpy(param_temp->key, msg_fields[i]);
-
-            // Get length of field
-            uint8_t len = 4;
-
-            // Extract into struct
-            memcpy(&(param_temp->value), current_pt, len);
-
-            HASH_ADD_STR(msg_floats, key, param_temp);
-            current_pt += len;
-
+            if (current + sizeof(float) > rx_len){
+                return PARSE_INCOMPLETE;
+            }
+            if (dest != NULL){
+                rxCopy(current, dest, sizeof(float));
+            }
+            current += sizeof(float);
             break;
         }
         case BYTES:
@@ -460,30 +643,34 @@ char * parseMessageIntoHashTables(char *msg)
             also specify the length of the byte array, so that it can be parsed
             properly. We store this length as a 16-bit unsigned integer and it
             is found as the first two bytes of the byte array */
-            ByteParams *param_temp;
-
-            param_temp = malloc(sizeof(ByteParams));
-            if (param_temp == NULL)
-            {
-                MemManage_Handler();
-            } // if the memory has not been allocated, interrupt operations
-
-            strcpy(param_temp->key, msg_fields[i]);
-            
-            // Get length of field
             uint16_t len;
-            memcpy(&len, current_pt, sizeof(len)); // sizeof(len) always 2 bytes
-            param_temp->len = len;
+            if (current + sizeof(len) > rx_len){
+                return PARSE_INCOMPLETE;
+            }
+            rxCopy(current, &len, sizeof(len)); // sizeof(len) always 2 bytes
 
             // Move to the actual byte data
-            current_pt = current_pt + 2;
-
-            // Extract into struct
-            memset(&(param_temp->value[0]), 0, USB_BUFFER_SIZE);
-            memcpy(&(param_temp->value[0]), current_pt, len);
-
-            HASH_ADD_STR(msg_bytes, key, param_temp);
-            current_pt += len;
+            current += sizeof(len);
+
+            /* A length the field cannot hold, or the buffer, would never 
+            complete. Discard up to the length, the search for the next 'C'
+            skips the rest. */
+            if (len > schema->fields[i].size - offsetof(BytesField, value)
+                || current + len > USB_BUFFER_SIZE){
+                usb_print("Invalid byte array length.\r\n");
+                *end = current - 1;
+                return PARSE_ERROR;
+            }
+            if (current + len > rx_len){
+                return PARSE_INCOMPLETE;
+            }
+
+            if (dest != NULL){
+                BytesField *field = (BytesField*) dest;
+                field->len = len;
+                rxCopy(current, &(field->value[0]), len);
+            }
+            current += len;
             break;
         }
         default:
@@ -493,100 +680,18 @@ char * parseMessageIntoHashTables(char *msg)
     
     /* Now that we have gone through all the fields, we definitely expect the 
     message terminator to be here */
-    char *end_pt = strchr(current_pt, '\r'); 
-    if (*end_pt != '\r'){
-        usb_print("Failed to detect USB command terminator char! Trying my best");
-        end_pt = current_pt;
-    }
-
-    return end_pt;
-
-} // end parseMessageIntoHashTables()
-
-
-/**
- * @brief Get the next key character (either | or \r) after the current pointer
- * location.
- * 
- * @param msg 
- * @return char* pointer to the next key character
- */
-char* getNextKeyChar(char* msg){
-    char *next_sep_pt = strchr(msg, '|'); // Index of next separator
-    char *next_end_pt = strchr(msg, '\r'); // Index of next terminator
-    char *next_pt = NULL;
-
-    if (next_sep_pt == NULL && next_end_pt == NULL){
-        /* We sometimes enter this condition when the next field is
-        either a float or byte. Since those fields could contain the
-        string terminator '\0', then this will prematurely exit the 
-        strchr() functions.
-        */
-        usb_print("No next key character found.");
-        osDelay(1);
-    }
-    else if (next_sep_pt == NULL){
-        next_pt = next_end_pt;
-    }
-    else if (next_end_pt == NULL){
-        next_pt = next_sep_pt;
-    }
-    else if (next_sep_pt < next_end_pt){
-        next_pt = next_sep_pt;
-    }
-    else if (next_end_pt < next_sep_pt)
-    {
-        next_pt = next_end_pt;
-    }
-
-    return next_pt;
-}
-
-
-/**
- * @brief Frees memory from the hash tables.
- * 
- */
-void deleteOldParams() {
-
-    /* Delete int params */
-    IntParams *current_int, *tmp_int;
-
-    HASH_ITER(hh, msg_ints, current_int, tmp_int) {
-        HASH_DEL(msg_ints, current_int);  /* delete; advances to next param */
-        free(current_int);    
+    if (current >= rx_len){
+        return PARSE_INCOMPLETE;
     }
-
-    /* Delete str params */
-    StrParams *current_str, *tmp_str;
-
-    HASH_ITER(hh, msg_strs, current_str, tmp_str) {
-        HASH_DEL(msg_strs, current_str);  /* delete; advances to next param */
-        free(current_str);    
+    *end = current;
+    if (rxByte(current) != '\r'){
+        return PARSE_ERROR;
     }
 
-    /* Delete bool params */
-    BoolParams *current_bool, *tmp_bool;
-
-    HASH_ITER(hh, msg_bools, current_bool, tmp_bool) {
-        HASH_DEL(msg_bools, current_bool);  /* delete; advances to next param */
-        free(current_bool);    
+    if (out != NULL){
+        command_number = number;
     }
 
-    /* Delete float params */
-    FloatParams *current_float, *tmp_float;
-
-    HASH_ITER(hh, msg_floats, current_float, tmp_float) {
-        HASH_DEL(msg_floats, current_float);  /* delete; advances to next param */
-        free(current_float);    
-    }
+    return PARSE_OK;
 
-    /* Delete byte params */
-    ByteParams *current_bytes, *tmp_bytes;
-
-    HASH_ITER(hh, msg_bytes, current_bytes, tmp_bytes)
-    {
-        HASH_DEL(msg_bytes, current_bytes); /* delete; advances to next param */
-        free(current_bytes);
-    }
-}
\ No newline at end of file
+} // end parseMessage()
@@ -33,6 +33,8 @@
 #include "testing.h"
 #include "usb_interface.h"
 #include "commands.h"
+#include "tdma.h"
+#include "rtos_stats.h"
 
 /* USER CODE END Includes */
 
@@ -61,8 +63,17 @@ struct str_params *FSM_str_params = NULL;
 
 osThreadId defaultTaskHandle;
 osThreadId blinkTaskHandle;
+uint32_t blinkTaskBuffer[ BLINK_STACK_SIZE ];
+osStaticThreadDef_t blinkTaskControlBlock;
 osThreadId usbReceiveTaskHandle;
+uint32_t usbReceiveTaskBuffer[ USB_RECEIVE_STACK_SIZE ];
+osStaticThreadDef_t usbReceiveTaskControlBlock;
 osThreadId twrInterruptTaskHandle;
+uint32_t twrInterruptTaskBuffer[ UWB_STACK_SIZE ];
+osStaticThreadDef_t twrInterruptTaskControlBlock;
+osThreadId tdmaTaskHandle;
+uint32_t tdmaTaskBuffer[ TDMA_STACK_SIZE ];
+osStaticThreadDef_t tdmaTaskControlBlock;
 
 /* Private function prototypes -----------------------------------------------*/
 /* USER CODE BEGIN FunctionPrototypes */
@@ -72,6 +83,26 @@ void StartUsbReceive(void const * argument);
 void uwbInterruptTask(void const * argument);
 /* USER CODE END FunctionPrototypes */
 
+/* Hook prototypes */
+void vApplicationIdleHook(void);
+void vApplicationTickHook(void);
+
+/* USER CODE BEGIN 2 */
+void vApplicationIdleHook( void )
+{
+   /* CPU load over the last second, see rtos_stats.c */
+   rtosStatsIdleHook();
+}
+/* USER CODE END 2 */
+
+/* USER CODE BEGIN 3 */
+void vApplicationTickHook( void )
+{
+   /* Peak occupancy of the queues */
+   rtosStatsTickHook();
+}
+/* USER CODE END 3 */
+
 extern void MX_USB_DEVICE_Init(void);
 void MX_FREERTOS_Init(void); /* (MISRA C 2004 rule 8.1) */
 
@@ -118,14 +149,17 @@ void MX_FREERTOS_Init(void) {
   /* USER CODE END RTOS_QUEUES */
 
   /* USER CODE BEGIN RTOS_THREADS */
-  osThreadDef(blink, StartBlinking, osPriorityIdle, 0, 64);
+  osThreadStaticDef(blink, StartBlinking, osPriorityIdle, 0, BLINK_STACK_SIZE, blinkTaskBuffer, &blinkTaskControlBlock);
   blinkTaskHandle = osThreadCreate(osThread(blink), NULL);
 
-  osThreadDef(usbReceive, StartUsbReceive, osPriorityAboveNormal, 0, 768);
+  osThreadStaticDef(usbReceive, StartUsbReceive, osPriorityAboveNormal, 0, USB_RECEIVE_STACK_SIZE, usbReceiveTaskBuffer, &usbReceiveTaskControlBlock);
   usbReceiveTaskHandle = osThreadCreate(osThread(usbReceive), NULL);
 
-  osThreadDef(twrInterrupt, uwbInterruptTask, osPriorityRealtime, 0, 576);
+  osThreadStaticDef(twrInterrupt, uwbInterruptTask, osPriorityRealtime, 0, UWB_STACK_SIZE, twrInterruptTaskBuffer, &twrInterruptTaskControlBlock);
   twrInterruptTaskHandle = osThreadCreate(osThread(twrInterrupt), NULL);
+
+  osThreadStaticDef(tdma, tdmaTask, osPriorityHigh, 0, TDMA_STACK_SIZE, tdmaTaskBuffer, &tdmaTaskControlBlock);
+  tdmaTaskHandle = osThreadCreate(osThread(tdma), NULL);
   /* USER CODE END RTOS_THREADS */
 }
 
@@ -142,7 +176,6 @@ void StartUsbReceive(void const *argument){
   // To receive the data transmitted by a computer, execute in a terminal
   // >> cat /dev/ttyACMx
 
-  uint8_t reg_state; // to store the state of the DW receiver
   interfaceInit();
   
   while (1){
@@ -150,10 +183,7 @@ void StartUsbReceive(void const *argument){
     readUsb();
 
     /* RX is supposed to be enabled from the interrupt task. If not, re-enable */
-    reg_state = dwt_read8bitoffsetreg(SYS_STATE_ID, 1); // read RX status
-    if (!reg_state){
-      dwt_rxenable(DWT_START_RX_IMMEDIATE); // turn on uwb receiver
-    } 
+    ensureRxEnabled();
 
     osDelay(1); 
   }
@@ -166,8 +196,7 @@ void uwbInterruptTask(void const *argument){
   dwt_setrxaftertxdelay(40);
 
   while (1){ 
-    uwbFrameHandler(); 
-    dwt_rxenable(DWT_START_RX_IMMEDIATE); // turn on uwb receiver
+    uwbFrameHandler(); // also turns the receiver back on between exchanges
   }
 } // end uwbInterruptTask()
 /* USER CODE END Application */
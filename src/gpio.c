@@ -98,8 +98,9 @@ void MX_GPIO_Init(void)
   GPIO_InitStruct.Pull = GPIO_NOPULL;
   HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
 
-  /* EXTI interrupt init*/
-  HAL_NVIC_SetPriority(DECAIRQ_EXTI_IRQn, 0, 0);
+  /* EXTI interrupt init. Must not be above configMAX_SYSCALL_INTERRUPT_PRIORITY,
+  since the DW1000 callbacks post events to the UWB task. */
+  HAL_NVIC_SetPriority(DECAIRQ_EXTI_IRQn, 5, 0);
   HAL_NVIC_EnableIRQ(DECAIRQ_EXTI_IRQn);
 }
 
@@ -30,6 +30,7 @@
 /* USER CODE BEGIN Includes */
 #include "common.h"
 #include "ranging.h"
+#include "records.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -97,8 +98,10 @@ int main(void)
   /* USER CODE BEGIN 2 */
   MX_USB_DEVICE_Init();
   board_id_init();
+  recordsInit();
   uwb_init();
   ranging_init();
+  tdma_init();
   /* USER CODE END 2 */
 
   /* Call init function for freertos objects (in freertos.c) */
@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <math.h>   
 #include "common.h"
+#include "trace.h"
 
 void convert_float_to_string(char* str,float data){
   char *tmpSign = (data < 0) ? "-" : "";
@@ -35,7 +36,23 @@ void convert_elementR3_to_string(char* str, element_R3 data){
 void usb_print(char* c){
   // TODO: can this be overloaded so that we can allow a format specifier like
   // sprintf? 
-  CDC_Transmit_FS((unsigned char*) c, strlen(c));
+  uint32_t start = traceCycles();
+
+  CDC_Write_FS((uint8_t*) c, strlen(c));
+  traceEnd(TRACE_USB_PRINT, start);
+}
+
+/**
+ * @brief Sends an arbitrary array of bytes over USB. Unlike usb_print(), the
+ * data may contain the string terminator '\0'. The data is copied into the
+ * USB transmit buffer, so the caller may reuse it immediately.
+ * 
+ * @param data pointer to the bytes to send
+ * @param len number of bytes to send
+ * @return int 1 if the data was queued, 0 if the transmit buffer was full
+ */
+int usb_write(uint8_t* data, uint16_t len){
+  return CDC_Write_FS(data, len) == USBD_OK;
 }
 
 /**
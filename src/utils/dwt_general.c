@@ -12,24 +12,103 @@
 #include "spi.h"
 #include "cmsis_os.h"
 
-#define FINAL_MSG_TS_LEN 4
-
-/* Default communication configuration. 
-In Decawave's examples, the default mode (mode 3) is used. 
-We use here Justin Cano's settings, for the time being. */
-static dwt_config_t config = {
-		2,               /* Channel number. */
-		DWT_PRF_64M,     /* Pulse repetition frequency. */
-		DWT_PLEN_128,   /* Preamble length. Used in TX only. */
-		DWT_PAC8,       /* Preamble acquisition chunk size. Used in RX only. */
-		9,               /* TX preamble code. Used in TX only. */
-		9,               /* RX preamble code. Used in RX only. */
-		0,               /* 0 to use standard SFD, 1 to use non-standard SFD. */
-		DWT_BR_6M8,     /* Data rate. */
-		DWT_PHRMODE_STD, /* PHY header mode. */
-		(129 + 8 - 8) /* SFD timeout (preamble length + 1 + SFD length - PAC size). Used in RX only. */
+/* The time-stamps are sent whole, so that the durations computed from them
+are not limited by the wrap-around of their low 32 bits, 67 ms. */
+#define FINAL_MSG_TS_LEN 5
+
+/* Radio profiles, indexed by RADIO_PROFILE_. The default one is Justin Cano's
+settings; in Decawave's examples, mode 3 is used. Each profile carries the
+constants that depend on its configuration, so that they are switched with it:
+- The first path power constant is 121.74 for a PRF of 64 MHz and 113.77 for
+  16 MHz, and the preamble count is corrected for the SFD, which is 8 symbols
+  long at 850 kbps and 6.8 Mbps and 64 symbols at 110 kbps (User Manual 4.7.1).
+- The SFD timeout is the preamble length + 1 + SFD length - PAC size.
+- The accumulator holds 1016 taps at 64 MHz PRF and 992 at 16 MHz (User
+  Manual 7.2.37).
+- The reply delays include the air time of the frames, which is dominated by
+  the preamble at 6.8 Mbps and by the payload at 110 kbps. */
+static const RadioProfile radio_profiles[NUM_RADIO_PROFILES] = {
+    [RADIO_PROFILE_DEFAULT] = {
+        .name = "DEFAULT",
+        .config = {2, DWT_PRF_64M, DWT_PLEN_128, DWT_PAC8, 9, 9, 0, DWT_BR_6M8,
+                   DWT_PHRMODE_STD, (129 + 8 - 8)},
+        .a_constant = 121.74,
+        .rxpacc_adjustment = -10,
+        .skew_ppm_per_ci = -(FREQ_OFFSET_MULTIPLIER*HERTZ_TO_PPM_MULTIPLIER_CHAN_2),
+        .pre_timeout = 800,
+        .rx_after_tx_uus = 40,
+        .frame_wait_ms = 5,
+        .ss_reply_uus = 1500,
+        .ss_fast_reply_uus = 700,
+        .ds_reply_uus = 1500,
+        .burst_first_slot_uus = 1500,
+        .burst_slot_uus = 500,
+        .min_slot_uus = 2500,
+        .tx_lead_uus = 500,
+        .cir_taps = 1016,
+    },
+    [RADIO_PROFILE_FAST] = {
+        .name = "FAST",
+        .config = {2, DWT_PRF_64M, DWT_PLEN_64, DWT_PAC8, 9, 9, 0, DWT_BR_6M8,
+                   DWT_PHRMODE_STD, (65 + 8 - 8)},
+        .a_constant = 121.74,
+        .rxpacc_adjustment = -10,
+        .skew_ppm_per_ci = -(FREQ_OFFSET_MULTIPLIER*HERTZ_TO_PPM_MULTIPLIER_CHAN_2),
+        .pre_timeout = 800,
+        .rx_after_tx_uus = 40,
+        .frame_wait_ms = 5,
+        .ss_reply_uus = 1400,
+        .ss_fast_reply_uus = 600,
+        .ds_reply_uus = 1400,
+        .burst_first_slot_uus = 1400,
+        .burst_slot_uus = 450,
+        .min_slot_uus = 2300,
+        .tx_lead_uus = 500,
+        .cir_taps = 1016,
+    },
+    [RADIO_PROFILE_LONG_RANGE] = {
+        .name = "LONG_RANGE",
+        .config = {2, DWT_PRF_16M, DWT_PLEN_1024, DWT_PAC32, 3, 3, 0, DWT_BR_110K,
+                   DWT_PHRMODE_STD, (1025 + 64 - 32)},
+        .a_constant = 113.77,
+        .rxpacc_adjustment = -64,
+        .skew_ppm_per_ci = -(FREQ_OFFSET_MULTIPLIER_110KB*HERTZ_TO_PPM_MULTIPLIER_CHAN_2),
+        .pre_timeout = 400,
+        .rx_after_tx_uus = 40,
+        .frame_wait_ms = 15,
+        .ss_reply_uus = 5000,
+        .ss_fast_reply_uus = 4000,
+        .ds_reply_uus = 5000,
+        .burst_first_slot_uus = 5000,
+        .burst_slot_uus = 3000,
+        .min_slot_uus = 18000,
+        .tx_lead_uus = 1500,
+        .cir_taps = 992,
+    },
+};
+
+/* Profile in use. Only changed by radioProfileConfigure(), with the DW1000
+interrupt masked, so that the call-backs see the constants of the
+configuration the frame was received with. */
+static const RadioProfile *radio_profile = &radio_profiles[RADIO_PROFILE_DEFAULT];
+
+/* Copy of the configuration of the profile, which dwt_configure() takes as
+non-const. */
+static dwt_config_t config;
+
+/* Antenna delays of this board, TX and RX, for each profile, since they
+depend on the PRF. Set by antennaDelaySet(), and written to the DW1000 with
+the profile. */
+static volatile uint16_t antenna_delays[NUM_RADIO_PROFILES][2] = {
+    [RADIO_PROFILE_DEFAULT] = {TX_ANT_DLY, RX_ANT_DLY},
+    [RADIO_PROFILE_FAST] = {TX_ANT_DLY, RX_ANT_DLY},
+    [RADIO_PROFILE_LONG_RANGE] = {TX_ANT_DLY_16M, RX_ANT_DLY_16M},
 };
 
+/* TX antenna delay the DW1000 was last given, which it adds to the
+transmission times. */
+static uint16_t tx_ant_dly = TX_ANT_DLY;
+
 /**
   * @brief  Pulse generator delay, as per Table 38 in the User Manual.
   */
@@ -106,27 +185,130 @@ void uwb_init(void){
     }
     port_set_dw1000_fastrate();
 
+    /* Configure LEDs management. See NOTE 6 below. */
+    dwt_setleds(DWT_LEDS_ENABLE);
+
+    /* Configure DW1000. */
+    radioProfileConfigure(RADIO_PROFILE_DEFAULT);
+
+    /* Set the UWB ID. dwt_seteui() writes the full 8-byte EUI. */
+    uint8_t unique_id[8] = {BOARD_ID()}; // This is the module's ID.
+    dwt_seteui(unique_id);
+
+    usb_print("UWB tag initialized and configured. \n");
+}
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn radioProfileConfigure()
+ *
+ * @brief Configure the DW1000 for one of the radio profiles. The receiver must
+ *        be off and the DW1000 interrupt masked.
+ *
+ * @param  id  RADIO_PROFILE_, must be valid
+ *
+ * @return none
+ */
+void radioProfileConfigure(uint8_t id)
+{
+    radio_profile = &radio_profiles[id];
+    config = radio_profile->config;
+
     /* Set transmission power to maximum */
     dwt_txconfig_t txrf_config = {.PGdly = PGdly[config.chan],
                                   .power = 0x1F1F1F1FL};
-    
+
     dwt_configuretxrf(&txrf_config);
+    dwt_configure(&config);
 
-    /* Configure LEDs management. See NOTE 6 below. */
-    dwt_setleds(DWT_LEDS_ENABLE);
+    antennaDelayConfigure();
+}
 
-    /* Configure DW1000. */
-    dwt_configure(&config);
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn radioProfile()
+ *
+ * @brief Get the profile in use, and its constants.
+ */
+const RadioProfile *radioProfile(void)
+{
+    return radio_profile;
+}
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn radioProfileById()
+ *
+ * @brief Get one of the profiles, in use or not.
+ *
+ * @param  id  RADIO_PROFILE_, must be valid
+ */
+const RadioProfile *radioProfileById(uint8_t id)
+{
+    return &radio_profiles[id];
+}
 
-    /* Apply default antenna delay value. See NOTE 1 below. */
-	dwt_setrxantennadelay(RX_ANT_DLY);
-	dwt_settxantennadelay(TX_ANT_DLY);
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn radioProfileId()
+ *
+ * @brief Get the RADIO_PROFILE_ index of the profile in use.
+ */
+uint8_t radioProfileId(void)
+{
+    return (uint8_t)(radio_profile - radio_profiles);
+}
 
-    /* Set the UWB ID */
-    uint8_t unique_id = BOARD_ID(); // This is the module's ID.
-    dwt_seteui(&unique_id);
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn antennaDelaySet()
+ *
+ * @brief Set the antenna delays of this board for one of the profiles, as
+ *        found by calibration (see APS014). Only written to the DW1000 by
+ *        radioProfileConfigure() or antennaDelayConfigure().
+ *
+ * @param  profile  RADIO_PROFILE_, must be valid
+ * @param  tx       TX antenna delay, in DW1000 time units
+ * @param  rx       RX antenna delay, in DW1000 time units
+ */
+void antennaDelaySet(uint8_t profile, uint16_t tx, uint16_t rx)
+{
+    antenna_delays[profile][0] = tx;
+    antenna_delays[profile][1] = rx;
+}
 
-    usb_print("UWB tag initialized and configured. \n");
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn antennaDelayGet()
+ *
+ * @brief Get the antenna delays of this board for one of the profiles.
+ *
+ * @param  profile  RADIO_PROFILE_, must be valid
+ */
+void antennaDelayGet(uint8_t profile, uint16_t *tx, uint16_t *rx)
+{
+    *tx = antenna_delays[profile][0];
+    *rx = antenna_delays[profile][1];
+}
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn antennaDelayConfigure()
+ *
+ * @brief Write the antenna delays of the profile in use to the DW1000. The
+ *        transceiver must be off and the DW1000 interrupt masked.
+ */
+void antennaDelayConfigure(void)
+{
+    uint8_t id = radioProfileId();
+
+    tx_ant_dly = antenna_delays[id][0];
+    dwt_settxantennadelay(tx_ant_dly);
+    dwt_setrxantennadelay(antenna_delays[id][1]);
+}
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * @fn txAntennaDelay()
+ *
+ * @brief Get the TX antenna delay in use, to predict the time-stamps of
+ *        delayed transmissions.
+ */
+uint16_t txAntennaDelay(void)
+{
+    return tx_ant_dly;
 }
 
 /** @fn      reset_DW1000
@@ -238,12 +420,12 @@ void final_msg_set_ts(uint8 *ts_field, uint64 ts)
  *
  * @return none
  */
-void final_msg_get_ts(const uint8 *ts_field, uint32 *ts)
+void final_msg_get_ts(const uint8 *ts_field, uint64 *ts)
 {
     int i;
     *ts = 0;
     for (i = 0; i < FINAL_MSG_TS_LEN; i++)
     {
-        *ts += ts_field[i] << (i * 8);
+        *ts += (uint64)ts_field[i] << (i * 8);
     }
 }
\ No newline at end of file
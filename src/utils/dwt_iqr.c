@@ -121,15 +121,17 @@ void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
  * @brief   main call-back for processing of DW1000 IRQ
  *          it re-enters the IRQ routing and processes all events.
  *          After processing of all events, DW1000 will clear the IRQ line.
+ *          The line is edge-triggered, so it must be low on return: with
+ *          double buffering, a second frame may already be waiting.
  * */
 __INLINE void process_deca_irq(void)
 {
-    // while(port_CheckEXT_IRQ() != 0)
-    // {
+    while(port_CheckEXT_IRQ() != 0)
+    {
 
         port_deca_isr();
 
-    // } //while DW1000 IRQ line active
+    } //while DW1000 IRQ line active
 }
 
 /* @fn      port_CheckEXT_IRQ
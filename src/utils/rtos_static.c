@@ -0,0 +1,46 @@
+/**
+  ******************************************************************************
+  * @file    rtos_static.c
+  * @brief   Mail queues without the FreeRTOS heap. Their control blocks are
+  *          filled in the same way as osMailCreate() does, so that the rest
+  *          of the CMSIS-RTOS mail functions work on them unchanged.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "rtos_static.h"
+#include <string.h>
+
+/* Public functions ----------------------------------------------------------*/
+/*! ----------------------------------------------------------------------------
+ * Function: osMailCreateStatic()
+ *
+ * @brief Same as osMailCreate(), in the storage of osMailQStaticDef().
+ *
+ * @param queue_def (osMailQDef_t*) osMailQ(name).
+ * @param storage (osStaticMailQDef_t*) osMailQStatic(name).
+ *
+ * @return (osMailQId) Mail queue ID, NULL in case of error.
+ */
+osMailQId osMailCreateStatic(const osMailQDef_t *queue_def, const osStaticMailQDef_t *storage){
+    MailQueueCb *queue_cb = storage->queue_cb;
+    MailPoolCb *pool_cb = storage->pool_cb;
+
+    pool_cb->pool = storage->pool;
+    pool_cb->markers = storage->markers;
+    pool_cb->pool_sz = queue_def->queue_sz;
+    pool_cb->item_sz = 4*((queue_def->item_sz + 3)/4);
+    pool_cb->currentIndex = 0;
+    memset(pool_cb->markers, 0, queue_def->queue_sz);
+
+    queue_cb->queue_def = queue_def;
+    queue_cb->pool = (osPoolId)pool_cb;
+    queue_cb->handle = xQueueCreateStatic(queue_def->queue_sz, sizeof(void *),
+                                          storage->queue_buffer, storage->queue);
+    if (queue_cb->handle == NULL){
+        return NULL;
+    }
+
+    *(queue_def->cb) = (struct os_mailQ_cb *)queue_cb;
+    return *(queue_def->cb);
+}
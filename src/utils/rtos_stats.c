@@ -0,0 +1,231 @@
+/**
+  ******************************************************************************
+  * @file    rtos_stats.c
+  * @brief   FreeRTOS telemetry, sent to the host as a single binary record:
+  *          run time of each task, from the DWT cycle counter, CPU load over
+  *          the last second, measured from the idle hook, stack high-water
+  *          marks, the occupancy of the mail queues, whose peaks are
+  *          sampled from the tick hook, and the USB transmit statistics.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "rtos_stats.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "cmsis_os.h"
+#include "ranging.h"
+#include "records.h"
+#include "rtos_static.h"
+#include "tdma.h"
+#include "usb_interface.h"
+#include "usbd_cdc_if.h"
+#include <string.h>
+
+/* Defines -------------------------------------------------------------------*/
+/* Tasks reported, idle task included */
+#define RTOS_STATS_MAX_TASKS (8)
+
+/* The CPU load is measured over windows this long, in ms */
+#define RTOS_LOAD_WINDOW_MS (1000)
+
+#define NUM_RTOS_QUEUES (sizeof(rtos_queues)/sizeof(rtos_queues[0]))
+
+/* Typedefs ------------------------------------------------------------------*/
+typedef struct {
+    const char *name;
+    osMailQId (*queue)(void);  // NULL until the queue is created
+} RtosQueueDef;
+
+/* Private variables ---------------------------------------------------------*/
+static const RtosQueueDef rtos_queues[] = {
+    {"UwbMsgBox", uwbMailQId},
+    {"MsgBox",    getMailQId},
+    {"TdmaBox",   tdmaMailQId},
+};
+
+static volatile uint8_t queue_peaks[NUM_RTOS_QUEUES];
+
+/* Written by the idle task. */
+static struct {
+    uint32_t tick;       // Start of the current window
+    uint32_t run_time;   // Run time counter at the same instant
+    uint32_t idle_time;  // Run time of the idle task at the same instant
+    uint16_t permille;   // Load over the last complete window
+} cpu_load;
+
+/* Private functions ---------------------------------------------------------*/
+/*! ----------------------------------------------------------------------------
+ * Function: rtosLoad()
+ *
+ * @brief CPU load in permille, from the run time elapsed and the part of it
+ * spent in the idle task.
+ */
+static uint16_t rtosLoad(uint32_t run_time, uint32_t idle_time){
+    if (run_time == 0 || idle_time > run_time){
+        return 0;
+    }
+    return 1000 - (uint16_t)(((uint64_t)idle_time*1000)/run_time);
+}
+
+/* Public functions ----------------------------------------------------------*/
+/*! ----------------------------------------------------------------------------
+ * Function: rtosRunTimeCounter()
+ *
+ * @brief Run time statistics clock of FreeRTOS, portGET_RUN_TIME_COUNTER_VALUE().
+ * The 32-bit cycle counter wraps around every 25 s, so it is extended here
+ * and divided down by RTOS_RUN_TIME_SHIFT. It is read at every context
+ * switch, which happens at least every 250 ms with the blink task.
+ */
+uint32_t rtosRunTimeCounter(void){
+    static uint32_t last_cycles = 0;
+    static uint32_t wraps = 0;
+    uint32_t primask = __get_PRIMASK();
+    uint32_t cycles, value;
+
+    __disable_irq();
+    cycles = DWT->CYCCNT;
+    if (cycles < last_cycles){
+        wraps++;
+    }
+    last_cycles = cycles;
+    value = (wraps << (32 - RTOS_RUN_TIME_SHIFT)) | (cycles >> RTOS_RUN_TIME_SHIFT);
+    __set_PRIMASK(primask);
+    return value;
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: rtosStatsIdleHook()
+ *
+ * @brief Called from vApplicationIdleHook(). Closes the CPU load window once
+ * it is RTOS_LOAD_WINDOW_MS long. The idle task does not run at all under full
+ * load, which rtosStatsSend() accounts for.
+ */
+void rtosStatsIdleHook(void){
+    uint32_t tick = xTaskGetTickCount();
+    uint32_t run_time, idle_time;
+
+    if (tick - cpu_load.tick < RTOS_LOAD_WINDOW_MS){
+        return;
+    }
+    run_time = portGET_RUN_TIME_COUNTER_VALUE();
+    idle_time = ulTaskGetIdleRunTimeCounter();
+
+    taskENTER_CRITICAL();
+    cpu_load.permille = rtosLoad(run_time - cpu_load.run_time, idle_time - cpu_load.idle_time);
+    cpu_load.tick = tick;
+    cpu_load.run_time = run_time;
+    cpu_load.idle_time = idle_time;
+    taskEXIT_CRITICAL();
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: rtosStatsTickHook()
+ *
+ * @brief Called from vApplicationTickHook(), in the SysTick interrupt. Samples
+ * the peak occupancy of the mail queues.
+ */
+void rtosStatsTickHook(void){
+    for (uint32_t i = 0; i < NUM_RTOS_QUEUES; i++){
+        const MailQueueCb *mail = (const MailQueueCb *)rtos_queues[i].queue();
+        UBaseType_t used;
+
+        if (mail == NULL){
+            continue;
+        }
+        used = uxQueueMessagesWaitingFromISR(mail->handle);
+        if (used > queue_peaks[i]){
+            queue_peaks[i] = used;
+        }
+    }
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: rtosStatsSend()
+ *
+ * @brief Send a snapshot of the RTOS as a RECORD_TYPE_RTOS record, whatever
+ * the output mode.
+ *
+ * @param reset_peaks (bool) Start the queue peaks over after the snapshot.
+ *
+ * @return (int) 1 if the record was handed to the USB driver.
+ */
+int rtosStatsSend(bool reset_peaks){
+    /* Too large for the stack of the USB task */
+    static TaskStatus_t tasks[RTOS_STATS_MAX_TASKS];
+    static uint8_t payload[sizeof(RtosStatsHeader)
+                           + RTOS_STATS_MAX_TASKS*sizeof(RtosTaskRecord)
+                           + NUM_RTOS_QUEUES*sizeof(RtosQueueRecord)
+                           + sizeof(RtosUsbRecord)];
+    RtosStatsHeader header;
+    RtosTaskRecord task;
+    RtosQueueRecord queue;
+    RtosUsbRecord usb;
+    CdcTxStats tx_stats;
+    uint32_t total_time, load_tick, load_run, load_idle;
+    uint16_t len;
+
+    /* Returns 0 if there are more tasks than RTOS_STATS_MAX_TASKS */
+    header.num_tasks = uxTaskGetSystemState(tasks, RTOS_STATS_MAX_TASKS, &total_time);
+    header.num_queues = NUM_RTOS_QUEUES;
+    header.tick = osKernelSysTick();
+    header.run_time = total_time;
+    header.run_time_hz = HAL_RCC_GetHCLKFreq() >> RTOS_RUN_TIME_SHIFT;
+
+    taskENTER_CRITICAL();
+    header.cpu_load = cpu_load.permille;
+    load_tick = cpu_load.tick;
+    load_run = cpu_load.run_time;
+    load_idle = cpu_load.idle_time;
+    taskEXIT_CRITICAL();
+
+    /* The idle task has not run since, so the load is that of the current
+       window */
+    if (header.tick - load_tick > 2*RTOS_LOAD_WINDOW_MS){
+        header.cpu_load = rtosLoad(total_time - load_run, ulTaskGetIdleRunTimeCounter() - load_idle);
+    }
+
+    memcpy(payload, &header, sizeof(header));
+    len = sizeof(header);
+
+    for (int i = 0; i < header.num_tasks; i++){
+        memset(&task, 0, sizeof(task));
+        strncpy(task.name, tasks[i].pcTaskName, RECORD_RTOS_NAME_LEN);
+        task.priority = tasks[i].uxCurrentPriority;
+        task.state = tasks[i].eCurrentState;
+        task.stack_free = tasks[i].usStackHighWaterMark;
+        task.run_time = tasks[i].ulRunTimeCounter;
+        memcpy(&payload[len], &task, sizeof(task));
+        len += sizeof(task);
+    }
+
+    for (uint32_t i = 0; i < NUM_RTOS_QUEUES; i++){
+        const MailQueueCb *mail = (const MailQueueCb *)rtos_queues[i].queue();
+
+        memset(&queue, 0, sizeof(queue));
+        strncpy(queue.name, rtos_queues[i].name, RECORD_RTOS_NAME_LEN);
+        if (mail != NULL){
+            queue.size = mail->queue_def->queue_sz;
+            queue.used = uxQueueMessagesWaiting(mail->handle);
+        }
+        queue.peak = queue_peaks[i];
+        if (reset_peaks){
+            queue_peaks[i] = queue.used;
+        }
+        memcpy(&payload[len], &queue, sizeof(queue));
+        len += sizeof(queue);
+    }
+
+    CDC_GetTxStats_FS(&tx_stats);
+    usb.queued_bytes = tx_stats.queued_bytes;
+    usb.sent_bytes = tx_stats.sent_bytes;
+    usb.dropped_msgs = tx_stats.dropped_msgs;
+    usb.dropped_bytes = tx_stats.dropped_bytes;
+    usb.high_water = tx_stats.high_water;
+    usb.pending = tx_stats.pending;
+    memcpy(&payload[len], &usb, sizeof(usb));
+    len += sizeof(usb);
+
+    return sendRecord(RECORD_TYPE_RTOS, payload, len);
+}
@@ -24,10 +24,33 @@
 #include "common.h"
 
 /* USER CODE BEGIN 0 */
-
+#include "cmsis_os.h"
+#include <stdbool.h>
+
+/* Transfers shorter than this are not worth setting up the DMA for, e.g.
+register accesses. */
+#define SPI_DMA_MIN_LEN 32
+
+/* Released by the DMA transfer-complete callbacks. */
+static osStaticSemaphoreDef_t spi_dma_sem_cb;
+osSemaphoreStaticDef(spiDma, &spi_dma_sem_cb);
+static osSemaphoreId spi_dma_sem = NULL;
+static volatile bool spi_dma_error = false;
+
+/* Held by a task for a whole transaction, header and body, since it may sleep
+on spi_dma_sem in the middle of it. The DW1000 ISR never takes it. */
+static osStaticMutexDef_t spi_mutex_cb;
+osMutexStaticDef(spiBus, &spi_mutex_cb);
+static osMutexId spi_mutex = NULL;
+
+/* Cycles spent waiting on spi_dma_sem, during which other tasks run. Only
+counted if the DWT cycle counter is enabled. */
+static volatile uint32_t spi_dma_wait_cycles = 0;
 /* USER CODE END 0 */
 
 SPI_HandleTypeDef hspi1;
+DMA_HandleTypeDef hdma_spi1_rx;
+DMA_HandleTypeDef hdma_spi1_tx;
 
 /* SPI1 init function */
 void MX_SPI1_Init(void)
@@ -57,7 +80,13 @@ void MX_SPI1_Init(void)
     Error_Handler();
   }
   /* USER CODE BEGIN SPI1_Init 2 */
-
+  /* A static binary semaphore is created taken, so it waits for the DMA. */
+  if (spi_dma_sem == NULL){
+    spi_dma_sem = osSemaphoreCreate(osSemaphore(spiDma), 1);
+  }
+  if (spi_mutex == NULL){
+    spi_mutex = osMutexCreate(osMutex(spiBus));
+  }
   /* USER CODE END SPI1_Init 2 */
 
 }
@@ -96,6 +125,50 @@ void HAL_SPI_MspInit(SPI_HandleTypeDef* spiHandle)
     GPIO_InitStruct.Alternate = GPIO_AF5_SPI1;
     HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
 
+    /* SPI1 DMA Init */
+    __HAL_RCC_DMA2_CLK_ENABLE();
+
+    /* SPI1_RX Init */
+    hdma_spi1_rx.Instance = DMA2_Stream0;
+    hdma_spi1_rx.Init.Channel = DMA_CHANNEL_3;
+    hdma_spi1_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_spi1_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_spi1_rx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_spi1_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_spi1_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_spi1_rx.Init.Mode = DMA_NORMAL;
+    hdma_spi1_rx.Init.Priority = DMA_PRIORITY_HIGH;
+    hdma_spi1_rx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(&hdma_spi1_rx) != HAL_OK)
+    {
+      Error_Handler();
+    }
+    __HAL_LINKDMA(spiHandle,hdmarx,hdma_spi1_rx);
+
+    /* SPI1_TX Init */
+    hdma_spi1_tx.Instance = DMA2_Stream3;
+    hdma_spi1_tx.Init.Channel = DMA_CHANNEL_3;
+    hdma_spi1_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    hdma_spi1_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_spi1_tx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_spi1_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_spi1_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_spi1_tx.Init.Mode = DMA_NORMAL;
+    hdma_spi1_tx.Init.Priority = DMA_PRIORITY_HIGH;
+    hdma_spi1_tx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(&hdma_spi1_tx) != HAL_OK)
+    {
+      Error_Handler();
+    }
+    __HAL_LINKDMA(spiHandle,hdmatx,hdma_spi1_tx);
+
+    /* DMA interrupt init. Must not be above configMAX_SYSCALL_INTERRUPT_PRIORITY,
+    since the callbacks release a semaphore. */
+    HAL_NVIC_SetPriority(DMA2_Stream0_IRQn, 5, 0);
+    HAL_NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+    HAL_NVIC_SetPriority(DMA2_Stream3_IRQn, 5, 0);
+    HAL_NVIC_EnableIRQ(DMA2_Stream3_IRQn);
+
   /* USER CODE BEGIN SPI1_MspInit 1 */
 
   /* USER CODE END SPI1_MspInit 1 */
@@ -123,6 +196,10 @@ void HAL_SPI_MspDeInit(SPI_HandleTypeDef* spiHandle)
 
     HAL_GPIO_DeInit(GPIOB, GPIO_PIN_3|GPIO_PIN_4|GPIO_PIN_5);
 
+    /* SPI1 DMA DeInit */
+    HAL_DMA_DeInit(spiHandle->hdmarx);
+    HAL_DMA_DeInit(spiHandle->hdmatx);
+
   /* USER CODE BEGIN SPI1_MspDeInit 1 */
   usb_print("Deinitializing SPI interface.\n");
   osDelay(1);
@@ -148,6 +225,107 @@ void SPI1_DeInit(void){
   HAL_SPI_DeInit(&hspi1);
 }
 
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: spiUseDma()
+ *
+ * The DMA path blocks on a semaphore, so it is only taken from a task. The
+ * DW1000 ISR, which runs above the RTOS interrupt priorities, always polls.
+ */
+static int spiInTask(void)
+{
+	return __get_IPSR() == 0 && osKernelRunning();
+}
+
+static int spiUseDma(uint32 length)
+{
+	return length >= SPI_DMA_MIN_LEN && spiInTask();
+} // end spiUseDma()
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: spiLock()
+ *
+ * Take the bus for a transaction, when called from a task. Returns whether
+ * spiUnlock() must be called.
+ */
+static int spiLock(void)
+{
+	if (!spiInTask()){
+		return 0;
+	}
+	osMutexWait(spi_mutex, osWaitForever);
+	return 1;
+} // end spiLock()
+
+static void spiUnlock(int locked)
+{
+	if (locked){
+		osMutexRelease(spi_mutex);
+	}
+} // end spiUnlock()
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: spiDmaStart()
+ *
+ * Clear a completion left over by a transfer that was aborted after it timed
+ * out, so that it does not end the wait for the next one early.
+ */
+static void spiDmaStart(void)
+{
+	osSemaphoreWait(spi_dma_sem, 0);
+	spi_dma_error = false;
+} // end spiDmaStart()
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: spiDmaWait()
+ *
+ * Sleep until the DMA transfer of the body completes. Returns 0 for success,
+ * or -1 if it timed out and was aborted.
+ */
+static int spiDmaWait(void)
+{
+	uint32_t start = DWT->CYCCNT;
+	int32_t ret = osSemaphoreWait(spi_dma_sem, SPI_TIMEOUT);
+
+	spi_dma_wait_cycles += DWT->CYCCNT - start;
+	if (ret != osOK || spi_dma_error){
+		spi_dma_error = false;
+		HAL_SPI_Abort(&hspi1);
+		return -1;
+	}
+	return 0;
+} // end spiDmaWait()
+
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+	osSemaphoreRelease(spi_dma_sem);
+}
+
+void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+	osSemaphoreRelease(spi_dma_sem);
+}
+
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+	osSemaphoreRelease(spi_dma_sem);
+}
+
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+	spi_dma_error = true;
+	osSemaphoreRelease(spi_dma_sem);
+}
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: spiDmaWaitCycles()
+ *
+ * Total CPU cycles handed over to other tasks while waiting for the DMA.
+ */
+uint32_t spiDmaWaitCycles(void)
+{
+	return spi_dma_wait_cycles;
+} // end spiDmaWaitCycles()
+
 /*! ------------------------------------------------------------------------------------------------------------------
  * Function: writetospi()
  *
@@ -155,35 +333,51 @@ void SPI1_DeInit(void){
  * Takes two separate byte buffers for write header and write data
  * returns 0 for success, or -1 for error
  * 
- * Extracted from the Decawave tutorial.
+ * The chip select is driven by the SPI peripheral (hardware NSS) and stays
+ * asserted while it is enabled, so the header and the body are sent back to
+ * back straight from the caller's buffers. Long bodies are sent by DMA.
  * 
  */
 #pragma GCC optimize ("O3")
 int writetospi(uint16 headerLength, const uint8 *headerBuffer, uint32 bodylength, const uint8 *bodyBuffer)
 {
-	uint32_t i;
+	int ret = 0;
+	int locked = spiLock();
+	HAL_StatusTypeDef status;
 
-	//allocate a big local buffer
-	const uint32_t size = headerLength + bodylength;
-	uint8_t write_buffer[size];
-  
-	// fill the buffer
-	for(i=0; i<headerLength; i++){
-		write_buffer[i]=headerBuffer[i];
+	//begin transmission by enabling CS
+	__HAL_SPI_ENABLE(&hspi1);
+
+	status = HAL_SPI_Transmit(&hspi1, (uint8_t*)headerBuffer, headerLength, SPI_TIMEOUT);
+	if (status == HAL_BUSY){
+		// The transfer of the DW1000 ISR or of a task it interrupted, left alone
+		spiUnlock(locked);
+		return -1;
 	}
-	for(i=headerLength;i<size;i++){
-		write_buffer[i]=bodyBuffer[i-headerLength];
+	if (status != HAL_OK){
+		ret = -1;
+	}
+	else if (bodylength == 0){
+		// header only
+	}
+	else if (spiUseDma(bodylength)){
+		spiDmaStart();
+		if (HAL_SPI_Transmit_DMA(&hspi1, (uint8_t*)bodyBuffer, bodylength) != HAL_OK){
+			ret = -1;
+		}
+		else{
+			ret = spiDmaWait();
+		}
+	}
+	else if (HAL_SPI_Transmit(&hspi1, (uint8_t*)bodyBuffer, bodylength, SPI_TIMEOUT) != HAL_OK){
+		ret = -1;
 	}
 
-
-	//begin transmission by enabling CS
-	__HAL_SPI_ENABLE(&hspi1);
-	//transmit
-	HAL_SPI_Transmit(&hspi1, write_buffer,size,SPI_TIMEOUT);
 	//end tranmission
 	__HAL_SPI_DISABLE(&hspi1);
+	spiUnlock(locked);
 
-    return 0;
+    return ret;
 } // end writetospi()
 
 
@@ -195,37 +389,47 @@ int writetospi(uint16 headerLength, const uint8 *headerBuffer, uint32 bodylength
  * returns the offset into read buffer where first byte of read data may be found,
  * or returns -1 if there was an error
  *
- * Extracted from the Decawave tutorial.
+ * The data is received straight into the caller's buffer, by DMA if it is
+ * long. The DW1000 ignores MOSI while it sends the data, so the buffer's
+ * previous content is clocked out as padding.
  * 
  */
 int readfromspi(uint16 headerLength, const uint8 *headerBuffer, uint32 readlength, uint8 *readBuffer)
 {
-	uint32_t i;
-
-	// alocate temp buffer
-	const uint32 size = readlength + headerLength;
-	uint8_t RXbuffer[size];
-	uint8_t TXbuffer[size];
-   // We fill the TX Buffer
-	for(i=0; i<headerLength;i++){
-		TXbuffer[i] = headerBuffer[i];
-	}
+	int ret = 0;
+	int locked = spiLock();
+	HAL_StatusTypeDef status;
 
 	//Begin transmission (activate CS)
-	//Begin data swapping
 	__HAL_SPI_ENABLE(&hspi1);
 
-	HAL_SPI_TransmitReceive(&hspi1, TXbuffer, RXbuffer, size, SPI_TIMEOUT);
+	status = HAL_SPI_Transmit(&hspi1, (uint8_t*)headerBuffer, headerLength, SPI_TIMEOUT);
+	if (status == HAL_BUSY){
+		// The transfer of the DW1000 ISR or of a task it interrupted, left alone
+		spiUnlock(locked);
+		return -1;
+	}
+	if (status != HAL_OK){
+		ret = -1;
+	}
+	else if (spiUseDma(readlength)){
+		spiDmaStart();
+		if (HAL_SPI_Receive_DMA(&hspi1, readBuffer, readlength) != HAL_OK){
+			ret = -1;
+		}
+		else if (spiDmaWait() != 0){
+			ret = -1;
+		}
+	}
+	else if (HAL_SPI_Receive(&hspi1, readBuffer, readlength, SPI_TIMEOUT) != HAL_OK){
+		ret = -1;
+	}
 
   // End of the transmission
 	__HAL_SPI_DISABLE(&hspi1);
+	spiUnlock(locked);
 
-	// fill the results buffer
-	for(i=headerLength;i<size;i++){
-		readBuffer[i-headerLength]=RXbuffer[i];
-	}
-
-  return 0;
+  return ret;
 } // end readfromspi()
 
 /* USER CODE END 1 */
@@ -11,6 +11,10 @@
 #include "common.h"
 #include <stdio.h>
 #include "deca_device_api.h"
+#include "deca_types.h"
+#include "spi.h"
+#include "dwt_iqr.h"
+#include "ranging_math.h"
 
 /*! ------------------------------------------------------------------------------------------------------------------
  * Function: dw_test()
@@ -48,4 +52,167 @@ void read_id(){
   usb_print(print_buff);
   
   osDelay(100);
-} // end dw_test()
\ No newline at end of file
+} // end dw_test()
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: spi_legacy_write(), spi_legacy_read()
+ *
+ * The SPI port as it was before DMA transfers, which copied the header and
+ * the data through stack buffers. Only kept as a reference for spi_benchmark().
+ * The buffers are static here, so that the benchmark fits the stack of the
+ * USB task (C21); the copies cost the same.
+ * 
+ */
+#define SPI_LEGACY_MAX_LEN (1 + 1024)
+
+static uint8_t legacy_tx[SPI_LEGACY_MAX_LEN];
+static uint8_t legacy_rx[SPI_LEGACY_MAX_LEN];
+
+static int spi_legacy_write(uint16 headerLength, const uint8 *headerBuffer, uint32 bodylength, const uint8 *bodyBuffer){
+  uint32_t i;
+  const uint32_t size = headerLength + bodylength;
+  uint8_t *write_buffer = legacy_tx;
+
+  for(i=0; i<headerLength; i++){
+    write_buffer[i]=headerBuffer[i];
+  }
+  for(i=headerLength;i<size;i++){
+    write_buffer[i]=bodyBuffer[i-headerLength];
+  }
+
+  __HAL_SPI_ENABLE(&hspi1);
+  HAL_SPI_Transmit(&hspi1, write_buffer,size,SPI_TIMEOUT);
+  __HAL_SPI_DISABLE(&hspi1);
+
+  return 0;
+}
+
+static int spi_legacy_read(uint16 headerLength, const uint8 *headerBuffer, uint32 readlength, uint8 *readBuffer){
+  uint32_t i;
+  const uint32 size = readlength + headerLength;
+  uint8_t *RXbuffer = legacy_rx;
+  uint8_t *TXbuffer = legacy_tx;
+
+  for(i=0; i<headerLength;i++){
+    TXbuffer[i] = headerBuffer[i];
+  }
+
+  __HAL_SPI_ENABLE(&hspi1);
+  HAL_SPI_TransmitReceive(&hspi1, TXbuffer, RXbuffer, size, SPI_TIMEOUT);
+  __HAL_SPI_DISABLE(&hspi1);
+
+  for(i=headerLength;i<size;i++){
+    readBuffer[i-headerLength]=RXbuffer[i];
+  }
+
+  return 0;
+}
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: spi_benchmark()
+ *
+ * Compares the CPU cycles of the legacy SPI port against the current one,
+ * reading and writing the TX buffer of the DW1000 (register file 0x09) with
+ * a register, frame and full buffer length. The current port hands the CPU
+ * over to other tasks while the DMA runs; those cycles are reported apart.
+ * Must be called from a task, while no ranging is going on. The header and
+ * data of each transfer must fit in SPI_LEGACY_MAX_LEN.
+ * 
+ */
+void spi_benchmark(){
+  static uint8_t buffer[1024];
+  static const uint32_t lengths[] = {4, 127, 1024};
+  const uint8_t read_header = 0x09;
+  const uint8_t write_header = 0x80 | 0x09;
+  uint32_t start, legacy_rd, legacy_wr, rd, wr, rd_wait, wr_wait;
+  char print_buff[100];
+  decaIrqStatus_t stat;
+
+  /* The cycle counter runs since DWT_Delay_Init(). It is not reset here:
+  the RTOS run time counter and the trace points rely on it running freely,
+  and the differences below are right across a wrap. */
+  stat = decamutexon();
+  for (int i=0; i<sizeof(lengths)/sizeof(lengths[0]); i++){
+    start = DWT->CYCCNT;
+    spi_legacy_write(1, &write_header, lengths[i], buffer);
+    legacy_wr = DWT->CYCCNT - start;
+
+    start = DWT->CYCCNT;
+    spi_legacy_read(1, &read_header, lengths[i], buffer);
+    legacy_rd = DWT->CYCCNT - start;
+
+    wr_wait = spiDmaWaitCycles();
+    start = DWT->CYCCNT;
+    writetospi(1, &write_header, lengths[i], buffer);
+    wr = DWT->CYCCNT - start;
+    wr_wait = spiDmaWaitCycles() - wr_wait;
+
+    rd_wait = spiDmaWaitCycles();
+    start = DWT->CYCCNT;
+    readfromspi(1, &read_header, lengths[i], buffer);
+    rd = DWT->CYCCNT - start;
+    rd_wait = spiDmaWaitCycles() - rd_wait;
+
+    sprintf(print_buff, "SPI %lu bytes: write %lu -> %lu (%lu idle), read %lu -> %lu (%lu idle) cycles\n",
+            lengths[i], legacy_wr, wr, wr_wait, legacy_rd, rd, rd_wait);
+    usb_print(print_buff);
+  }
+  decamutexoff(stat);
+
+  osDelay(100);
+} // end spi_benchmark()
+
+/*! ------------------------------------------------------------------------------------------------------------------
+ * Function: ranging_math_benchmark()
+ *
+ * Compares the CPU cycles of the double-precision range computation used
+ * before ranging_math.c against its fixed-point kernels, for one SS-TWR and
+ * one DS-TWR exchange with 1 ms reply times.
+ * 
+ */
+void ranging_math_benchmark(){
+  volatile uint32_t Ra1 = 63898003, Db1 = 63897205, Ra2 = 63898011, Db2 = 63897215;
+  volatile float skew = 8.0f, dist;
+  uint32_t start, legacy_ss, legacy_ds, ss, ss_skew, ds, ds_asym;
+  char print_buff[120];
+
+  // The cycle counter runs freely since DWT_Delay_Init(), see spi_benchmark()
+  start = DWT->CYCCNT;
+  {
+    double Ra = (double)Ra1;
+    double Db = (double)Db1;
+    int64_t tof_dtu = (int64_t)((Ra - Db) / (2));
+    dist = tof_dtu * DWT_TIME_UNITS * SPEED_OF_LIGHT;
+  }
+  legacy_ss = DWT->CYCCNT - start;
+
+  start = DWT->CYCCNT;
+  {
+    double tof_dtu = 0.5*((double)Ra1 - (double)Ra2/(double)Db2*(double)Db1);
+    dist = tof_dtu * DWT_TIME_UNITS * SPEED_OF_LIGHT;
+  }
+  legacy_ds = DWT->CYCCNT - start;
+
+  start = DWT->CYCCNT;
+  dist = tofToDistance(tofSS(Ra1, Db1));
+  ss = DWT->CYCCNT - start;
+
+  start = DWT->CYCCNT;
+  dist = tofToDistance(tofSSSkew(Ra1, Db1, skew));
+  ss_skew = DWT->CYCCNT - start;
+
+  start = DWT->CYCCNT;
+  dist = tofToDistance(tofDS(Ra1, Ra2, Db1, Db2));
+  ds = DWT->CYCCNT - start;
+
+  start = DWT->CYCCNT;
+  dist = tofToDistance(tofDSAsym(Ra1, Ra2, Db1, Db2));
+  ds_asym = DWT->CYCCNT - start;
+  (void)dist;
+
+  sprintf(print_buff, "SS %lu -> %lu (skew %lu), DS %lu -> %lu (asym %lu) cycles\n",
+          legacy_ss, ss, ss_skew, legacy_ds, ds, ds_asym);
+  usb_print(print_buff);
+  
+  osDelay(100);
+} // end ranging_math_benchmark()
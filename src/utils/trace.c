@@ -0,0 +1,235 @@
+/**
+  ******************************************************************************
+  * @file    trace.c
+  * @brief   Trace points over the CPU cycle counter. Each phase keeps its
+  *          count, minimum, mean and maximum, and a histogram from which its
+  *          99th percentile is found, and the last samples of all phases are
+  *          kept in a ring buffer. Samples are recorded from the DW1000
+  *          interrupt as well as from the tasks.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "trace.h"
+#include "common.h"
+#include <stdio.h>
+#include <string.h>
+
+/* Defines -------------------------------------------------------------------*/
+/* Samples of all phases kept for TRACE_REPORT_RECENT */
+#define TRACE_RING_LEN (32)
+
+/* The histogram has 4 bins per power of two, so that the percentile is within
+ * 25% of the true value, and covers the full 32-bit range. */
+#define TRACE_BIN_BITS (2)
+#define TRACE_BINS ((32 - TRACE_BIN_BITS + 1) << TRACE_BIN_BITS)
+
+#ifdef UWB_SIM
+/* The simulator runs the interrupt and the tasks as threads. */
+#include <pthread.h>
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+#define TRACE_LOCK()   pthread_mutex_lock(&trace_lock)
+#define TRACE_UNLOCK() pthread_mutex_unlock(&trace_lock)
+#else
+#define TRACE_LOCK()   uint32_t primask = __get_PRIMASK(); __disable_irq()
+#define TRACE_UNLOCK() __set_PRIMASK(primask)
+#endif
+
+/* Typedefs ------------------------------------------------------------------*/
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint16_t bins[TRACE_BINS];
+} TraceStats;
+
+typedef struct {
+    uint32_t start;
+    uint32_t cycles;
+    uint8_t phase;
+} TraceSample;
+
+/* Private variables ---------------------------------------------------------*/
+static const char *const trace_names[NUM_TRACE_PHASES] = {
+    [TRACE_ISR]           = "isr",
+    [TRACE_RX_READ]       = "rx_read",
+    [TRACE_RX_POWER]      = "rx_power",
+    [TRACE_RX_SKEW]       = "rx_skew",
+    [TRACE_EVENT_LATENCY] = "event_latency",
+    [TRACE_EVENT]         = "event",
+    [TRACE_POLL_START]    = "poll_start",
+    [TRACE_RESPONSE_WAIT] = "response_wait",
+    [TRACE_EXCHANGE]      = "exchange",
+    [TRACE_RECORD_FORMAT] = "record_format",
+    [TRACE_USB_PRINT]     = "usb_print",
+};
+
+static TraceStats trace_stats[NUM_TRACE_PHASES];
+static TraceSample trace_ring[TRACE_RING_LEN];
+static uint32_t trace_ring_next = 0;  // Total number of samples recorded
+
+/* Private functions ---------------------------------------------------------*/
+/*! ----------------------------------------------------------------------------
+ * Function: traceBin()
+ *
+ * @brief Histogram bin of a duration: values below 4 have their own bin, and
+ * each power of two above is split in 4.
+ */
+static uint32_t traceBin(uint32_t cycles){
+    uint32_t msb;
+
+    if (cycles < (1u << TRACE_BIN_BITS)){
+        return cycles;
+    }
+    msb = 31 - __builtin_clz(cycles);
+    return ((msb - TRACE_BIN_BITS + 1) << TRACE_BIN_BITS)
+         + ((cycles >> (msb - TRACE_BIN_BITS)) & ((1u << TRACE_BIN_BITS) - 1));
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: traceBinTop()
+ *
+ * @brief Largest duration that falls in a bin.
+ */
+static uint32_t traceBinTop(uint32_t bin){
+    uint32_t shift, sub;
+
+    if (bin < (1u << TRACE_BIN_BITS)){
+        return bin;
+    }
+    shift = (bin >> TRACE_BIN_BITS) - 1;
+    sub = bin & ((1u << TRACE_BIN_BITS) - 1);
+    return ((((1u << TRACE_BIN_BITS) + sub + 1) << shift) - 1);
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: tracePercentile()
+ *
+ * @brief Upper bound of the 99th percentile of a histogram, at most its
+ * maximum.
+ */
+static uint32_t tracePercentile(const TraceStats *stats){
+    uint32_t total = 0, rank, seen = 0, top;
+
+    for (int i = 0; i < TRACE_BINS; i++){
+        total += stats->bins[i];
+    }
+    rank = total - total/100;
+    for (int i = 0; i < TRACE_BINS; i++){
+        seen += stats->bins[i];
+        if (seen >= rank && seen > 0){
+            top = traceBinTop(i);
+            return (top < stats->max) ? top : stats->max;
+        }
+    }
+    return stats->max;
+}
+
+/* Public functions ----------------------------------------------------------*/
+/*! ----------------------------------------------------------------------------
+ * Function: traceRecord()
+ *
+ * @brief Record one sample of a phase. Callable from the DW1000 interrupt.
+ *
+ * @param phase (uint8_t) TRACE_ phase.
+ * @param start (uint32_t) traceCycles() at the start of the phase.
+ * @param end (uint32_t) traceCycles() at its end.
+ */
+void traceRecord(uint8_t phase, uint32_t start, uint32_t end){
+#if UWB_TRACE
+    uint32_t cycles = end - start;
+    TraceStats *stats = &trace_stats[phase];
+    TraceSample *sample;
+    uint32_t bin = traceBin(cycles);
+
+    TRACE_LOCK();
+    sample = &trace_ring[trace_ring_next++ % TRACE_RING_LEN];
+    sample->start = start;
+    sample->cycles = cycles;
+    sample->phase = phase;
+
+    if (stats->count == 0 || cycles < stats->min){
+        stats->min = cycles;
+    }
+    if (cycles > stats->max){
+        stats->max = cycles;
+    }
+    stats->count++;
+    stats->sum += cycles;
+
+    /* Halve the whole histogram rather than let a bin overflow, which keeps
+       its shape */
+    if (stats->bins[bin] == UINT16_MAX){
+        for (int i = 0; i < TRACE_BINS; i++){
+            stats->bins[i] >>= 1;
+        }
+    }
+    stats->bins[bin]++;
+    TRACE_UNLOCK();
+#endif
+}
+
+/*! ----------------------------------------------------------------------------
+ * Function: traceReport()
+ *
+ * @brief Output the trace over USB, in CPU cycles. The first line gives the
+ * CPU frequency and the number of lines that follow:
+ *     R17|<cpu_hz>|<lines>
+ * then, for TRACE_REPORT_STATS and TRACE_REPORT_RESET, one line per phase
+ * that was recorded:
+ *     T17|<phase>|<count>|<min>|<mean>|<max>|<p99>
+ * and for TRACE_REPORT_RECENT, one line per sample, oldest first:
+ *     T17|<phase>|<start>|<cycles>
+ *
+ * @param what (uint8_t) TRACE_REPORT_.
+ */
+void traceReport(uint8_t what){
+    static TraceStats stats;  // Snapshots, too large for the stack of the USB task
+    static TraceSample ring[TRACE_RING_LEN];
+    uint32_t next, num = 0, phases = 0;
+    char line[80];
+
+    if (what == TRACE_REPORT_RECENT){
+        TRACE_LOCK();
+        memcpy(ring, trace_ring, sizeof(ring));
+        next = trace_ring_next;
+        TRACE_UNLOCK();
+
+        num = (next < TRACE_RING_LEN) ? next : TRACE_RING_LEN;
+        sprintf(line, "R17|%lu|%lu\r\n", HAL_RCC_GetHCLKFreq(), num);
+        usb_print(line);
+        for (uint32_t i = next - num; i != next; i++){
+            const TraceSample *s = &ring[i % TRACE_RING_LEN];
+            sprintf(line, "T17|%s|%lu|%lu\r\n", trace_names[s->phase], s->start, s->cycles);
+            usb_print(line);
+        }
+        return;
+    }
+
+    /* Only the phases counted in the first line are output */
+    for (int i = 0; i < NUM_TRACE_PHASES; i++){
+        if (trace_stats[i].count > 0){
+            phases |= 1u << i;
+            num++;
+        }
+    }
+    sprintf(line, "R17|%lu|%lu\r\n", HAL_RCC_GetHCLKFreq(), num);
+    usb_print(line);
+
+    for (int i = 0; i < NUM_TRACE_PHASES; i++){
+        TRACE_LOCK();
+        stats = trace_stats[i];
+        if (what == TRACE_REPORT_RESET){
+            memset(&trace_stats[i], 0, sizeof(trace_stats[i]));
+        }
+        TRACE_UNLOCK();
+
+        if (!(phases & (1u << i))){
+            continue;
+        }
+        sprintf(line, "T17|%s|%lu|%lu|%lu|%lu|%lu\r\n", trace_names[i], stats.count,
+                stats.min, (uint32_t)(stats.sum/stats.count), stats.max, tracePercentile(&stats));
+        usb_print(line);
+    }
+}
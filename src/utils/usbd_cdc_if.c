@@ -64,6 +64,13 @@
   */
 
 /* USER CODE BEGIN PRIVATE_DEFINES */
+/* Size of the transmit ring buffer. Must be a power of two so that the free
+running head and tail counters can be masked into an index. */
+#define APP_TX_RING_SIZE  4096
+#define APP_TX_RING_MASK  (APP_TX_RING_SIZE - 1)
+
+/* Largest single IN transfer handed to the driver. */
+#define APP_TX_MAX_TRANSFER  (16*CDC_DATA_FS_MAX_PACKET_SIZE)
 /* USER CODE END PRIVATE_DEFINES */
 
 /**
@@ -96,7 +103,16 @@ uint8_t UserRxBufferFS[APP_RX_DATA_SIZE];
 uint8_t UserTxBufferFS[APP_TX_DATA_SIZE];
 
 /* USER CODE BEGIN PRIVATE_VARIABLES */
+/* Transmit ring buffer. The head is only advanced by the producers, the tail
+only by the transmit-complete callback. Both are free running counters. */
+static uint8_t TxRingFS[APP_TX_RING_SIZE];
+static volatile uint32_t tx_head = 0;
+static volatile uint32_t tx_tail = 0;
+
+/* Number of bytes currently handed to the driver, starting at tx_tail. */
+static volatile uint32_t tx_in_flight = 0;
 
+static volatile CdcTxStats tx_stats = {0};
 /* USER CODE END PRIVATE_VARIABLES */
 
 /**
@@ -131,6 +147,7 @@ static int8_t CDC_TransmitCplt_FS(uint8_t *pbuf, uint32_t *Len, uint8_t epnum);
 
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_DECLARATION */
+static void CDC_StartNextTransfer_FS(void);
 
 /* USER CODE END PRIVATE_FUNCTIONS_DECLARATION */
 
@@ -158,6 +175,10 @@ static int8_t CDC_Init_FS(void)
   /* Set Application Buffers */
   USBD_CDC_SetTxBuffer(&hUsbDeviceFS, UserTxBufferFS, 0);
   USBD_CDC_SetRxBuffer(&hUsbDeviceFS, UserRxBufferFS);
+
+  /* A transfer interrupted by a disconnect never completes. Forget about it,
+  the data still queued in the ring is sent on the next write. */
+  tx_in_flight = 0;
   return (USBD_OK);
   /* USER CODE END 3 */
 }
@@ -339,12 +360,138 @@ static int8_t CDC_TransmitCplt_FS(uint8_t *Buf, uint32_t *Len, uint8_t epnum)
   UNUSED(Buf);
   UNUSED(Len);
   UNUSED(epnum);
+
+  /* Release the bytes that were just sent and chain the next transfer. This
+  runs in the USB interrupt, which the producers mask while touching the ring. */
+  tx_tail += tx_in_flight;
+  tx_in_flight = 0;
+  CDC_StartNextTransfer_FS();
   /* USER CODE END 13 */
   return result;
   
 }
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_IMPLEMENTATION */
+/**
+  * @brief  CDC_Write_FS
+  *         Queues data for transmission over the USB IN endpoint. The data is
+  *         copied into the transmit ring buffer, so the caller's buffer can be
+  *         reused as soon as this function returns. Never blocks. May be
+  *         called from tasks and from interrupts up to
+  *         configMAX_SYSCALL_INTERRUPT_PRIORITY.
+  *
+  * @param  Buf: Buffer of data to be sent
+  * @param  Len: Number of data to be sent (in bytes)
+  * @retval USBD_OK if the data was queued, USBD_BUSY if the ring buffer did not
+  *         have room for the whole message, in which case nothing is queued.
+  */
+uint8_t CDC_Write_FS(const uint8_t* Buf, uint16_t Len)
+{
+  UBaseType_t mask;
+  uint32_t idx, first;
+
+  if (Len == 0){
+    return USBD_OK;
+  }
+
+  /* Several tasks print, so the producer side is serialised by masking the
+  interrupts up to configMAX_SYSCALL_INTERRUPT_PRIORITY, i.e. the scheduler,
+  the USB and the DW1000 interrupts, for the duration of the copy. The
+  DW1000 time-stamps frames in hardware, so the short delay of its interrupt
+  does not affect the ranging. */
+  mask = portSET_INTERRUPT_MASK_FROM_ISR();
+
+  if (Len > APP_TX_RING_SIZE - (tx_head - tx_tail)){
+    tx_stats.dropped_msgs++;
+    tx_stats.dropped_bytes += Len;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+    return USBD_BUSY;
+  }
+
+  /* Copy in at most two pieces, wrapping around the end of the ring. */
+  idx = tx_head & APP_TX_RING_MASK;
+  first = APP_TX_RING_SIZE - idx;
+  if (first > Len){
+    first = Len;
+  }
+  memcpy(&TxRingFS[idx], Buf, first);
+  memcpy(&TxRingFS[0], &Buf[first], Len - first);
+  tx_head += Len;
+
+  tx_stats.queued_bytes += Len;
+  if (tx_head - tx_tail > tx_stats.high_water){
+    tx_stats.high_water = tx_head - tx_tail;
+  }
+
+  /* Only kick the driver from thread mode. Starting a transfer from an
+  interrupt that preempted the USB interrupt could collide with the driver's
+  own locking; the data is then picked up by the next write or completion. */
+  if (__get_IPSR() == 0){
+    CDC_StartNextTransfer_FS();
+  }
+
+  portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+
+  return USBD_OK;
+}
+
+/**
+  * @brief  CDC_GetTxStats_FS
+  *         Returns a snapshot of the transmit ring buffer statistics.
+  * @param  stats: Structure to be filled
+  */
+void CDC_GetTxStats_FS(CdcTxStats* stats)
+{
+  UBaseType_t mask = portSET_INTERRUPT_MASK_FROM_ISR();
+  *stats = tx_stats;
+  stats->pending = tx_head - tx_tail;
+  portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+/**
+  * @brief  CDC_StartNextTransfer_FS
+  *         Hands the next contiguous block of the ring buffer to the driver if
+  *         no transfer is ongoing. Must be called with the USB interrupt masked
+  *         or from the USB interrupt itself.
+  */
+static void CDC_StartNextTransfer_FS(void)
+{
+  USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
+  uint32_t pending, idx, len;
+
+  /* Not enumerated yet, or previous transfer still ongoing. */
+  if (hcdc == NULL || hUsbDeviceFS.dev_state != USBD_STATE_CONFIGURED
+      || tx_in_flight != 0 || hcdc->TxState != 0){
+    return;
+  }
+
+  pending = tx_head - tx_tail;
+  if (pending == 0){
+    return;
+  }
+
+  /* Largest contiguous block, i.e. up to the end of the ring. */
+  idx = tx_tail & APP_TX_RING_MASK;
+  len = APP_TX_RING_SIZE - idx;
+  if (len > pending){
+    len = pending;
+  }
+  if (len > APP_TX_MAX_TRANSFER){
+    len = APP_TX_MAX_TRANSFER;
+  }
+
+  /* Every transfer ends the host's read, with a short packet or with the
+  zero-length packet the CDC class sends after a multiple of the packet size,
+  so there is no point in rounding len to whole packets. */
+  tx_in_flight = len;
+  USBD_CDC_SetTxBuffer(&hUsbDeviceFS, &TxRingFS[idx], len);
+  if (USBD_CDC_TransmitPacket(&hUsbDeviceFS) != USBD_OK){
+    tx_in_flight = 0;
+  }
+  else{
+    tx_stats.sent_bytes += len;
+  }
+}
 /* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
 /**
@@ -0,0 +1,30 @@
+/**
+  ******************************************************************************
+  * @file    test.h
+  * @brief   Minimal checks shared by the host tests. Each test is its own
+  *          program, which prints the failed checks and exits with 1 if
+  *          there were any.
+  ******************************************************************************
+  */
+#ifndef __TEST_H__
+#define __TEST_H__
+
+#include <stdio.h>
+
+static int test_failures = 0;
+
+/* Counts and prints a failed check, with a printf-style explanation. */
+#define CHECK(cond, ...)                                                       \
+    do {                                                                       \
+        if (!(cond)){                                                          \
+            test_failures++;                                                   \
+            printf("%s:%d: check failed: %s: ", __FILE__, __LINE__, #cond);    \
+            printf(__VA_ARGS__);                                               \
+            printf("\n");                                                      \
+        }                                                                      \
+    } while (0)
+
+/* Value of main() */
+#define TEST_RESULT() (test_failures ? 1 : 0)
+
+#endif /* __TEST_H__ */
@@ -0,0 +1,253 @@
+/**
+  ******************************************************************************
+  * @file    test_ranging_math.c
+  * @brief   Host test of the time-of-flight kernels of ranging_math.c against
+  *          the same formulas in double precision, and against the true time
+  *          of flight, over exchanges with representative reply times,
+  *          distances and clock offsets. Also checks the 40-bit time-stamps
+  *          across the wrap-around of the DW1000 clock, from the registers
+  *          through the final messages to the durations.
+  ******************************************************************************
+  */
+/* Includes ------------------------------------------------------------------*/
+#include "ranging_math.h"
+#include "dwt_general.h"
+#include "cmsis_os.h"
+#include "test.h"
+#include <math.h>
+#include <string.h>
+
+/* Defines -------------------------------------------------------------------*/
+/* DW1000 time units per second, 128*499.2 MHz */
+#define TICKS_PER_S (63.8976e9)
+
+/* One fixed-point time unit of the kernels */
+#define FIXED (1 << TOF_FRAC_BITS)
+
+/* Private variables ---------------------------------------------------------*/
+/* From a register access to the longest reply the kernels allow, half the
+ * wrap-around of the clock */
+static const double reply_times[] = {300e-6, 1e-3, 10e-3, 100e-3, 1.0, 8.0};
+
+static const double distances[] = {0.0, 0.5, 10.0, 100.0, 300.0};
+
+/* Clock offsets of the initiator and of the target, in ppm */
+static const double offsets[][2] = {{0, 0}, {-10, 15}, {20, -20}, {-20, -20}};
+
+/* Time-stamp registers of the DW1000, as read by dwt_general.c */
+static uint8_t tx_ts_reg[5];
+static uint8_t rx_ts_reg[5];
+
+/* Stubs of what dwt_general.c needs from the radio and the board ------------*/
+void dwt_readtxtimestamp(uint8 *timestamp){ memcpy(timestamp, tx_ts_reg, 5); }
+void dwt_readrxtimestamp(uint8 *timestamp){ memcpy(timestamp, rx_ts_reg, 5); }
+int dwt_initialise(int config){ return DWT_SUCCESS; }
+void dwt_configure(dwt_config_t *config){}
+void dwt_configuretxrf(dwt_txconfig_t *config){}
+void dwt_seteui(uint8 *eui64){}
+void dwt_setleds(uint8 mode){}
+void dwt_settxantennadelay(uint16 antennaDly){}
+void dwt_setrxantennadelay(uint16 antennaDly){}
+void port_set_dw1000_slowrate(void){}
+void port_set_dw1000_fastrate(void){}
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init){}
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState){}
+uint32_t HAL_RCC_GetHCLKFreq(void){ return 168000000; }
+uint8_t get_board_id(void){ return 1; }
+osStatus osDelay(uint32_t millisec){ return osOK; }
+void usb_print(char *str){}
+
+/* Private functions ---------------------------------------------------------*/
+static uint64_t ticks(double seconds_ideal, double ppm){
+    return (uint64_t)llround(seconds_ideal*TICKS_PER_S*(1 + ppm*1e-6));
+}
+
+/* Single-sided exchange: Ra by the initiator, Db by the target. */
+static void testSS(double dist, double reply, double ppm_i, double ppm_t){
+    double tof = dist/SPEED_OF_LIGHT;
+    uint64_t Ra = ticks(2*tof + reply, ppm_i);
+    uint64_t Db = ticks(reply, ppm_t);
+    /* As the initiator measures it from the carrier integrator */
+    float skew = (float)((ppm_i - ppm_t)/(1 + ppm_t*1e-6));
+    double ref, ref_skew, corr, truth;
+    int32_t got;
+
+    ref = ((double)Ra - (double)Db)/2*FIXED;
+    got = tofSS(Ra, Db);
+    CHECK(fabs(got - ref) <= 0.5, "tofSS %.1f m, Db %g s: %d, expected %.1f",
+          dist, reply, got, ref);
+
+    corr = (double)Db*skew*1e-6;
+    ref_skew = ((double)Ra - (double)Db - corr)/2*FIXED;
+    got = tofSSSkew(Ra, Db, skew);
+    /* The correction term is computed in single precision */
+    CHECK(fabs(got - ref_skew) <= 1 + fabs(corr)*FIXED*0x1p-23,
+          "tofSSSkew %.1f m, Db %g s, %g/%g ppm: %d, expected %.1f",
+          dist, reply, ppm_i, ppm_t, got, ref_skew);
+
+    /* With the clock offset corrected, only the offset of the initiator on
+       the time of flight itself and the rounding of the time-stamps remain */
+    truth = tof*TICKS_PER_S*FIXED;
+    CHECK(fabs(got - truth) <= FIXED + truth*fabs(ppm_i)*1e-6 + fabs(corr)*FIXED*0x1p-23,
+          "tofSSSkew %.1f m, Db %g s, %g/%g ppm: %d, true %.1f",
+          dist, reply, ppm_i, ppm_t, got, truth);
+}
+
+/* Double-sided exchange where the target sends both responses: Ra1 and Ra2
+ * by the initiator, Db1 and Db2 by the target. */
+static void testDS(double dist, double reply1, double reply2, double ppm_i, double ppm_t){
+    double tof = dist/SPEED_OF_LIGHT;
+    uint64_t Ra1 = ticks(2*tof + reply1, ppm_i);
+    uint64_t Ra2 = ticks(reply2, ppm_i);
+    uint64_t Db1 = ticks(reply1, ppm_t);
+    uint64_t Db2 = ticks(reply2, ppm_t);
+    double ref, truth;
+    int32_t got;
+
+    ref = ((double)Ra1 - (double)Db1*(double)Ra2/(double)Db2)/2*FIXED;
+    got = tofDS(Ra1, Ra2, Db1, Db2);
+    /* Double precision itself rounds the products of long reply times */
+    CHECK(fabs(got - ref) <= 1 + fabs((double)Ra1)*FIXED*0x1p-52,
+          "tofDS %.1f m, Db %g/%g s, %g/%g ppm: %d, expected %.1f",
+          dist, reply1, reply2, ppm_i, ppm_t, got, ref);
+
+    /* The rounding of the time-stamps is scaled by Db1/Db2 */
+    truth = tof*TICKS_PER_S*FIXED;
+    CHECK(fabs(got - truth) <= FIXED*(1 + reply1/reply2) + truth*fabs(ppm_i)*1e-6,
+          "tofDS %.1f m, Db %g/%g s, %g/%g ppm: %d, true %.1f",
+          dist, reply1, reply2, ppm_i, ppm_t, got, truth);
+}
+
+static void testDistance(void){
+    int32_t tofs[] = {0, 1, FIXED, -FIXED, 1000*FIXED, 64000*FIXED};
+    double expected;
+    float got;
+    unsigned i;
+
+    for (i = 0; i < sizeof(tofs)/sizeof(tofs[0]); i++){
+        expected = (double)tofs[i]/FIXED/TICKS_PER_S*SPEED_OF_LIGHT;
+        got = tofToDistance(tofs[i]);
+        CHECK(fabs(got - expected) <= 1e-6*fabs(expected) + 1e-9,
+              "tofToDistance(%d): %.6f, expected %.6f", tofs[i], got, expected);
+    }
+}
+
+static void setReg(uint8_t *reg, uint64_t ts){
+    int i;
+    for (i = 0; i < 5; i++){
+        reg[i] = (uint8_t)(ts >> 8*i);
+    }
+}
+
+static void testTsDiff(void){
+    CHECK(tsDiff(1000, 400) == 600, "no wrap");
+    CHECK(tsDiff(500, DWT_TS_MASK - 999) == 1500, "across the wrap");
+    CHECK(tsDiff(0, DWT_TS_MASK) == 1, "one tick across the wrap");
+    CHECK(tsDiff(1234, 1234) == 0, "equal");
+    CHECK(tsDiff(DWT_TS_MASK/2, 0) == DWT_TS_MASK/2, "half the wrap");
+}
+
+/* The time-stamps of the registers and of the final messages keep their 40
+ * bits, without sign extension or bits above them. */
+static void testTimestampFields(void){
+    static const uint64_t values[] = {
+        0, 1, 0xFFFFFFFFULL, 0x100000000ULL, 0x8000000000ULL,
+        DWT_TS_MASK - 1, DWT_TS_MASK,
+    };
+    uint8_t field[7];
+    uint64 ts;
+    unsigned i;
+
+    for (i = 0; i < sizeof(values)/sizeof(values[0]); i++){
+        setReg(tx_ts_reg, values[i]);
+        setReg(rx_ts_reg, values[i]);
+        CHECK(get_tx_timestamp_u64() == values[i], "TX register %llx",
+              (unsigned long long)values[i]);
+        CHECK(get_rx_timestamp_u64() == values[i], "RX register %llx",
+              (unsigned long long)values[i]);
+
+        memset(field, 0xA5, sizeof(field));
+        final_msg_set_ts(&field[1], values[i]);
+        final_msg_get_ts(&field[1], &ts);
+        CHECK(ts == values[i], "final message %llx: %llx",
+              (unsigned long long)values[i], (unsigned long long)ts);
+        CHECK(field[0] == 0xA5 && field[6] == 0xA5,
+              "final message %llx: written outside of its 5 bytes",
+              (unsigned long long)values[i]);
+    }
+
+    /* Bits above the 40 of the clock are dropped */
+    final_msg_set_ts(field, (1ULL << 40) | 42);
+    final_msg_get_ts(field, &ts);
+    CHECK(ts == 42, "final message of a 41-bit value: %llx", (unsigned long long)ts);
+}
+
+/* Exchanges whose time-stamps wrap around between the signals, as they reach
+ * the kernels: read from the registers, sent in a final message and taken
+ * apart with tsDiff(). The times of flight are those without the wrap. */
+static void testWrap(double dist, double reply){
+    static const uint64_t before[] = {1, 1000, 64000000};  // ticks before the wrap
+    double tof = dist/SPEED_OF_LIGHT;
+    uint64_t ra1 = ticks(2*tof + reply, 10), ra2 = ticks(reply, 10);
+    uint64_t db1 = ticks(reply, -10), db2 = ticks(reply, -10);
+    uint64 tx1, rx2, rx3, rx1, tx2, tx3;
+    uint8_t frame[15];
+    unsigned i, j;
+
+    for (i = 0; i < sizeof(before)/sizeof(before[0]); i++){
+        for (j = 0; j < sizeof(before)/sizeof(before[0]); j++){
+            /* The initiator sends near the end of its clock, the target
+               replies near the end of its own */
+            tx1 = DWT_TS_MASK + 1 - before[i];
+            rx2 = (tx1 + ra1) & DWT_TS_MASK;
+            rx3 = (rx2 + ra2) & DWT_TS_MASK;
+            rx1 = DWT_TS_MASK + 1 - before[j]/2 - 1;
+            tx2 = (rx1 + db1) & DWT_TS_MASK;
+            tx3 = (tx2 + db2) & DWT_TS_MASK;
+
+            setReg(tx_ts_reg, tx1);
+            setReg(rx_ts_reg, rx2);
+            final_msg_set_ts(&frame[0], get_tx_timestamp_u64());
+            final_msg_set_ts(&frame[5], get_rx_timestamp_u64());
+            final_msg_set_ts(&frame[10], rx3);
+            final_msg_get_ts(&frame[0], &tx1);
+            final_msg_get_ts(&frame[5], &rx2);
+            final_msg_get_ts(&frame[10], &rx3);
+
+            CHECK(tofSS(tsDiff(rx2, tx1), tsDiff(tx2, rx1)) == tofSS(ra1, db1),
+                  "tofSS across the wrap, %llu/%llu ticks before it, Db %g s",
+                  (unsigned long long)before[i], (unsigned long long)before[j], reply);
+            CHECK(tofDS(tsDiff(rx2, tx1), tsDiff(rx3, rx2), tsDiff(tx2, rx1), tsDiff(tx3, tx2))
+                  == tofDS(ra1, ra2, db1, db2),
+                  "tofDS across the wrap, %llu/%llu ticks before it, Db %g s",
+                  (unsigned long long)before[i], (unsigned long long)before[j], reply);
+        }
+    }
+}
+
+/* Main ----------------------------------------------------------------------*/
+int main(void){
+    unsigned d, r, o;
+
+    for (d = 0; d < sizeof(distances)/sizeof(distances[0]); d++){
+        for (r = 0; r < sizeof(reply_times)/sizeof(reply_times[0]); r++){
+            for (o = 0; o < sizeof(offsets)/sizeof(offsets[0]); o++){
+                testSS(distances[d], reply_times[r], offsets[o][0], offsets[o][1]);
+                testDS(distances[d], reply_times[r], reply_times[r],
+                       offsets[o][0], offsets[o][1]);
+                /* Unequal replies, as with a response delay set by C08 */
+                testDS(distances[d], reply_times[r], reply_times[r]/2 + 200e-6,
+                       offsets[o][0], offsets[o][1]);
+            }
+        }
+    }
+    testDistance();
+
+    testTsDiff();
+    testTimestampFields();
+    for (r = 0; r < sizeof(reply_times)/sizeof(reply_times[0]); r++){
+        testWrap(10.0, reply_times[r]);
+    }
+
+    return TEST_RESULT();
+}
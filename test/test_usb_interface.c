@@ -0,0 +1,1001 @@
+/**
+  ******************************************************************************
+  * @file    test_usb_interface.c
+  * @brief   Host test of the USB command parser of usb_interface.c, and of
+  *          the reassembly of the commands in its ring buffer. USB packets
+  *          are posted to its mail queue as the CDC driver would, and
+  *          readUsb() runs stubs of the commands, which record what they
+  *          were called with. Also times the parser on streams of
+  *          back-to-back commands, against the linear buffer it had
+  *          before the ring buffer.
+  ******************************************************************************
+  */
+/* Includes ------------------------------------------------------------------*/
+#include "usb_interface.h"
+#include "commands.h"
+#include "dwt_iqr.h"
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+
+/* Typedefs ------------------------------------------------------------------*/
+/* The mail queue of usb_interface.c, a FIFO of the packets posted */
+struct os_mailQ_cb {
+    UsbMsg pool[USB_QUEUE_SIZE];
+    UsbMsg *fifo[USB_QUEUE_SIZE];
+    uint32_t head;
+    uint32_t count;
+};
+
+/* The fields of a command, as the host sends them: the same schemas as those
+ * of usb_interface.c, written out again so that any change to them shows. */
+typedef enum {INT=1, STR=2, BOOL=3, FLOAT=4, BYTES=5} FieldTypes;
+
+typedef struct {
+    FieldTypes type;
+    uint16_t offset;  // offset of the destination in CommandParams
+} TestField;
+
+typedef struct {
+    int number;
+    uint8_t num_fields;
+    TestField fields[5];
+} TestSchema;
+
+/* Defines -------------------------------------------------------------------*/
+#define FIELD(cmd, type, name) {type, offsetof(CommandParams, cmd.name)}
+
+/* Packets of commands of each parser benchmark */
+#define BENCH_PACKETS (2000)
+
+/* Private variables ---------------------------------------------------------*/
+static struct os_mailQ_cb mail_queue;
+
+/* Indexed by command number, every command of all_commands */
+static const TestSchema test_schemas[] = {
+    {0, 0, {{0}}},
+    {1, 0, {{0}}},
+    {2, 0, {{0}}},
+    {3, 5, {FIELD(c03, INT, test_int), FIELD(c03, STR, test_str),
+            FIELD(c03, BOOL, test_bool), FIELD(c03, FLOAT, test_flt),
+            FIELD(c03, BYTES, test_byte)}},
+    {4, 1, {FIELD(c04, BOOL, toggle)}},
+    {5, 4, {FIELD(c05, INT, target), FIELD(c05, BOOL, targ_meas),
+            FIELD(c05, INT, ds_twr), FIELD(c05, BOOL, get_cir)}},
+    {6, 1, {FIELD(c06, BYTES, data)}},
+    {7, 0, {{0}}},
+    {8, 1, {FIELD(c08, INT, delay)}},
+    {9, 0, {{0}}},
+    {10, 1, {FIELD(c10, INT, mode)}},
+    {11, 2, {FIELD(c11, BYTES, targets), FIELD(c11, BOOL, targ_meas)}},
+    {12, 2, {FIELD(c12, INT, slot_len), FIELD(c12, BYTES, slots)}},
+    {13, 2, {FIELD(c13, INT, half_window), FIELD(c13, BOOL, iq)}},
+    {14, 1, {FIELD(c14, INT, mode)}},
+    {15, 1, {FIELD(c15, INT, mode)}},
+    {16, 1, {FIELD(c16, INT, profile)}},
+    {17, 1, {FIELD(c17, INT, report)}},
+    {18, 1, {FIELD(c18, INT, reset)}},
+    {19, 4, {FIELD(c19, INT, profile), FIELD(c19, FLOAT, fpp_start),
+             FIELD(c19, FLOAT, fpp_step), FIELD(c19, BYTES, bias)}},
+    {20, 3, {FIELD(c20, INT, profile), FIELD(c20, INT, tx), FIELD(c20, INT, rx)}},
+    {21, 1, {FIELD(c21, INT, benchmark)}},
+};
+
+#define NUM_SCHEMAS ((int)(sizeof(test_schemas)/sizeof(test_schemas[0])))
+
+/* Commands run by readUsb(), in order, and the parameters of the last one */
+static int calls[16];
+static int num_calls;
+static CommandParams last_params;
+
+/* Value the command stubs return, 0 to have them retried */
+static int command_result = 1;
+
+/* Last string printed */
+static char printed[100];
+
+/* Stubs of the CMSIS-RTOS mail queue ----------------------------------------*/
+osMailQId osMailCreate(const osMailQDef_t *queue_def, osThreadId thread_id){
+    memset(&mail_queue, 0, sizeof(mail_queue));
+    *queue_def->cb = &mail_queue;
+    return &mail_queue;
+}
+
+osEvent osMailGet(osMailQId queue_id, uint32_t millisec){
+    osEvent evt;
+
+    memset(&evt, 0, sizeof(evt));
+    evt.status = osOK;
+    if (queue_id->count > 0){
+        evt.status = osEventMail;
+        evt.value.p = queue_id->fifo[queue_id->head];
+        queue_id->head = (queue_id->head + 1) % USB_QUEUE_SIZE;
+        queue_id->count--;
+    }
+    return evt;
+}
+
+osStatus osMailFree(osMailQId queue_id, void *mail){
+    return osOK;
+}
+
+/* Stubs of the rest of the firmware -----------------------------------------*/
+decaIrqStatus_t decamutexon(void){ return 0; }
+void decamutexoff(decaIrqStatus_t s){}
+
+void usb_print(char *str){
+    strncpy(printed, str, sizeof(printed) - 1);
+}
+
+static int commandCalled(int number, const CommandParams *params){
+    if (num_calls < (int)(sizeof(calls)/sizeof(calls[0]))){
+        calls[num_calls] = number;
+    }
+    num_calls++;
+    memcpy(&last_params, params, sizeof(CommandParams));
+    return command_result;
+}
+
+#define COMMAND_STUB(number, name) \
+    int name(const CommandParams *params){ return commandCalled(number, params); }
+
+COMMAND_STUB(0, c00_set_idle)
+COMMAND_STUB(1, c01_get_id)
+COMMAND_STUB(2, c02_reset)
+COMMAND_STUB(3, c03_do_tests)
+COMMAND_STUB(4, c04_toggle_passive)
+COMMAND_STUB(5, c05_initiate_twr)
+COMMAND_STUB(6, c06_broadcast)
+COMMAND_STUB(7, c07_get_max_frame_len)
+COMMAND_STUB(8, c08_set_response_delay)
+COMMAND_STUB(9, c09_jump_to_bootloader)
+COMMAND_STUB(10, c10_set_output_mode)
+COMMAND_STUB(11, c11_initiate_burst)
+COMMAND_STUB(12, c12_set_schedule)
+COMMAND_STUB(13, c13_set_cir_window)
+COMMAND_STUB(14, c14_set_passive_output)
+COMMAND_STUB(15, c15_set_rx_buffering)
+COMMAND_STUB(16, c16_set_radio_profile)
+COMMAND_STUB(17, c17_get_trace)
+COMMAND_STUB(18, c18_get_rtos_stats)
+COMMAND_STUB(19, c19_set_bias_table)
+COMMAND_STUB(20, c20_set_antenna_delay)
+COMMAND_STUB(21, c21_run_benchmark)
+
+/* Private functions ---------------------------------------------------------*/
+/* Posts one USB packet, as the CDC receive callback does. */
+static bool post(const void *data, uint32_t len){
+    UsbMsg *msg;
+
+    if (mail_queue.count == USB_QUEUE_SIZE || len > USB_MSG_BUFFER_SIZE){
+        return false;
+    }
+    msg = &mail_queue.pool[(mail_queue.head + mail_queue.count) % USB_QUEUE_SIZE];
+    memcpy(msg->msg, data, len);
+    msg->len = len;
+    mail_queue.fifo[(mail_queue.head + mail_queue.count) % USB_QUEUE_SIZE] = msg;
+    mail_queue.count++;
+    return true;
+}
+
+/* Posts a packet and runs the USB task once. */
+static void receive(const void *data, uint32_t len){
+    post(data, len);
+    readUsb();
+}
+
+static void receiveStr(const char *str){
+    receive(str, strlen(str));
+}
+
+/* Starts each test case with an empty parser and no calls. */
+static void reset(void){
+    interfaceInit();
+    readUsb();
+    num_calls = 0;
+    command_result = 1;
+    printed[0] = '\0';
+}
+
+/* Appends a BYTES field: its length, as 2 little-endian bytes, then the data */
+static uint32_t putBytes(uint8_t *buf, const void *data, uint16_t len){
+    memcpy(buf, &len, 2);
+    memcpy(buf + 2, data, len);
+    return 2 + len;
+}
+
+/* Appends a FLOAT field, packed as by struct.pack("<f", x) */
+static uint32_t putFloat(uint8_t *buf, float x){
+    memcpy(buf, &x, sizeof(float));
+    return sizeof(float);
+}
+
+static uint32_t putStr(uint8_t *buf, const char *str){
+    memcpy(buf, str, strlen(str));
+    return strlen(str);
+}
+
+/* Receives len bytes without any message start, which the parser discards
+ * as they come. This moves the start of the ring buffer by len bytes. */
+static void receiveGarbage(uint32_t len){
+    static uint8_t garbage[USB_MSG_BUFFER_SIZE];
+    uint32_t chunk;
+
+    memset(garbage, 'x', sizeof(garbage));
+    while (len > 0){
+        chunk = (len > sizeof(garbage)) ? sizeof(garbage) : len;
+        receive(garbage, chunk);
+        len -= chunk;
+    }
+}
+
+/* A C19 message, with binary fields of every kind */
+static uint32_t c19Message(uint8_t *msg){
+    static const uint8_t bias[] = {0x7C, 0x43, '|', '\r', 'C', 0};
+    uint32_t len;
+
+    len = putStr(msg, "C19|2|");
+    len += putFloat(&msg[len], -93.25f);
+    len += putStr(&msg[len], "|");
+    len += putFloat(&msg[len], 0.75f);
+    len += putStr(&msg[len], "|");
+    len += putBytes(&msg[len], bias, sizeof(bias));
+    len += putStr(&msg[len], "\r");
+    return len;
+}
+
+static bool isC19Message(void){
+    const C19Params *p = &last_params.c19;
+
+    return p->profile == 2 && p->fpp_start == -93.25f && p->fpp_step == 0.75f
+        && p->bias.len == 6 && memcmp(p->bias.value, "\x7C\x43|\rC", 6) == 0;
+}
+
+/* Value of field i of a test message of a command. Different for every
+ * field, and with the reserved characters in the byte arrays. */
+static int intValue(int number, int i){
+    return (i % 2 ? -1 : 1) * (1000*number + 37*i);
+}
+
+static void strValue(int number, int i, char *str){
+    sprintf(str, "command %02d, field %d", number, i);
+}
+
+static float floatValue(int number, int i){
+    return -(number + 0.25f*(i + 1));
+}
+
+static uint16_t bytesValue(int number, int i, uint8_t *data){
+    static const uint8_t pattern[] = {'|', '\r', 0, 'C', 0xFF};
+    uint16_t len = 4 + number + i;
+    uint16_t j;
+
+    for (j = 0; j < len; j++){
+        data[j] = (j % 2) ? pattern[(j/2) % sizeof(pattern)] : number + j;
+    }
+    return len;
+}
+
+/* Writes a message of a command with the values above. Only the first
+ * num_fields fields are written, and an extra one if asked. */
+static uint32_t putMessage(uint8_t *msg, const TestSchema *schema,
+                           int num_fields, bool extra){
+    uint8_t data[100];
+    char str[40];
+    uint32_t len;
+    int n = schema->number;
+    int i;
+
+    len = sprintf((char*)msg, "C%02d", n);
+    for (i = 0; i < num_fields; i++){
+        len += putStr(&msg[len], "|");
+        switch (schema->fields[i].type){
+        case INT:
+            len += sprintf((char*)&msg[len], "%d", intValue(n, i));
+            break;
+        case STR:
+            strValue(n, i, str);
+            len += putStr(&msg[len], str);
+            break;
+        case BOOL:
+            len += putStr(&msg[len], (n + i) % 2 ? "1" : "0");
+            break;
+        case FLOAT:
+            len += putFloat(&msg[len], floatValue(n, i));
+            break;
+        case BYTES:
+            len += putBytes(&msg[len], data, bytesValue(n, i, data));
+            break;
+        }
+    }
+    if (extra){
+        len += putStr(&msg[len], "|1");
+    }
+    len += putStr(&msg[len], "\r");
+    return len;
+}
+
+/* Checks the parameters of the last call against the values of putMessage() */
+static void checkFields(const TestSchema *schema){
+    const uint8_t *params = (const uint8_t*) &last_params;
+    const BytesField *bytes;
+    uint8_t data[100];
+    char str[40];
+    uint16_t len;
+    int n = schema->number;
+    int i;
+
+    for (i = 0; i < schema->num_fields; i++){
+        const void *dest = params + schema->fields[i].offset;
+
+        switch (schema->fields[i].type){
+        case INT:
+            CHECK(*(const int*)dest == intValue(n, i), "C%02d field %d: INT %d",
+                  n, i, *(const int*)dest);
+            break;
+        case STR:
+            strValue(n, i, str);
+            CHECK(strcmp(dest, str) == 0, "C%02d field %d: STR '%s'",
+                  n, i, (const char*)dest);
+            break;
+        case BOOL:
+            CHECK(*(const bool*)dest == (n + i) % 2, "C%02d field %d: BOOL", n, i);
+            break;
+        case FLOAT:
+            CHECK(*(const float*)dest == floatValue(n, i), "C%02d field %d: FLOAT %g",
+                  n, i, *(const float*)dest);
+            break;
+        case BYTES:
+            bytes = dest;
+            len = bytesValue(n, i, data);
+            CHECK(bytes->len == len && memcmp(bytes->value, data, len) == 0,
+                  "C%02d field %d: BYTES of %u bytes", n, i, bytes->len);
+            break;
+        }
+    }
+}
+
+/* Test cases ----------------------------------------------------------------*/
+/* Every command goes through with all its fields, and is dropped without
+ * its last field or with one too many. */
+static void testEverySchema(void){
+    uint8_t msg[200];
+    uint32_t len;
+    int n;
+
+    for (n = 0; n < NUM_SCHEMAS; n++){
+        const TestSchema *schema = &test_schemas[n];
+
+        reset();
+        len = putMessage(msg, schema, schema->num_fields, false);
+        receive(msg, len);
+        CHECK(num_calls == 1 && calls[0] == n, "C%02d: %d calls", n, num_calls);
+        checkFields(schema);
+
+        if (schema->num_fields > 0){
+            reset();
+            len = putMessage(msg, schema, schema->num_fields - 1, false);
+            len += putStr(&msg[len], "C01\r");
+            receive(msg, len);
+            CHECK(num_calls == 1 && calls[0] == 1,
+                  "C%02d without its last field: %d calls, first %d",
+                  n, num_calls, calls[0]);
+        }
+
+        reset();
+        len = putMessage(msg, schema, schema->num_fields, true);
+        len += putStr(&msg[len], "C01\r");
+        receive(msg, len);
+        CHECK(num_calls == 1 && calls[0] == 1, "C%02d with an extra field: "
+              "%d calls, first %d", n, num_calls, calls[0]);
+    }
+
+    /* The table above has all the commands */
+    reset();
+    sprintf((char*)msg, "C%02d\r", NUM_SCHEMAS);
+    receiveStr((char*)msg);
+    CHECK(num_calls == 0 && strstr(printed, "Unknown command") != NULL,
+          "C%02d: %d calls", NUM_SCHEMAS, num_calls);
+}
+
+/* C03 has one field of each type. The byte array holds the reserved
+ * characters, which must not end it. */
+static void testAllTypes(void){
+    static const uint8_t data[] = {'|', '\r', 0, 'C', '0', '1', '\r', 0xFF};
+    uint8_t msg[100];
+    uint32_t len = 0;
+    const C03Params *p = &last_params.c03;
+
+    reset();
+    len += putStr(&msg[len], "C03|-42|hello world|1|");
+    len += putFloat(&msg[len], -1.5e-3f);
+    len += putStr(&msg[len], "|");
+    len += putBytes(&msg[len], data, sizeof(data));
+    len += putStr(&msg[len], "\r");
+    receive(msg, len);
+
+    CHECK(num_calls == 1 && calls[0] == 3, "%d calls", num_calls);
+    CHECK(p->test_int == -42, "INT %d", p->test_int);
+    CHECK(strcmp(p->test_str, "hello world") == 0, "STR '%s'", p->test_str);
+    CHECK(p->test_bool, "BOOL");
+    CHECK(p->test_flt == -1.5e-3f, "FLOAT %g", p->test_flt);
+    CHECK(p->test_byte.len == sizeof(data)
+          && memcmp(p->test_byte.value, data, sizeof(data)) == 0,
+          "BYTES of %u bytes", p->test_byte.len);
+
+    /* Values at their limits, and an empty string and byte array */
+    reset();
+    len = putStr(msg, "C03|2147483647||0|");
+    len += putFloat(&msg[len], 3.4e38f);
+    len += putStr(&msg[len], "|");
+    len += putBytes(&msg[len], "", 0);
+    len += putStr(&msg[len], "\r");
+    receive(msg, len);
+
+    CHECK(num_calls == 1 && calls[0] == 3, "%d calls", num_calls);
+    CHECK(p->test_int == 2147483647, "INT %d", p->test_int);
+    CHECK(p->test_str[0] == '\0', "STR '%s'", p->test_str);
+    CHECK(!p->test_bool, "BOOL");
+    CHECK(p->test_flt == 3.4e38f, "FLOAT %g", p->test_flt);
+    CHECK(p->test_byte.len == 0, "BYTES of %u bytes", p->test_byte.len);
+}
+
+static void testFieldOrder(void){
+    uint8_t msg[100];
+    uint32_t len;
+    static const uint8_t bias[] = {1, 0, 2, 0};
+
+    reset();
+    receiveStr("C05|3|0|1|1\r");
+    CHECK(num_calls == 1 && calls[0] == 5, "%d calls", num_calls);
+    CHECK(last_params.c05.target == 3 && !last_params.c05.targ_meas
+          && last_params.c05.ds_twr == 1 && last_params.c05.get_cir,
+          "C05 %d %d %d %d", last_params.c05.target, last_params.c05.targ_meas,
+          last_params.c05.ds_twr, last_params.c05.get_cir);
+
+    reset();
+    len = putStr(msg, "C19|1|");
+    len += putFloat(&msg[len], -95.0f);
+    len += putStr(&msg[len], "|");
+    len += putFloat(&msg[len], 0.5f);
+    len += putStr(&msg[len], "|");
+    len += putBytes(&msg[len], bias, sizeof(bias));
+    len += putStr(&msg[len], "\r");
+    receive(msg, len);
+    CHECK(num_calls == 1 && calls[0] == 19, "%d calls", num_calls);
+    CHECK(last_params.c19.profile == 1 && last_params.c19.fpp_start == -95.0f
+          && last_params.c19.fpp_step == 0.5f && last_params.c19.bias.len == 4,
+          "C19 %d %g %g %u", last_params.c19.profile, last_params.c19.fpp_start,
+          last_params.c19.fpp_step, last_params.c19.bias.len);
+
+    reset();
+    receiveStr("C20|0|16450|-1\r");
+    CHECK(num_calls == 1 && calls[0] == 20, "%d calls", num_calls);
+    CHECK(last_params.c20.profile == 0 && last_params.c20.tx == 16450
+          && last_params.c20.rx == -1, "C20 %d %d %d", last_params.c20.profile,
+          last_params.c20.tx, last_params.c20.rx);
+}
+
+/* A message short of fields is dropped, without swallowing the next one. */
+static void testMissingFields(void){
+    reset();
+    receiveStr("C05|2|1\rC01\r");
+    CHECK(num_calls == 1 && calls[0] == 1, "after a missing field: %d calls, first %d",
+          num_calls, calls[0]);
+
+    reset();
+    receiveStr("C04\rC01\r");
+    CHECK(num_calls == 1 && calls[0] == 1, "without fields: %d calls, first %d",
+          num_calls, calls[0]);
+
+    /* Fields of a command without any */
+    reset();
+    receiveStr("C01|1\rC00\r");
+    CHECK(num_calls == 1 && calls[0] == 0, "extra field: %d calls, first %d",
+          num_calls, calls[0]);
+
+    /* Only complete once the terminator is in */
+    reset();
+    receiveStr("C04|1");
+    CHECK(num_calls == 0, "unterminated: %d calls", num_calls);
+    receiveStr("\r");
+    CHECK(num_calls == 1 && calls[0] == 4 && last_params.c04.toggle,
+          "terminated: %d calls", num_calls);
+}
+
+static void testOverlong(void){
+    char msg[COMMAND_MAX_STR_LEN + 50];
+    uint32_t len;
+    const C03Params *p = &last_params.c03;
+
+    /* Strings longer than their field are truncated */
+    reset();
+    len = putStr((uint8_t*)msg, "C03|1|");
+    memset(&msg[len], 'x', COMMAND_MAX_STR_LEN + 10);
+    len += COMMAND_MAX_STR_LEN + 10;
+    len += putStr((uint8_t*)&msg[len], "|1|");
+    len += putFloat((uint8_t*)&msg[len], 1.0f);
+    len += putStr((uint8_t*)&msg[len], "|");
+    len += putBytes((uint8_t*)&msg[len], "ab", 2);
+    len += putStr((uint8_t*)&msg[len], "\r");
+    receive(msg, len);
+    CHECK(num_calls == 1 && calls[0] == 3, "%d calls", num_calls);
+    CHECK(strlen(p->test_str) == COMMAND_MAX_STR_LEN - 1, "STR of %zu chars",
+          strlen(p->test_str));
+    CHECK(p->test_bool && p->test_flt == 1.0f && p->test_byte.len == 2,
+          "fields after the string");
+}
+
+static void testInvalid(void){
+    reset();
+    receiveStr("garbage C99\rCx1\rC0\rC01\r");
+    CHECK(num_calls == 1 && calls[0] == 1, "%d calls, first %d", num_calls, calls[0]);
+
+    reset();
+    receiveStr("C99\r");
+    CHECK(num_calls == 0 && strstr(printed, "Unknown command") != NULL,
+          "unknown command: %d calls, printed '%s'", num_calls, printed);
+}
+
+/* A command split in two packets at every position, with the second half
+ * arriving after the first was parsed. */
+static void testSplit(void){
+    uint8_t msg[100];
+    uint32_t len = c19Message(msg);
+    uint32_t i;
+
+    for (i = 1; i < len; i++){
+        reset();
+        receive(msg, i);
+        CHECK(num_calls == 0, "first %u bytes: %d calls", i, num_calls);
+        receive(&msg[i], len - i);
+        CHECK(num_calls == 1 && calls[0] == 19 && isC19Message(),
+              "split after %u bytes: %d calls", i, num_calls);
+    }
+
+    /* One byte per packet */
+    reset();
+    for (i = 0; i < len; i++){
+        receive(&msg[i], 1);
+    }
+    CHECK(num_calls == 1 && calls[0] == 19 && isC19Message(),
+          "one byte per packet: %d calls", num_calls);
+}
+
+/* A command across the end of the ring buffer, starting at every position
+ * before it. */
+static void testWrap(void){
+    uint8_t msg[100];
+    uint32_t len = c19Message(msg);
+    uint32_t i;
+
+    for (i = 1; i <= len; i++){
+        reset();
+        receiveGarbage(USB_BUFFER_SIZE - i);
+        receive(msg, len/2);
+        receive(&msg[len/2], len - len/2);
+        CHECK(num_calls == 1 && calls[0] == 19 && isC19Message(),
+              "%u bytes before the wrap: %d calls", i, num_calls);
+    }
+}
+
+/* Several commands in one packet run in order, also when the first has to be
+ * retried, which holds back the others. */
+static void testSeveral(void){
+    uint8_t msg[200];
+    uint32_t len;
+
+    reset();
+    len = putStr(msg, "C01\rC04|0\r");
+    len += c19Message(&msg[len]);
+    len += putStr(&msg[len], "C00\r");
+    receive(msg, len);
+    CHECK(num_calls == 4 && calls[0] == 1 && calls[1] == 4 && calls[2] == 19
+          && calls[3] == 0, "%d calls", num_calls);
+
+    reset();
+    command_result = 0;
+    receiveStr("C01\rC04|1\rC00\r");
+    CHECK(num_calls == 1 && calls[0] == 1, "failed once: %d calls", num_calls);
+    command_result = 1;
+    readUsb();
+    CHECK(num_calls == 4 && calls[1] == 1 && calls[2] == 4 && calls[3] == 0,
+          "retried: %d calls", num_calls);
+
+    /* Given up on after MAX_COMMAND_RETRIES, the next one runs */
+    reset();
+    command_result = 0;
+    receiveStr("C01\rC00\r");
+    while (num_calls < MAX_COMMAND_RETRIES + 1){
+        readUsb();
+    }
+    command_result = 1;
+    readUsb();
+    CHECK(num_calls == MAX_COMMAND_RETRIES + 2 && calls[MAX_COMMAND_RETRIES + 1] == 0,
+          "given up: %d calls", num_calls);
+}
+
+/* Byte arrays longer than their field are dropped as they arrive, rather
+ * than waited for. */
+static void testBytesLength(void){
+    static const uint16_t lengths[] = {COMMAND_MAX_BYTES_LEN + 1, 5000, 0xFFFF};
+    static uint8_t msg[4 + 2 + COMMAND_MAX_BYTES_LEN + 1];
+    uint16_t longest = COMMAND_MAX_BYTES_LEN;
+    uint32_t len;
+    unsigned i;
+
+    for (i = 0; i < sizeof(lengths)/sizeof(lengths[0]); i++){
+        reset();
+        len = putStr(msg, "C06|");
+        memcpy(&msg[len], &lengths[i], 2);
+        len += 2;
+        receive(msg, len);
+        CHECK(strstr(printed, "Invalid byte array length") != NULL,
+              "length %u: printed '%s'", lengths[i], printed);
+        receiveStr("C01\r");
+        CHECK(num_calls == 1 && calls[0] == 1, "length %u: %d calls",
+              lengths[i], num_calls);
+    }
+
+    /* The longest byte array, across the wrap */
+    reset();
+    receiveGarbage(USB_BUFFER_SIZE - 10);
+    len = putStr(msg, "C06|");
+    memcpy(&msg[len], &longest, 2);
+    len += 2;
+    memset(&msg[len], 'b', longest);
+    len += longest;
+    len += putStr(&msg[len], "\r");
+    receive(msg, 500);
+    receive(&msg[500], len - 500);
+    CHECK(num_calls == 1 && calls[0] == 6
+          && last_params.c06.data.len == COMMAND_MAX_BYTES_LEN,
+          "longest byte array: %d calls", num_calls);
+}
+
+/* Input that does not fit in the ring buffer is rejected. The message it
+ * belonged to can then never be completed, and must not take the commands
+ * sent after it as its missing fields. */
+static void testOverflow(void){
+    static uint8_t garbage[USB_MSG_BUFFER_SIZE];
+    int i;
+
+    reset();
+    memset(garbage, 'x', sizeof(garbage));
+
+    /* The retried command keeps the partial message after it in the buffer
+       while it fills up */
+    command_result = 0;
+    receiveStr("C04|1\rC05|2|0|");
+    for (i = 0; i < USB_QUEUE_SIZE; i++){
+        post(garbage, sizeof(garbage));
+    }
+    command_result = 1;
+    readUsb();
+    CHECK(num_calls == 2 && calls[1] == 4, "retried: %d calls", num_calls);
+    CHECK(strstr(printed, "Discarding") != NULL, "printed '%s'", printed);
+
+    receiveStr("C01\r");
+    CHECK(num_calls == 3 && calls[2] == 1, "after the overflow: %d calls", num_calls);
+}
+
+/* Reference: the linear buffer of usb_interface.c before the ring buffer ----*/
+/* Its loadBuffer(), slideBuffer(), readUsb() and parseMessage(), as they
+ * were, with the schemas above. Every message is consumed by sliding the
+ * rest of the buffer up, and searched for with strchr() and memchr() over
+ * the whole buffer. It only works on whole messages, and only ran the last
+ * one of the buffer: here it runs them all, as the ring buffer does. */
+static uint8_t slide_rx_buffer[USB_BUFFER_SIZE];
+static uint32_t slide_buffer_len;
+static uint8_t slide_temp_buffer[USB_BUFFER_SIZE];
+static CommandParams slide_params;
+
+static void slideInit(void){
+    memset(slide_rx_buffer, 0, USB_BUFFER_SIZE);
+    slide_buffer_len = 0;
+}
+
+static void slideLoadBuffer(void){
+    osEvent evt;
+    UsbMsg *msg_ptr;
+
+    evt = osMailGet(&mail_queue, 0);
+    while (evt.status == osEventMail){
+        msg_ptr = evt.value.p;
+
+        if (slide_buffer_len + msg_ptr->len > USB_BUFFER_SIZE){
+            usb_print("USB Buffer full! Message rejected to prevent overflow.");
+            osMailFree(&mail_queue, msg_ptr);
+            break;
+        }
+        memcpy(slide_rx_buffer + slide_buffer_len, msg_ptr->msg, msg_ptr->len);
+        slide_buffer_len += msg_ptr->len;
+        osMailFree(&mail_queue, msg_ptr);
+        evt = osMailGet(&mail_queue, 0);
+    }
+}
+
+static void slideBuffer(uint8_t *idx){
+    uint8_t len = idx - &slide_rx_buffer[0] + 1;
+
+    memcpy(slide_temp_buffer, slide_rx_buffer + len, slide_buffer_len - len);
+    memset(slide_rx_buffer, 0, slide_buffer_len);
+    memcpy(slide_rx_buffer, slide_temp_buffer, slide_buffer_len - len);
+    slide_buffer_len -= len;
+}
+
+static char *slideGetNextKeyChar(char *msg){
+    char *next_sep_pt = strchr(msg, '|');
+    char *next_end_pt = strchr(msg, '\r');
+
+    if (next_sep_pt == NULL){
+        return next_end_pt;
+    }
+    if (next_end_pt == NULL || next_sep_pt < next_end_pt){
+        return next_sep_pt;
+    }
+    return next_end_pt;
+}
+
+/* Returns the last character of the message, and its command number in
+ * number, or -1. */
+static char *slideParseMessage(char *msg, int *number){
+    const TestSchema *schema;
+    char *current_pt = msg;
+    char *next_pt;
+    uint8_t *dest;
+    uint16_t len;
+    int i;
+
+    if (current_pt[1] < '0' || current_pt[1] > '9'
+        || current_pt[2] < '0' || current_pt[2] > '9'){
+        *number = -1;
+        return current_pt;
+    }
+    *number = (current_pt[1] - '0')*10 + (current_pt[2] - '0');
+    if (*number >= NUM_SCHEMAS){
+        *number = -1;
+        return current_pt + 2;
+    }
+    schema = &test_schemas[*number];
+    current_pt += 3;
+
+    slideLoadBuffer();
+    for (i = 0; i < schema->num_fields; ++i){
+        dest = (uint8_t*) &slide_params + schema->fields[i].offset;
+        current_pt += 1;
+
+        switch (schema->fields[i].type){
+        case INT:
+            next_pt = slideGetNextKeyChar(current_pt);
+            if (next_pt == NULL){
+                return current_pt;
+            }
+            *(int*) dest = (int) strtol(current_pt, NULL, 10);
+            current_pt = next_pt;
+            break;
+        case STR:
+            next_pt = slideGetNextKeyChar(current_pt);
+            if (next_pt == NULL){
+                return current_pt;
+            }
+            len = next_pt - current_pt;
+            if (len > COMMAND_MAX_STR_LEN - 1){
+                len = COMMAND_MAX_STR_LEN - 1;
+            }
+            memcpy(dest, current_pt, len);
+            dest[len] = '\0';
+            current_pt = next_pt;
+            break;
+        case BOOL:
+            next_pt = slideGetNextKeyChar(current_pt);
+            if (next_pt == NULL){
+                return current_pt;
+            }
+            *(bool*) dest = strtol(current_pt, NULL, 10) != 0;
+            current_pt = next_pt;
+            break;
+        case FLOAT:
+            memcpy(dest, current_pt, sizeof(float));
+            current_pt += sizeof(float);
+            break;
+        case BYTES:
+        {
+            BytesField *field = (BytesField*) dest;
+            memcpy(&len, current_pt, sizeof(len));
+            current_pt += 2;
+            field->len = (len > COMMAND_MAX_BYTES_LEN) ? COMMAND_MAX_BYTES_LEN : len;
+            memcpy(field->value, current_pt, field->len);
+            current_pt += len;
+            break;
+        }
+        }
+    }
+
+    next_pt = strchr(current_pt, '\r');
+    return (next_pt == NULL) ? current_pt : next_pt;
+}
+
+static void slideReadUsb(void){
+    decaIrqStatus_t stat;
+    uint8_t *msg_start;
+    char *msg_end;
+    int number;
+
+    stat = decamutexon();
+    slideLoadBuffer();
+
+    msg_start = memchr(slide_rx_buffer, 'C', USB_BUFFER_SIZE);
+    while (msg_start != NULL){
+        msg_end = slideParseMessage((char*) msg_start, &number);
+        if (*msg_end != '\r'){
+            slideBuffer((uint8_t*) msg_end);
+            break;
+        }
+        slideBuffer((uint8_t*) msg_end);
+        if (number >= 0){
+            commandCalled(number, &slide_params);
+        }
+        msg_start = memchr(slide_rx_buffer, 'C', USB_BUFFER_SIZE);
+    }
+    decamutexoff(stat);
+}
+
+/* Benchmarks ----------------------------------------------------------------*/
+static double now(void){
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + 1e-9*t.tv_nsec;
+}
+
+/* Fills a packet with as many copies of a message as fit. */
+static uint32_t fillPacket(uint8_t *packet, const uint8_t *msg, uint32_t len){
+    uint32_t packet_len = 0;
+
+    while (packet_len + len <= USB_MSG_BUFFER_SIZE){
+        memcpy(&packet[packet_len], msg, len);
+        packet_len += len;
+    }
+    return packet_len;
+}
+
+/* Streams of back-to-back copies of the test message of each command, in
+ * full packets, as a host pipelining commands sends them. The USB task runs
+ * once the mail queue is full. Prints the time per command. */
+static void benchEverySchema(void){
+    static uint8_t packet[USB_MSG_BUFFER_SIZE];
+    uint8_t msg[200];
+    uint32_t len, packet_len;
+    int per_packet;
+    double start, elapsed;
+    int n, i, j;
+
+    for (n = 0; n < NUM_SCHEMAS; n++){
+        len = putMessage(msg, &test_schemas[n], test_schemas[n].num_fields, false);
+        packet_len = fillPacket(packet, msg, len);
+        per_packet = packet_len / len;
+
+        reset();
+        start = now();
+        for (i = 0; i < BENCH_PACKETS/USB_QUEUE_SIZE; i++){
+            for (j = 0; j < USB_QUEUE_SIZE; j++){
+                post(packet, packet_len);
+            }
+            readUsb();
+        }
+        elapsed = now() - start;
+
+        CHECK(num_calls == (BENCH_PACKETS/USB_QUEUE_SIZE)*USB_QUEUE_SIZE*per_packet,
+              "C%02d: %d calls", n, num_calls);
+        printf("  C%02d, %3u bytes: %6.1f ns per command\n", n, len,
+               1e9*elapsed/num_calls);
+    }
+}
+
+/* Times about BENCH_PACKETS packets, the given ones over and over, through
+ * the ring buffer or the reference. The USB task runs whenever queued
+ * packets are waiting. Returns the time per command in ns. */
+static double benchStream(bool ring, const uint8_t *packets,
+                          const uint32_t *packet_lens, int num_packets,
+                          int num_commands, uint32_t queued){
+    void (*read)(void) = ring ? readUsb : slideReadUsb;
+    int rounds = BENCH_PACKETS/num_packets;
+    uint32_t offset;
+    double start, elapsed;
+    int i, j;
+
+    reset();
+    slideInit();
+    start = now();
+    for (i = 0; i < rounds; i++){
+        offset = 0;
+        for (j = 0; j < num_packets; j++){
+            post(&packets[offset], packet_lens[j]);
+            offset += packet_lens[j];
+            if (mail_queue.count == queued){
+                read();
+            }
+        }
+    }
+    read();
+    elapsed = now() - start;
+
+    num_commands *= rounds;
+    CHECK(num_calls == num_commands, "%s: %d calls out of %d",
+          ring ? "ring buffer" : "reference", num_calls, num_commands);
+    return 1e9*elapsed/num_calls;
+}
+
+/* The test messages of all the commands, in turn, one per packet and then
+ * in packets as full as whole messages allow, since the reference cannot
+ * assemble messages split across packets. The USB task runs after each
+ * packet, as when it keeps up with the host, or after a full mail queue. */
+static void benchSlideBuffer(void){
+    static uint8_t stream[NUM_SCHEMAS*200];
+    static uint8_t packet[USB_MSG_BUFFER_SIZE];
+    uint32_t lens[NUM_SCHEMAS];
+    uint32_t len = 0;
+    uint32_t packet_len = 0;
+    int num_commands = 0;
+    double ring, slide;
+    int n;
+
+    for (n = 0; n < NUM_SCHEMAS; n++){
+        lens[n] = putMessage(&stream[len], &test_schemas[n],
+                             test_schemas[n].num_fields, false);
+        len += lens[n];
+    }
+    ring = benchStream(true, stream, lens, NUM_SCHEMAS, NUM_SCHEMAS, 1);
+    slide = benchStream(false, stream, lens, NUM_SCHEMAS, NUM_SCHEMAS, 1);
+    printf("  one command per packet, one packet per call:  %6.1f ns per "
+           "command, %6.1f with slideBuffer()\n", ring, slide);
+
+    ring = benchStream(true, stream, lens, NUM_SCHEMAS, NUM_SCHEMAS, USB_QUEUE_SIZE);
+    slide = benchStream(false, stream, lens, NUM_SCHEMAS, NUM_SCHEMAS, USB_QUEUE_SIZE);
+    printf("  one command per packet, full queue per call:  %6.1f ns per "
+           "command, %6.1f with slideBuffer()\n", ring, slide);
+
+    /* A packet of the same messages, in turn, up to the last that fits */
+    len = 0;
+    n = 0;
+    while (packet_len + lens[n] <= USB_MSG_BUFFER_SIZE){
+        memcpy(&packet[packet_len], &stream[len], lens[n]);
+        packet_len += lens[n];
+        len += lens[n];
+        num_commands++;
+        if (++n == NUM_SCHEMAS){
+            n = 0;
+            len = 0;
+        }
+    }
+    ring = benchStream(true, packet, &packet_len, 1, num_commands, USB_QUEUE_SIZE);
+    slide = benchStream(false, packet, &packet_len, 1, num_commands, USB_QUEUE_SIZE);
+    printf("  full packets, full queue per call:            %6.1f ns per "
+           "command, %6.1f with slideBuffer()\n", ring, slide);
+}
+
+/* Main ----------------------------------------------------------------------*/
+int main(void){
+    testEverySchema();
+    testAllTypes();
+    testFieldOrder();
+    testMissingFields();
+    testOverlong();
+    testInvalid();
+
+    testSplit();
+    testWrap();
+    testSeveral();
+    testBytesLength();
+    testOverflow();
+
+    printf("parser, streams of back-to-back commands:\n");
+    benchEverySchema();
+    printf("ring buffer against the linear buffer it replaced:\n");
+    benchSlideBuffer();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,92 @@
+# Summary of the RAM taken by each part of the firmware, from the link map
+# of GNU ld (-Wl,-Map). Only the input sections kept in .data, .bss, .ccmram
+# and ._user_heap_stack (the main stack and the newlib heap) are counted.
+#
+#   awk -v groups="core:ranging.o,tdma.o;utils:common.o" -f memmap.awk firmware.map
+#
+# groups is a ";"-separated list of name:object,object,... Objects of no group
+# are counted as "other", and archive members as "libc".
+
+function hex(s,    i, c, v){
+    v = 0
+    s = tolower(s)
+    sub(/^0x/, "", s)
+    for (i = 1; i <= length(s); i++){
+        c = index("0123456789abcdef", substr(s, i, 1))
+        v = v*16 + c - 1
+    }
+    return v
+}
+
+function count(size, file,    name){
+    if (file ~ /\.a\(/){
+        name = "libc"
+    }
+    else{
+        sub(/.*\//, "", file)
+        name = (file in group_of) ? group_of[file] : "other"
+    }
+    used[name] += size
+    total += size
+}
+
+BEGIN {
+    num_groups = split(groups, list, ";")
+    for (i = 1; i <= num_groups; i++){
+        gsub(/^ +| +$/, "", list[i])
+        split(list[i], g, ":")
+        order[i] = g[1]
+        n = split(g[2], objs, ",")
+        for (j = 1; j <= n; j++){
+            group_of[objs[j]] = g[1]
+        }
+    }
+    order[++num_groups] = "libc"
+    order[++num_groups] = "other"
+}
+
+/^Memory Configuration/ { in_memory = 1; next }
+/^Linker script and memory map/ { in_memory = 0; in_map = 1; next }
+
+in_memory && ($1 == "RAM" || $1 == "CCMRAM") { length_of[$1] = hex($3); next }
+
+!in_map { next }
+
+# Output sections start in the first column, with their address and size on
+# the same line or on the next one
+/^[^ ]/ {
+    section = $1
+    pending = ""
+    if (section == "._user_heap_stack" && NF >= 3){
+        stack_heap = hex($3)
+    }
+    next
+}
+
+# The main stack and the newlib heap are reserved by the linker script itself
+section == "._user_heap_stack" && NF == 2 && $1 ~ /^0x/ && $2 ~ /^0x/ {
+    if (stack_heap == 0){
+        stack_heap = hex($2)
+    }
+    next
+}
+
+section != ".data" && section != ".bss" && section != ".ccmram" { next }
+
+# Input section, on one line or with its name alone on the line before
+($1 ~ /^\./ || $1 == "COMMON") && NF == 1 { pending = $1; next }
+($1 ~ /^\./ || $1 == "COMMON") && NF >= 4 && $2 ~ /^0x/ { count(hex($3), $4); pending = ""; next }
+pending != "" && NF >= 3 && $1 ~ /^0x/ && $2 ~ /^0x/ { count(hex($2), $3); pending = ""; next }
+{ pending = "" }
+
+END {
+    printf "RAM by part, in bytes:\n"
+    for (i = 1; i <= num_groups; i++){
+        if (used[order[i]] > 0){
+            printf "  %-12s %7d\n", order[i], used[order[i]]
+        }
+    }
+    printf "  %-12s %7d\n", "stack+heap", stack_heap
+    printf "  %-12s %7d of %d (RAM) + %d (CCMRAM)\n", "total", total + stack_heap,
+           length_of["RAM"], length_of["CCMRAM"]
+}